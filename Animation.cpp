@@ -0,0 +1,107 @@
+#include "Animation.h"
+#include <algorithm>
+#include <chrono>
+#include "SceneLoader.h"
+
+namespace {
+
+// Tracks posed per task; enough to amortize the dispatch, few enough to spread over the workers.
+constexpr size_t POSE_CHUNK = 16384;
+
+bool same_vec(const Vec3& a, const Vec3& b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void run(const ParallelFor& parallel, int count, const std::function<void(int)>& task) {
+    if (parallel) parallel(count, task);
+    else for (int i = 0; i < count; ++i) task(i);
+}
+
+// Poses every track over the workers; with `patch_store`, the brute-force SIMD store too.
+void pose_tracks(Scene& scene, double time, bool patch_store, const ParallelFor& parallel) {
+    const std::vector<SphereTrack>& tracks = scene.animation.tracks;
+    const int chunks = static_cast<int>((tracks.size() + POSE_CHUNK - 1) / POSE_CHUNK);
+    // Taken before the workers start: a mapped scene's spheres get their own copy here, once, and
+    // only when something moves.
+    Sphere* objects = tracks.empty() ? nullptr : scene.objects.mutable_data();
+    run(parallel, chunks, [&](int chunk) {
+        const size_t end = std::min(tracks.size(), (chunk + 1) * POSE_CHUNK);
+        for (size_t t = chunk * POSE_CHUNK; t < end; ++t) {
+            const SphereTrack& track = tracks[t];
+            const Sphere pose = pose_sphere(scene.animation, track, time);
+            objects[track.sphere] = pose;
+            if (!patch_store) continue;
+            if (scene.precision == Precision::Float) scene.sphere_soa_f.update(track.sphere, pose);
+            else scene.sphere_soa.update(track.sphere, pose);
+        }
+        });
+    scene.animation.time = time;
+}
+
+} // namespace
+
+bool same_animation(const SceneAnimation& a, const SceneAnimation& b) {
+    if (a.tracks.size() != b.tracks.size() || a.keys.size() != b.keys.size()) return false;
+    for (size_t i = 0; i < a.tracks.size(); ++i) {
+        const SphereTrack& x = a.tracks[i];
+        const SphereTrack& y = b.tracks[i];
+        if (x.sphere != y.sphere || x.first_key != y.first_key || x.key_count != y.key_count || !same_vec(x.rest.center, y.rest.center) ||
+            x.rest.radius != y.rest.radius || !same_vec(x.velocity, y.velocity)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < a.keys.size(); ++i) {
+        const SphereKeyframe& x = a.keys[i];
+        const SphereKeyframe& y = b.keys[i];
+        if (x.time != y.time || !same_vec(x.center, y.center) || x.radius != y.radius) return false;
+    }
+    return true;
+}
+
+Sphere pose_sphere(const SceneAnimation& animation, const SphereTrack& track, double time) {
+    if (track.key_count == 0) return Sphere(track.rest.center + track.velocity * time, track.rest.radius);
+    if (time <= 0.0) return track.rest;
+    const SphereKeyframe* first = animation.keys.data() + track.first_key;
+    const SphereKeyframe* last = first + track.key_count;
+    const SphereKeyframe* next = std::upper_bound(first, last, time,
+        [](double t, const SphereKeyframe& key) { return t < key.time; });
+    if (next == last) return Sphere(last[-1].center, last[-1].radius);
+    // The rest pose is the key at time 0.
+    const double previous_time = next == first ? 0.0 : next[-1].time;
+    const Vec3 previous_center = next == first ? track.rest.center : next[-1].center;
+    const double previous_radius = next == first ? track.rest.radius : next[-1].radius;
+    const double a = (time - previous_time) / (next->time - previous_time);
+    return Sphere(previous_center + (next->center - previous_center) * a, previous_radius + (next->radius - previous_radius) * a);
+}
+
+void pose_scene(Scene& scene, double time, const ParallelFor& parallel) {
+    pose_tracks(scene, time, false, parallel);
+}
+
+AnimationUpdate animate_scene(Scene& scene, double time, const AnimationSettings& settings, const ParallelFor& parallel) {
+    AnimationUpdate update;
+    if (scene.animation.empty()) return update;
+    update.spheres_posed = static_cast<uint32_t>(scene.animation.tracks.size());
+    const bool brute_force = scene.bvh.empty();
+    auto pose_start = std::chrono::steady_clock::now();
+    pose_tracks(scene, time, brute_force, parallel);
+    update.pose_ms = elapsed_ms(pose_start);
+    if (brute_force) return update;
+
+    auto refit_start = std::chrono::steady_clock::now();
+    const double sah_cost = scene.bvh.refit(scene.objects, parallel);
+    update.refit_ms = elapsed_ms(refit_start);
+    const double built_cost = scene.bvh.build_stats().sah_cost;
+    update.sah_growth = built_cost > 0.0 ? sah_cost / built_cost : 1.0;
+    if (update.sah_growth > settings.rebuild_threshold) {
+        auto rebuild_start = std::chrono::steady_clock::now();
+        build_acceleration(scene, true, scene.precision);
+        update.rebuild_ms = elapsed_ms(rebuild_start);
+        update.rebuilt = true;
+    }
+    return update;
+}
@@ -0,0 +1,68 @@
+#pragma once
+// Sphere animation. A sphere's line in the scene file is its pose at time 0; from there it either
+// moves at a constant velocity (particles, simulation output) or follows keyframes, interpolated
+// linearly and held after the last one. Every frame, animate_scene() poses the animated spheres at
+// the frame's time and refits the acceleration structures to them on the render workers. The BVH
+// keeps its topology while it does, until moving spheres have stretched its boxes so far apart
+// that its SAH cost passes a threshold over the cost it was built with; only then is it rebuilt.
+#include <cstdint>
+#include <vector>
+#include "BVH.h"
+
+struct Scene;
+
+struct SphereKeyframe {
+    double time;  // Seconds; increasing along a track, all after 0
+    Vec3 center;
+    double radius;
+};
+
+struct SphereTrack {
+    uint32_t sphere = 0;               // Index into Scene::objects
+    uint32_t first_key = 0;            // Into SceneAnimation::keys
+    uint32_t key_count = 0;            // 0 = moves at `velocity`
+    Sphere rest = Sphere(Vec3(), 0.0); // Pose at time 0, as the scene file has it
+    Vec3 velocity;
+};
+
+struct SceneAnimation {
+    std::vector<SphereTrack> tracks; // Ascending sphere index
+    std::vector<SphereKeyframe> keys;
+    double time = 0.0;               // What Scene::objects are posed at
+
+    bool empty() const { return tracks.empty(); }
+    void clear() {
+        tracks.clear();
+        keys.clear();
+        time = 0.0;
+    }
+};
+
+// Same tracks and keyframes, at whatever time.
+bool same_animation(const SceneAnimation& a, const SceneAnimation& b);
+
+// The track's pose `time` seconds in.
+Sphere pose_sphere(const SceneAnimation& animation, const SphereTrack& track, double time);
+
+struct AnimationSettings {
+    double rebuild_threshold = 1.5; // Rebuild once the refit BVH's SAH cost is this many times its built cost
+};
+
+// What one animate_scene() call did.
+struct AnimationUpdate {
+    uint32_t spheres_posed = 0;
+    double pose_ms = 0.0;    // Evaluating the tracks into Scene::objects (and the brute-force store)
+    double refit_ms = 0.0;
+    bool rebuilt = false;
+    double rebuild_ms = 0.0;
+    double sah_growth = 1.0; // Refit SAH cost over the built one, before any rebuild
+};
+
+// Writes the animated spheres' poses at `time` into Scene::objects only; the acceleration
+// structures are left for the caller to build.
+void pose_scene(Scene& scene, double time, const ParallelFor& parallel = nullptr);
+// Poses the scene at `time` and brings its acceleration structures along: patches the brute-force
+// store, or refits the BVH and rebuilds it when the refit degraded it past the threshold. Must
+// not run while a frame is rendering the scene.
+AnimationUpdate animate_scene(Scene& scene, double time, const AnimationSettings& settings = AnimationSettings(),
+    const ParallelFor& parallel = nullptr);
@@ -0,0 +1,472 @@
+#include "BVH.h"
+#include <chrono>
+#include <cmath>
+#include <deque>
+
+namespace {
+
+constexpr double SAH_TRAVERSAL_COST = 1.0;
+constexpr double SAH_INTERSECTION_COST = 1.0;
+// Below this depth the SAH is trusted; deeper subtrees are split by median to bound the traversal stack.
+constexpr uint32_t FORCE_MEDIAN_DEPTH = 64;
+
+inline double axis_value(const Vec3& v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+template <typename T>
+inline bool ray_box(const BVHNodeT<T>& node, const Vec3T<T>& origin, const Vec3T<T>& inv_dir, T t_min, T t_max, T& t_entry) {
+    T tx1 = (node.bounds_min[0] - origin.x) * inv_dir.x;
+    T tx2 = (node.bounds_max[0] - origin.x) * inv_dir.x;
+    T t_near = std::min(tx1, tx2);
+    T t_far = std::max(tx1, tx2);
+    T ty1 = (node.bounds_min[1] - origin.y) * inv_dir.y;
+    T ty2 = (node.bounds_max[1] - origin.y) * inv_dir.y;
+    t_near = std::max(t_near, std::min(ty1, ty2));
+    t_far = std::min(t_far, std::max(ty1, ty2));
+    T tz1 = (node.bounds_min[2] - origin.z) * inv_dir.z;
+    T tz2 = (node.bounds_max[2] - origin.z) * inv_dir.z;
+    t_near = std::max(t_near, std::min(tz1, tz2));
+    t_far = std::min(t_far, std::max(tz1, tz2));
+    t_entry = std::max(t_near, t_min);
+    return t_entry <= std::min(t_far, t_max);
+}
+
+void set_node_bounds(BVHNode& node, const AABB& box) {
+    node.bounds_min[0] = box.min_corner.x;
+    node.bounds_min[1] = box.min_corner.y;
+    node.bounds_min[2] = box.min_corner.z;
+    node.bounds_max[0] = box.max_corner.x;
+    node.bounds_max[1] = box.max_corner.y;
+    node.bounds_max[2] = box.max_corner.z;
+}
+
+// Float nodes must still contain every sphere: round each bound away from the box.
+void set_float_node(BVHNodeF& out, const BVHNode& node) {
+    for (int axis = 0; axis < 3; ++axis) {
+        float lo = static_cast<float>(node.bounds_min[axis]);
+        float hi = static_cast<float>(node.bounds_max[axis]);
+        out.bounds_min[axis] = lo > node.bounds_min[axis] ? std::nextafter(lo, -std::numeric_limits<float>::infinity()) : lo;
+        out.bounds_max[axis] = hi < node.bounds_max[axis] ? std::nextafter(hi, std::numeric_limits<float>::infinity()) : hi;
+    }
+    out.right_or_first = node.right_or_first;
+    out.prim_count = node.prim_count;
+}
+
+// Squared distance from a point to the closest point of a node's box (0 when inside).
+template <typename T>
+inline double box_distance_sq(const BVHNodeT<T>& node, const Vec3& p) {
+    double dx = std::max({ node.bounds_min[0] - p.x, 0.0, p.x - node.bounds_max[0] });
+    double dy = std::max({ node.bounds_min[1] - p.y, 0.0, p.y - node.bounds_max[1] });
+    double dz = std::max({ node.bounds_min[2] - p.z, 0.0, p.z - node.bounds_max[2] });
+    return dx * dx + dy * dy + dz * dz;
+}
+
+AABB node_bounds(const BVHNode& node) {
+    AABB box;
+    box.min_corner = Vec3(node.bounds_min[0], node.bounds_min[1], node.bounds_min[2]);
+    box.max_corner = Vec3(node.bounds_max[0], node.bounds_max[1], node.bounds_max[2]);
+    return box;
+}
+
+} // namespace
+
+void BVH::clear() {
+    nodes.clear();
+    prim_indices.clear();
+    leaf_geometry.clear();
+    nodes_f.clear();
+    leaf_geometry_f.clear();
+    stats = BVHBuildStats();
+}
+
+void BVH::build(std::span<const Sphere> spheres, Precision precision) {
+    auto build_start = std::chrono::steady_clock::now();
+    clear();
+    if (spheres.empty()) {
+        return;
+    }
+
+    std::vector<BuildPrimitive> prims(spheres.size());
+    prim_indices.resize(spheres.size());
+    for (size_t i = 0; i < spheres.size(); ++i) {
+        prims[i].bounds = sphere_bounds(spheres[i]);
+        prims[i].centroid = spheres[i].center;
+        prim_indices[i] = static_cast<uint32_t>(i);
+    }
+    nodes.reserve(spheres.size() * 2 / MAX_LEAF_SIZE + 16);
+    build_recursive(prims, 0, static_cast<uint32_t>(spheres.size()), 0);
+    nodes.shrink_to_fit();
+    if (precision == Precision::Float) {
+        nodes_f.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            set_float_node(nodes_f[i], nodes[i]);
+        }
+        leaf_geometry_f.build(spheres, &prim_indices);
+    }
+    else {
+        leaf_geometry.build(spheres, &prim_indices);
+    }
+
+    // Expected cost of a random ray through the tree, in units of one sphere test.
+    double root_area = node_bounds(nodes[0]).surface_area();
+    double sah = 0.0;
+    for (const BVHNode& node : nodes) {
+        double relative_area = root_area > 0.0 ? node_bounds(node).surface_area() / root_area : 1.0;
+        sah += relative_area * (node.is_leaf() ? SAH_INTERSECTION_COST * node.prim_count : SAH_TRAVERSAL_COST);
+    }
+    stats.sah_cost = sah;
+    stats.node_count = static_cast<uint32_t>(nodes.size());
+    stats.build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_start).count();
+}
+
+double BVH::refit_node(uint32_t index, std::span<const Sphere> spheres) {
+    BVHNode& node = nodes[index];
+    AABB box;
+    double cost = SAH_TRAVERSAL_COST;
+    if (node.is_leaf()) {
+        const uint32_t end = node.right_or_first + node.prim_count;
+        for (uint32_t k = node.right_or_first; k < end; ++k) {
+            const Sphere& sphere = spheres[prim_indices[k]];
+            box.grow(sphere_bounds(sphere));
+            if (has_float_nodes()) leaf_geometry_f.update(k, sphere);
+            else leaf_geometry.update(k, sphere);
+        }
+        cost = SAH_INTERSECTION_COST * node.prim_count;
+    }
+    else {
+        box = node_bounds(nodes[index + 1]);
+        box.grow(node_bounds(nodes[node.right_or_first]));
+    }
+    set_node_bounds(node, box);
+    if (has_float_nodes()) set_float_node(nodes_f[index], node);
+    return box.surface_area() * cost;
+}
+
+double BVH::refit(std::span<const Sphere> spheres, const ParallelFor& parallel) {
+    if (nodes.empty()) return 0.0;
+    // Split the top of the tree breadth-first into subtrees. Nodes are stored depth-first, so each
+    // subtree is a contiguous index range with every child after its parent: refitting a range
+    // backwards visits children first. The split-off top nodes follow once all subtrees are done.
+    std::vector<uint32_t> top;
+    std::vector<uint32_t> subtrees;
+    std::deque<uint32_t> frontier{ 0 };
+    while (!frontier.empty() && frontier.size() + subtrees.size() < REFIT_SUBTREES) {
+        const uint32_t index = frontier.front();
+        frontier.pop_front();
+        if (nodes[index].is_leaf()) {
+            subtrees.push_back(index);
+            continue;
+        }
+        top.push_back(index);
+        frontier.push_back(index + 1);
+        frontier.push_back(nodes[index].right_or_first);
+    }
+    subtrees.insert(subtrees.end(), frontier.begin(), frontier.end());
+
+    std::vector<double> sums(subtrees.size(), 0.0);
+    auto refit_subtree = [&](int task) {
+        const uint32_t root = subtrees[task];
+        uint32_t last = root; // The subtree ends after its rightmost leaf
+        while (!nodes[last].is_leaf()) last = nodes[last].right_or_first;
+        double sum = 0.0;
+        for (uint32_t i = last + 1; i-- > root;) sum += refit_node(i, spheres);
+        sums[task] = sum;
+    };
+    if (parallel) parallel(static_cast<int>(subtrees.size()), refit_subtree);
+    else for (int task = 0; task < static_cast<int>(subtrees.size()); ++task) refit_subtree(task);
+
+    double sum = 0.0;
+    for (double s : sums) sum += s;
+    for (size_t i = top.size(); i-- > 0;) sum += refit_node(top[i], spheres); // Breadth-first: parents before children
+    const double root_area = node_bounds(nodes[0]).surface_area();
+    return root_area > 0.0 ? sum / root_area : stats.sah_cost; // Every sphere at one point
+}
+
+void BVH::make_leaf(BVHNode& node, uint32_t begin, uint32_t end) {
+    node.right_or_first = begin;
+    node.prim_count = end - begin;
+    stats.leaf_count++;
+    stats.max_leaf_size = std::max(stats.max_leaf_size, node.prim_count);
+}
+
+uint32_t BVH::build_recursive(std::vector<BuildPrimitive>& prims, uint32_t begin, uint32_t end, uint32_t depth) {
+    uint32_t node_index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    stats.max_depth = std::max(stats.max_depth, depth);
+
+    AABB bounds;
+    AABB centroid_bounds;
+    for (uint32_t i = begin; i < end; ++i) {
+        const BuildPrimitive& prim = prims[prim_indices[i]];
+        bounds.grow(prim.bounds);
+        centroid_bounds.grow(prim.centroid);
+    }
+    set_node_bounds(nodes[node_index], bounds);
+    nodes[node_index].prim_count = 0;
+
+    uint32_t count = end - begin;
+    if (count <= 2) {
+        make_leaf(nodes[node_index], begin, end);
+        return node_index;
+    }
+
+    Vec3 centroid_extent = centroid_bounds.extent();
+    int best_axis = -1;
+    int best_split = 0;
+    double best_cost = std::numeric_limits<double>::infinity();
+
+    if (depth < FORCE_MEDIAN_DEPTH) {
+        struct Bin {
+            AABB bounds;
+            uint32_t count = 0;
+        };
+        for (int axis = 0; axis < 3; ++axis) {
+            double axis_min = axis_value(centroid_bounds.min_corner, axis);
+            double axis_extent = axis_value(centroid_extent, axis);
+            if (axis_extent <= 1e-12) continue;
+
+            Bin bins[SAH_BIN_COUNT];
+            double scale = SAH_BIN_COUNT / axis_extent;
+            for (uint32_t i = begin; i < end; ++i) {
+                const BuildPrimitive& prim = prims[prim_indices[i]];
+                int b = std::min(SAH_BIN_COUNT - 1, static_cast<int>((axis_value(prim.centroid, axis) - axis_min) * scale));
+                bins[b].count++;
+                bins[b].bounds.grow(prim.bounds);
+            }
+
+            // Sweep from the right to get suffix areas/counts, then from the left to evaluate every split plane.
+            double right_area[SAH_BIN_COUNT];
+            uint32_t right_count[SAH_BIN_COUNT];
+            AABB right_box;
+            uint32_t running = 0;
+            for (int b = SAH_BIN_COUNT - 1; b > 0; --b) {
+                right_box.grow(bins[b].bounds);
+                running += bins[b].count;
+                right_area[b] = right_box.surface_area();
+                right_count[b] = running;
+            }
+            AABB left_box;
+            uint32_t left_count = 0;
+            for (int split = 1; split < SAH_BIN_COUNT; ++split) {
+                left_box.grow(bins[split - 1].bounds);
+                left_count += bins[split - 1].count;
+                if (left_count == 0 || right_count[split] == 0) continue;
+                double cost = left_box.surface_area() * left_count + right_area[split] * right_count[split];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = split;
+                }
+            }
+        }
+    }
+
+    uint32_t mid = begin;
+    if (best_axis >= 0) {
+        double split_cost = SAH_TRAVERSAL_COST + SAH_INTERSECTION_COST * best_cost / bounds.surface_area();
+        double leaf_cost = SAH_INTERSECTION_COST * count;
+        if (split_cost >= leaf_cost && count <= MAX_LEAF_SIZE) {
+            make_leaf(nodes[node_index], begin, end);
+            return node_index;
+        }
+        double axis_min = axis_value(centroid_bounds.min_corner, best_axis);
+        double scale = SAH_BIN_COUNT / axis_value(centroid_extent, best_axis);
+        auto mid_it = std::partition(prim_indices.begin() + begin, prim_indices.begin() + end, [&](uint32_t idx) {
+            int b = std::min(SAH_BIN_COUNT - 1, static_cast<int>((axis_value(prims[idx].centroid, best_axis) - axis_min) * scale));
+            return b < best_split;
+            });
+        mid = static_cast<uint32_t>(mid_it - prim_indices.begin());
+    }
+
+    if (mid == begin || mid == end) {
+        if (count <= MAX_LEAF_SIZE) {
+            make_leaf(nodes[node_index], begin, end);
+            return node_index;
+        }
+        // Coincident centroids or forced median: split by count along the widest axis.
+        int axis = 0;
+        if (centroid_extent.y > centroid_extent.x) axis = 1;
+        if (centroid_extent.z > axis_value(centroid_extent, axis)) axis = 2;
+        mid = begin + count / 2;
+        std::nth_element(prim_indices.begin() + begin, prim_indices.begin() + mid, prim_indices.begin() + end,
+            [&](uint32_t a, uint32_t b) {
+                return axis_value(prims[a].centroid, axis) < axis_value(prims[b].centroid, axis);
+            });
+    }
+
+    build_recursive(prims, begin, mid, depth + 1); // Left child lands at node_index + 1
+    uint32_t right_child = build_recursive(prims, mid, end, depth + 1);
+    nodes[node_index].right_or_first = right_child;
+    return node_index;
+}
+
+template <typename T>
+bool BVH::intersect_closest(const RayT<T>& ray, T t_min, T t_max, SceneHit& hit, TraversalStats& traversal) const {
+    const std::vector<BVHNodeT<T>>& tree = nodes_for<T>();
+    const SphereSoAT<T>& leaves = leaf_geometry_for<T>();
+    if (tree.empty()) {
+        return false;
+    }
+    const Vec3T<T> origin = ray.origin;
+    const Vec3T<T> inv_dir(T(1) / ray.direction.x, T(1) / ray.direction.y, T(1) / ray.direction.z);
+    const SphereRayQueryT<T> query = make_sphere_ray_query(ray);
+
+    T closest_t = t_max;
+    bool found = false;
+    T t_entry;
+    if (!ray_box(tree[0], origin, inv_dir, t_min, closest_t, t_entry)) {
+        return false;
+    }
+
+    uint32_t stack[MAX_STACK_DEPTH];
+    int stack_size = 0;
+    uint32_t node_index = 0;
+    uint64_t nodes_visited = 0;
+    uint64_t primitive_tests = 0;
+
+    while (true) {
+        const BVHNodeT<T>& node = tree[node_index];
+        nodes_visited++;
+        if (node.is_leaf()) {
+            primitive_tests += node.prim_count;
+            int32_t leaf_hit = leaves.intersect_range(query, node.right_or_first, node.right_or_first + node.prim_count, t_min, closest_t);
+            if (leaf_hit >= 0) {
+                hit.sphere_index = prim_indices[leaf_hit];
+                found = true;
+            }
+        }
+        else {
+            uint32_t left = node_index + 1;
+            uint32_t right = node.right_or_first;
+            T t_left, t_right;
+            bool hit_left = ray_box(tree[left], origin, inv_dir, t_min, closest_t, t_left);
+            bool hit_right = ray_box(tree[right], origin, inv_dir, t_min, closest_t, t_right);
+            if (hit_left && hit_right) {
+                // Visit the nearer child first so closest_t shrinks early; the far one waits on the stack.
+                if (t_right < t_left) std::swap(left, right);
+                stack[stack_size++] = right;
+                node_index = left;
+                continue;
+            }
+            if (hit_left || hit_right) {
+                node_index = hit_left ? left : right;
+                continue;
+            }
+        }
+        if (stack_size == 0) break;
+        node_index = stack[--stack_size];
+    }
+
+    traversal.nodes_visited += nodes_visited;
+    traversal.primitive_tests += primitive_tests;
+    if (found) {
+        hit.t = closest_t;
+    }
+    return found;
+}
+
+template <typename T>
+bool BVH::intersect_any(const RayT<T>& ray, T t_min, T t_max, TraversalStats& traversal) const {
+    const std::vector<BVHNodeT<T>>& tree = nodes_for<T>();
+    const SphereSoAT<T>& leaves = leaf_geometry_for<T>();
+    if (tree.empty()) {
+        return false;
+    }
+    const Vec3T<T> origin = ray.origin;
+    const Vec3T<T> inv_dir(T(1) / ray.direction.x, T(1) / ray.direction.y, T(1) / ray.direction.z);
+    const SphereRayQueryT<T> query = make_sphere_ray_query(ray);
+
+    T t_entry;
+    if (!ray_box(tree[0], origin, inv_dir, t_min, t_max, t_entry)) {
+        return false;
+    }
+
+    uint32_t stack[MAX_STACK_DEPTH];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    uint64_t nodes_visited = 0;
+    uint64_t primitive_tests = 0;
+    bool found = false;
+
+    while (stack_size > 0) {
+        const uint32_t node_index = stack[--stack_size];
+        const BVHNodeT<T>& node = tree[node_index];
+        nodes_visited++;
+        if (node.is_leaf()) {
+            primitive_tests += node.prim_count;
+            T leaf_t = t_max;
+            if (leaves.intersect_range(query, node.right_or_first, node.right_or_first + node.prim_count, t_min, leaf_t) >= 0) {
+                found = true;
+                break;
+            }
+            continue;
+        }
+        const uint32_t left = node_index + 1;
+        const uint32_t right = node.right_or_first;
+        if (ray_box(tree[right], origin, inv_dir, t_min, t_max, t_entry)) stack[stack_size++] = right;
+        if (ray_box(tree[left], origin, inv_dir, t_min, t_max, t_entry)) stack[stack_size++] = left;
+    }
+
+    traversal.nodes_visited += nodes_visited;
+    traversal.primitive_tests += primitive_tests;
+    return found;
+}
+
+template <typename T>
+void BVH::intersect_packet(RayPacketSoAT<T>& packet, const PacketFrustum& frustum, T t_min, TraversalStats& traversal) const {
+    const std::vector<BVHNodeT<T>>& tree = nodes_for<T>();
+    const SphereSoAT<T>& leaves = leaf_geometry_for<T>();
+    if (tree.empty()) {
+        return;
+    }
+    auto farthest_hit = [&packet]() {
+        double farthest = 0.0;
+        for (uint32_t r = 0; r < packet.count; ++r) farthest = std::max(farthest, static_cast<double>(packet.t[r]));
+        return farthest;
+    };
+    double max_t = farthest_hit();
+
+    uint32_t stack[MAX_STACK_DEPTH];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    uint64_t nodes_visited = 0;
+    uint64_t primitive_tests = 0;
+
+    while (stack_size > 0) {
+        const uint32_t node_index = stack[--stack_size];
+        const BVHNodeT<T>& node = tree[node_index];
+        if (!frustum.overlaps_box(node.bounds_min, node.bounds_max)) continue;
+        if (box_distance_sq(node, frustum.origin) > max_t * max_t) continue; // Every ray already hit something closer
+        nodes_visited++;
+
+        if (node.is_leaf()) {
+            primitive_tests += static_cast<uint64_t>(node.prim_count) * packet.count;
+            leaves.intersect_packet(packet, node.right_or_first, node.right_or_first + node.prim_count, t_min);
+            max_t = farthest_hit();
+            continue;
+        }
+        uint32_t near_child = node_index + 1;
+        uint32_t far_child = node.right_or_first;
+        if (box_distance_sq(tree[far_child], frustum.origin) < box_distance_sq(tree[near_child], frustum.origin)) {
+            std::swap(near_child, far_child);
+        }
+        stack[stack_size++] = far_child;
+        stack[stack_size++] = near_child; // Popped first
+    }
+
+    for (uint32_t r = 0; r < packet.count; ++r) {
+        if (packet.hit_index[r] >= T(0)) {
+            packet.hit_index[r] = static_cast<T>(prim_indices[static_cast<uint32_t>(packet.hit_index[r])]);
+        }
+    }
+    traversal.nodes_visited += nodes_visited;
+    traversal.primitive_tests += primitive_tests;
+}
+
+template bool BVH::intersect_closest<double>(const RayT<double>&, double, double, SceneHit&, TraversalStats&) const;
+template bool BVH::intersect_closest<float>(const RayT<float>&, float, float, SceneHit&, TraversalStats&) const;
+template bool BVH::intersect_any<double>(const RayT<double>&, double, double, TraversalStats&) const;
+template bool BVH::intersect_any<float>(const RayT<float>&, float, float, TraversalStats&) const;
+template void BVH::intersect_packet<double>(RayPacketSoAT<double>&, const PacketFrustum&, double, TraversalStats&) const;
+template void BVH::intersect_packet<float>(RayPacketSoAT<float>&, const PacketFrustum&, float, TraversalStats&) const;
@@ -0,0 +1,165 @@
+#pragma once
+#include <vector>
+#include <span>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include "Vec3.h"
+#include "Ray.h"
+#include "Sphere.h"
+#include "SphereSoA.h"
+#include "RayPacket.h"
+
+struct AABB {
+    Vec3 min_corner = Vec3(std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity());
+    Vec3 max_corner = Vec3(-std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity());
+
+    void grow(const Vec3& p) {
+        min_corner = Vec3(std::min(min_corner.x, p.x), std::min(min_corner.y, p.y), std::min(min_corner.z, p.z));
+        max_corner = Vec3(std::max(max_corner.x, p.x), std::max(max_corner.y, p.y), std::max(max_corner.z, p.z));
+    }
+    void grow(const AABB& other) {
+        grow(other.min_corner);
+        grow(other.max_corner);
+    }
+    bool valid() const { return min_corner.x <= max_corner.x; }
+    double surface_area() const {
+        if (!valid()) return 0.0;
+        Vec3 e = max_corner - min_corner;
+        return 2.0 * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+    Vec3 extent() const { return max_corner - min_corner; }
+    Vec3 centroid() const { return (min_corner + max_corner) * 0.5; }
+};
+
+// One node of the flattened tree. Nodes are stored depth-first, so an interior node's left child
+// is always the next node and only the right child is indexed. The double node fills a cache
+// line; the float node (bounds rounded outward from the double ones) packs two per line.
+template <typename T>
+struct alignas(sizeof(T) * 8) BVHNodeT {
+    T bounds_min[3];
+    uint32_t right_or_first; // Interior: index of right child. Leaf: first entry in BVH::prim_indices.
+    uint32_t prim_count;     // 0 for interior nodes
+    T bounds_max[3];
+
+    bool is_leaf() const { return prim_count > 0; }
+};
+using BVHNode = BVHNodeT<double>;
+using BVHNodeF = BVHNodeT<float>;
+static_assert(sizeof(BVHNode) == 64, "BVHNode should fill exactly one cache line");
+static_assert(sizeof(BVHNodeF) == 32, "BVHNodeF should fill half a cache line");
+
+struct BVHBuildStats {
+    double build_ms = 0.0;
+    uint32_t node_count = 0;
+    uint32_t leaf_count = 0;
+    uint32_t max_depth = 0;
+    uint32_t max_leaf_size = 0;
+    double sah_cost = 0.0;  // Expected traversal cost of the whole tree, relative to one sphere test
+};
+
+// Per-thread traversal counters, summed into the frame totals by the render pool.
+struct TraversalStats {
+    uint64_t nodes_visited = 0;
+    uint64_t primitive_tests = 0;
+
+    TraversalStats& operator+=(const TraversalStats& other) {
+        nodes_visited += other.nodes_visited;
+        primitive_tests += other.primitive_tests;
+        return *this;
+    }
+};
+
+// Runs task(index) for index in [0, count) and returns when all are done, e.g. on the render
+// workers (RenderThreadPool::parallel_for). Null runs them one after another on the caller.
+using ParallelFor = std::function<void(int count, const std::function<void(int)>& task)>;
+
+struct SceneHit {
+    double t = -1.0;
+    uint32_t sphere_index = 0;
+};
+
+// Bounding volume hierarchy over Scene::objects, built with binned SAH.
+class BVH {
+public:
+    static constexpr int SAH_BIN_COUNT = 16;
+    static constexpr int MAX_LEAF_SIZE = 8;
+    static constexpr int MAX_STACK_DEPTH = 128; // Build switches to median splits past depth 64
+    static constexpr size_t REFIT_SUBTREES = 256; // Parallel refit tasks; the top levels above them are refit last
+
+    // The tree is always constructed in double. Precision::Float then adds single-precision nodes
+    // and keeps the leaf geometry in float only, for the float traversal.
+    void build(std::span<const Sphere> spheres, Precision precision = Precision::Double);
+    // Moves the bounds (and leaf geometry) to the spheres' current poses, keeping the tree's
+    // topology; `spheres` is the vector the tree was built from, with the same count. The subtrees
+    // below the top levels are refit in parallel. Returns the refit tree's SAH cost, comparable to
+    // build_stats().sah_cost: it grows as moving spheres stretch the boxes apart.
+    double refit(std::span<const Sphere> spheres, const ParallelFor& parallel = nullptr);
+    void clear();
+    bool empty() const { return nodes.empty(); }
+
+    // Closest hit with t in (t_min, t_max); hit.sphere_index refers to the vector the tree was built from.
+    // T = float needs a tree built with Precision::Float.
+    template <typename T>
+    bool intersect_closest(const RayT<T>& ray, T t_min, T t_max, SceneHit& hit, TraversalStats& stats) const;
+    // Whether anything is hit with t in (t_min, t_max), for shadow rays: returns at the first leaf
+    // with a hit and visits children in stack order, without sorting them by distance.
+    template <typename T>
+    bool intersect_any(const RayT<T>& ray, T t_min, T t_max, TraversalStats& stats) const;
+
+    // Closest hits for a whole primary-ray packet. Nodes are culled against the packet frustum and the
+    // farthest hit found so far, leaves run the SIMD packet kernel. On return packet.hit_index holds
+    // indices into the sphere vector the tree was built from (-1 = miss).
+    template <typename T>
+    void intersect_packet(RayPacketSoAT<T>& packet, const PacketFrustum& frustum, T t_min, TraversalStats& stats) const;
+
+    const BVHBuildStats& build_stats() const { return stats; }
+    const std::vector<BVHNode>& node_array() const { return nodes; }
+    const std::vector<uint32_t>& primitive_indices() const { return prim_indices; }
+    const SphereSoA& leaf_spheres() const { return leaf_geometry; }
+    bool has_float_nodes() const { return !nodes_f.empty(); }
+    // Everything traversal reads: both node arrays, the index map and the leaf geometry.
+    size_t memory_bytes() const {
+        return nodes.capacity() * sizeof(BVHNode) + nodes_f.capacity() * sizeof(BVHNodeF) + prim_indices.capacity() * sizeof(uint32_t) +
+            leaf_geometry.memory_bytes() + leaf_geometry_f.memory_bytes();
+    }
+
+private:
+    struct BuildPrimitive {
+        AABB bounds;
+        Vec3 centroid;
+    };
+
+    uint32_t build_recursive(std::vector<BuildPrimitive>& prims, uint32_t begin, uint32_t end, uint32_t depth);
+    void make_leaf(BVHNode& node, uint32_t begin, uint32_t end);
+    // Recomputes one node's bounds from its spheres or children; returns its SAH term (unnormalized).
+    double refit_node(uint32_t index, std::span<const Sphere> spheres);
+
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> prim_indices;
+    SphereSoA leaf_geometry; // Sphere geometry in prim_indices order, so each leaf is one contiguous SIMD range
+    std::vector<BVHNodeF> nodes_f;  // Precision::Float only
+    SphereSoAF leaf_geometry_f;
+
+    template <typename T>
+    const std::vector<BVHNodeT<T>>& nodes_for() const {
+        if constexpr (std::is_same_v<T, float>) return nodes_f;
+        else return nodes;
+    }
+    template <typename T>
+    const SphereSoAT<T>& leaf_geometry_for() const {
+        if constexpr (std::is_same_v<T, float>) return leaf_geometry_f;
+        else return leaf_geometry;
+    }
+    BVHBuildStats stats;
+};
+
+inline AABB sphere_bounds(const Sphere& sphere) {
+    AABB box;
+    Vec3 r(sphere.radius, sphere.radius, sphere.radius);
+    box.grow(sphere.center - r);
+    box.grow(sphere.center + r);
+    return box;
+}
@@ -0,0 +1,177 @@
+#include "Denoise.h"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <utility>
+
+namespace {
+
+// 3x3 kernel ([1 2 1] / 4 in x and y) per pass. The paper's 5x5 B3 spline costs 25 taps instead of 9 and, with the
+// same number of passes, came out no closer to a converged render of scene.txt from 4 spp up.
+constexpr int TAPS = 3;
+constexpr int RADIUS = TAPS / 2;
+constexpr float KERNEL[TAPS] = { 0.25f, 0.5f, 0.25f };
+
+// e^-x for x >= 0, to about 2e-5 relative error. Only arithmetic, integer conversion and shifts, so
+// the tap loops below vectorize on the baseline target (std::exp would stay a scalar call).
+inline float exp_negative(float x) {
+    const float scaled = x * -1.44269504f;
+    const float y = scaled > -64.0f ? scaled : -64.0f; // e^-x = 2^y
+    const int whole = static_cast<int>(y);                // Rounds toward zero, so fraction is in (-1, 0]
+    const float f = y - static_cast<float>(whole);
+    const float fraction = 1.0f + f * (0.69314718f + f * (0.24022651f + f * (0.05550411f + f * (0.00961813f + f * 0.00133336f))));
+    return std::bit_cast<float>((whole + 127) << 23) * fraction;
+}
+
+// Pixels filtered together. Their sums live in a block on the stack rather than in a buffer the
+// compiler would have to assume may overlap the planes; with that assumption the tap loop needs
+// more runtime alias checks than GCC will emit, and stays scalar.
+constexpr int BLOCK = 256;
+
+struct Block {
+    float r[BLOCK], g[BLOCK], b[BLOCK], weight[BLOCK];
+    float depth_scale[BLOCK];
+};
+
+// One row of the source and guides.
+struct RowPlanes {
+    const float* r;
+    const float* g;
+    const float* b;
+    const float* nx;
+    const float* ny;
+    const float* nz;
+    const float* ax;
+    const float* ay;
+    const float* az;
+    const float* z;
+};
+
+struct TapRow {
+    std::ptrdiff_t offset; // From a pixel to its first tap in this kernel row
+    int step;              // Between the taps
+    float kernel[TAPS];
+    float inv_color;
+    float inv_normal;
+    float inv_albedo;
+};
+
+// Adds the kernel-row taps T... to the pixels [x_begin, x_end) of the block that starts at x0; all of
+// the taps must be inside the image. Doing a whole kernel row per pixel keeps the center values and
+// the sums in registers across its taps. The taps are a pack so they are unrolled: as a loop, GCC
+// vectorizes across the taps instead of across x.
+template <int... T>
+void add_taps(std::integer_sequence<int, T...>, const TapRow& taps, const RowPlanes& p, int x0, int x_begin,
+    int x_end, Block& block) {
+    for (int x = x_begin; x < x_end; ++x) {
+        const int i = x - x0;
+        const float cr = p.r[x], cg = p.g[x], cb = p.b[x];
+        const float cnx = p.nx[x], cny = p.ny[x], cnz = p.nz[x];
+        const float cax = p.ax[x], cay = p.ay[x], caz = p.az[x];
+        const float cz = p.z[x], z_scale = block.depth_scale[i];
+        float r = block.r[i], g = block.g[i], b = block.b[i], weight = block.weight[i];
+        auto add_tap = [&](int t) {
+            const std::ptrdiff_t q = x + taps.offset + static_cast<std::ptrdiff_t>(t) * taps.step;
+            const float qr = p.r[q], qg = p.g[q], qb = p.b[q];
+            const float dr = qr - cr, dg = qg - cg, db = qb - cb;
+            const float dnx = p.nx[q] - cnx, dny = p.ny[q] - cny, dnz = p.nz[q] - cnz;
+            const float dax = p.ax[q] - cax, day = p.ay[q] - cay, daz = p.az[q] - caz;
+            const float dz = std::abs(p.z[q] - cz);
+            const float distance = (dr * dr + dg * dg + db * db) * taps.inv_color +
+                (dnx * dnx + dny * dny + dnz * dnz) * taps.inv_normal +
+                (dax * dax + day * day + daz * daz) * taps.inv_albedo + dz * z_scale;
+            const float w = taps.kernel[t] * exp_negative(distance);
+            r += w * qr;
+            g += w * qg;
+            b += w * qb;
+            weight += w;
+        };
+        (add_tap(T), ...);
+        block.r[i] = r;
+        block.g[i] = g;
+        block.b[i] = b;
+        block.weight[i] = weight;
+    }
+}
+
+} // namespace
+
+// Taps that fall outside the image are left out rather than clamped; the result is normalized by
+// the weights actually used. Every loop runs over a contiguous span of x whose taps are all inside
+// the image, which keeps the inner loops free of branches.
+void denoise_pass(const DenoiseImage& image, const DenoiseSettings& settings, int pass,
+    const float* src, float* dst, int row_begin, int row_end) {
+    const int width = image.width;
+    const size_t plane = static_cast<size_t>(width) * image.height;
+    const int step = 1 << pass;
+    const float sigma_color = settings.sigma_color / static_cast<float>(step);
+    const float inv_color = 1.0f / (sigma_color * sigma_color);
+    const float inv_normal = 1.0f / (settings.sigma_normal * settings.sigma_normal);
+    const float inv_albedo = 1.0f / (settings.sigma_albedo * settings.sigma_albedo);
+    // Where all taps of a kernel row are inside the image they go in one sweep; near the left
+    // and right edges each tap covers the pixels that have it in range.
+    const int inner_begin = std::min(RADIUS * step, width);
+    const int inner_end = std::max(inner_begin, width - RADIUS * step);
+
+    // Column blocks outermost: at the wider steps the kernel rows of consecutive pixel rows do not
+    // overlap, and a full-width sweep would evict them before the next pixel rows reuse them.
+    Block block;
+    for (int x0 = 0; x0 < width; x0 += BLOCK) {
+        const int x1 = std::min(width, x0 + BLOCK);
+        for (int y = row_begin; y < row_end; ++y) {
+            const size_t row = static_cast<size_t>(y) * width;
+            const RowPlanes planes{ src + row, src + plane + row, src + 2 * plane + row,
+                image.normal + row, image.normal + plane + row, image.normal + 2 * plane + row,
+                image.albedo + row, image.albedo + plane + row, image.albedo + 2 * plane + row, image.depth + row };
+            for (int x = x0; x < x1; ++x) {
+                const int i = x - x0;
+                block.r[i] = block.g[i] = block.b[i] = block.weight[i] = 0.0f;
+                block.depth_scale[i] = 1.0f / (settings.sigma_depth * std::max(planes.z[x], 1e-4f));
+            }
+
+            for (int ky = 0; ky < TAPS; ++ky) {
+                const int qy = y + (ky - RADIUS) * step;
+                if (qy < 0 || qy >= image.height) continue;
+                const std::ptrdiff_t row_offset = (static_cast<std::ptrdiff_t>(qy) - y) * width;
+                TapRow taps{ row_offset - RADIUS * step, step, {}, inv_color, inv_normal, inv_albedo };
+                for (int kx = 0; kx < TAPS; ++kx) taps.kernel[kx] = KERNEL[ky] * KERNEL[kx];
+                add_taps(std::make_integer_sequence<int, TAPS>{}, taps, planes, x0, std::max(x0, inner_begin),
+                    std::min(x1, inner_end), block);
+                for (int kx = 0; kx < TAPS; ++kx) {
+                    const int dx = (kx - RADIUS) * step;
+                    const int x_begin = std::max(x0, -dx);
+                    const int x_end = std::min(x1, width - dx);
+                    const TapRow tap{ row_offset + dx, step, { taps.kernel[kx] }, inv_color, inv_normal, inv_albedo };
+                    add_taps(std::integer_sequence<int, 0>{}, tap, planes, x0, x_begin, std::min(x_end, inner_begin), block);
+                    add_taps(std::integer_sequence<int, 0>{}, tap, planes, x0, std::max(x_begin, inner_end), x_end, block);
+                }
+            }
+
+            for (int x = x0; x < x1; ++x) {
+                const int i = x - x0;
+                const float inv_w = 1.0f / block.weight[i]; // The center tap always has weight 1/4
+                dst[row + x] = block.r[i] * inv_w;
+                dst[plane + row + x] = block.g[i] * inv_w;
+                dst[2 * plane + row + x] = block.b[i] * inv_w;
+            }
+        }
+    }
+}
+
+void interleaved_to_planes(const float* rgb, float* planes, int width, int height, int row_begin, int row_end) {
+    const size_t plane = static_cast<size_t>(width) * height;
+    for (size_t i = static_cast<size_t>(row_begin) * width; i < static_cast<size_t>(row_end) * width; ++i) {
+        planes[i] = rgb[i * 3 + 0];
+        planes[plane + i] = rgb[i * 3 + 1];
+        planes[2 * plane + i] = rgb[i * 3 + 2];
+    }
+}
+
+void planes_to_interleaved(const float* planes, float* rgb, int width, int height, int row_begin, int row_end) {
+    const size_t plane = static_cast<size_t>(width) * height;
+    for (size_t i = static_cast<size_t>(row_begin) * width; i < static_cast<size_t>(row_end) * width; ++i) {
+        rgb[i * 3 + 0] = planes[i];
+        rgb[i * 3 + 1] = planes[plane + i];
+        rgb[i * 3 + 2] = planes[2 * plane + i];
+    }
+}
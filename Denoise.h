@@ -0,0 +1,40 @@
+#pragma once
+// Edge-avoiding a-trous wavelet denoiser (Dammertz et al., "Edge-Avoiding A-Trous Wavelet
+// Transform for fast Global Illumination Filtering", 2010). Each pass blurs with a 3x3 kernel
+// whose taps are 2^pass pixels apart, and weights every tap by how close its color and
+// first-hit guides (albedo, normal, depth) are to the center pixel's, so a few passes cover a wide
+// radius without blurring across silhouettes, creases or material boundaries. The renderer runs
+// the passes over bands of rows on its worker pool (RenderThreadPool::render_frame).
+#include <cstdint>
+
+struct DenoiseSettings {
+    bool enabled = false;
+    int passes = 4;             // Filter radius 2^passes - 1 pixels
+    float sigma_color = 0.5f;   // Color distance scale of the first pass; halved every pass after it
+    float sigma_normal = 0.25f;
+    float sigma_albedo = 0.1f;
+    float sigma_depth = 0.05f;  // Relative to the center pixel's depth
+};
+
+// Guide depth of pixels whose camera ray missed everything; far enough that they only ever
+// average with each other.
+inline constexpr float DENOISE_MISS_DEPTH = 1e30f;
+
+// Frame being filtered. The guides are planar (all x values, then all y, then all z) so a pass
+// reads them with unit stride.
+struct DenoiseImage {
+    int width;
+    int height;
+    const float* albedo; // 3 planes
+    const float* normal; // 3 planes
+    const float* depth;  // 1 plane
+};
+
+// Rows [row_begin, row_end) of one pass: reads any row of `src`, writes only those rows of `dst`
+// (both 3 planes of width * height floats).
+void denoise_pass(const DenoiseImage& image, const DenoiseSettings& settings, int pass,
+    const float* src, float* dst, int row_begin, int row_end);
+
+// Conversions between the renderer's interleaved RGB and the filter's planes, also by rows.
+void interleaved_to_planes(const float* rgb, float* planes, int width, int height, int row_begin, int row_end);
+void planes_to_interleaved(const float* planes, float* rgb, int width, int height, int row_begin, int row_end);
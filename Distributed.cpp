@@ -0,0 +1,542 @@
+#include "Distributed.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <type_traits>
+#include "Log.h"
+#include "SceneBinary.h"
+#include "Socket.h"
+
+namespace {
+
+double now_ms() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Wire format: a MessageHeader, then `size` bytes of body starting with the message's struct.
+const uint32_t PROTOCOL_VERSION = 2;
+const uint64_t MAX_MESSAGE_SIZE = 1ull << 32; // Larger headers are garbage, not a big scene
+
+enum class MessageType : uint32_t { Hello = 1, Scene, Frame, Job, JobDone, Shutdown };
+
+struct MessageHeader {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t size;
+};
+
+// Worker -> coordinator, first thing after connecting. The sizes catch builds whose structs differ.
+struct HelloMessage {
+    uint32_t protocol;
+    uint32_t threads;
+    uint32_t frame_info_size;
+    uint32_t camera_size;
+};
+
+// Followed by the scene as .rmsc bytes; 16 bytes keep those 8-byte aligned in the receive buffer.
+struct SceneMessage {
+    uint64_t version;
+    uint32_t use_bvh;
+    uint32_t precision;
+};
+
+static_assert(std::is_trivially_copyable_v<FrameInfo> && std::is_trivially_copyable_v<Camera>,
+    "Frame messages copy FrameInfo and Camera as bytes");
+
+struct FrameMessage {
+    uint64_t frame_id;
+    uint64_t scene_version;
+    int32_t width;
+    int32_t height;
+    int32_t samples_per_pixel; // The scene's, as overridden by the coordinator's caller
+    int32_t max_ray_depth;
+    uint32_t with_hdr;
+    uint32_t reserved;
+    double animation_time;     // Workers pose the scene's moving spheres themselves
+    FrameInfo frame_info;
+    Camera camera;
+};
+
+struct JobMessage {
+    uint64_t frame_id;
+    uint32_t job;
+    uint32_t reserved;
+    RenderTile tile;
+};
+
+// Followed by the tile's pixels row by row, then its hdr when with_hdr.
+struct JobDoneMessage {
+    uint64_t frame_id;
+    uint32_t job;
+    uint32_t with_hdr;
+    RenderTile tile;
+    uint64_t rays_traced;
+    uint64_t pixels_sampled;
+    TraversalStats traversal;
+};
+
+void append_message(std::vector<uint8_t>& out, MessageType type, const void* body, size_t body_size,
+    const void* extra = nullptr, size_t extra_size = 0) {
+    const MessageHeader header{ static_cast<uint32_t>(type), 0, body_size + extra_size };
+    const size_t offset = out.size();
+    out.resize(offset + sizeof(header) + body_size + extra_size);
+    std::memcpy(out.data() + offset, &header, sizeof(header));
+    if (body_size > 0) std::memcpy(out.data() + offset + sizeof(header), body, body_size);
+    if (extra_size > 0) std::memcpy(out.data() + offset + sizeof(header) + body_size, extra, extra_size);
+}
+
+size_t tile_pixels(const RenderTile& tile) {
+    return static_cast<size_t>(tile.endX - tile.startX) * (tile.endY - tile.startY);
+}
+
+bool same_tile(const RenderTile& a, const RenderTile& b) {
+    return a.startX == b.startX && a.startY == b.startY && a.endX == b.endX && a.endY == b.endY;
+}
+
+// What a worker may send the coordinator: one Hello of the right size first, then JobDone messages
+// no bigger than a whole job with hdr. Checked as soon as a header is in, so a peer that is not a
+// worker cannot make the coordinator buffer a large body.
+bool header_allowed(const MessageHeader& header, bool ready, int job_size) {
+    if (header.type == static_cast<uint32_t>(MessageType::Hello)) return !ready && header.size == sizeof(HelloMessage);
+    if (header.type != static_cast<uint32_t>(MessageType::JobDone) || !ready) return false;
+    const uint64_t max_pixels = static_cast<uint64_t>(job_size) * job_size;
+    return header.size >= sizeof(JobDoneMessage) && header.size <= sizeof(JobDoneMessage) + max_pixels * (sizeof(uint32_t) + 3 * sizeof(float));
+}
+
+} // namespace
+
+struct RenderCoordinator::Connection {
+    intptr_t socket = NO_SOCKET;
+    std::string name;               // Peer address, for the log
+    bool ready = false;             // Sent a valid Hello
+    int threads = 0;
+    bool has_scene = false;
+    uint64_t scene_version = 0;     // Last scene sent
+    uint64_t frame_id = 0;          // Last frame sent
+    std::vector<uint32_t> in_flight; // Jobs of the current frame
+    std::vector<uint8_t> inbox;     // Received bytes not yet forming a whole message
+    std::vector<uint8_t> outbox;
+    size_t outbox_sent = 0;
+    double last_heard_ms = 0.0;     // Last bytes received, or the moment it was given work while idle
+};
+
+RenderCoordinator::RenderCoordinator(const DistributedSettings& settings_)
+    : settings(settings_), listener(NO_SOCKET) {
+    settings.job_size = std::max(8, settings.job_size);
+    settings.jobs_per_worker = std::max(1, settings.jobs_per_worker);
+}
+
+RenderCoordinator::~RenderCoordinator() {
+    MessageHeader shutdown{ static_cast<uint32_t>(MessageType::Shutdown), 0, 0 };
+    for (const std::unique_ptr<Connection>& worker : workers) {
+        set_nonblocking(worker->socket, false);
+        if (worker->ready && send_all(worker->socket, worker->outbox.data() + worker->outbox_sent, worker->outbox.size() - worker->outbox_sent)) {
+            send_all(worker->socket, reinterpret_cast<const uint8_t*>(&shutdown), sizeof(shutdown));
+        }
+        close_socket(worker->socket);
+    }
+    if (listener != NO_SOCKET) close_socket(listener);
+}
+
+bool RenderCoordinator::listen() {
+    listener = open_listener(settings.bind_address, settings.port, bound_port, "coordinator");
+    return listener != NO_SOCKET;
+}
+
+int RenderCoordinator::worker_count() const {
+    int count = 0;
+    for (const std::unique_ptr<Connection>& worker : workers) count += worker->ready ? 1 : 0;
+    return count;
+}
+
+bool RenderCoordinator::wait_for_workers(int count, double timeout_ms) {
+    const double start = now_ms();
+    while (worker_count() < count) {
+        if (now_ms() - start > timeout_ms) return false;
+        poll_once(50, nullptr, nullptr);
+    }
+    return true;
+}
+
+void RenderCoordinator::accept_workers() {
+    while (true) {
+        std::string peer;
+        const intptr_t s = accept_connection(listener, peer);
+        if (s == NO_SOCKET) return;
+        set_nonblocking(s, true);
+        set_nodelay(s);
+        auto worker = std::make_unique<Connection>();
+        worker->socket = s;
+        worker->name = peer;
+        worker->last_heard_ms = now_ms();
+        workers.push_back(std::move(worker));
+    }
+}
+
+bool RenderCoordinator::receive(Connection& worker, FrameBuffer* target, DistributedFrameStats* stats) {
+    uint8_t buffer[64 * 1024];
+    while (true) {
+        const long received = recv_some(worker.socket, buffer, sizeof(buffer));
+        if (received == 0) return false;
+        if (received < 0) {
+            if (would_block()) break;
+            return false;
+        }
+        worker.inbox.insert(worker.inbox.end(), buffer, buffer + received);
+        worker.last_heard_ms = now_ms();
+        if (stats) stats->bytes_received += static_cast<uint64_t>(received);
+        if (!handle_messages(worker, target, stats)) return false;
+    }
+    return true;
+}
+
+bool RenderCoordinator::handle_messages(Connection& worker, FrameBuffer* target, DistributedFrameStats* stats) {
+    size_t offset = 0;
+    while (worker.inbox.size() - offset >= sizeof(MessageHeader)) {
+        MessageHeader header;
+        std::memcpy(&header, worker.inbox.data() + offset, sizeof(header));
+        if (!header_allowed(header, worker.ready, settings.job_size)) return false;
+        if (worker.inbox.size() - offset - sizeof(header) < header.size) break;
+        const uint8_t* body = worker.inbox.data() + offset + sizeof(header);
+        offset += sizeof(header) + header.size;
+
+        if (header.type == static_cast<uint32_t>(MessageType::Hello)) {
+            HelloMessage hello;
+            std::memcpy(&hello, body, sizeof(hello));
+            if (hello.protocol != PROTOCOL_VERSION || hello.frame_info_size != sizeof(FrameInfo) || hello.camera_size != sizeof(Camera)) {
+                log_message("Error: worker " + worker.name + " runs an incompatible build\n");
+                return false;
+            }
+            worker.ready = true;
+            worker.threads = static_cast<int>(hello.threads);
+            log_message("Worker " + worker.name + " joined with " + std::to_string(worker.threads) + " threads\n");
+            continue;
+        }
+        JobDoneMessage done;
+        std::memcpy(&done, body, sizeof(done));
+        if (done.frame_id != frame_id || !target) continue; // A copy of a job from a frame that has finished
+        if (done.job >= jobs.size() || !same_tile(done.tile, jobs[done.job])) return false;
+        const size_t pixels = tile_pixels(done.tile);
+        if (header.size != sizeof(done) + pixels * (sizeof(uint32_t) + (done.with_hdr ? 3 * sizeof(float) : 0))) return false;
+        auto held = std::find(worker.in_flight.begin(), worker.in_flight.end(), done.job);
+        if (held != worker.in_flight.end()) {
+            worker.in_flight.erase(held);
+            job_states[done.job].holders--;
+        }
+        JobState& state = job_states[done.job];
+        if (state.done) continue; // Another worker's copy came back first
+        const RenderTile& tile = done.tile;
+        const int tile_width = tile.endX - tile.startX;
+        const uint8_t* pixel_rows = body + sizeof(done);
+        const uint8_t* hdr_rows = pixel_rows + pixels * sizeof(uint32_t);
+        for (int y = tile.startY; y < tile.endY; ++y) {
+            const size_t row = static_cast<size_t>(y - tile.startY) * tile_width;
+            const size_t dst = static_cast<size_t>(y) * target->width + tile.startX;
+            std::memcpy(target->pixels.data() + dst, pixel_rows + row * sizeof(uint32_t), tile_width * sizeof(uint32_t));
+            if (done.with_hdr && target->has_hdr()) {
+                std::memcpy(target->hdr.data() + dst * 3, hdr_rows + row * 3 * sizeof(float), tile_width * 3 * sizeof(float));
+            }
+        }
+        state.done = true;
+        jobs_done++;
+        if (stats) {
+            stats->rays_traced += done.rays_traced;
+            stats->pixels_sampled += done.pixels_sampled;
+            stats->traversal += done.traversal;
+        }
+    }
+    worker.inbox.erase(worker.inbox.begin(), worker.inbox.begin() + offset);
+    return true;
+}
+
+bool RenderCoordinator::flush(Connection& worker) {
+    while (worker.outbox_sent < worker.outbox.size()) {
+        const long sent = send_some(worker.socket, worker.outbox.data() + worker.outbox_sent, worker.outbox.size() - worker.outbox_sent);
+        if (sent < 0) return would_block();
+        worker.outbox_sent += static_cast<size_t>(sent);
+    }
+    worker.outbox.clear();
+    worker.outbox_sent = 0;
+    return true;
+}
+
+void RenderCoordinator::drop_worker(size_t index, DistributedFrameStats* stats) {
+    Connection& worker = *workers[index];
+    for (uint32_t job : worker.in_flight) {
+        JobState& state = job_states[job];
+        state.holders--;
+        if (!state.done && state.holders == 0) {
+            queued.push_back(job); // Next out
+            if (stats) stats->reassigned++;
+        }
+    }
+    if (worker.ready) log_message("Worker " + worker.name + " dropped\n");
+    close_socket(worker.socket);
+    workers.erase(workers.begin() + index);
+}
+
+void RenderCoordinator::poll_once(int timeout_ms, FrameBuffer* target, DistributedFrameStats* stats) {
+    std::vector<PollEntry> entries(workers.size() + 1);
+    entries[0].fd = native(listener);
+    entries[0].events = POLLIN;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        entries[i + 1].fd = native(workers[i]->socket);
+        entries[i + 1].events = static_cast<short>(POLLIN | (workers[i]->outbox.empty() ? 0 : POLLOUT));
+    }
+    if (poll_sockets(entries.data(), entries.size(), timeout_ms) < 0) return;
+
+    const double now = now_ms();
+    std::vector<size_t> dropped;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        Connection& worker = *workers[i];
+        const short events = entries[i + 1].revents;
+        bool alive = (events & (POLLERR | POLLNVAL)) == 0;
+        if (alive && (events & (POLLIN | POLLHUP))) alive = receive(worker, target, stats);
+        if (alive && (events & POLLOUT)) alive = flush(worker);
+        // A worker that owes results, or never finished its handshake, has to keep talking.
+        if (alive && (!worker.ready || !worker.in_flight.empty()) && now - worker.last_heard_ms > settings.worker_timeout_ms) {
+            log_message("Worker " + worker.name + " timed out\n");
+            alive = false;
+        }
+        if (!alive) dropped.push_back(i);
+    }
+    for (size_t d = dropped.size(); d > 0; --d) drop_worker(dropped[d - 1], stats);
+    if (entries[0].revents & POLLIN) accept_workers();
+}
+
+bool RenderCoordinator::render_frame(const FrameInfo& frame_info, const Scene& scene, uint64_t scene_version, bool use_bvh,
+    const Camera& camera, FrameBuffer& target, DistributedFrameStats& stats) {
+    stats = DistributedFrameStats();
+    if (listener == NO_SOCKET) return false;
+    if (!encoded_valid || encoded_version != scene_version) {
+        size_t size = 0;
+        const std::vector<uint64_t> encoded = encode_binary_scene(scene, size);
+        const SceneMessage message{ scene_version, use_bvh ? 1u : 0u, static_cast<uint32_t>(scene.precision) };
+        scene_message.clear();
+        append_message(scene_message, MessageType::Scene, &message, sizeof(message), encoded.data(), size);
+        encoded_version = scene_version;
+        encoded_valid = true;
+    }
+
+    frame_id++;
+    FrameMessage frame{ frame_id, scene_version, target.width, target.height, scene.samples_per_pixel, scene.max_ray_depth,
+        target.has_hdr() ? 1u : 0u, 0, scene.animation.time, frame_info, camera };
+    frame_message.clear();
+    append_message(frame_message, MessageType::Frame, &frame, sizeof(frame));
+
+    jobs.clear();
+    for (int y = 0; y < target.height; y += settings.job_size) {
+        for (int x = 0; x < target.width; x += settings.job_size) {
+            jobs.push_back(RenderTile{ x, y, std::min(x + settings.job_size, target.width), std::min(y + settings.job_size, target.height) });
+        }
+    }
+    job_states.assign(jobs.size(), JobState());
+    queued.clear();
+    for (size_t j = jobs.size(); j > 0; --j) queued.push_back(static_cast<uint32_t>(j - 1));
+    jobs_done = 0;
+    // Jobs still out from the last frame are now stale; their results are ignored when they arrive.
+    for (const std::unique_ptr<Connection>& worker : workers) worker->in_flight.clear();
+
+    double last_worker_ms = now_ms();
+    while (jobs_done < jobs.size()) {
+        const double now = now_ms();
+        bool any_ready = false;
+        for (const std::unique_ptr<Connection>& connection : workers) {
+            Connection& worker = *connection;
+            if (!worker.ready) continue;
+            any_ready = true;
+            if (!worker.has_scene || worker.scene_version != scene_version) {
+                worker.outbox.insert(worker.outbox.end(), scene_message.begin(), scene_message.end());
+                worker.has_scene = true;
+                worker.scene_version = scene_version;
+                stats.scene_bytes += scene_message.size();
+            }
+            if (worker.frame_id != frame_id) {
+                worker.outbox.insert(worker.outbox.end(), frame_message.begin(), frame_message.end());
+                worker.frame_id = frame_id;
+            }
+            auto hand_out = [&](uint32_t job) {
+                if (worker.in_flight.empty()) worker.last_heard_ms = now; // Its silence counts from here
+                const JobMessage message{ frame_id, job, 0, jobs[job] };
+                append_message(worker.outbox, MessageType::Job, &message, sizeof(message));
+                worker.in_flight.push_back(job);
+                JobState& state = job_states[job];
+                if (state.holders++ == 0 && state.sent_ms == 0.0) state.sent_ms = now;
+            };
+            while (static_cast<int>(worker.in_flight.size()) < settings.jobs_per_worker && !queued.empty()) {
+                const uint32_t job = queued.back();
+                queued.pop_back();
+                hand_out(job);
+            }
+            if (worker.in_flight.empty() && queued.empty()) {
+                // Nothing left to start: back up the job that has been out longest.
+                uint32_t oldest = UINT32_MAX;
+                for (uint32_t j = 0; j < jobs.size(); ++j) {
+                    const JobState& state = job_states[j];
+                    if (!state.done && state.holders == 1 && (oldest == UINT32_MAX || state.sent_ms < job_states[oldest].sent_ms)) oldest = j;
+                }
+                if (oldest != UINT32_MAX) {
+                    hand_out(oldest);
+                    stats.duplicated++;
+                }
+            }
+            flush(worker); // Errors show up in the next poll
+        }
+        if (any_ready) {
+            last_worker_ms = now;
+        }
+        else if (now - last_worker_ms > settings.worker_timeout_ms) {
+            log_message("Error: no render workers left, frame " + std::to_string(frame_info.frameNumber) + " is incomplete\n");
+            return false;
+        }
+        poll_once(any_ready ? 20 : 100, &target, &stats);
+    }
+    stats.workers = worker_count();
+    stats.jobs = static_cast<uint32_t>(jobs.size());
+    return true;
+}
+
+namespace {
+
+// Blocking read of one whole message; the body lands 8-byte aligned for decode_binary_scene.
+bool read_message(intptr_t s, MessageHeader& header, std::vector<uint64_t>& body) {
+    if (!recv_all(s, reinterpret_cast<uint8_t*>(&header), sizeof(header)) || header.size > MAX_MESSAGE_SIZE) return false;
+    body.resize((header.size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    return recv_all(s, reinterpret_cast<uint8_t*>(body.data()), header.size);
+}
+
+} // namespace
+
+bool run_render_worker(const std::string& host, int port, int threads) {
+    if (!sockets_ready()) return false;
+    const std::string address = host + ":" + std::to_string(port);
+    intptr_t s = NO_SOCKET;
+    for (int attempt = 0; attempt < 100 && s == NO_SOCKET; ++attempt) {
+        if (attempt > 0) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        s = connect_to(host, port);
+    }
+    if (s == NO_SOCKET) {
+        log_message("Error: could not connect to coordinator " + address + "\n");
+        return false;
+    }
+    set_nodelay(s);
+    RenderThreadPool pool(threads);
+    const HelloMessage hello{ PROTOCOL_VERSION, static_cast<uint32_t>(pool.thread_count()), sizeof(FrameInfo), sizeof(Camera) };
+    std::vector<uint8_t> out;
+    append_message(out, MessageType::Hello, &hello, sizeof(hello));
+    bool ok = send_all(s, out.data(), out.size());
+
+    Scene scene;
+    bool has_scene = false;
+    uint64_t scene_version = 0;
+    bool has_frame = false;
+    FrameMessage frame;
+    FrameBuffer buffer;
+    std::deque<JobMessage> pending;
+    std::vector<uint64_t> body;
+    bool running = ok;
+    while (running) {
+        // Read everything that has arrived before starting a job: a new frame cancels the jobs
+        // queued for the old one, which the coordinator no longer needs.
+        while (running && (pending.empty() || has_input(s))) {
+            MessageHeader header;
+            if (!read_message(s, header, body)) {
+                ok = running = false;
+                break;
+            }
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(body.data());
+            switch (static_cast<MessageType>(header.type)) {
+            case MessageType::Scene: {
+                SceneMessage message;
+                if (header.size < sizeof(message)) {
+                    ok = running = false;
+                    break;
+                }
+                std::memcpy(&message, bytes, sizeof(message));
+                if (!decode_binary_scene(bytes + sizeof(message), header.size - sizeof(message), scene, "scene from " + address)) {
+                    ok = running = false;
+                    break;
+                }
+                build_acceleration(scene, message.use_bvh != 0, static_cast<Precision>(message.precision));
+                has_scene = true;
+                scene_version = message.version;
+                break;
+            }
+            case MessageType::Frame:
+                if (header.size != sizeof(frame)) {
+                    ok = running = false;
+                    break;
+                }
+                std::memcpy(&frame, bytes, sizeof(frame));
+                has_frame = true;
+                pending.clear();
+                if (buffer.width != frame.width || buffer.height != frame.height || buffer.has_hdr() != (frame.with_hdr != 0)) {
+                    buffer.resize(frame.width, frame.height, frame.with_hdr != 0);
+                }
+                break;
+            case MessageType::Job: {
+                JobMessage job;
+                if (header.size != sizeof(job)) {
+                    ok = running = false;
+                    break;
+                }
+                std::memcpy(&job, bytes, sizeof(job));
+                const RenderTile& tile = job.tile;
+                if (!has_frame || tile.startX < 0 || tile.startY < 0 || tile.endX > frame.width || tile.endY > frame.height ||
+                    tile.startX >= tile.endX || tile.startY >= tile.endY) {
+                    ok = running = false;
+                    break;
+                }
+                if (job.frame_id == frame.frame_id) pending.push_back(job);
+                break;
+            }
+            case MessageType::Shutdown:
+                running = false;
+                break;
+            default:
+                ok = running = false;
+                break;
+            }
+        }
+        if (!running || pending.empty()) continue;
+        if (!has_scene || scene_version != frame.scene_version) {
+            log_message("Error: coordinator " + address + " sent a frame without its scene\n");
+            ok = false;
+            break;
+        }
+        const JobMessage job = pending.front();
+        pending.pop_front();
+        scene.samples_per_pixel = frame.samples_per_pixel;
+        scene.max_ray_depth = frame.max_ray_depth;
+        if (!scene.animation.empty() && scene.animation.time != frame.animation_time) {
+            animate_scene(scene, frame.animation_time, AnimationSettings(),
+                [&](int count, const std::function<void(int)>& task) { pool.parallel_for(count, task); });
+        }
+        const FrameStats stats = pool.render_frame(frame.frame_info, scene, frame.camera, buffer, &job.tile);
+
+        const RenderTile& tile = job.tile;
+        const int tile_width = tile.endX - tile.startX;
+        const size_t pixels = tile_pixels(tile);
+        const bool with_hdr = buffer.has_hdr();
+        std::vector<uint8_t> payload(pixels * (sizeof(uint32_t) + (with_hdr ? 3 * sizeof(float) : 0)));
+        uint8_t* hdr_rows = payload.data() + pixels * sizeof(uint32_t);
+        for (int y = tile.startY; y < tile.endY; ++y) {
+            const size_t row = static_cast<size_t>(y - tile.startY) * tile_width;
+            const size_t src = static_cast<size_t>(y) * buffer.width + tile.startX;
+            std::memcpy(payload.data() + row * sizeof(uint32_t), buffer.pixels.data() + src, tile_width * sizeof(uint32_t));
+            if (with_hdr) std::memcpy(hdr_rows + row * 3 * sizeof(float), buffer.hdr.data() + src * 3, tile_width * 3 * sizeof(float));
+        }
+        const JobDoneMessage done{ job.frame_id, job.job, with_hdr ? 1u : 0u, tile, stats.rays_traced, stats.pixels_sampled, stats.traversal };
+        out.clear();
+        append_message(out, MessageType::JobDone, &done, sizeof(done), payload.data(), payload.size());
+        if (!send_all(s, out.data(), out.size())) {
+            ok = false;
+            break;
+        }
+    }
+    close_socket(s);
+    if (!ok) log_message("Error: lost the connection to coordinator " + address + "\n");
+    return ok;
+}
@@ -0,0 +1,105 @@
+#pragma once
+// Distributed rendering over TCP. A coordinator cuts every frame into square jobs and hands them to
+// worker processes (rmrender --worker), which render them on their own RenderThreadPool and send
+// the pixels back; the coordinator copies each finished job into its frame. Workers may join at any
+// time and get the scene once per change, not once per frame: frames only carry the camera, the
+// render settings and the animation time, at which workers pose the scene's moving spheres. Each worker has a couple of jobs in flight so it never waits for the next one;
+// a worker that disconnects or stops answering is dropped and its jobs go back in the queue, and
+// workers that run out of jobs near the end of a frame take copies of the oldest outstanding ones,
+// so a slow machine cannot hold the frame up (the first copy back wins).
+//
+// Messages are raw structs behind a MessageHeader, so coordinator and workers must be the same
+// build (checked in the handshake). Frames that accumulate, sample adaptively, or run the temporal
+// or denoise passes need the whole image on one machine and are not supported.
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Renderer.h"
+
+struct DistributedSettings {
+    int port = 0;                      // Coordinator's listening port; 0 picks a free one, see port()
+    std::string bind_address = "127.0.0.1"; // Interface it listens on; workers on other machines need "0.0.0.0"
+    int job_size = 64;                 // Edge of the square jobs in pixels; a multiple of the tile size keeps tiles whole
+    int jobs_per_worker = 2;           // In flight per worker
+    double worker_timeout_ms = 10000.0; // A worker holding jobs that sends nothing for this long is dropped
+};
+
+// What one distributed frame took, from the coordinator's side.
+struct DistributedFrameStats {
+    int workers = 0;           // Connected when the frame finished
+    uint32_t jobs = 0;
+    uint32_t reassigned = 0;   // Jobs put back in the queue after their worker was dropped
+    uint32_t duplicated = 0;   // Copies of outstanding jobs handed to idle workers
+    uint64_t scene_bytes = 0;  // Scene uploads; 0 unless the scene changed or a worker joined
+    uint64_t bytes_received = 0;
+    uint64_t rays_traced = 0;  // Reported by the workers for the jobs that were used
+    uint64_t pixels_sampled = 0;
+    TraversalStats traversal;
+};
+
+class RenderCoordinator {
+public:
+    explicit RenderCoordinator(const DistributedSettings& settings = DistributedSettings());
+    // Tells the connected workers to exit.
+    ~RenderCoordinator();
+
+    RenderCoordinator(const RenderCoordinator&) = delete;
+    RenderCoordinator& operator=(const RenderCoordinator&) = delete;
+
+    // Opens the listening socket on settings.bind_address. Logs and returns false on failure.
+    bool listen();
+    int port() const { return bound_port; }
+    // Accepts workers until `count` have completed the handshake or timeout_ms has passed.
+    bool wait_for_workers(int count, double timeout_ms);
+    int worker_count() const;
+
+    // Renders the frame into target's pixels (and hdr, when it has one). `scene_version` names the
+    // scene's content: workers are sent the scene again only when it changes. `use_bvh` and the
+    // scene's precision are rebuilt on the workers' side. Returns false when the last worker is
+    // gone and none joins within the worker timeout; the target is then incomplete.
+    bool render_frame(const FrameInfo& frame_info, const Scene& scene, uint64_t scene_version, bool use_bvh,
+        const Camera& camera, FrameBuffer& target, DistributedFrameStats& stats);
+
+private:
+    struct Connection;
+
+    void accept_workers();
+    // Reads what the socket has and handles every complete message; false when the worker is gone.
+    bool receive(Connection& worker, FrameBuffer* target, DistributedFrameStats* stats);
+    // Handles the complete messages in the worker's inbox, checking each header as soon as it is
+    // in; false when the worker breaks the protocol.
+    bool handle_messages(Connection& worker, FrameBuffer* target, DistributedFrameStats* stats);
+    bool flush(Connection& worker);
+    void drop_worker(size_t index, DistributedFrameStats* stats);
+    // Runs one poll() round over the listener and all workers, for up to timeout_ms.
+    void poll_once(int timeout_ms, FrameBuffer* target, DistributedFrameStats* stats);
+
+    DistributedSettings settings;
+    intptr_t listener; // Socket handle, -1 when closed
+    int bound_port = 0;
+    std::vector<std::unique_ptr<Connection>> workers;
+
+    // The scene as sent, encoded once per version.
+    uint64_t encoded_version = 0;
+    bool encoded_valid = false;
+    std::vector<uint8_t> scene_message;
+
+    // The frame in progress; jobs are rectangles of it in scanline order.
+    uint64_t frame_id = 0;
+    std::vector<uint8_t> frame_message;
+    std::vector<RenderTile> jobs;
+    struct JobState {
+        bool done = false;
+        int holders = 0;         // Workers it is in flight on
+        double sent_ms = 0.0;    // When its first copy went out, for picking duplicates
+    };
+    std::vector<JobState> job_states;
+    std::vector<uint32_t> queued; // Jobs waiting for a worker, next at the back
+    uint32_t jobs_done = 0;
+};
+
+// Worker process: connects to the coordinator at host:port (retrying for a few seconds while it
+// starts up) and renders the jobs it is sent on `threads` threads until told to stop. Returns
+// false when the connection fails or breaks.
+bool run_render_worker(const std::string& host, int port, int threads);
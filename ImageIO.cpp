@@ -0,0 +1,84 @@
+#include "ImageIO.h"
+#include <cstdio>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "Log.h"
+
+bool write_ppm(const std::string& filename, const FrameBuffer& frame) {
+    std::FILE* file = std::fopen(filename.c_str(), "wb");
+    if (!file) {
+        log_message("Error: Could not open output file: " + filename + "\n");
+        return false;
+    }
+    std::fprintf(file, "P6\n%d %d\n255\n", frame.width, frame.height);
+    std::vector<unsigned char> row(static_cast<size_t>(frame.width) * 3);
+    for (int y = 0; y < frame.height; ++y) {
+        for (int x = 0; x < frame.width; ++x) {
+            uint32_t color = frame.pixels[static_cast<size_t>(y) * frame.width + x];
+            row[x * 3 + 0] = static_cast<unsigned char>((color >> 16) & 0xFF);
+            row[x * 3 + 1] = static_cast<unsigned char>((color >> 8) & 0xFF);
+            row[x * 3 + 2] = static_cast<unsigned char>(color & 0xFF);
+        }
+        std::fwrite(row.data(), 1, row.size(), file);
+    }
+    bool ok = std::ferror(file) == 0;
+    std::fclose(file);
+    return ok;
+}
+
+bool write_pfm(const std::string& filename, const FrameBuffer& frame) {
+    if (!frame.has_hdr()) {
+        log_message("Error: PFM output requested but the frame has no HDR buffer.\n");
+        return false;
+    }
+    std::FILE* file = std::fopen(filename.c_str(), "wb");
+    if (!file) {
+        log_message("Error: Could not open output file: " + filename + "\n");
+        return false;
+    }
+    // Negative scale marks little-endian data; PFM stores rows bottom-to-top.
+    std::fprintf(file, "PF\n%d %d\n-1.0\n", frame.width, frame.height);
+    const size_t row_floats = static_cast<size_t>(frame.width) * 3;
+    for (int y = frame.height - 1; y >= 0; --y) {
+        std::fwrite(frame.hdr.data() + y * row_floats, sizeof(float), row_floats, file);
+    }
+    bool ok = std::ferror(file) == 0;
+    std::fclose(file);
+    return ok;
+}
+
+bool write_image(const std::string& filename, const FrameBuffer& frame) {
+    if (filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".pfm") == 0) {
+        return write_pfm(filename, frame);
+    }
+    return write_ppm(filename, frame);
+}
+
+bool write_sample_heatmap(const std::string& filename, const FrameBuffer& frame) {
+    if (frame.sample_counts.size() != static_cast<size_t>(frame.width) * frame.height) {
+        log_message("Error: Sample heatmap requested but the frame has no adaptive sample counts.\n");
+        return false;
+    }
+    uint32_t min_count = 0xFFFFFFFFu;
+    uint32_t max_count = 0;
+    for (uint32_t count : frame.sample_counts) {
+        min_count = std::min(min_count, count);
+        max_count = std::max(max_count, count);
+    }
+    double log_min = std::log2(std::max(min_count, 1u));
+    double log_range = std::max(std::log2(std::max(max_count, 1u)) - log_min, 1e-9);
+
+    FrameBuffer heatmap;
+    heatmap.resize(frame.width, frame.height, false);
+    for (size_t i = 0; i < frame.sample_counts.size(); ++i) {
+        double t = (std::log2(std::max(frame.sample_counts[i], 1u)) - log_min) / log_range;
+        // Blue -> green -> red ramp
+        double r = std::clamp(2.0 * t - 1.0, 0.0, 1.0);
+        double g = 1.0 - std::abs(2.0 * t - 1.0);
+        double b = std::clamp(1.0 - 2.0 * t, 0.0, 1.0);
+        heatmap.pixels[i] = 0xFF000000u | (static_cast<uint32_t>(r * 255.0) << 16) |
+            (static_cast<uint32_t>(g * 255.0) << 8) | static_cast<uint32_t>(b * 255.0);
+    }
+    return write_ppm(filename, heatmap);
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+#include "Renderer.h"
+
+// Binary PPM (P6) from the 8-bit pixel buffer.
+bool write_ppm(const std::string& filename, const FrameBuffer& frame);
+// Little-endian PFM ("PF", scale -1.0) from the HDR buffer. Fails if the frame has no HDR data.
+bool write_pfm(const std::string& filename, const FrameBuffer& frame);
+// Debug view of adaptive sampling: per-pixel sample counts on a log scale, dark blue (fewest)
+// through green to red (most). Fails if the frame has no sample counts.
+bool write_sample_heatmap(const std::string& filename, const FrameBuffer& frame);
+// Picks PPM or PFM from the file extension.
+bool write_image(const std::string& filename, const FrameBuffer& frame);
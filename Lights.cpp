@@ -0,0 +1,117 @@
+#include "Lights.h"
+#include <algorithm>
+#include <cmath>
+#include "SceneLoader.h"
+
+namespace {
+
+// Cone of directions from a point onto a sphere.
+struct LightCone {
+    Vec3 axis;                // Unit, toward the center
+    double distance_sq = 0.0; // To the center
+    double one_minus_cos = 0.0; // 1 - cos of the half angle, kept apart so tiny cones keep their precision
+};
+
+bool light_cone(const Sphere& light, const Vec3& origin, LightCone& cone) {
+    const Vec3 to_center = light.center - origin;
+    cone.distance_sq = to_center.length_squared();
+    const double radius_sq = light.radius * light.radius;
+    if (cone.distance_sq <= radius_sq) return false; // Inside: the light covers every direction
+    const double sin_sq = radius_sq / cone.distance_sq;
+    cone.one_minus_cos = sin_sq / (1.0 + std::sqrt(1.0 - sin_sq));
+    if (!(cone.one_minus_cos > 0.0)) return false;
+    cone.axis = to_center / std::sqrt(cone.distance_sq);
+    return true;
+}
+
+double cone_pdf(const LightCone& cone) {
+    return 1.0 / (2.0 * M_PI * cone.one_minus_cos);
+}
+
+} // namespace
+
+double LightList::pmf(uint32_t sphere) const {
+    auto it = std::lower_bound(spheres.begin(), spheres.end(), sphere);
+    if (it == spheres.end() || *it != sphere) return 0.0;
+    const size_t i = static_cast<size_t>(it - spheres.begin());
+    return cdf[i] - (i > 0 ? cdf[i - 1] : 0.0);
+}
+
+void build_light_list(Scene& scene) {
+    LightList& lights = scene.lights;
+    lights.spheres.clear();
+    lights.cdf.clear();
+    double total = 0.0;
+    for (size_t i = 0; i < scene.objects.size(); ++i) {
+        const Vec3& emission = scene.material_of(i).emission_color;
+        const double luminance = 0.2126 * emission.x + 0.7152 * emission.y + 0.0722 * emission.z;
+        const double radius = scene.objects[i].radius;
+        if (!(luminance > 0.0) || !(radius > 0.0)) continue;
+        total += luminance * radius * radius;
+        lights.spheres.push_back(static_cast<uint32_t>(i));
+        lights.cdf.push_back(total);
+    }
+    for (double& c : lights.cdf) c /= total;
+    if (!lights.cdf.empty()) lights.cdf.back() = 1.0;
+}
+
+bool sample_light(const Scene& scene, const Vec3& origin, double u1, double u2, LightSample& sample) {
+    const LightList& lights = scene.lights;
+    if (lights.empty()) return false;
+    const size_t i = std::min(static_cast<size_t>(std::upper_bound(lights.cdf.begin(), lights.cdf.end(), u1) - lights.cdf.begin()),
+        lights.cdf.size() - 1);
+    const double below = i > 0 ? lights.cdf[i - 1] : 0.0;
+    const double pmf = lights.cdf[i] - below;
+    if (!(pmf > 0.0)) return false;
+    u1 = std::min((u1 - below) / pmf, 1.0);
+
+    const Sphere& light = scene.objects[lights.spheres[i]];
+    LightCone cone;
+    if (!light_cone(light, origin, cone)) return false;
+    // Uniform in the cone: 1 - cos(theta) is uniform in [0, one_minus_cos].
+    const double one_minus_cos = u1 * cone.one_minus_cos;
+    const double cos_theta = 1.0 - one_minus_cos;
+    const double sin_sq = std::max(0.0, one_minus_cos * (2.0 - one_minus_cos));
+    const double sin_theta = std::sqrt(sin_sq);
+    const double phi = 2.0 * M_PI * u2;
+    Vec3 tangent, bitangent;
+    create_onb(cone.axis, tangent, bitangent);
+    sample.direction = (tangent * (std::cos(phi) * sin_theta) + bitangent * (std::sin(phi) * sin_theta) + cone.axis * cos_theta).normalize();
+    // Near root of the ray-sphere test, with the perpendicular distance taken from sin(theta).
+    const double distance = std::sqrt(cone.distance_sq);
+    sample.distance = distance * cos_theta - std::sqrt(std::max(0.0, light.radius * light.radius - cone.distance_sq * sin_sq));
+    sample.sphere = lights.spheres[i];
+    sample.pdf = pmf * cone_pdf(cone);
+    return true;
+}
+
+double light_pdf(const Scene& scene, const Vec3& origin, uint32_t sphere) {
+    const double pmf = scene.lights.pmf(sphere);
+    if (pmf <= 0.0) return 0.0;
+    LightCone cone;
+    if (!light_cone(scene.objects[sphere], origin, cone)) return 0.0;
+    return pmf * cone_pdf(cone);
+}
+
+// The lobe's direction is normalize(c + r w), c = (1 - r) mirror, w cosine-distributed about the
+// normal. Its directions d come from the points s d on the sphere of radius r around c; each such
+// point (one or two roots s > 0) contributes w's pdf times the Jacobian s^2 / (r^2 |w . d|), where
+// |w . d| = sqrt(discriminant) / r.
+double lobe_pdf(const ReflectionLobe& lobe, const Vec3& direction) {
+    const double r = lobe.roughness;
+    if (r <= 0.0) return 0.0;
+    const double c_length = 1.0 - r;
+    const double half_b = c_length * Vec3::dot(direction, lobe.mirror);
+    const double discriminant = half_b * half_b - c_length * c_length + r * r;
+    if (!(discriminant > 0.0)) return 0.0;
+    const double root = std::sqrt(discriminant);
+    double pdf = 0.0;
+    for (double s : { half_b - root, half_b + root }) {
+        if (s <= 0.0) continue;
+        const Vec3 w = (direction * s - lobe.mirror * c_length) / r;
+        const double cos_w = Vec3::dot(w, lobe.normal);
+        if (cos_w <= 0.0) continue;
+        pdf += cos_w / M_PI * s * s / (r * root);
+    }
+    return pdf;
+}
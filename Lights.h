@@ -0,0 +1,64 @@
+#pragma once
+// Direct lighting. Every emissive sphere goes into the scene's light list, and at each glossy
+// bounce the integrators sample one of them directly (next-event estimation): a light is picked in
+// proportion to its power, then a direction uniformly inside the cone it subtends, and a shadow ray
+// checks that nothing is in between. The bounce's own reflection ray still finds emitters by
+// chance, so the two estimates are combined with multiple importance sampling (power heuristic):
+// each weighs a light by how likely the other strategy was to pick the same direction. Small
+// emitters are then carried by the light samples, and large ones seen through sharp lobes by the
+// reflection rays.
+//
+// In this material model a surface's only response to light is its reflection lobe (the base
+// color is unlit), so f * cos over the lobe's pdf is the reflectivity and the light estimate is
+// throughput * emission * lobe pdf / light pdf. Mirror bounces cannot be sampled from a light.
+#include <cstdint>
+#include <vector>
+#include "Vec3.h"
+
+struct Scene;
+
+struct LightList {
+    std::vector<uint32_t> spheres; // Emissive spheres, ascending index into Scene::objects
+    std::vector<double> cdf;       // Selection probability of spheres[0..i]; the last entry is 1
+
+    bool empty() const { return spheres.empty(); }
+    // Probability of picking the sphere, 0 when it is not a light.
+    double pmf(uint32_t sphere) const;
+};
+
+// Rebuilds scene.lights from the objects' materials and current radii. Selection is proportional
+// to emitted power (luminance of the emission times surface area). build_acceleration() calls it.
+void build_light_list(Scene& scene);
+
+// A direction toward a light, seen from a shading point.
+struct LightSample {
+    uint32_t sphere = 0;
+    Vec3 direction;      // Unit length
+    double distance = 0; // Along direction, to the light's near surface
+    double pdf = 0;      // Solid angle, including the light's selection probability
+};
+
+// Picks a light with u1 (reused, rescaled, for the cone) and a direction toward it inside the cone
+// it subtends from `origin`. False when there is nothing to sample from there (no lights, or the
+// origin is inside the light it picked).
+bool sample_light(const Scene& scene, const Vec3& origin, double u1, double u2, LightSample& sample);
+// Solid-angle pdf of sample_light() returning a direction onto `sphere` from `origin`.
+double light_pdf(const Scene& scene, const Vec3& origin, uint32_t sphere);
+
+// The glossy lobe a reflection ray was drawn from: the mirror direction bent toward a cosine
+// sample about the normal by `roughness` (see shade_hit).
+struct ReflectionLobe {
+    Vec3 normal;
+    Vec3 mirror;
+    double roughness = 0.0; // 0 for camera rays, mirror bounces and when there is no light sampling
+};
+
+// Solid-angle pdf of the lobe producing `direction`.
+double lobe_pdf(const ReflectionLobe& lobe, const Vec3& direction);
+
+// Power heuristic weight of a strategy with pdf `a` against one with pdf `b`.
+inline double mis_weight(double a, double b) {
+    const double a2 = a * a;
+    const double b2 = b * b;
+    return a2 + b2 > 0.0 ? a2 / (a2 + b2) : 0.0;
+}
@@ -0,0 +1,17 @@
+#include "Log.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cstdio>
+#endif
+
+void log_message(const std::string& message) {
+#ifdef _WIN32
+    OutputDebugStringA(message.c_str());
+#else
+    std::fputs(message.c_str(), stderr);
+#endif
+}
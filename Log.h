@@ -0,0 +1,6 @@
+#pragma once
+#include <string>
+
+// Writes a diagnostic line to the platform's debug channel.
+// On Windows this goes to OutputDebugStringA (visible in the debugger), elsewhere to stderr.
+void log_message(const std::string& message);
@@ -0,0 +1,240 @@
+#include "Profile.h"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include "Renderer.h"
+#include "Log.h"
+
+namespace {
+
+constexpr int PHASE_COUNT = static_cast<int>(ProfilePhase::PHASE_COUNT);
+
+constexpr int phase_slot(size_t thread, ProfilePhase phase) {
+    return static_cast<int>(thread) * PHASE_COUNT + static_cast<int>(phase);
+}
+
+void append_format(std::string& out, const char* format, ...) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int length = std::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length > 0) out.append(buffer, std::min<size_t>(static_cast<size_t>(length), sizeof(buffer) - 1));
+}
+
+} // namespace
+
+const char* profile_phase_name(ProfilePhase phase) {
+    switch (phase) {
+    case ProfilePhase::SceneReload: return "SceneReload";
+    case ProfilePhase::CameraUpdate: return "CameraUpdate";
+    case ProfilePhase::Animate: return "Animate";
+    case ProfilePhase::RenderFrame: return "RenderFrame";
+    case ProfilePhase::FrameWait: return "FrameWait";
+    case ProfilePhase::Temporal: return "Temporal";
+    case ProfilePhase::Denoise: return "Denoise";
+    case ProfilePhase::Upscale: return "Upscale";
+    case ProfilePhase::Present: return "Present";
+    case ProfilePhase::WorkerWake: return "WorkerWake";
+    case ProfilePhase::RenderTile: return "RenderTile";
+    case ProfilePhase::BarrierWait: return "BarrierWait";
+    default: return "Unknown";
+    }
+}
+
+uint64_t profile_time_ns(std::chrono::steady_clock::time_point time) {
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    if (time <= epoch) return 0;
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time - epoch).count());
+}
+
+FrameProfiler::FrameProfiler(size_t window_, size_t max_trace_events_)
+    : window(std::max<size_t>(window_, 1)), max_trace_events(max_trace_events_) {
+    profile_time_ns(std::chrono::steady_clock::now()); // Pin the epoch before any worker reads it
+}
+
+void FrameProfiler::record(ProfilePhase phase, uint64_t start_ns, uint64_t end_ns) {
+    if constexpr (!PROFILING_ENABLED) return;
+    const uint64_t duration_ns = end_ns > start_ns ? end_ns - start_ns : 0;
+    pending_phase_ms[static_cast<int>(phase)] += duration_ns / 1e6;
+    if (trace.size() < max_trace_events) trace.push_back(ProfileEvent{ start_ns, duration_ns, phase, 0, 0 });
+    else trace_truncated = true;
+}
+
+// Worker phase times come from WorkerFrameStats, which the pool fills in any build; only the
+// events and path counters depend on RM_PROFILING.
+void FrameProfiler::add_frame(const FrameStats& stats, double latency_ms) {
+    FrameRecord record;
+    const size_t threads = stats.workers.size() + 1;
+    record.frame_ms = stats.frame_ms;
+    record.latency_ms = latency_ms;
+    record.added_ns = profile_now_ns();
+    record.phase_ms.assign(threads * PHASE_COUNT, 0.0);
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        record.phase_ms[p] = pending_phase_ms[p];
+        pending_phase_ms[p] = 0.0;
+    }
+    record.phase_ms[phase_slot(0, ProfilePhase::RenderFrame)] = stats.frame_ms;
+    record.phase_ms[phase_slot(0, ProfilePhase::Temporal)] = stats.temporal_ms;
+    record.phase_ms[phase_slot(0, ProfilePhase::Denoise)] = stats.denoise_ms;
+    record.tiles.resize(stats.workers.size());
+    for (size_t i = 0; i < stats.workers.size(); ++i) {
+        const WorkerFrameStats& worker = stats.workers[i];
+        record.phase_ms[phase_slot(i + 1, ProfilePhase::WorkerWake)] = worker.wake_ms;
+        record.phase_ms[phase_slot(i + 1, ProfilePhase::RenderTile)] = worker.busy_ms;
+        record.phase_ms[phase_slot(i + 1, ProfilePhase::BarrierWait)] = worker.barrier_ms;
+        record.tiles[i] = worker.tiles_rendered;
+    }
+    record.rays = stats.rays_traced;
+    record.nodes_visited = stats.traversal.nodes_visited;
+    record.primitive_tests = stats.traversal.primitive_tests;
+    record.paths = stats.paths;
+
+    if constexpr (PROFILING_ENABLED) {
+        const size_t room = max_trace_events - std::min(max_trace_events, trace.size());
+        if (stats.events.size() > room) trace_truncated = true;
+        trace.insert(trace.end(), stats.events.begin(), stats.events.begin() + std::min(room, stats.events.size()));
+        if (!trace_truncated) trace_counters.push_back(CounterSample{ profile_now_ns(), record.rays, record.paths });
+    }
+
+    recent.push_back(std::move(record));
+    if (recent.size() > window) recent.pop_front();
+    frame_count++;
+}
+
+std::string FrameProfiler::summary() const {
+    std::string out;
+    if (recent.empty()) return "Profile: no frames yet\n";
+
+    double frame_sum = 0.0;
+    double frame_min = recent.front().frame_ms;
+    double frame_max = frame_min;
+    size_t threads = 0;
+    uint64_t rays = 0, nodes = 0, tests = 0;
+    PathStats paths;
+    for (const FrameRecord& record : recent) {
+        frame_sum += record.frame_ms;
+        frame_min = std::min(frame_min, record.frame_ms);
+        frame_max = std::max(frame_max, record.frame_ms);
+        threads = std::max(threads, record.phase_ms.size() / PHASE_COUNT);
+        rays += record.rays;
+        nodes += record.nodes_visited;
+        tests += record.primitive_tests;
+        paths += record.paths;
+    }
+    const double frames = static_cast<double>(recent.size());
+    append_format(out, "Profile: last %zu of %zu frames, %.3f ms/frame (min %.3f, max %.3f), %.2f Mrays/s\n",
+        recent.size(), frame_count, frame_sum / frames, frame_min, frame_max,
+        frame_sum > 0.0 ? rays / (frame_sum * 1000.0) : 0.0);
+
+    // Average ms per frame of each phase; a thread that did not exist in some frames counts as 0 there.
+    // Main-thread time recorded since the last frame (writing the output at exit) is included.
+    auto phase_avg = [&](size_t thread, ProfilePhase phase) {
+        double sum = thread == 0 ? pending_phase_ms[static_cast<int>(phase)] : 0.0;
+        for (const FrameRecord& record : recent) {
+            const size_t slot = phase_slot(thread, phase);
+            if (slot < record.phase_ms.size()) sum += record.phase_ms[slot];
+        }
+        return sum / frames;
+    };
+    append_format(out, "  Main:      scene reload %.3f ms, camera %.3f ms, animate %.3f ms, render %.3f ms (temporal %.3f ms, denoise %.3f ms), waited %.3f ms, upscale %.3f ms, present %.3f ms\n",
+        phase_avg(0, ProfilePhase::SceneReload), phase_avg(0, ProfilePhase::CameraUpdate), phase_avg(0, ProfilePhase::Animate),
+        phase_avg(0, ProfilePhase::RenderFrame),
+        phase_avg(0, ProfilePhase::Temporal), phase_avg(0, ProfilePhase::Denoise), phase_avg(0, ProfilePhase::FrameWait),
+        phase_avg(0, ProfilePhase::Upscale), phase_avg(0, ProfilePhase::Present));
+    double latency_sum = 0.0, latency_max = 0.0;
+    for (const FrameRecord& record : recent) {
+        latency_sum += record.latency_ms;
+        latency_max = std::max(latency_max, record.latency_ms);
+    }
+    if (latency_max > 0.0) {
+        const double span_ms = (recent.back().added_ns - recent.front().added_ns) / 1e6;
+        append_format(out, "  Loop:      %.2f frames/s, latency %.3f ms (max %.3f) from input to present\n",
+            recent.size() > 1 && span_ms > 0.0 ? (frames - 1.0) * 1000.0 / span_ms : 0.0, latency_sum / frames, latency_max);
+    }
+    for (size_t t = 1; t < threads; ++t) {
+        double tiles = 0.0;
+        for (const FrameRecord& record : recent) {
+            if (t - 1 < record.tiles.size()) tiles += record.tiles[t - 1];
+        }
+        append_format(out, "  Worker %-3zu wake %.3f ms, tiles %.3f ms (%.1f tiles), barrier %.3f ms\n", t - 1,
+            phase_avg(t, ProfilePhase::WorkerWake), phase_avg(t, ProfilePhase::RenderTile), tiles / frames,
+            phase_avg(t, ProfilePhase::BarrierWait));
+    }
+    if (rays > 0) {
+        append_format(out, "  Per ray:   %.2f nodes visited, %.2f sphere tests\n",
+            static_cast<double>(nodes) / rays, static_cast<double>(tests) / rays);
+    }
+    if constexpr (!PROFILING_ENABLED) {
+        out += "  Path counters compiled out (RM_PROFILING=0)\n";
+        return out;
+    }
+    const uint64_t path_count = paths.paths();
+    if (path_count > 0) {
+        append_format(out, "  Paths:     %.1f%% escaped, %.1f%% absorbed, %.1f%% roulette, %.1f%% cut at max depth, %.2f rays per path\n",
+            100.0 * paths.escaped / path_count, 100.0 * paths.absorbed / path_count, 100.0 * paths.roulette / path_count,
+            100.0 * paths.depth_limited / path_count, static_cast<double>(rays) / path_count);
+        out += "  Rays by depth:";
+        for (int d = 0; d < PathStats::DEPTH_BUCKETS && paths.rays[d] > 0; ++d) {
+            append_format(out, " %.3g", static_cast<double>(paths.rays[d]) / frames);
+        }
+        out += " per frame\n";
+    }
+    return out;
+}
+
+void FrameProfiler::clear_trace() {
+    trace.clear();
+    trace_counters.clear();
+    trace_truncated = false;
+}
+
+// Chrome trace-event format: complete ("X") events with microsecond timestamps, thread names as
+// metadata and the per-frame counters as counter ("C") tracks.
+bool FrameProfiler::write_chrome_trace(const std::string& path) const {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        log_message("Error: Could not open trace file: " + path + "\n");
+        return false;
+    }
+    uint16_t max_thread = 0;
+    for (const ProfileEvent& event : trace) max_thread = std::max(max_thread, event.thread);
+    const unsigned frames_track = max_thread + 1u;
+
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Main\"}}";
+    for (uint16_t t = 1; t <= max_thread; ++t) {
+        append_format(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"Worker %u\"}}", t, t - 1);
+    }
+    append_format(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"Frames\"}}", frames_track);
+    for (const ProfileEvent& event : trace) {
+        append_format(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u",
+            profile_phase_name(event.phase), event.start_ns / 1e3, event.duration_ns / 1e3,
+            event.phase == ProfilePhase::RenderFrame ? frames_track : event.thread);
+        if (event.phase == ProfilePhase::RenderTile) append_format(out, ",\"args\":{\"tile\":%u}", event.detail);
+        out += '}';
+        if (out.size() > (1u << 20)) {
+            std::fwrite(out.data(), 1, out.size(), file);
+            out.clear();
+        }
+    }
+    for (const CounterSample& sample : trace_counters) {
+        append_format(out, ",\n{\"name\":\"Rays\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{", sample.time_ns / 1e3);
+        for (int d = 0; d < PathStats::DEPTH_BUCKETS; ++d) {
+            if (sample.paths.rays[d] == 0 && d > 0) break;
+            append_format(out, "%s\"depth %d\":%llu", d > 0 ? "," : "", d, static_cast<unsigned long long>(sample.paths.rays[d]));
+        }
+        append_format(out, "}},\n{\"name\":\"Path ends\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":"
+            "{\"escaped\":%llu,\"absorbed\":%llu,\"roulette\":%llu,\"max depth\":%llu}}", sample.time_ns / 1e3,
+            static_cast<unsigned long long>(sample.paths.escaped), static_cast<unsigned long long>(sample.paths.absorbed),
+            static_cast<unsigned long long>(sample.paths.roulette), static_cast<unsigned long long>(sample.paths.depth_limited));
+    }
+    out += "\n]}\n";
+    std::fwrite(out.data(), 1, out.size(), file);
+    bool ok = std::ferror(file) == 0;
+    std::fclose(file);
+    if (trace_truncated) {
+        log_message("Warning: trace " + path + " stops early, the event limit was reached\n");
+    }
+    return ok;
+}
@@ -0,0 +1,144 @@
+#pragma once
+// Built-in profiling: path counters in the integrators, per-thread timing of the frame phases, a
+// rolling text summary and Chrome trace-event export (load the JSON in chrome://tracing or
+// Perfetto). Everything on the hot path is behind RM_PROFILING, so a build with RM_PROFILING=0
+// (CMake: -DRM_PROFILING=OFF) compiles the counters and tile events out entirely.
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#ifndef RM_PROFILING
+#define RM_PROFILING 1
+#endif
+
+inline constexpr bool PROFILING_ENABLED = RM_PROFILING != 0;
+
+// What a span of profiled time was spent on. The first group runs on the thread that drives the
+// frame loop, the second on the render workers.
+enum class ProfilePhase : uint8_t {
+    SceneReload,  // SceneManager::poll, including any re-parse and rebuild
+    CameraUpdate, // Input handling and camera recomputation
+    Animate,      // SceneManager::animate: posing the animated spheres, BVH refit and any rebuild
+    RenderFrame,  // From RenderThreadPool::submit_frame until the frame's last pass is done
+    FrameWait,    // Blocked in RenderThreadPool::wait_frame; all of RenderFrame unless the loop is pipelined
+    Temporal,     // Inside wait_frame, temporal reprojection and blending (run on the workers)
+    Denoise,      // Inside wait_frame, the denoiser passes (run on the workers)
+    Upscale,      // RenderThreadPool::upscale of a dynamic-resolution frame to the output size
+    Present,      // Showing (viewer) or writing (CLI) the finished image
+    WorkerWake,   // From the frame being published until a worker picks it up
+    RenderTile,   // One render_chunk call
+    BarrierWait,  // From a worker's last tile until the slowest worker finished
+    PHASE_COUNT
+};
+
+const char* profile_phase_name(ProfilePhase phase);
+
+// Nanoseconds since the first call in this process, on the steady clock; the time base of every
+// ProfileEvent.
+uint64_t profile_time_ns(std::chrono::steady_clock::time_point time);
+inline uint64_t profile_now_ns() { return profile_time_ns(std::chrono::steady_clock::now()); }
+
+// `thread` is 0 for the thread that drives the frames and 1 + the worker index for render workers.
+// RenderFrame spans overlap the main thread's own phases in a pipelined loop; the trace draws them
+// on a track of their own.
+// `detail` is the tile index for RenderTile and unused otherwise.
+struct ProfileEvent {
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    ProfilePhase phase;
+    uint16_t thread;
+    uint32_t detail;
+};
+
+// How the paths of a frame went, counted by both integrators. Every pixel sample starts one path
+// at depth 0; a path ends when it escapes to the background, lands on a surface that reflects
+// nothing (absorbed), loses at Russian roulette, or would reflect past the scene's max ray depth.
+struct PathStats {
+    static constexpr int DEPTH_BUCKETS = 16; // Deeper bounces are counted in the last bucket
+    uint64_t rays[DEPTH_BUCKETS] = {};       // Rays traced per bounce depth
+    uint64_t escaped = 0;
+    uint64_t absorbed = 0;
+    uint64_t roulette = 0;
+    uint64_t depth_limited = 0;
+
+    static int bucket(int depth) { return depth < DEPTH_BUCKETS ? depth : DEPTH_BUCKETS - 1; }
+    uint64_t paths() const { return escaped + absorbed + roulette + depth_limited; }
+
+    PathStats& operator+=(const PathStats& other) {
+        for (int d = 0; d < DEPTH_BUCKETS; ++d) rays[d] += other.rays[d];
+        escaped += other.escaped;
+        absorbed += other.absorbed;
+        roulette += other.roulette;
+        depth_limited += other.depth_limited;
+        return *this;
+    }
+};
+
+struct FrameStats;
+
+// Collects the profile of a frame loop. The loop times its own phases with record() / ProfileScope
+// and hands every FrameStats to add_frame(), which takes the workers' events and counters, with
+// the frame's latency: from sampling the input (camera, scene) it shows to presenting it.
+// summary() averages the last `window` frames; the trace keeps events until `max_trace_events`.
+class FrameProfiler {
+public:
+    explicit FrameProfiler(size_t window = 100, size_t max_trace_events = 4u << 20);
+
+    // A main-thread phase from start_ns to end_ns, counted towards the next add_frame().
+    void record(ProfilePhase phase, uint64_t start_ns, uint64_t end_ns);
+    void add_frame(const FrameStats& stats, double latency_ms = 0.0);
+
+    size_t frames() const { return frame_count; }
+    // Multi-line text: frame time, main-thread phases, per-worker phases and path counters.
+    std::string summary() const;
+    bool write_chrome_trace(const std::string& path) const;
+    // Drops the trace collected so far, so the next write starts from here (the summary is kept).
+    void clear_trace();
+
+private:
+    struct FrameRecord {
+        double frame_ms = 0.0;
+        double latency_ms = 0.0;
+        uint64_t added_ns = 0;         // When add_frame() took it; the spacing gives the throughput
+        std::vector<double> phase_ms;  // [thread * PHASE_COUNT + phase]
+        std::vector<uint32_t> tiles;   // Per worker
+        uint64_t rays = 0;
+        uint64_t nodes_visited = 0;
+        uint64_t primitive_tests = 0;
+        PathStats paths;
+    };
+    struct CounterSample {
+        uint64_t time_ns; // End of the frame
+        uint64_t rays;
+        PathStats paths;
+    };
+
+    size_t window;
+    size_t max_trace_events;
+    size_t frame_count = 0;
+    double pending_phase_ms[static_cast<int>(ProfilePhase::PHASE_COUNT)] = {};
+    std::deque<FrameRecord> recent;
+    std::vector<ProfileEvent> trace;
+    std::vector<CounterSample> trace_counters; // One per frame, drawn as counter tracks
+    bool trace_truncated = false;
+};
+
+// Times the enclosing block as one main-thread phase.
+class ProfileScope {
+public:
+    ProfileScope(FrameProfiler& profiler_, ProfilePhase phase_) : profiler(profiler_), phase(phase_) {
+        if constexpr (PROFILING_ENABLED) start_ns = profile_now_ns();
+    }
+    ~ProfileScope() {
+        if constexpr (PROFILING_ENABLED) profiler.record(phase, start_ns, profile_now_ns());
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    FrameProfiler& profiler;
+    ProfilePhase phase;
+    uint64_t start_ns = 0;
+};
@@ -0,0 +1,464 @@
+// Reproducible benchmark: generates (or loads) a scene, renders it headless from fixed camera
+// positions and reports throughput, frame time percentiles, load and build times as JSON, so runs
+// can be compared across commits and machines. Progress goes to stderr, the report to stdout
+// (or --json).
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <thread>
+#include "Renderer.h"
+#include "SceneGenerator.h"
+#include "SceneBinary.h"
+
+struct BenchView {
+    std::string name;
+    Vec3 position;
+    Vec3 target;
+    double fov_degrees = 60.0;
+};
+
+struct BenchOptions {
+    SceneGeneratorSettings generator;
+    std::string scene_file;     // Empty = generated scene
+    std::string emit_file;      // Write the generated scene here and exit
+    std::string json_file;      // Empty = stdout
+    int width = 640;
+    int height = 360;
+    int spp = 0;                // 0 = the scene's setting
+    int frames = 10;
+    int warmup = 2;
+    int threads = 0;
+    bool use_bvh = true;
+    std::string simd = "auto";
+    Precision precision = Precision::Double;
+    RenderSettings settings;
+    std::vector<BenchView> views; // Empty = the default views for the scene
+    double time_step = 1.0 / 30.0; // Animation time per frame, when the scene has moving spheres
+    AnimationSettings animation;
+};
+
+static void print_usage() {
+    std::printf(
+        "Usage: rmbench [options]\n"
+        "Scene (generated unless --scene is given):\n"
+        "  --spheres <n>           Sphere count (default 20000)\n"
+        "  --materials <n>         Palette size (default 16)\n"
+        "  --mix <d,m,g,e>         Weights of diffuse, mirror, glossy and emissive materials (default 0.5,0.2,0.25,0.05)\n"
+        "  --roughness <r>         Roughness of the glossy materials (default 0.2)\n"
+        "  --depth <n>             Max ray depth (default 6)\n"
+        "  --seed <n>              Generator seed (default 1)\n"
+        "  --animated <fraction>   Share of the spheres that move (default 0)\n"
+        "  --speed <v>             Their speed in units per second (default 0.5)\n"
+        "  --scene <file>          Benchmark a .txt or .rmsc scene instead\n"
+        "  --emit <file>           Write the generated scene in scene.txt format and exit\n"
+        "Rendering:\n"
+        "  --width <n> --height <n> Image size (default 640x360)\n"
+        "  --spp <n>               Samples per pixel (default: the scene's)\n"
+        "  --frames <n>            Timed frames per view (default 10)\n"
+        "  --warmup <n>            Untimed frames per view before those (default 2)\n"
+        "  --threads <n>           Worker threads (default: hardware concurrency)\n"
+        "  --accel <bvh|none>      Acceleration structure (default bvh)\n"
+        "  --simd <isa>            auto, scalar, sse2, avx2, avx512 (default auto)\n"
+        "  --precision <p>         double or float (default double)\n"
+        "  --packets <off|4x4|8x8> Primary ray packets (default 8x8)\n"
+        "  --integrator <i>        recursive or wavefront (default recursive)\n"
+        "  --roulette <on|off>     Russian roulette of dim paths (default off)\n"
+        "  --nee <on|off>          Light sampling at glossy bounces (default on)\n"
+        "  --camera px,py,pz,tx,ty,tz[,fov]\n"
+        "                          Replaces the default views; repeat for several\n"
+        "  --time-step <s>         Animation: scene time per frame, including warmup (default 1/30)\n"
+        "  --rebuild-threshold <x> Animation: rebuild once the refit BVH's SAH cost is x times the built one (default 1.5)\n"
+        "Output:\n"
+        "  --json <file>           Write the report here instead of stdout\n");
+}
+
+static bool parse_numbers(const std::string& value, std::vector<double>& numbers) {
+    std::istringstream stream(value);
+    std::string token;
+    while (std::getline(stream, token, ',')) {
+        numbers.push_back(std::stod(token));
+    }
+    return !numbers.empty();
+}
+
+static bool parse_args(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            print_usage();
+            std::exit(0);
+        }
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        std::string value = argv[++i];
+        try {
+            std::vector<double> numbers;
+            if (arg == "--spheres") options.generator.sphere_count = static_cast<uint32_t>(std::stoul(value));
+            else if (arg == "--materials") options.generator.material_count = static_cast<uint32_t>(std::stoul(value));
+            else if (arg == "--mix") {
+                if (!parse_numbers(value, numbers) || numbers.size() != 4) {
+                    std::fprintf(stderr, "Invalid --mix value: %s\n", value.c_str());
+                    return false;
+                }
+                options.generator.diffuse_weight = numbers[0];
+                options.generator.mirror_weight = numbers[1];
+                options.generator.glossy_weight = numbers[2];
+                options.generator.emissive_weight = numbers[3];
+            }
+            else if (arg == "--roughness") options.generator.roughness = std::stod(value);
+            else if (arg == "--depth") options.generator.max_ray_depth = std::stoi(value);
+            else if (arg == "--seed") options.generator.seed = static_cast<uint32_t>(std::stoul(value));
+            else if (arg == "--animated") options.generator.animated_fraction = std::stod(value);
+            else if (arg == "--speed") options.generator.speed = std::stod(value);
+            else if (arg == "--time-step") options.time_step = std::stod(value);
+            else if (arg == "--rebuild-threshold") options.animation.rebuild_threshold = std::stod(value);
+            else if (arg == "--scene") options.scene_file = value;
+            else if (arg == "--emit") options.emit_file = value;
+            else if (arg == "--json") options.json_file = value;
+            else if (arg == "--width") options.width = std::stoi(value);
+            else if (arg == "--height") options.height = std::stoi(value);
+            else if (arg == "--spp") options.spp = std::stoi(value);
+            else if (arg == "--frames") options.frames = std::stoi(value);
+            else if (arg == "--warmup") options.warmup = std::stoi(value);
+            else if (arg == "--threads") options.threads = std::stoi(value);
+            else if (arg == "--accel") {
+                if (value != "bvh" && value != "none") {
+                    std::fprintf(stderr, "Invalid --accel value: %s\n", value.c_str());
+                    return false;
+                }
+                options.use_bvh = value == "bvh";
+            }
+            else if (arg == "--simd") options.simd = value;
+            else if (arg == "--precision") {
+                if (!parse_precision(value, options.precision)) {
+                    std::fprintf(stderr, "Invalid --precision value: %s\n", value.c_str());
+                    return false;
+                }
+            }
+            else if (arg == "--packets") {
+                if (value == "off") options.settings.primary_rays = PrimaryRayMode::Single;
+                else if (value == "4x4") options.settings.primary_rays = PrimaryRayMode::Packet4x4;
+                else if (value == "8x8") options.settings.primary_rays = PrimaryRayMode::Packet8x8;
+                else {
+                    std::fprintf(stderr, "Invalid --packets value: %s\n", value.c_str());
+                    return false;
+                }
+            }
+            else if (arg == "--integrator") {
+                if (value == "recursive") options.settings.integrator = Integrator::Recursive;
+                else if (value == "wavefront") options.settings.integrator = Integrator::Wavefront;
+                else {
+                    std::fprintf(stderr, "Invalid --integrator value: %s\n", value.c_str());
+                    return false;
+                }
+            }
+            else if (arg == "--roulette") {
+                if (value != "on" && value != "off") {
+                    std::fprintf(stderr, "Invalid --roulette value: %s\n", value.c_str());
+                    return false;
+                }
+                options.settings.roulette.enabled = value == "on";
+            }
+            else if (arg == "--nee") {
+                if (value != "on" && value != "off") {
+                    std::fprintf(stderr, "Invalid --nee value: %s\n", value.c_str());
+                    return false;
+                }
+                options.settings.next_event = value == "on";
+            }
+            else if (arg == "--camera") {
+                if (!parse_numbers(value, numbers) || (numbers.size() != 6 && numbers.size() != 7)) {
+                    std::fprintf(stderr, "Invalid --camera value: %s\n", value.c_str());
+                    return false;
+                }
+                BenchView view;
+                view.name = "camera" + std::to_string(options.views.size());
+                view.position = Vec3(numbers[0], numbers[1], numbers[2]);
+                view.target = Vec3(numbers[3], numbers[4], numbers[5]);
+                if (numbers.size() == 7) view.fov_degrees = numbers[6];
+                options.views.push_back(view);
+            }
+            else {
+                std::fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+                return false;
+            }
+        }
+        catch (const std::exception&) {
+            std::fprintf(stderr, "Invalid value for %s: %s\n", arg.c_str(), value.c_str());
+            return false;
+        }
+    }
+    if (options.width <= 0 || options.height <= 0 || options.frames <= 0 || options.warmup < 0) {
+        std::fprintf(stderr, "Width, height and frames must be positive\n");
+        return false;
+    }
+    if (!(options.generator.animated_fraction >= 0.0 && options.generator.animated_fraction <= 1.0) || options.time_step < 0.0 ||
+        !(options.animation.rebuild_threshold >= 1.0)) {
+        std::fprintf(stderr, "--animated must be in [0, 1], --time-step not negative and --rebuild-threshold at least 1\n");
+        return false;
+    }
+    return true;
+}
+
+// Generated scenes: an overview of the whole field, a grazing view across it (deep occlusion,
+// many reflections off the ground) and a close-up. Loaded scenes: rmrender's default camera.
+static std::vector<BenchView> default_views(const BenchOptions& options) {
+    if (!options.scene_file.empty()) {
+        return { BenchView{ "default", Vec3(0, 1.0, 4.0), Vec3(0, 0.5, 0), 60.0 } };
+    }
+    const double extent = generated_scene_extent(options.generator);
+    return {
+        BenchView{ "overview", Vec3(0, 0.3 * extent + 1.5, 0.6 * extent + 2.0), Vec3(0, 0, 0), 50.0 },
+        BenchView{ "grazing", Vec3(0, 0.45, 0.5 * extent + 0.5), Vec3(0, 0.3, 0), 60.0 },
+        BenchView{ "closeup", Vec3(0.8, 0.7, 1.2), Vec3(0, 0.15, 0), 60.0 },
+    };
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Nearest-rank percentile of sorted values.
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+static std::string json_string(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+            continue;
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+static std::string json_vec3(const Vec3& v) {
+    char buffer[96];
+    std::snprintf(buffer, sizeof(buffer), "[%.6g, %.6g, %.6g]", v.x, v.y, v.z);
+    return buffer;
+}
+
+static const char* compiler_name() {
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc";
+#else
+    return "unknown";
+#endif
+}
+
+struct ViewResult {
+    BenchView view;
+    std::vector<double> frame_ms;
+    uint64_t rays = 0;
+    uint64_t paths = 0; // Pixel samples
+    TraversalStats traversal;
+};
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parse_args(argc, argv, options)) {
+        print_usage();
+        return 1;
+    }
+
+    SimdIsa isa;
+    if (!parse_simd_isa(options.simd, isa) || !set_active_simd_isa(isa)) {
+        std::fprintf(stderr, "SIMD ISA '%s' is unknown or not supported on this CPU\n", options.simd.c_str());
+        return 1;
+    }
+
+    // Generated scenes go through the text loader too, so load_ms tracks the real parser.
+    using clock = std::chrono::steady_clock;
+    double generate_ms = 0.0;
+    std::string scene_path = options.scene_file;
+    bool temporary_scene = false;
+    if (scene_path.empty()) {
+        auto generate_start = clock::now();
+        Scene generated = generate_scene(options.generator);
+        generate_ms = elapsed_ms(generate_start);
+        if (!options.emit_file.empty()) {
+            if (!write_scene_file(options.emit_file, generated)) return 1;
+            std::fprintf(stderr, "Wrote %s: %zu spheres, %zu materials\n", options.emit_file.c_str(),
+                generated.objects.size(), generated.materials.size());
+            return 0;
+        }
+        scene_path = (std::filesystem::temp_directory_path() / ("rmbench-" + std::to_string(options.generator.seed) + ".txt")).string();
+        if (!write_scene_file(scene_path, generated)) return 1;
+        temporary_scene = true;
+    }
+
+    Scene scene;
+    auto load_start = clock::now();
+    bool loaded = load_scene_any(scene_path, scene);
+    double load_ms = elapsed_ms(load_start);
+    if (temporary_scene) std::filesystem::remove(scene_path);
+    if (!loaded) {
+        std::fprintf(stderr, "Failed to load %s\n", scene_path.c_str());
+        return 1;
+    }
+    if (options.spp > 0) scene.samples_per_pixel = options.spp;
+
+    auto build_start = clock::now();
+    build_acceleration(scene, options.use_bvh, options.precision);
+    double build_ms = elapsed_ms(build_start);
+
+    const int thread_count = options.threads > 0 ? options.threads : default_thread_count();
+    RenderThreadPool pool(thread_count);
+    FrameBuffer frame;
+    frame.resize(options.width, options.height, false);
+    std::vector<BenchView> views = options.views.empty() ? default_views(options) : options.views;
+
+    // Moving spheres are posed and the BVH refit before every frame, warmup included, on the
+    // render pool; the frame times below do not include it.
+    const ParallelFor parallel = [&](int count, const std::function<void(int)>& task) { pool.parallel_for(count, task); };
+    std::vector<double> pose_ms;
+    std::vector<double> refit_ms;
+    int rebuilds = 0;
+    double rebuild_ms = 0.0;
+    int animation_frame = 0;
+
+    std::vector<ViewResult> results;
+    for (const BenchView& view : views) {
+        Camera camera;
+        camera.position = view.position;
+        camera.look_at_target = view.target;
+        camera.world_up_vector = Vec3(0, 1, 0);
+        camera.fov_degrees = view.fov_degrees;
+        camera.initialize(static_cast<double>(options.width) / options.height);
+
+        ViewResult result;
+        result.view = view;
+        for (int f = 0; f < options.warmup + options.frames; ++f) {
+            AnimationUpdate update;
+            if (!scene.animation.empty()) update = animate_scene(scene, ++animation_frame * options.time_step, options.animation, parallel);
+            FrameStats stats = pool.render_frame(FrameInfo{ f, options.settings }, scene, camera, frame);
+            if (f < options.warmup) continue;
+            if (update.spheres_posed > 0) {
+                pose_ms.push_back(update.pose_ms);
+                refit_ms.push_back(update.refit_ms);
+                rebuilds += update.rebuilt ? 1 : 0;
+                rebuild_ms += update.rebuild_ms;
+            }
+            result.frame_ms.push_back(stats.frame_ms);
+            result.rays += stats.rays_traced;
+            result.paths += stats.pixels_sampled * static_cast<uint64_t>(scene.samples_per_pixel > 0 ? scene.samples_per_pixel : 1);
+            result.traversal += stats.traversal;
+        }
+        std::sort(result.frame_ms.begin(), result.frame_ms.end());
+        double seconds = 0.0;
+        for (double ms : result.frame_ms) seconds += ms / 1000.0;
+        std::fprintf(stderr, "%s: median %.2f ms, %.2f Mrays/s\n", view.name.c_str(), percentile(result.frame_ms, 50.0),
+            seconds > 0.0 ? result.rays / seconds / 1e6 : 0.0);
+        results.push_back(std::move(result));
+    }
+
+    FILE* out = stdout;
+    if (!options.json_file.empty()) {
+        out = std::fopen(options.json_file.c_str(), "w");
+        if (!out) {
+            std::fprintf(stderr, "Cannot write %s\n", options.json_file.c_str());
+            return 1;
+        }
+    }
+
+    const BVHBuildStats& bvh_stats = scene.bvh.build_stats();
+    std::fprintf(out, "{\n");
+    std::fprintf(out, "  \"format_version\": 1,\n");
+    std::fprintf(out, "  \"system\": {\"hardware_threads\": %u, \"threads\": %d, \"simd\": %s, \"compiler\": %s},\n",
+        std::thread::hardware_concurrency(), thread_count, json_string(simd_isa_name(active_simd_isa())).c_str(),
+        json_string(compiler_name()).c_str());
+    std::fprintf(out, "  \"config\": {\"width\": %d, \"height\": %d, \"spp\": %d, \"max_ray_depth\": %d, \"frames\": %d, \"warmup\": %d, "
+        "\"accel\": %s, \"precision\": %s, \"packets\": %s, \"integrator\": %s, \"sampler\": %s, \"roulette\": %s, \"nee\": %s},\n",
+        options.width, options.height, scene.samples_per_pixel, scene.max_ray_depth, options.frames, options.warmup,
+        options.use_bvh ? "\"bvh\"" : "\"none\"", json_string(precision_name(scene.precision)).c_str(),
+        options.settings.primary_rays == PrimaryRayMode::Single ? "\"off\"" : options.settings.primary_rays == PrimaryRayMode::Packet4x4 ? "\"4x4\"" : "\"8x8\"",
+        options.settings.integrator == Integrator::Wavefront ? "\"wavefront\"" : "\"recursive\"",
+        json_string(sampler_name(options.settings.sampler)).c_str(), options.settings.roulette.enabled ? "true" : "false",
+        options.settings.next_event ? "true" : "false");
+    std::fprintf(out, "  \"scene\": {\"source\": %s, ", json_string(options.scene_file.empty() ? "generated" : options.scene_file).c_str());
+    if (options.scene_file.empty()) {
+        const SceneGeneratorSettings& g = options.generator;
+        std::fprintf(out, "\"generator\": {\"spheres\": %u, \"materials\": %u, \"mix\": [%g, %g, %g, %g], \"roughness\": %g, "
+            "\"animated\": %g, \"speed\": %g, \"seed\": %u}, ",
+            g.sphere_count, g.material_count, g.diffuse_weight, g.mirror_weight, g.glossy_weight, g.emissive_weight, g.roughness,
+            g.animated_fraction, g.speed, g.seed);
+    }
+    std::fprintf(out, "\"spheres\": %zu, \"materials\": %zu, \"generate_ms\": %.3f, \"load_ms\": %.3f, \"build_ms\": %.3f",
+        scene.objects.size(), scene.materials.size(), generate_ms, load_ms, build_ms);
+    if (options.use_bvh) {
+        std::fprintf(out, ", \"bvh\": {\"nodes\": %u, \"leaves\": %u, \"depth\": %u, \"sah_cost\": %.3f}",
+            bvh_stats.node_count, bvh_stats.leaf_count, bvh_stats.max_depth, bvh_stats.sah_cost);
+    }
+    std::fprintf(out, "},\n");
+
+    uint64_t total_frames = 0;
+    double total_frame_ms = 0.0;
+    for (const ViewResult& r : results) {
+        for (double ms : r.frame_ms) total_frame_ms += ms;
+        total_frames += r.frame_ms.size();
+    }
+    if (!pose_ms.empty()) {
+        // Share of the frame: everything animate_scene() did over everything the timed frames took.
+        double pose_sum = 0.0;
+        double refit_sum = 0.0;
+        for (double ms : pose_ms) pose_sum += ms;
+        for (double ms : refit_ms) refit_sum += ms;
+        const double frame_mean = total_frames > 0 ? total_frame_ms / total_frames : 0.0;
+        const double animate_mean = (pose_sum + refit_sum + rebuild_ms) / pose_ms.size();
+        std::sort(pose_ms.begin(), pose_ms.end());
+        std::sort(refit_ms.begin(), refit_ms.end());
+        std::fprintf(out, "  \"animation\": {\"moving_spheres\": %zu, \"keyframes\": %zu, \"time_step\": %g, \"rebuild_threshold\": %g, "
+            "\"pose_ms\": {\"p50\": %.3f, \"mean\": %.3f}, \"refit_ms\": {\"p50\": %.3f, \"mean\": %.3f, \"max\": %.3f}, "
+            "\"rebuilds\": %d, \"rebuild_ms\": %.3f, \"frame_share\": %.4f},\n",
+            scene.animation.tracks.size(), scene.animation.keys.size(), options.time_step, options.animation.rebuild_threshold,
+            percentile(pose_ms, 50.0), pose_sum / pose_ms.size(), percentile(refit_ms, 50.0), refit_sum / refit_ms.size(), refit_ms.back(),
+            rebuilds, rebuild_ms, frame_mean > 0.0 ? animate_mean / frame_mean : 0.0);
+    }
+    std::fprintf(out, "  \"views\": [\n");
+
+    uint64_t total_rays = 0;
+    double total_seconds = 0.0;
+    for (size_t v = 0; v < results.size(); ++v) {
+        const ViewResult& r = results[v];
+        double seconds = 0.0;
+        for (double ms : r.frame_ms) seconds += ms / 1000.0;
+        total_rays += r.rays;
+        total_seconds += seconds;
+        std::fprintf(out, "    {\"name\": %s, \"position\": %s, \"target\": %s, \"fov\": %g, \"rays\": %llu, \"mrays_per_s\": %.3f, "
+            "\"rays_per_path\": %.3f, \"nodes_per_ray\": %.3f, \"tests_per_ray\": %.3f,\n",
+            json_string(r.view.name).c_str(), json_vec3(r.view.position).c_str(), json_vec3(r.view.target).c_str(), r.view.fov_degrees,
+            static_cast<unsigned long long>(r.rays), seconds > 0.0 ? r.rays / seconds / 1e6 : 0.0,
+            r.paths > 0 ? static_cast<double>(r.rays) / r.paths : 0.0,
+            r.rays > 0 ? static_cast<double>(r.traversal.nodes_visited) / r.rays : 0.0,
+            r.rays > 0 ? static_cast<double>(r.traversal.primitive_tests) / r.rays : 0.0);
+        std::fprintf(out, "     \"frame_ms\": {\"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f}}%s\n",
+            r.frame_ms.front(), percentile(r.frame_ms, 50.0), percentile(r.frame_ms, 90.0), percentile(r.frame_ms, 99.0),
+            r.frame_ms.back(), seconds * 1000.0 / r.frame_ms.size(), v + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(out, "  ],\n");
+    std::fprintf(out, "  \"total\": {\"rays\": %llu, \"seconds\": %.4f, \"mrays_per_s\": %.3f}\n",
+        static_cast<unsigned long long>(total_rays), total_seconds, total_seconds > 0.0 ? total_rays / total_seconds / 1e6 : 0.0);
+    std::fprintf(out, "}\n");
+    if (out != stdout) std::fclose(out);
+    return 0;
+}
@@ -1,4 +1,5 @@
 #define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
 #define M_PI 3.14159265358979323846
 #include <windows.h>
 #include <vector>
@@ -25,167 +26,63 @@
 #include "ColorUtils.h"
 #include "Material.h"
 #include "SceneLoader.h"
+#include "SceneManager.h"
+#include "Renderer.h"
+#include "Log.h"
+#include "Profile.h"
+#include "Resolution.h"
 
-const int IMAGE_WIDTH = 1920;
-const int IMAGE_HEIGHT = 1080;
-const int NUM_THREADS = 16;
-const double REFLECTION_EPSILON = 1e-4;
+const int INITIAL_WIDTH = 1920; // Window client size at startup; the output follows the window after that
+const int INITIAL_HEIGHT = 1080;
 
 HWND g_hwnd = nullptr;
-std::vector<uint32_t> g_pixelBuffer(IMAGE_WIDTH* IMAGE_HEIGHT);
+FrameBuffer g_frameBuffer; // Render target, sized by the dynamic resolution controller
+FrameBuffer g_output;      // Window-sized image that g_frameBuffer is upscaled into
 BITMAPINFO g_bitmapInfo = { 0 };
+int g_client_width = INITIAL_WIDTH; // Latest WM_SIZE; applied to g_output between frames
+int g_client_height = INITIAL_HEIGHT;
 
-struct FrameInfo {
-    long long frameNumber;
-};
-FrameInfo g_currentFrameInfo;
-
-std::vector<std::jthread> g_threads;
-std::mutex g_renderMutex;
-std::condition_variable g_workerStartCv;
-std::condition_variable g_mainWaitCv;
-std::atomic<long long> g_targetFrameId = -1;
-std::atomic<int> g_workersDoneCount = 0;
-std::atomic<bool> g_shutdownThreads = false;
-
-Scene g_current_scene;
 Camera g_camera;
-
-Vec3 trace_ray(const Ray& ray, int depth, std::mt19937& rng); // Forward declaration
-
-struct ThreadRenderTask {
-    int threadId;
-    int startY;
-    int endY;
-    std::vector<uint32_t>* pixelBuffer_ptr;
-};
-std::vector<ThreadRenderTask> g_renderTasks;
-
-void render_chunk(const FrameInfo& frame_info, const ThreadRenderTask& task, std::mt19937& rng_for_thread) {
-    for (int y = task.startY; y < task.endY; ++y) {
-        for (int x = 0; x < IMAGE_WIDTH; ++x) {
-            Vec3 accumulated_color(0.0, 0.0, 0.0);
-            int samples = g_current_scene.samples_per_pixel > 0 ? g_current_scene.samples_per_pixel : 1;
-
-            for (int s = 0; s < samples; ++s) {
-                std::uniform_real_distribution<double> jitter_dist(0.0, 1.0);
-                double dx = (samples > 1) ? jitter_dist(rng_for_thread) : 0.5;
-                double dy = (samples > 1) ? jitter_dist(rng_for_thread) : 0.5;
-                double u = (static_cast<double>(x) + dx) / IMAGE_WIDTH;
-                double v = (static_cast<double>(y) + dy) / IMAGE_HEIGHT;
-                Ray primary_ray = g_camera.get_ray(u, v);
-                accumulated_color = accumulated_color + trace_ray(primary_ray, 0, rng_for_thread);
-            }
-            Vec3 final_pixel_color = accumulated_color / static_cast<double>(samples);
-            (*task.pixelBuffer_ptr)[y * IMAGE_WIDTH + x] = vec3_to_uint32_color(final_pixel_color);
-        }
-    }
-}
-
-Vec3 trace_ray(const Ray& ray, int depth, std::mt19937& rng) {
-    if (depth >= g_current_scene.max_ray_depth) {
-        return Vec3(0.0, 0.0, 0.0);
-    }
-
-    double closest_t = -1.0;
-    const Sphere* hit_sphere = nullptr;
-    Vec3 hit_point;
-    Vec3 surface_normal;
-
-    for (const auto& sphere_obj : g_current_scene.objects) {
-        double t_intersection;
-        Vec3 current_hit_point;
-        Vec3 current_normal;
-        if (sphere_obj.intersect(ray, t_intersection, current_hit_point, current_normal)) {
-            double t_min_check = (depth == 0) ? 1e-4 : REFLECTION_EPSILON;
-            if (t_intersection > t_min_check && (closest_t < 0 || t_intersection < closest_t)) {
-                closest_t = t_intersection;
-                hit_sphere = &sphere_obj;
-                hit_point = current_hit_point;
-                surface_normal = current_normal;
-            }
-        }
-    }
-
-    if (!hit_sphere) {
-        return g_current_scene.background_color;
-    }
-
-    const Material& material = hit_sphere->material;
-    Vec3 final_color = material.emission_color;
-    double base_color_contribution_factor = 1.0 - material.reflectivity;
-
-    if (base_color_contribution_factor > 1e-5) {
-        final_color = final_color + material.base_color * base_color_contribution_factor;
-    }
-
-    if (material.reflectivity > 1e-5) {
-        Vec3 incident_dir = ray.direction;
-        Vec3 perfect_reflection_dir = incident_dir - surface_normal * (2.0 * Vec3::dot(incident_dir, surface_normal));
-        perfect_reflection_dir = perfect_reflection_dir.normalize();
-        Vec3 scattered_reflection_dir;
-
-        if (material.roughness < 1e-5) {
-            scattered_reflection_dir = perfect_reflection_dir;
-        }
-        else {
-            Vec3 tangent, bitangent;
-            create_onb(surface_normal, tangent, bitangent);
-            Vec3 sample_local_hemisphere = random_cosine_direction(rng);
-            Vec3 random_world_dir = (tangent * sample_local_hemisphere.x +
-                bitangent * sample_local_hemisphere.y +
-                surface_normal * sample_local_hemisphere.z).normalize();
-            scattered_reflection_dir = (perfect_reflection_dir * (1.0 - material.roughness) +
-                random_world_dir * material.roughness).normalize();
-        }
-        Ray reflection_ray(hit_point + surface_normal * REFLECTION_EPSILON, scattered_reflection_dir);
-        Vec3 reflected_light = trace_ray(reflection_ray, depth + 1, rng);
-        final_color = final_color + reflected_light * material.reflectivity;
-    }
-    return final_color;
-}
-
-void render_chunk_loop(const ThreadRenderTask& task) {
-    long long worker_last_completed_frame_id = -1;
-    std::mt19937 thread_rng(static_cast<unsigned int>(std::chrono::high_resolution_clock::now().time_since_epoch().count()) + task.threadId);
-    while (true) {
-        FrameInfo local_frame_info;
-        long long current_frame_to_render;
-        {
-            std::unique_lock<std::mutex> lock(g_renderMutex);
-            g_workerStartCv.wait(lock, [&] {
-                return g_targetFrameId.load(std::memory_order_acquire) > worker_last_completed_frame_id ||
-                    g_shutdownThreads.load(std::memory_order_acquire);
-                });
-            if (g_shutdownThreads.load(std::memory_order_acquire)) {
-                break;
-            }
-            current_frame_to_render = g_targetFrameId.load(std::memory_order_acquire);
-            local_frame_info = g_currentFrameInfo;
-        }
-        render_chunk(local_frame_info, task, thread_rng);
-        worker_last_completed_frame_id = current_frame_to_render;
-        if (g_workersDoneCount.fetch_add(1, std::memory_order_acq_rel) + 1 == NUM_THREADS) {
-            std::lock_guard<std::mutex> lock(g_renderMutex);
-            g_mainWaitCv.notify_one();
-        }
-    }
-}
+FrameProfiler g_profiler(100, 1u << 20); // Summary over the last 100 frames; F2 writes the trace
+bool g_trace_requested = false;
+bool g_denoise_toggled = false; // F3
+bool g_temporal_toggled = false; // F4
+bool g_resolution_toggled = false; // F5
+bool g_pipeline_toggled = false; // F6
+bool g_animation_toggled = false; // F7
+bool g_next_event_toggled = false; // F8
+int g_exposure_steps = 0; // Page Up / Page Down since the last frame, half a stop each
 
 LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
     switch (msg) {
     case WM_PAINT: {
+        ProfileScope present_scope(g_profiler, ProfilePhase::Present);
         PAINTSTRUCT ps;
         HDC hdc = BeginPaint(hwnd, &ps);
-        if (!g_pixelBuffer.empty()) {
-            StretchDIBits(hdc, 0, 0, IMAGE_WIDTH, IMAGE_HEIGHT, 0, 0, IMAGE_WIDTH, IMAGE_HEIGHT,
-                g_pixelBuffer.data(), &g_bitmapInfo, DIB_RGB_COLORS, SRCCOPY);
+        if (!g_output.pixels.empty()) {
+            StretchDIBits(hdc, 0, 0, g_output.width, g_output.height, 0, 0, g_output.width, g_output.height,
+                g_output.pixels.data(), &g_bitmapInfo, DIB_RGB_COLORS, SRCCOPY);
         }
         EndPaint(hwnd, &ps);
         return 0;
     }
     case WM_KEYDOWN:
         if (wParam == VK_ESCAPE) PostQuitMessage(0);
+        if (wParam == VK_F2) g_trace_requested = true;
+        if (wParam == VK_F3) g_denoise_toggled = true;
+        if (wParam == VK_F4) g_temporal_toggled = true;
+        if (wParam == VK_F5) g_resolution_toggled = true;
+        if (wParam == VK_F6) g_pipeline_toggled = true;
+        if (wParam == VK_F7) g_animation_toggled = true;
+        if (wParam == VK_F8) g_next_event_toggled = true;
+        if (wParam == VK_PRIOR) g_exposure_steps++;
+        if (wParam == VK_NEXT) g_exposure_steps--;
+        return 0;
+    case WM_SIZE:
+        if (LOWORD(lParam) > 0 && HIWORD(lParam) > 0) { // Not minimized
+            g_client_width = LOWORD(lParam);
+            g_client_height = HIWORD(lParam);
+        }
         return 0;
     case WM_DESTROY:
         PostQuitMessage(0);
@@ -200,13 +97,20 @@ void setup_camera_defaults() {
     g_camera.look_at_target = Vec3(0, 0.5, 0);
     g_camera.world_up_vector = Vec3(0, 1, 0);
     g_camera.fov_degrees = 60.0;
-    g_camera.initialize(static_cast<double>(IMAGE_WIDTH) / IMAGE_HEIGHT);
+    g_camera.initialize(static_cast<double>(INITIAL_WIDTH) / INITIAL_HEIGHT);
+}
+
+// Follows the window's client size: output buffer, DIB header and camera aspect.
+void resize_output(int width, int height) {
+    g_output.resize(width, height, false);
+    g_bitmapInfo.bmiHeader.biWidth = width;
+    g_bitmapInfo.bmiHeader.biHeight = -height; // Top-down DIB
+    g_camera.aspect_ratio = static_cast<double>(width) / height;
+    g_camera.update_orientation_vectors();
 }
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int nCmdShow) {
     g_bitmapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-    g_bitmapInfo.bmiHeader.biWidth = IMAGE_WIDTH;
-    g_bitmapInfo.bmiHeader.biHeight = -IMAGE_HEIGHT; // Top-down DIB
     g_bitmapInfo.bmiHeader.biPlanes = 1;
     g_bitmapInfo.bmiHeader.biBitCount = 32;
     g_bitmapInfo.bmiHeader.biCompression = BI_RGB;
@@ -220,7 +124,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int nCmdShow) {
     wc.lpszClassName = L"RayTracerWindowClass";
     RegisterClassEx(&wc);
 
-    RECT window_rect = { 0, 0, IMAGE_WIDTH, IMAGE_HEIGHT };
+    RECT window_rect = { 0, 0, INITIAL_WIDTH, INITIAL_HEIGHT };
     AdjustWindowRect(&window_rect, WS_OVERLAPPEDWINDOW, FALSE);
     g_hwnd = CreateWindowEx(0, L"RayTracerWindowClass", L"CPU Ray Tracer", WS_OVERLAPPEDWINDOW,
         CW_USEDEFAULT, CW_USEDEFAULT, window_rect.right - window_rect.left, window_rect.bottom - window_rect.top,
@@ -232,22 +136,18 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int nCmdShow) {
     ShowWindow(g_hwnd, nCmdShow);
     UpdateWindow(g_hwnd);
 
-    g_renderTasks.resize(NUM_THREADS);
-    int rowsPerThread = IMAGE_HEIGHT / NUM_THREADS;
-    int current_y_offset = 0;
-    for (int i = 0; i < NUM_THREADS; ++i) {
-        g_renderTasks[i].threadId = i;
-        g_renderTasks[i].startY = current_y_offset;
-        g_renderTasks[i].endY = current_y_offset + rowsPerThread;
-        g_renderTasks[i].pixelBuffer_ptr = &g_pixelBuffer;
-        if (i == NUM_THREADS - 1) g_renderTasks[i].endY = IMAGE_HEIGHT;
-        current_y_offset = g_renderTasks[i].endY;
-    }
-
-    g_threads.reserve(NUM_THREADS);
-    for (int i = 0; i < NUM_THREADS; ++i) {
-        g_threads.emplace_back(render_chunk_loop, std::cref(g_renderTasks[i]));
-    }
+    RenderThreadPool render_pool(default_thread_count());
+    SceneManager scene_manager("scene.txt"); // Re-parsed only when the file changes on disk
+    RenderSettings render_settings;
+    render_settings.accumulate = true; // Keep refining while nothing moves
+    render_settings.adaptive.enabled = true; // ...but only where the image is still noisy
+    render_settings.temporal.enabled = true; // Moving the camera keeps the reprojected image, F4 toggles
+    render_settings.denoise.enabled = true; // Filter the running mean for display, F3 toggles
+    DynamicResolutionSettings resolution_settings;
+    resolution_settings.enabled = true; // Render smaller while frames are slow, F5 toggles
+    resolution_settings.target_ms = 33.3;
+    DynamicResolution resolution(resolution_settings);
+    int scene_spp = scene_manager.scene().samples_per_pixel; // The file's; the controller may render fewer
 
     const double CAMERA_MOVE_STEP = 0.1;
     const double CAMERA_ROTATE_STEP = 0.03;
@@ -255,6 +155,73 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int nCmdShow) {
     long long frame_counter = 0;
 
     setup_camera_defaults();
+    resize_output(g_client_width, g_client_height);
+
+    // Pipelined (F6 toggles), the next frame renders while the window paints the last one: after a
+    // frame is waited for and upscaled into g_output, the next one is submitted at once, and the
+    // input for the one after it is sampled while it renders. Anything that touches the scene or
+    // g_frameBuffer (scene reloads, accumulation resets, resizes) waits for apply_input(), which
+    // only runs with no frame in flight; the pool keeps its own copy of the camera and settings.
+    bool pipelined = true;
+    bool in_flight = false;
+    bool reset_pending = false;   // Camera or aspect changed since the last apply_input()
+    auto input_time = std::chrono::steady_clock::now(); // When the next frame's input was sampled
+    auto frame_input = input_time;                       // ... and the frame in flight's
+    // Moving spheres follow the wall clock while animation runs (F7 pauses it).
+    const ParallelFor parallel = [&](int count, const std::function<void(int)>& task) { render_pool.parallel_for(count, task); };
+    bool animating = true;
+    double animation_seconds = 0.0;
+    auto apply_input = [&]() {
+        SceneUpdate scene_update;
+        {
+            ProfileScope reload_scope(g_profiler, ProfilePhase::SceneReload);
+            scene_update = scene_manager.poll();
+        }
+        AnimationUpdate animation_update;
+        {
+            ProfileScope animate_scope(g_profiler, ProfilePhase::Animate);
+            animation_update = scene_manager.animate(animation_seconds, parallel);
+        }
+        if (animation_update.rebuilt) {
+            log_message(std::format("BVH rebuilt after refitting to SAH x{:.2f} in {:.2f} ms\n", animation_update.sah_growth,
+                animation_update.rebuild_ms));
+        }
+        if (scene_update.scene_changed()) {
+            log_message(std::format("Scene reloaded: {} material(s), {} moved, {} restyled{} in {:.2f} ms\n",
+                scene_update.materials_changed, scene_update.spheres_moved, scene_update.spheres_restyled,
+                scene_update.acceleration_rebuilt ? ", acceleration rebuilt" : "", scene_update.parse_ms + scene_update.apply_ms));
+        }
+        if (scene_update.reloaded) {
+            scene_spp = scene_manager.scene().samples_per_pixel;
+        }
+        if (scene_update.reloaded && scene_manager.scene().objects.empty()) {
+            log_message("Warning: Scene may be empty or invalid after loading.\n");
+        }
+        if (reset_pending || scene_update.scene_changed() || animation_update.spheres_posed > 0) {
+            g_frameBuffer.reset_accumulation();
+        }
+        if (scene_update.scene_changed()) {
+            g_frameBuffer.reset_history(); // Earlier frames show the old scene
+        }
+        reset_pending = false;
+
+        if (g_resolution_toggled) {
+            g_resolution_toggled = false;
+            resolution_settings.enabled = !resolution_settings.enabled;
+            resolution = DynamicResolution(resolution_settings);
+            log_message(resolution_settings.enabled ? "Dynamic resolution on\n" : "Dynamic resolution off\n");
+        }
+        const RenderScale size = resolution.next(g_output.width, g_output.height, scene_spp);
+        scene_manager.scene().samples_per_pixel = size.spp;
+        if (size.width != g_frameBuffer.width || size.height != g_frameBuffer.height) {
+            g_frameBuffer.resize(size.width, size.height, false);
+        }
+    };
+    auto submit = [&]() {
+        frame_input = input_time;
+        render_pool.submit_frame(FrameInfo{ frame_counter, render_settings }, scene_manager.scene(), g_camera, g_frameBuffer);
+        in_flight = true;
+    };
 
     while (!quit_flag) {
         MSG msg = { 0 };
@@ -265,13 +232,17 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int nCmdShow) {
         }
         if (quit_flag) break;
 
-        g_current_scene = load_scene_from_file("scene.txt"); // Scene reloaded each frame
-        if (g_current_scene.objects.empty() && g_current_scene.max_ray_depth <= 0) {
-            OutputDebugStringA("Warning: Scene may be empty or invalid after loading.\n");
+        // Input for the next frame submitted.
+        const auto now = std::chrono::steady_clock::now();
+        if (animating) animation_seconds += std::chrono::duration<double>(now - input_time).count();
+        input_time = now;
+        {
+            ProfileScope reload_scope(g_profiler, ProfilePhase::SceneReload);
+            scene_manager.prepare(); // Parses an edited file; poll() applies it
         }
-
         bool camera_has_moved = false;
         if (GetActiveWindow() == g_hwnd) {
+            ProfileScope camera_scope(g_profiler, ProfilePhase::CameraUpdate);
             if (GetAsyncKeyState('W') & 0x8000) { g_camera.move_forward(CAMERA_MOVE_STEP); camera_has_moved = true; }
             if (GetAsyncKeyState('S') & 0x8000) { g_camera.move_forward(-CAMERA_MOVE_STEP); camera_has_moved = true; }
             if (GetAsyncKeyState('A') & 0x8000) { g_camera.move_sideways(-CAMERA_MOVE_STEP); camera_has_moved = true; }
@@ -284,27 +255,81 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int nCmdShow) {
             if (GetAsyncKeyState(VK_DOWN) & 0x8000) { g_camera.rotate_pitch(-CAMERA_ROTATE_STEP); camera_has_moved = true; }
             if (camera_has_moved) g_camera.update_orientation_vectors();
         }
+        if (g_client_width != g_output.width || g_client_height != g_output.height) {
+            resize_output(g_client_width, g_client_height); // Not upscaled into while a frame renders
+            camera_has_moved = true; // The aspect ratio changed
+        }
+        if (camera_has_moved) reset_pending = true;
+
+        if (g_denoise_toggled) {
+            g_denoise_toggled = false;
+            render_settings.denoise.enabled = !render_settings.denoise.enabled;
+            log_message(render_settings.denoise.enabled ? "Denoiser on\n" : "Denoiser off\n");
+        }
+        if (g_temporal_toggled) {
+            g_temporal_toggled = false;
+            render_settings.temporal.enabled = !render_settings.temporal.enabled;
+            log_message(render_settings.temporal.enabled ? "Temporal reprojection on\n" : "Temporal reprojection off\n");
+        }
+        if (g_pipeline_toggled) {
+            g_pipeline_toggled = false;
+            pipelined = !pipelined;
+            log_message(pipelined ? "Pipelined frames on\n" : "Pipelined frames off\n");
+        }
+        if (g_animation_toggled) {
+            g_animation_toggled = false;
+            animating = !animating;
+            log_message(animating ? "Animation running\n" : "Animation paused\n");
+        }
+        if (g_next_event_toggled) {
+            g_next_event_toggled = false;
+            render_settings.next_event = !render_settings.next_event; // Same mean either way, so accumulation carries on
+            log_message(render_settings.next_event ? "Light sampling on\n" : "Light sampling off\n");
+        }
+        if (g_exposure_steps != 0) {
+            render_settings.tonemap.exposure += 0.5f * g_exposure_steps; // Only changes the resolve; nothing restarts
+            g_exposure_steps = 0;
+            log_message(std::format("Exposure {:+.1f} stops\n", render_settings.tonemap.exposure));
+        }
 
-        g_currentFrameInfo.frameNumber = frame_counter;
-        g_workersDoneCount.store(0, std::memory_order_relaxed);
-        g_targetFrameId.store(frame_counter, std::memory_order_release);
-        g_workerStartCv.notify_all();
+        if (!in_flight) {
+            apply_input();
+            submit();
+        }
+        FrameStats frame_stats;
+        {
+            ProfileScope wait_scope(g_profiler, ProfilePhase::FrameWait);
+            frame_stats = render_pool.wait_frame();
+        }
+        in_flight = false;
+        double upscale_ms = 0.0;
         {
-            std::unique_lock<std::mutex> lock(g_renderMutex);
-            g_mainWaitCv.wait(lock, [&] {
-                return g_workersDoneCount.load(std::memory_order_acquire) == NUM_THREADS;
-                });
+            ProfileScope upscale_scope(g_profiler, ProfilePhase::Upscale);
+            const auto upscale_start = std::chrono::steady_clock::now();
+            render_pool.upscale(g_frameBuffer, g_output);
+            upscale_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - upscale_start).count();
         }
-        InvalidateRect(g_hwnd, NULL, FALSE);
+        resolution.update(frame_stats.frame_ms + upscale_ms, frame_stats.pixels_sampled);
+        g_profiler.add_frame(frame_stats, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_input).count());
+        InvalidateRect(g_hwnd, NULL, FALSE); // Painted by the next message pump
         frame_counter++;
         if (frame_counter % 100 == 0) {
-            OutputDebugStringA(std::format("Frame: {}\n", frame_counter).c_str());
+            log_message(std::format("Frame: {}, rendering {}x{} at {} spp\n", frame_counter, g_frameBuffer.width,
+                g_frameBuffer.height, scene_manager.scene().samples_per_pixel) + g_profiler.summary());
+        }
+        if (pipelined) {
+            apply_input();
+            submit();
+        }
+        if (g_trace_requested) {
+            g_trace_requested = false;
+            if (g_profiler.write_chrome_trace("profile_trace.json")) {
+                log_message("Wrote profile_trace.json (frames since the last F2)\n");
+            }
+            g_profiler.clear_trace();
         }
     }
 
-    g_shutdownThreads.store(true, std::memory_order_release);
-    g_workerStartCv.notify_all();
-    g_threads.clear(); // jthreads join on destruction
-
-    return 0;
+    if (in_flight) render_pool.wait_frame(); // It reads the scene, which goes before the pool
+    return 0; // render_pool joins its workers on destruction
 }
\ No newline at end of file
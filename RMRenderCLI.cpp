@@ -0,0 +1,917 @@
+// Headless batch renderer: loads a scene, renders it on the worker pool and writes PPM/PFM.
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <memory>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+extern char** environ;
+#endif
+#include "Distributed.h"
+#include "Renderer.h"
+#include "RenderServer.h"
+#include "SceneManager.h"
+#include "ImageIO.h"
+#include "Resolution.h"
+
+struct CliOptions {
+    std::string scene_file = "scene.txt";
+    std::string output_file = "render.ppm";
+    int width = 1920;
+    int height = 1080;
+    int spp = 0;          // 0 = use the scene's SAMPLES_PER_PIXEL
+    int threads = 0;      // 0 = hardware concurrency
+    int frames = 1;
+    bool frames_set = false;
+    double time_budget_ms = 0.0; // 0 = no limit
+    std::string heatmap_file;
+    std::string trace_file;
+    int profile_interval = 0; // 0 = no rolling profile summary
+    bool use_bvh = true;
+    bool thread_stats = false;
+    std::string simd = "auto";
+    Precision precision = Precision::Double;
+    bool compare_precision = false; // Render in both precisions and report speed and image difference
+    RenderSettings settings;
+    Vec3 camera_position = Vec3(0, 1.0, 4.0);
+    Vec3 camera_target = Vec3(0, 0.5, 0);
+    double fov_degrees = 60.0;
+    Vec3 camera_move;         // Per frame, after the first
+    double camera_yaw_degrees = 0.0;
+    bool pipeline = true;     // Sample and submit frame f+1 while frame f renders
+    double time_step = 0.0;   // Animation seconds per frame; 0 = the scene stays at time 0
+    AnimationSettings animation;
+    DynamicResolutionSettings resolution; // Render size relative to width x height
+    bool distributed = false;  // Coordinator: frames render on worker processes
+    DistributedSettings distribution;
+    int wait_workers = 0;      // Workers to wait for before the first frame; 0 = the spawned ones, at least 1
+    int spawn_workers = 0;     // Local worker processes to start
+    std::string worker_address; // Worker mode: coordinator's host:port
+    bool serve = false;        // Render service (RenderServer.h) instead of a batch render
+    int serve_port = -1;       // -1 = commands on stdin
+    std::string bind_address = "127.0.0.1"; // Interface --serve and --coordinator listen on
+    std::string serve_root;    // Directory the service's scene and output paths are relative to
+    double pass_ms = 50.0;
+};
+
+static void print_usage() {
+    std::printf(
+        "Usage: rmrender [options]\n"
+        "  --scene <file>          Scene file (default scene.txt)\n"
+        "  --output <file>         Output image, .ppm or .pfm (default render.ppm)\n"
+        "  --width <n>             Image width (default 1920)\n"
+        "  --height <n>            Image height (default 1080)\n"
+        "  --spp <n>               Samples per pixel, overrides the scene setting\n"
+        "  --threads <n>           Worker threads (default: hardware concurrency)\n"
+        "  --frames <n>            Number of timed frames to render (default 1)\n"
+        "  --accel <bvh|none>      Acceleration structure (default bvh)\n"
+        "  --simd <isa>            Sphere kernel: auto, scalar, sse2, avx2, avx512 (default auto)\n"
+        "  --precision <p>         Intersection precision: double, float, or compare to render both and\n"
+        "                          report throughput and image error of float against double (default double)\n"
+        "  --packets <off|4x4|8x8> Primary ray packets (default 8x8)\n"
+        "  --integrator <i>        recursive (depth-first per sample) or wavefront (bounce-synchronous\n"
+        "                          batches with binned shading); wavefront also prints wave occupancy\n"
+        "  --sampler <s>           sobol (scrambled low-discrepancy, default) or random (independent PCG32)\n"
+        "  --roulette <off|n[,t]>  Russian roulette from bounce n on for paths whose throughput is below t\n"
+        "                          (default 0.1), e.g. 3; off (the default) traces every path to the max depth\n"
+        "  --nee <on|off>          Sample the emissive spheres directly at glossy bounces, MIS-weighted against\n"
+        "                          the reflection ray (default on); off leaves them to be found by chance\n"
+        "  --denoise <off|on|n>    Edge-aware a-trous denoiser after every frame, guided by first-hit albedo,\n"
+        "                          normal and depth; n sets the pass count (on = 4, default off)\n"
+        "  --tonemap <aces|clamp>  Tone curve of the 8-bit output: filmic ACES fit (default) or a hard clip at 1\n"
+        "  --exposure <stops>      Scale the linear image by 2^stops before the tone curve (default 0)\n"
+        "  --srgb <on|off>         sRGB-encode the 8-bit output (default on); .pfm output stays linear\n"
+        "  --seed <n>              Sampler seed; the image depends only on it, not on threads or tiles (default 0)\n"
+        "  --tile-size <n>         Scheduler tile edge in pixels, at least 8 (default 32)\n"
+        "  --thread-stats <on|off> Print per-thread busy/idle time and tile counts per frame\n"
+        "  --accumulate <on|off>   Average all frames into the output instead of keeping the last one\n"
+        "  --adaptive <error>      Adaptive sampling to this relative error (implies --accumulate on); renders\n"
+        "                          until every pixel converges unless --frames or --time-budget stop it first\n"
+        "  --min-spp <n>           Adaptive: samples before a pixel may converge (default 16)\n"
+        "  --max-spp <n>           Adaptive: sample cap per pixel (default 4096)\n"
+        "  --time-budget <ms>      Stop starting new frames after this much render time\n"
+        "  --heatmap <file.ppm>    Adaptive: write the per-pixel sample-count heatmap\n"
+        "  --profile <n>           Print the profile (phase times per thread, path counters) of the last n\n"
+        "                          frames every n frames, and once more at the end\n"
+        "  --trace <file.json>     Write a Chrome trace of every frame (scene reload, worker wake-up, tiles,\n"
+        "                          barrier wait, output) for chrome://tracing or Perfetto\n"
+        "  --camera px,py,pz,tx,ty,tz[,fov]\n"
+        "                          Camera position, look-at target and vertical FOV\n"
+        "  --move dx,dy,dz[,yaw]   Move the camera by this much (and turn it by yaw degrees) before every frame\n"
+        "                          after the first, restarting accumulation like the viewer does\n"
+        "  --animate <seconds>     Advance the scene's moving spheres by this much per frame, refitting the BVH\n"
+        "                          (default 0: every frame shows them at time 0)\n"
+        "  --rebuild-threshold <x> Animation: rebuild the BVH instead of refitting it once its SAH cost has grown\n"
+        "                          x times over the freshly built tree's (default 1.5)\n"
+        "  --pipeline <on|off>     Prepare and submit each frame while the one before renders and report it\n"
+        "                          afterwards, instead of one frame at a time; prints throughput and input-to-\n"
+        "                          output latency either way (default on; off with --coordinator)\n"
+        "  --temporal <on|off>     Reproject earlier frames into the view after camera motion and blend them\n"
+        "                          with the new samples (default off)\n"
+        "  --target-ms <ms>        Dynamic resolution: size each frame's render to take this long (spp drops\n"
+        "                          too below --min-scale) and upscale it bilinearly to width x height\n"
+        "  --scale <s>             Render at s times width and height and upscale; with --target-ms, the\n"
+        "                          largest scale it may use (default 1)\n"
+        "  --min-scale <s>         Dynamic resolution: smallest scale (default 0.25)\n"
+        "  --coordinator <port>    Render frames on worker processes that connect to this port (0 = any free\n"
+        "                          port); not with accumulation, adaptive sampling, temporal, denoise or scaling\n"
+        "  --workers <n>           Coordinator: workers to wait for before the first frame (default: the\n"
+        "                          spawned ones, or 1); more may join at any time\n"
+        "  --spawn-workers <n>     Coordinator: start n local worker processes, each with --threads threads\n"
+        "                          (default: hardware concurrency / n)\n"
+        "  --job-size <n>          Coordinator: edge of the square jobs handed to workers (default 64)\n"
+        "  --worker <host:port>    Run as a worker for the coordinator at host:port until it shuts down\n"
+        "  --serve <port|->        Run as a render service: many jobs (scene, camera, size, spp, priority) share one\n"
+        "                          pool, driven by text commands on a TCP port (0 = any free one) or on stdin with -\n"
+        "                          (see RenderServer.h); --scene is loaded as 'default', and the size, camera and\n"
+        "                          render options are the jobs' defaults\n"
+        "  --bind <address>        Service and coordinator: IPv4 address the TCP port listens on (default 127.0.0.1,\n"
+        "                          this machine only; 0.0.0.0 lets anyone on the network in, and connections are\n"
+        "                          not authenticated)\n"
+        "  --serve-root <dir>      Service: directory that scene files and output images named in commands are\n"
+        "                          relative to (default: the working directory); absolute paths and .. are refused\n"
+        "  --pass-ms <ms>          Service: length of the progressive passes jobs take turns with (default 50)\n");
+}
+
+// One line per worker plus the spread of busy time: imbalance is max busy / mean busy (1.00 = perfect).
+static void print_thread_stats(const FrameStats& stats, bool per_thread) {
+    if (stats.workers.empty()) return;
+    double busy_min = stats.workers[0].busy_ms;
+    double busy_max = busy_min;
+    double busy_sum = 0.0;
+    uint32_t steals = 0;
+    for (size_t i = 0; i < stats.workers.size(); ++i) {
+        const WorkerFrameStats& worker = stats.workers[i];
+        busy_min = std::min(busy_min, worker.busy_ms);
+        busy_max = std::max(busy_max, worker.busy_ms);
+        busy_sum += worker.busy_ms;
+        steals += worker.tiles_stolen;
+        if (per_thread) {
+            std::printf("  Thread %zu: busy %.3f ms, idle %.3f ms, %u tiles (%u stolen)\n", i,
+                worker.busy_ms, worker.idle_ms, worker.tiles_rendered, worker.tiles_stolen);
+        }
+    }
+    double busy_avg = busy_sum / stats.workers.size();
+    std::printf("  Busy min/avg/max %.3f/%.3f/%.3f ms, imbalance %.2f, %u tiles stolen\n",
+        busy_min, busy_avg, busy_max, busy_avg > 0.0 ? busy_max / busy_avg : 1.0, steals);
+}
+
+// Occupancy is the share of a batch's paths still alive at each bounce.
+static void print_wavefront_stats(const WavefrontStats& stats) {
+    if (stats.waves == 0) return;
+    uint64_t rays = 0;
+    uint64_t slots = 0;
+    for (int d = 0; d < WavefrontStats::DEPTH_BUCKETS; ++d) {
+        rays += stats.rays[d];
+        slots += stats.slots[d];
+    }
+    std::printf("Wavefront: %llu waves, %.1f rays per wave, occupancy %.1f%%\n", static_cast<unsigned long long>(stats.waves),
+        static_cast<double>(rays) / stats.waves, slots > 0 ? 100.0 * rays / slots : 0.0);
+    std::printf("  Occupancy by bounce:");
+    for (int d = 0; d < WavefrontStats::DEPTH_BUCKETS && stats.slots[d] > 0; ++d) {
+        std::printf(" %.1f%%", 100.0 * stats.rays[d] / stats.slots[d]);
+    }
+    std::printf("\n  Hits binned: %llu miss, %llu terminal, %llu mirror, %llu glossy\n",
+        static_cast<unsigned long long>(stats.binned[WavefrontStats::Miss]),
+        static_cast<unsigned long long>(stats.binned[WavefrontStats::Terminal]),
+        static_cast<unsigned long long>(stats.binned[WavefrontStats::Mirror]),
+        static_cast<unsigned long long>(stats.binned[WavefrontStats::Glossy]));
+}
+
+static bool parse_numbers(const std::string& value, std::vector<double>& numbers) {
+    std::istringstream stream(value);
+    std::string token;
+    while (std::getline(stream, token, ',')) {
+        try {
+            numbers.push_back(std::stod(token));
+        }
+        catch (const std::exception&) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool parse_camera(const std::string& value, CliOptions& options) {
+    std::vector<double> numbers;
+    if (!parse_numbers(value, numbers)) return false;
+    if (numbers.size() != 6 && numbers.size() != 7) return false;
+    options.camera_position = Vec3(numbers[0], numbers[1], numbers[2]);
+    options.camera_target = Vec3(numbers[3], numbers[4], numbers[5]);
+    if (numbers.size() == 7) options.fov_degrees = numbers[6];
+    return true;
+}
+
+static bool parse_args(int argc, char** argv, CliOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            print_usage();
+            std::exit(0);
+        }
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        std::string value = argv[++i];
+        try {
+            if (arg == "--scene") options.scene_file = value;
+            else if (arg == "--output") options.output_file = value;
+            else if (arg == "--width") options.width = std::stoi(value);
+            else if (arg == "--height") options.height = std::stoi(value);
+            else if (arg == "--spp") options.spp = std::stoi(value);
+            else if (arg == "--threads") options.threads = std::stoi(value);
+            else if (arg == "--frames") {
+                options.frames = std::stoi(value);
+                options.frames_set = true;
+            }
+            else if (arg == "--accel") {
+                if (value != "bvh" && value != "none") {
+                    std::fprintf(stderr, "Invalid --accel value: %s\n", value.c_str());
+                    return false;
+                }
+                options.use_bvh = value == "bvh";
+            }
+            else if (arg == "--simd") options.simd = value;
+            else if (arg == "--precision") {
+                options.compare_precision = value == "compare";
+                if (!options.compare_precision && !parse_precision(value, options.precision)) {
+                    std::fprintf(stderr, "Invalid --precision value: %s\n", value.c_str());
+                    return false;
+                }
+            }
+            else if (arg == "--packets") {
+                if (value == "off") options.settings.primary_rays = PrimaryRayMode::Single;
+                else if (value == "4x4") options.settings.primary_rays = PrimaryRayMode::Packet4x4;
+                else if (value == "8x8") options.settings.primary_rays = PrimaryRayMode::Packet8x8;
+                else {
+                    std::fprintf(stderr, "Invalid --packets value: %s\n", value.c_str());
+                    return false;
+                }
+            }
+            else if (arg == "--integrator") {
+                if (value == "recursive") options.settings.integrator = Integrator::Recursive;
+                else if (value == "wavefront") options.settings.integrator = Integrator::Wavefront;
+                else {
+                    std::fprintf(stderr, "Invalid --integrator value: %s\n", value.c_str());
+                    return false;
+                }
+            }
+            else if (arg == "--sampler") {
+                if (!parse_sampler(value, options.settings.sampler)) {
+                    std::fprintf(stderr, "Invalid --sampler value: %s\n", value.c_str());
+                    return false;
+                }
+            }
+            else if (arg == "--roulette") {
+                options.settings.roulette.enabled = value != "off";
+                if (options.settings.roulette.enabled) {
+                    size_t comma = value.find(',');
+                    options.settings.roulette.min_depth = std::stoi(value.substr(0, comma));
+                    if (comma != std::string::npos) options.settings.roulette.threshold = std::stod(value.substr(comma + 1));
+                }
+            }
+            else if (arg == "--nee") {
+                if (value != "on" && value != "off") {
+                    std::fprintf(stderr, "Invalid --nee value: %s\n", value.c_str());
+                    return false;
+                }
+                options.settings.next_event = value == "on";
+            }
+            else if (arg == "--denoise") {
+                options.settings.denoise.enabled = value != "off";
+                if (value != "on" && value != "off") options.settings.denoise.passes = std::stoi(value);
+                if (options.settings.denoise.passes < 1) {
+                    std::fprintf(stderr, "Invalid --denoise value: %s\n", value.c_str());
+                    return false;
+                }
+            }
+            else if (arg == "--tonemap") {
+                if (value != "aces" && value != "clamp") {
+                    std::fprintf(stderr, "Invalid --tonemap value: %s\n", value.c_str());
+                    return false;
+                }
+                options.settings.tonemap.curve = value == "aces" ? ToneCurve::Aces : ToneCurve::Clamp;
+            }
+            else if (arg == "--exposure") options.settings.tonemap.exposure = std::stof(value);
+            else if (arg == "--srgb") {
+                if (value != "on" && value != "off") {
+                    std::fprintf(stderr, "Invalid --srgb value: %s\n", value.c_str());
+                    return false;
+                }
+                options.settings.tonemap.srgb = value == "on";
+            }
+            else if (arg == "--seed") options.settings.seed = static_cast<uint32_t>(std::stoul(value));
+            else if (arg == "--tile-size") options.settings.tile_size = std::stoi(value);
+            else if (arg == "--thread-stats") {
+                if (value != "on" && value != "off") {
+                    std::fprintf(stderr, "Invalid --thread-stats value: %s\n", value.c_str());
+                    return false;
+                }
+                options.thread_stats = value == "on";
+            }
+            else if (arg == "--accumulate") {
+                if (value != "on" && value != "off") {
+                    std::fprintf(stderr, "Invalid --accumulate value: %s\n", value.c_str());
+                    return false;
+                }
+                options.settings.accumulate = value == "on";
+            }
+            else if (arg == "--adaptive") {
+                options.settings.adaptive.enabled = true;
+                options.settings.adaptive.target_error = std::stod(value);
+                options.settings.accumulate = true;
+            }
+            else if (arg == "--min-spp") options.settings.adaptive.min_samples = static_cast<uint32_t>(std::stoul(value));
+            else if (arg == "--max-spp") options.settings.adaptive.max_samples = static_cast<uint32_t>(std::stoul(value));
+            else if (arg == "--time-budget") options.time_budget_ms = std::stod(value);
+            else if (arg == "--heatmap") options.heatmap_file = value;
+            else if (arg == "--profile") options.profile_interval = std::stoi(value);
+            else if (arg == "--trace") options.trace_file = value;
+            else if (arg == "--camera") {
+                if (!parse_camera(value, options)) {
+                    std::fprintf(stderr, "Invalid --camera value: %s\n", value.c_str());
+                    return false;
+                }
+            }
+            else if (arg == "--move") {
+                std::vector<double> numbers;
+                if (!parse_numbers(value, numbers) || (numbers.size() != 3 && numbers.size() != 4)) {
+                    std::fprintf(stderr, "Invalid --move value: %s\n", value.c_str());
+                    return false;
+                }
+                options.camera_move = Vec3(numbers[0], numbers[1], numbers[2]);
+                if (numbers.size() == 4) options.camera_yaw_degrees = numbers[3];
+            }
+            else if (arg == "--temporal") {
+                if (value != "on" && value != "off") {
+                    std::fprintf(stderr, "Invalid --temporal value: %s\n", value.c_str());
+                    return false;
+                }
+                options.settings.temporal.enabled = value == "on";
+            }
+            else if (arg == "--animate") options.time_step = std::stod(value);
+            else if (arg == "--rebuild-threshold") options.animation.rebuild_threshold = std::stod(value);
+            else if (arg == "--pipeline") {
+                if (value != "on" && value != "off") {
+                    std::fprintf(stderr, "Invalid --pipeline value: %s\n", value.c_str());
+                    return false;
+                }
+                options.pipeline = value == "on";
+            }
+            else if (arg == "--target-ms") {
+                options.resolution.enabled = true;
+                options.resolution.target_ms = std::stod(value);
+            }
+            else if (arg == "--scale") options.resolution.max_scale = std::stod(value);
+            else if (arg == "--min-scale") options.resolution.min_scale = std::stod(value);
+            else if (arg == "--coordinator") {
+                options.distributed = true;
+                options.distribution.port = std::stoi(value);
+            }
+            else if (arg == "--workers") options.wait_workers = std::stoi(value);
+            else if (arg == "--spawn-workers") options.spawn_workers = std::stoi(value);
+            else if (arg == "--job-size") options.distribution.job_size = std::stoi(value);
+            else if (arg == "--worker") options.worker_address = value;
+            else if (arg == "--serve") {
+                options.serve = true;
+                options.serve_port = value == "-" ? -1 : std::stoi(value);
+            }
+            else if (arg == "--bind") options.bind_address = value;
+            else if (arg == "--serve-root") options.serve_root = value;
+            else if (arg == "--pass-ms") options.pass_ms = std::stod(value);
+            else {
+                std::fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+                return false;
+            }
+        }
+        catch (const std::exception&) {
+            std::fprintf(stderr, "Invalid value for %s: %s\n", arg.c_str(), value.c_str());
+            return false;
+        }
+    }
+    if (options.width <= 0 || options.height <= 0 || options.frames <= 0) {
+        std::fprintf(stderr, "Width, height and frames must be positive\n");
+        return false;
+    }
+    if (options.time_step < 0.0 || !(options.animation.rebuild_threshold >= 1.0)) {
+        std::fprintf(stderr, "--animate must not be negative and --rebuild-threshold must be at least 1\n");
+        return false;
+    }
+    if (options.settings.adaptive.enabled && !options.frames_set) {
+        options.frames = std::numeric_limits<int>::max(); // Until converged or out of time
+    }
+    if (options.compare_precision && options.settings.adaptive.enabled) {
+        std::fprintf(stderr, "--precision compare needs a fixed frame count and cannot be combined with --adaptive\n");
+        return false;
+    }
+    if (options.settings.tile_size < 8) {
+        std::fprintf(stderr, "Tile size must be at least 8\n");
+        return false;
+    }
+    const DynamicResolutionSettings& resolution = options.resolution;
+    if (resolution.max_scale <= 0.0 || resolution.max_scale > 1.0 || resolution.min_scale <= 0.0 ||
+        resolution.min_scale > resolution.max_scale || (resolution.enabled && resolution.target_ms <= 0.0)) {
+        std::fprintf(stderr, "Scales must be in (0, 1] with --min-scale at most --scale, and --target-ms positive\n");
+        return false;
+    }
+    if (options.serve && (options.serve_port < -1 || options.serve_port > 65535 || !(options.pass_ms > 0.0))) {
+        std::fprintf(stderr, "Invalid --serve port or --pass-ms value\n");
+        return false;
+    }
+    if (options.distributed) {
+        const RenderSettings& settings = options.settings;
+        if (settings.accumulate || settings.wants_guides() || resolution.enabled || resolution.max_scale < 1.0 || options.compare_precision) {
+            std::fprintf(stderr, "--coordinator renders every frame from scratch: no --accumulate, --adaptive, --temporal, --denoise,\n"
+                "--target-ms, --scale or --precision compare\n");
+            return false;
+        }
+        if (options.distribution.port < 0 || options.distribution.port > 65535 || options.wait_workers < 0 ||
+            options.spawn_workers < 0 || options.distribution.job_size < 8) {
+            std::fprintf(stderr, "Invalid --coordinator, --workers, --spawn-workers or --job-size value\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+// Starts `self` as a worker process for the coordinator on host:port; returns its handle (pid), or -1.
+static intptr_t spawn_worker(const char* self, const std::string& host, int port, int threads) {
+    const std::string address = host + ":" + std::to_string(port);
+    const std::string thread_count = std::to_string(threads);
+#ifdef _WIN32
+    std::string command = "\"" + std::string(self) + "\" --worker " + address + " --threads " + thread_count;
+    STARTUPINFOA startup = { sizeof(startup) };
+    PROCESS_INFORMATION process;
+    if (!CreateProcessA(nullptr, command.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &process)) return -1;
+    CloseHandle(process.hThread);
+    return reinterpret_cast<intptr_t>(process.hProcess);
+#else
+    std::vector<std::string> args = { self, "--worker", address, "--threads", thread_count };
+    std::vector<char*> argv;
+    for (std::string& arg : args) argv.push_back(arg.data());
+    argv.push_back(nullptr);
+    pid_t pid;
+    if (posix_spawnp(&pid, self, nullptr, nullptr, argv.data(), environ) != 0) return -1;
+    return pid;
+#endif
+}
+
+static void wait_for_process(intptr_t process) {
+#ifdef _WIN32
+    WaitForSingleObject(reinterpret_cast<HANDLE>(process), INFINITE);
+    CloseHandle(reinterpret_cast<HANDLE>(process));
+#else
+    int status;
+    waitpid(static_cast<pid_t>(process), &status, 0);
+#endif
+}
+
+// Worker processes started by spawn_worker, waited for when this goes out of scope. They only exit
+// once their coordinator is gone, so it has to be destroyed first.
+struct SpawnedWorkers {
+    std::vector<intptr_t> processes;
+    SpawnedWorkers() = default;
+    SpawnedWorkers(const SpawnedWorkers&) = delete;
+    SpawnedWorkers& operator=(const SpawnedWorkers&) = delete;
+    ~SpawnedWorkers() {
+        for (intptr_t process : processes) wait_for_process(process);
+    }
+};
+
+// Root-mean-square difference of two 8-bit renders, in 0-255 units per channel.
+static double image_rmse(const FrameBuffer& a, const FrameBuffer& b) {
+    double sum_sq = 0.0;
+    for (size_t i = 0; i < a.pixels.size(); ++i) {
+        for (int shift = 0; shift <= 16; shift += 8) {
+            double d = static_cast<double>((a.pixels[i] >> shift) & 0xFF) - static_cast<double>((b.pixels[i] >> shift) & 0xFF);
+            sum_sq += d * d;
+        }
+    }
+    return a.pixels.empty() ? 0.0 : std::sqrt(sum_sq / (a.pixels.size() * 3.0));
+}
+
+// Renders options.frames frames into a fresh target and returns the throughput in Mrays/s.
+static double render_for_comparison(RenderThreadPool& pool, const CliOptions& options, const Scene& scene,
+    const Camera& camera, FrameBuffer& frame) {
+    frame.resize(options.width, options.height, false);
+    uint64_t rays = 0;
+    double seconds = 0.0;
+    for (int f = 0; f < options.frames; ++f) {
+        FrameStats stats = pool.render_frame(FrameInfo{ f, options.settings }, scene, camera, frame);
+        rays += stats.rays_traced;
+        seconds += stats.frame_ms / 1000.0;
+    }
+    return seconds > 0.0 ? rays / seconds / 1e6 : 0.0;
+}
+
+// Float against double on the same frames. A second double render measures the sampling noise
+// between two runs, so the float error can be read against it (both are 0 for a noiseless scene).
+static void compare_precisions(RenderThreadPool& pool, const CliOptions& options, Scene& scene, const Camera& camera) {
+    FrameBuffer reference, repeat, single;
+    build_acceleration(scene, options.use_bvh, Precision::Double);
+    double double_mrays = render_for_comparison(pool, options, scene, camera, reference);
+    render_for_comparison(pool, options, scene, camera, repeat);
+    build_acceleration(scene, options.use_bvh, Precision::Float);
+    if (scene.precision != Precision::Float) return;
+    double float_mrays = render_for_comparison(pool, options, scene, camera, single);
+    std::printf("Precision: double %.2f Mrays/s, float %.2f Mrays/s (%.2fx)\n", double_mrays, float_mrays,
+        double_mrays > 0.0 ? float_mrays / double_mrays : 0.0);
+    std::printf("Precision: float vs double RMSE %.4f, double vs double %.4f (of 255)\n",
+        image_rmse(single, reference), image_rmse(repeat, reference));
+}
+
+int main(int argc, char** argv) {
+    CliOptions options;
+    if (!parse_args(argc, argv, options)) {
+        print_usage();
+        return 1;
+    }
+    if (!options.worker_address.empty()) {
+        const size_t colon = options.worker_address.rfind(':');
+        int port = -1;
+        try {
+            if (colon != std::string::npos) port = std::stoi(options.worker_address.substr(colon + 1));
+        }
+        catch (const std::exception&) {
+        }
+        if (port <= 0 || port > 65535) {
+            std::fprintf(stderr, "Invalid --worker address: %s\n", options.worker_address.c_str());
+            return 1;
+        }
+        const int threads = options.threads > 0 ? options.threads : default_thread_count();
+        return run_render_worker(options.worker_address.substr(0, colon), port, threads) ? 0 : 1;
+    }
+
+    SimdIsa isa;
+    if (!parse_simd_isa(options.simd, isa)) {
+        std::fprintf(stderr, "Unknown --simd value: %s\n", options.simd.c_str());
+        return 1;
+    }
+    if (!set_active_simd_isa(isa)) {
+        std::fprintf(stderr, "SIMD ISA '%s' is not supported on this CPU\n", simd_isa_name(isa));
+        return 1;
+    }
+
+    if (options.serve) {
+        RenderServerSettings server;
+        server.port = options.serve_port;
+        server.bind_address = options.bind_address;
+        server.root = options.serve_root;
+        server.renderer.threads = options.threads;
+        server.renderer.pass_ms = options.pass_ms;
+        server.render = options.settings;
+        server.width = options.width;
+        server.height = options.height;
+        server.camera_position = options.camera_position;
+        server.camera_target = options.camera_target;
+        server.fov_degrees = options.fov_degrees;
+        server.use_bvh = options.use_bvh;
+        server.precision = options.precision;
+        server.default_scene = options.scene_file;
+        return run_render_server(server) ? 0 : 1;
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto load_start = clock::now();
+    SceneManager scene_manager(options.scene_file, options.use_bvh, options.precision);
+    double load_ms = std::chrono::duration<double, std::milli>(clock::now() - load_start).count();
+    Scene& scene = scene_manager.scene();
+    if (scene.objects.empty()) {
+        std::fprintf(stderr, "Warning: scene '%s' has no objects\n", options.scene_file.c_str());
+    }
+    if (options.spp > 0) {
+        scene.samples_per_pixel = options.spp;
+    }
+    if (options.use_bvh) {
+        const BVHBuildStats& bvh_stats = scene.bvh.build_stats();
+        std::printf("BVH: built in %.2f ms, %u nodes, %u leaves (max %u spheres), depth %u, SAH cost %.2f\n",
+            bvh_stats.build_ms, bvh_stats.node_count, bvh_stats.leaf_count, bvh_stats.max_leaf_size,
+            bvh_stats.max_depth, bvh_stats.sah_cost);
+    }
+
+    Camera camera;
+    camera.position = options.camera_position;
+    camera.look_at_target = options.camera_target;
+    camera.world_up_vector = Vec3(0, 1, 0);
+    camera.fov_degrees = options.fov_degrees;
+    camera.initialize(static_cast<double>(options.width) / options.height);
+
+    int thread_count = options.threads > 0 ? options.threads : default_thread_count();
+    RenderThreadPool pool(options.distributed ? 1 : thread_count);
+
+    // Distributed: declared in this order so that on any return the coordinator is destroyed, which
+    // tells the spawned workers to exit, before they are waited for.
+    SpawnedWorkers spawned;
+    std::unique_ptr<RenderCoordinator> coordinator;
+    if (options.distributed) {
+        options.distribution.bind_address = options.bind_address;
+        coordinator = std::make_unique<RenderCoordinator>(options.distribution);
+        if (!coordinator->listen()) return 1;
+        const int worker_threads = options.threads > 0 ? options.threads : std::max(1, default_thread_count() / std::max(1, options.spawn_workers));
+        const std::string worker_host = options.bind_address == "0.0.0.0" ? "127.0.0.1" : options.bind_address;
+        for (int i = 0; i < options.spawn_workers; ++i) {
+            const intptr_t process = spawn_worker(argv[0], worker_host, coordinator->port(), worker_threads);
+            if (process == -1) {
+                std::fprintf(stderr, "Could not start worker process %d\n", i);
+                break;
+            }
+            spawned.processes.push_back(process);
+        }
+        const int wait_count = options.wait_workers > 0 ? options.wait_workers : std::max<int>(1, static_cast<int>(spawned.processes.size()));
+        std::printf("Coordinator on port %d, waiting for %d worker(s)\n", coordinator->port(), wait_count);
+        if (!coordinator->wait_for_workers(wait_count, 30000.0)) {
+            std::fprintf(stderr, "Only %d of %d workers connected\n", coordinator->worker_count(), wait_count);
+            if (coordinator->worker_count() == 0) return 1;
+        }
+    }
+
+    FrameBuffer frame;
+    bool want_hdr = options.output_file.size() >= 4 &&
+        options.output_file.compare(options.output_file.size() - 4, 4, ".pfm") == 0;
+    frame.resize(options.width, options.height, want_hdr);
+    // With a render scale, frames render into render_target and are upscaled into `frame`; the
+    // render target is only resized when the scale changes, so it keeps accumulating in between.
+    const bool scaling = options.resolution.enabled || options.resolution.max_scale < 1.0;
+    DynamicResolution resolution(options.resolution);
+    FrameBuffer render_target;
+    int scene_spp = scene.samples_per_pixel;
+
+    std::printf("Scene: %s (%zu spheres, %d spp, max depth %d), loaded in %.2f ms\n",
+        options.scene_file.c_str(), scene.objects.size(), scene.samples_per_pixel, scene.max_ray_depth, load_ms);
+    SceneFootprint footprint = scene_footprint(scene);
+    std::printf("Scene data: %.0f B/sphere geometry + %.0f B/sphere material index, %.1f B/sphere acceleration, %zu materials (%zu B)\n",
+        footprint.geometry_per_sphere, footprint.material_refs_per_sphere, footprint.acceleration_per_sphere,
+        scene.materials.size(), footprint.material_table_bytes);
+    if (!scene.lights.empty()) {
+        std::printf("Lights: %zu emissive spheres, %s\n", scene.lights.spheres.size(),
+            options.settings.next_event ? "sampled at glossy bounces" : "light sampling off");
+    }
+    const std::string workers = coordinator
+        ? std::to_string(coordinator->worker_count()) + " worker(s), " + std::to_string(options.distribution.job_size) + "px jobs"
+        : std::to_string(thread_count) + " threads";
+    std::printf("Rendering %dx%d with %s, %dpx tiles, %d frame(s), %s sphere kernel, %s precision, %s sampler\n", options.width,
+        options.height, workers.c_str(), options.settings.tile_size, options.frames, simd_isa_name(active_simd_isa()),
+        precision_name(scene.precision), sampler_name(options.settings.sampler));
+    if (options.resolution.enabled) {
+        std::printf("Dynamic resolution: %.1f ms per frame, scale %.2f to %.2f\n", options.resolution.target_ms,
+            options.resolution.min_scale, options.resolution.max_scale);
+    }
+    else if (scaling) {
+        std::printf("Render scale %.2f\n", options.resolution.max_scale);
+    }
+
+    uint64_t total_rays = 0;
+    uint64_t total_paths = 0;
+    TraversalStats total_traversal;
+    WavefrontStats total_wavefront;
+    double total_seconds = 0.0;
+    int frames_rendered = 0;
+    const bool profiling = options.profile_interval > 0 || !options.trace_file.empty();
+    FrameProfiler profiler(options.profile_interval > 0 ? static_cast<size_t>(options.profile_interval) : 100);
+    // A frame takes four steps: sample its input (the camera move, and a changed scene file parsed
+    // on the side), apply it (everything that touches the scene or the frame buffers, which needs
+    // the pool idle), submit it, and finish it (wait, upscale, report). One at a time, every frame
+    // runs all four before the next one starts. Pipelined, frame f+1's input is sampled while f
+    // renders, and f+1 is applied and submitted as soon as f is done (and upscaled, which takes the
+    // pool too), before f is reported, so the workers do not sit idle while the main thread prints. The pool keeps its own
+    // copy of the camera, so moving it never disturbs the frame in flight.
+    const bool pipelined = options.pipeline && !coordinator;
+    bool camera_moved = false;
+    clock::time_point input_time;     // When the next frame's input was sampled
+    clock::time_point frame_input;    // ... and the frame in flight's
+    clock::time_point frame_start;
+    auto sample_input = [&](int f) {
+        input_time = clock::now();
+        camera_moved = f > 0 && (options.camera_move.length_squared() > 0.0 || options.camera_yaw_degrees != 0.0);
+        if (camera_moved) {
+            camera.position = camera.position + options.camera_move;
+            camera.rotate_yaw(options.camera_yaw_degrees * M_PI / 180.0);
+            camera.update_orientation_vectors();
+        }
+        ProfileScope reload_scope(profiler, ProfilePhase::SceneReload);
+        scene_manager.prepare();
+    };
+    // Moving spheres are posed for the frame and the BVH refit on the pool, between frames.
+    const ParallelFor parallel = [&](int count, const std::function<void(int)>& task) { pool.parallel_for(count, task); };
+    AnimationUpdate next_animation;   // Of the frame about to be submitted
+    AnimationUpdate frame_animation;  // ... and of the frame in flight
+    auto apply_input = [&](int f) {
+        // Edits to the scene file between frames are picked up incrementally.
+        SceneUpdate update;
+        {
+            ProfileScope reload_scope(profiler, ProfilePhase::SceneReload);
+            update = scene_manager.poll();
+        }
+        {
+            ProfileScope animate_scope(profiler, ProfilePhase::Animate);
+            next_animation = scene_manager.animate(f * options.time_step, parallel, options.animation);
+        }
+        if (update.scene_changed()) {
+            if (options.spp > 0) scene.samples_per_pixel = options.spp;
+            scene_spp = scene.samples_per_pixel;
+            std::printf("Scene changed: parsed in %.2f ms, applied in %.2f ms%s\n", update.parse_ms, update.apply_ms,
+                update.acceleration_rebuilt ? " (acceleration rebuilt)" : "");
+            frame.reset_accumulation();
+            frame.reset_history();
+        }
+        if (camera_moved || next_animation.spheres_posed > 0) frame.reset_accumulation();
+        if (scaling) {
+            const RenderScale size = resolution.next(options.width, options.height, scene_spp);
+            scene.samples_per_pixel = size.spp;
+            if (render_target.width != size.width || render_target.height != size.height) {
+                render_target.resize(size.width, size.height, want_hdr);
+            }
+        }
+    };
+    // Distributed frames render synchronously when they are finished.
+    auto submit = [&](int f) {
+        frame_input = input_time;
+        frame_animation = next_animation;
+        frame_start = clock::now();
+        if (!coordinator) pool.submit_frame(FrameInfo{ f, options.settings }, scene, camera, scaling ? render_target : frame);
+    };
+
+    std::vector<double> latencies;
+    int animated_frames = 0;
+    int rebuilds = 0;
+    double total_animate_ms = 0.0;
+    double total_refit_ms = 0.0;
+    auto loop_start = clock::now();
+    if (options.frames > 0) {
+        sample_input(0);
+        apply_input(0);
+        submit(0);
+    }
+    for (int f = 0; f < options.frames; ++f) {
+        const bool has_next = f + 1 < options.frames;
+        if (pipelined && has_next) sample_input(f + 1);
+        FrameBuffer& target = scaling ? render_target : frame;
+        FrameStats stats;
+        DistributedFrameStats distributed;
+        if (coordinator) {
+            if (!coordinator->render_frame(FrameInfo{ f, options.settings }, scene, scene_manager.version(), options.use_bvh,
+                camera, target, distributed)) return 1;
+            stats.rays_traced = distributed.rays_traced;
+            stats.pixels_sampled = distributed.pixels_sampled;
+            stats.traversal = distributed.traversal;
+        }
+        else {
+            ProfileScope wait_scope(profiler, ProfilePhase::FrameWait);
+            stats = pool.wait_frame();
+        }
+        double seconds = std::chrono::duration<double>(clock::now() - frame_start).count();
+        double upscale_ms = 0.0;
+        if (scaling) {
+            ProfileScope upscale_scope(profiler, ProfilePhase::Upscale);
+            auto upscale_start = clock::now();
+            pool.upscale(render_target, frame);
+            upscale_ms = std::chrono::duration<double, std::milli>(clock::now() - upscale_start).count();
+            resolution.update(seconds * 1000.0 + upscale_ms, stats.pixels_sampled);
+        }
+        // The output holds the frame now; that ends its latency.
+        const double latency_ms = std::chrono::duration<double, std::milli>(clock::now() - frame_input).count();
+        if (options.settings.adaptive.enabled && stats.pixels_sampled == 0) {
+            std::printf("All pixels converged after %d frame(s)\n", frames_rendered);
+            break;
+        }
+        frames_rendered++;
+        latencies.push_back(latency_ms);
+        uint64_t rays = stats.rays_traced;
+        const int rendered_width = target.width, rendered_height = target.height, rendered_spp = scene.samples_per_pixel;
+        total_rays += rays;
+        total_paths += stats.pixels_sampled * static_cast<uint64_t>(rendered_spp > 0 ? rendered_spp : 1);
+        total_traversal += stats.traversal;
+        total_wavefront += stats.wavefront;
+        total_seconds += seconds;
+        const bool out_of_time = options.time_budget_ms > 0.0 && total_seconds * 1000.0 >= options.time_budget_ms;
+        const bool next = has_next && !out_of_time;
+        const AnimationUpdate animation = frame_animation;
+        if (animation.spheres_posed > 0) {
+            animated_frames++;
+            total_animate_ms += animation.pose_ms + animation.refit_ms + animation.rebuild_ms;
+            total_refit_ms += animation.refit_ms;
+            rebuilds += animation.rebuilt ? 1 : 0;
+        }
+        if (pipelined && next) {
+            apply_input(f + 1);
+            submit(f + 1);
+        }
+
+        std::printf("Frame %d: %.3f ms, %llu rays, %.2f Mrays/s", f, seconds * 1000.0,
+            static_cast<unsigned long long>(rays), seconds > 0.0 ? rays / seconds / 1e6 : 0.0);
+        if (options.settings.temporal.enabled) {
+            std::printf(", temporal %.3f ms", stats.temporal_ms);
+        }
+        if (options.settings.denoise.enabled) {
+            std::printf(", denoise %.3f ms", stats.denoise_ms);
+        }
+        if (options.settings.adaptive.enabled) {
+            std::printf(", %.1f%% of pixels sampled", 100.0 * stats.pixels_sampled / (static_cast<double>(rendered_width) * rendered_height));
+        }
+        if (scaling) {
+            std::printf(", %dx%d at %d spp, upscale %.3f ms", rendered_width, rendered_height, rendered_spp, upscale_ms);
+        }
+        if (coordinator) {
+            std::printf(", %d workers, %u jobs (%u reassigned, %u duplicated), scene %.1f KB, received %.1f KB", distributed.workers,
+                distributed.jobs, distributed.reassigned, distributed.duplicated, distributed.scene_bytes / 1024.0,
+                distributed.bytes_received / 1024.0);
+        }
+        if (animation.spheres_posed > 0) {
+            std::printf(", %u spheres posed in %.3f ms, refit %.3f ms (SAH x%.2f)", animation.spheres_posed, animation.pose_ms,
+                animation.refit_ms, animation.sah_growth);
+            if (animation.rebuilt) std::printf(", rebuilt in %.3f ms", animation.rebuild_ms);
+        }
+        std::printf(", latency %.3f ms\n", latency_ms);
+        print_thread_stats(stats, options.thread_stats);
+        if (profiling) {
+            profiler.add_frame(stats, latency_ms);
+            if (options.profile_interval > 0 && frames_rendered % options.profile_interval == 0) {
+                std::printf("%s", profiler.summary().c_str());
+            }
+        }
+        if (out_of_time && has_next) {
+            std::printf("Time budget of %.1f ms reached\n", options.time_budget_ms);
+            break;
+        }
+        if (!pipelined && next) {
+            sample_input(f + 1);
+            apply_input(f + 1);
+            submit(f + 1);
+        }
+    }
+    const double loop_seconds = std::chrono::duration<double>(clock::now() - loop_start).count();
+    if (animated_frames > 0) {
+        std::printf("Animation: %zu moving spheres, %.3f ms per frame (refit %.3f ms, %.1f%% of the render time), %d rebuild(s)\n",
+            scene.animation.tracks.size(), total_animate_ms / animated_frames, total_refit_ms / animated_frames,
+            total_seconds > 0.0 ? 100.0 * total_animate_ms / (total_seconds * 1000.0) : 0.0, rebuilds);
+    }
+    if (!latencies.empty()) {
+        double latency_sum = 0.0;
+        for (double latency : latencies) latency_sum += latency;
+        std::sort(latencies.begin(), latencies.end());
+        std::printf("Frame loop (%s): %.2f frames/s, latency %.3f ms average, %.3f ms p95, %.3f ms max\n",
+            pipelined ? "pipelined" : "one frame at a time", frames_rendered / loop_seconds, latency_sum / latencies.size(),
+            latencies[std::min(latencies.size() - 1, latencies.size() * 95 / 100)], latencies.back());
+    }
+    std::printf("Total: %.3f s wall, %llu rays, %.2f Mrays/s\n", total_seconds,
+        static_cast<unsigned long long>(total_rays), total_seconds > 0.0 ? total_rays / total_seconds / 1e6 : 0.0);
+    if (total_rays > 0) {
+        std::printf("Per ray: %.2f nodes visited, %.2f sphere tests\n",
+            static_cast<double>(total_traversal.nodes_visited) / total_rays,
+            static_cast<double>(total_traversal.primitive_tests) / total_rays);
+        std::printf("Average path length: %.2f rays (max depth %d, %s)\n", static_cast<double>(total_rays) / total_paths,
+            scene.max_ray_depth, options.settings.roulette.enabled ? "Russian roulette" : "no roulette");
+    }
+    print_wavefront_stats(total_wavefront);
+
+    const FrameBuffer& rendered = scaling ? render_target : frame;
+    if (options.settings.adaptive.enabled) {
+        uint64_t samples = 0;
+        uint32_t max_count = 0;
+        for (uint32_t count : rendered.sample_counts) {
+            samples += count;
+            max_count = std::max(max_count, count);
+        }
+        std::printf("Adaptive: %.1f samples per pixel on average (max %u)\n",
+            static_cast<double>(samples) / rendered.sample_counts.size(), max_count);
+    }
+    else if (options.settings.accumulate) {
+        std::printf("Accumulated %u samples per pixel\n", rendered.accumulated_samples);
+    }
+    if (!options.heatmap_file.empty()) {
+        if (!write_sample_heatmap(options.heatmap_file, rendered)) return 1;
+        std::printf("Wrote %s\n", options.heatmap_file.c_str());
+    }
+    {
+        ProfileScope present_scope(profiler, ProfilePhase::Present);
+        if (!write_image(options.output_file, frame)) {
+            return 1;
+        }
+    }
+    std::printf("Wrote %s\n", options.output_file.c_str());
+    if (profiling && frames_rendered > 0) {
+        if (options.profile_interval == 0 || frames_rendered % options.profile_interval != 0) {
+            std::printf("%s", profiler.summary().c_str());
+        }
+        if (!options.trace_file.empty()) {
+            if (!profiler.write_chrome_trace(options.trace_file)) return 1;
+            std::printf("Wrote %s\n", options.trace_file.c_str());
+        }
+    }
+    if (options.compare_precision) {
+        compare_precisions(pool, options, scene, camera);
+    }
+    return 0;
+}
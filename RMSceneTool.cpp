@@ -0,0 +1,198 @@
+// Scene file utility: converts scene.txt syntax to the memory-mappable binary format and
+// benchmarks the loaders against each other.
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <map>
+#include "SceneLoader.h"
+#include "SceneBinary.h"
+
+static void print_usage() {
+    std::printf(
+        "Usage:\n"
+        "  rmscene convert <scene.txt> <scene.rmsc>   Convert a text scene to the binary format\n"
+        "  rmscene bench <scene.txt> [runs]           Time the stream, from_chars and binary loaders (default 3 runs)\n");
+}
+
+// The original istringstream/stod loader, kept as the baseline for `rmscene bench`.
+static bool legacy_parse_scene_file(const std::string& filename, Scene& loaded_scene) {
+    bool success = true; // Flag to track parsing success
+
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        log_message("Error: Could not open scene file: " + filename + "\n");
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    bool globals_loaded = false;
+    std::map<std::string, MaterialIndex> material_lookup;
+
+    while (std::getline(file, line)) {
+        line_number++;
+        line.erase(0, line.find_first_not_of(" \t\n\r\f\v"));
+        line.erase(line.find_last_not_of(" \t\n\r\f\v") + 1);
+
+        if (line.empty() || line[0] == '#') continue;
+
+        std::vector<std::string> tokens = split_string(line, ';');
+        if (tokens.empty()) continue;
+
+        try {
+            if (!globals_loaded) {
+                if (tokens.size() < 5) {
+                    log_message("Error: Insufficient global settings on line " + std::to_string(line_number) + "\n");
+                    success = false; break; // Stop parsing on critical error
+                }
+                loaded_scene.max_ray_depth = std::stoi(tokens[0]);
+                loaded_scene.samples_per_pixel = std::stoi(tokens[1]);
+                loaded_scene.background_color.x = std::stod(tokens[2]);
+                loaded_scene.background_color.y = std::stod(tokens[3]);
+                loaded_scene.background_color.z = std::stod(tokens[4]);
+                globals_loaded = true;
+                continue;
+            }
+
+            char type = tokens[0][0];
+            if (type == 'M') {
+                if (tokens.size() < 7) { /* ... error handling ... */ continue; }
+                std::string id = tokens[1];
+                Vec3 color(std::stod(tokens[2]), std::stod(tokens[3]), std::stod(tokens[4]));
+                double reflectivity = std::stod(tokens[5]);
+                double roughness = std::stod(tokens[6]);
+                Vec3 emission(0, 0, 0);
+                if (tokens.size() >= 10) {
+                    emission.x = std::stod(tokens[7]);
+                    emission.y = std::stod(tokens[8]);
+                    emission.z = std::stod(tokens[9]);
+                }
+                material_lookup[id] = loaded_scene.add_material(id, Material(color, reflectivity, roughness, emission));
+            }
+            else if (type == 'S') {
+                if (tokens.size() < 6) { /* ... error handling ... */ continue; }
+                std::string mat_id_ref = tokens[1];
+                Vec3 center(std::stod(tokens[2]), std::stod(tokens[3]), std::stod(tokens[4]));
+                double radius = std::stod(tokens[5]);
+
+                auto it = material_lookup.find(mat_id_ref);
+                if (it != material_lookup.end()) {
+                    loaded_scene.add_sphere(Sphere(center, radius), it->second);
+                }
+                else {
+                    log_message("Error: Material ID '" + mat_id_ref + "' not found for sphere on line " + std::to_string(line_number) + "\n");
+                    // Optionally set success = false; or skip this sphere
+                }
+            }
+            else {
+                log_message("Warning: Unknown object type '" + std::string(1, type) + "' on line " + std::to_string(line_number) + "\n");
+            }
+        }
+        catch (const std::exception& e) { // Catch std::exception for broader coverage
+            log_message("Error parsing line " + std::to_string(line_number) + ": " + e.what() + "\n");
+            success = false; // Potentially stop parsing or just log and continue
+        }
+    }
+    file.close();
+
+    if (!globals_loaded && line_number > 0 && success) { // only an error if parsing was otherwise ok
+        log_message("Error: Global settings not found or no valid lines in scene file.\n");
+        success = false;
+    }
+
+    return success;
+}
+
+static bool same_scene(const Scene& a, const Scene& b) {
+    if (a.max_ray_depth != b.max_ray_depth || a.samples_per_pixel != b.samples_per_pixel ||
+        a.objects.size() != b.objects.size() || a.materials.size() != b.materials.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.objects.size(); ++i) {
+        const Sphere& x = a.objects[i];
+        const Sphere& y = b.objects[i];
+        if (x.center.x != y.center.x || x.center.y != y.center.y || x.center.z != y.center.z ||
+            x.radius != y.radius || a.material_id_of(i) != b.material_id_of(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int convert(const std::string& input, const std::string& output) {
+    Scene scene;
+    if (!load_scene_any(input, scene)) {
+        std::fprintf(stderr, "Failed to load %s\n", input.c_str());
+        return 1;
+    }
+    if (!write_binary_scene(output, scene)) {
+        return 1;
+    }
+    std::printf("Wrote %s: %zu materials, %zu spheres, %llu bytes\n", output.c_str(), scene.materials.size(),
+        scene.objects.size(), static_cast<unsigned long long>(std::filesystem::file_size(output)));
+    return 0;
+}
+
+template <typename LoadFn>
+static double best_time_ms(int runs, LoadFn load) {
+    double best = 0.0;
+    for (int run = 0; run < runs; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        if (!load()) return -1.0;
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        best = run == 0 ? ms : std::min(best, ms);
+    }
+    return best;
+}
+
+static int bench(const std::string& input, int runs) {
+    std::string binary_path = (std::filesystem::temp_directory_path() /
+        (std::filesystem::path(input).stem().string() + "-bench" + SCENE_BINARY_EXTENSION)).string();
+    Scene reference;
+    if (!parse_scene_file(input, reference) || !write_binary_scene(binary_path, reference)) {
+        std::fprintf(stderr, "Failed to prepare %s\n", input.c_str());
+        return 1;
+    }
+    size_t sphere_count = reference.objects.size();
+
+    // Each timed load fills a fresh Scene; the previous one is freed outside the timed region.
+    std::vector<Scene> results(4);
+    double stream_ms = best_time_ms(runs, [&] { results[0] = Scene(); return legacy_parse_scene_file(input, results[0]); });
+    double from_chars_ms = best_time_ms(runs, [&] { results[1] = Scene(); return parse_scene_file(input, results[1]); });
+    double binary_ms = best_time_ms(runs, [&] { results[2] = Scene(); return read_binary_scene(binary_path, results[2]); });
+    double map_ms = best_time_ms(runs, [&] { MappedScene mapped; return mapped.open(binary_path); });
+    bool identical = same_scene(results[0], results[1]) && same_scene(results[0], results[2]);
+    std::filesystem::remove(binary_path);
+
+    if (stream_ms < 0.0 || from_chars_ms < 0.0 || binary_ms < 0.0 || map_ms < 0.0) {
+        std::fprintf(stderr, "A loader failed on %s\n", input.c_str());
+        return 1;
+    }
+    auto report = [&](const char* name, double ms) {
+        std::printf("  %-28s %10.2f ms  %8.2f Mspheres/s  %6.1fx\n", name, ms,
+            ms > 0.0 ? sphere_count / ms / 1e3 : 0.0, ms > 0.0 ? stream_ms / ms : 0.0);
+    };
+    std::printf("%s: %zu spheres, best of %d run(s)\n", input.c_str(), sphere_count, runs);
+    report("text, istringstream + stod", stream_ms);
+    report("text, from_chars", from_chars_ms);
+    report("binary, mmap into Scene", binary_ms);
+    report("binary, mmap in place", map_ms);
+    std::printf("Loaded scenes %s\n", identical ? "match" : "DIFFER");
+    return identical ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 4 && std::string(argv[1]) == "convert") {
+        return convert(argv[2], argv[3]);
+    }
+    if (argc >= 3 && std::string(argv[1]) == "bench") {
+        int runs = argc >= 4 ? std::max(1, std::atoi(argv[3])) : 3;
+        return bench(argv[2], runs);
+    }
+    print_usage();
+    return 1;
+}
@@ -1,9 +1,29 @@
 #pragma once
+#include <cmath>
+#include <limits>
+#include <algorithm>
 #include "Vec3.h"
 // --- Ray Definition ---
-struct Ray {
-    Vec3 origin;
-    Vec3 direction; // Should be normalized
+template <typename T>
+struct RayT {
+    Vec3T<T> origin;
+    Vec3T<T> direction; // Should be normalized
 
-    Ray(const Vec3& o, const Vec3& d) : origin(o), direction(d.normalize()) {}
+    RayT(const Vec3T<T>& o, const Vec3T<T>& d) : origin(o), direction(d.normalize()) {}
+    template <typename U>
+    explicit RayT(const RayT<U>& other) : origin(other.origin), direction(other.direction) {}
 };
+
+using Ray = RayT<double>;
+using Rayf = RayT<float>;
+
+// Secondary rays start this far above the surface they leave. The offset scales with the
+// magnitude of the coordinates involved (hit point and sphere radius) and the precision of T,
+// so the computed intersection with the surface just left always lands behind the new origin
+// and rays can use t_min = 0 instead of a fixed distance epsilon.
+template <typename T>
+T self_intersection_offset(const Vec3T<T>& point, T radius) {
+    const T ULPS = T(256);
+    T magnitude = std::max({ std::abs(point.x), std::abs(point.y), std::abs(point.z), std::abs(radius), T(1) });
+    return ULPS * std::numeric_limits<T>::epsilon() * magnitude;
+}
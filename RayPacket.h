@@ -0,0 +1,43 @@
+#pragma once
+#include "Vec3.h"
+#include "Camera.h"
+#include "SphereKernels.h"
+
+// Bounding frustum of a block of primary rays: four planes through the shared camera origin,
+// spanned by the rays through the block's corners. Every jittered sample inside the block lies
+// inside it, so a box outside any plane cannot be hit by any ray of the packet.
+struct PacketFrustum {
+    Vec3 origin;
+    Vec3 plane_normals[4]; // Inward facing: dot(n, p - origin) >= 0 for points inside
+
+    template <typename T>
+    bool overlaps_box(const T bounds_min[3], const T bounds_max[3]) const {
+        for (const Vec3& n : plane_normals) {
+            // Box corner furthest along the plane normal; if even that is outside, the whole box is.
+            double px = (n.x >= 0.0 ? bounds_max[0] : bounds_min[0]) - origin.x;
+            double py = (n.y >= 0.0 ? bounds_max[1] : bounds_min[1]) - origin.y;
+            double pz = (n.z >= 0.0 ? bounds_max[2] : bounds_min[2]) - origin.z;
+            if (n.x * px + n.y * py + n.z * pz < 0.0) return false;
+        }
+        return true;
+    }
+};
+
+// Frustum of the image-space rectangle [u0, u1] x [v0, v1] (normalized like Camera::get_ray).
+inline PacketFrustum make_packet_frustum(const Camera& camera, double u0, double v0, double u1, double v1) {
+    Vec3 corners[4] = {
+        camera.get_ray(u0, v0).direction,
+        camera.get_ray(u1, v0).direction,
+        camera.get_ray(u1, v1).direction,
+        camera.get_ray(u0, v1).direction,
+    };
+    Vec3 center_dir = (corners[0] + corners[1] + corners[2] + corners[3]) * 0.25;
+    PacketFrustum frustum;
+    frustum.origin = camera.position;
+    for (int i = 0; i < 4; ++i) {
+        Vec3 n = Vec3::cross(corners[i], corners[(i + 1) % 4]);
+        if (Vec3::dot(n, center_dir) < 0.0) n = n * -1.0;
+        frustum.plane_normals[i] = n;
+    }
+    return frustum;
+}
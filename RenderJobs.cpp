@@ -0,0 +1,204 @@
+#include "RenderJobs.h"
+#include <algorithm>
+#include <new>
+#include "Log.h"
+
+const char* job_state_name(JobState state) {
+    switch (state) {
+    case JobState::Queued: return "queued";
+    case JobState::Running: return "running";
+    case JobState::Done: return "done";
+    case JobState::Cancelled: return "cancelled";
+    case JobState::Failed: return "failed";
+    }
+    return "?";
+}
+
+Renderer::Renderer(const RendererSettings& settings_)
+    : settings(settings_), pool(settings_.threads > 0 ? settings_.threads : default_thread_count()) {
+    scheduler = std::jthread([this] { run_scheduler(); });
+}
+
+Renderer::~Renderer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shutting_down = true;
+        for (auto& entry : job_table) entry.second->cancel_requested = true;
+        if (running_id != 0) pool.cancel_frame();
+    }
+    scheduler_cv.notify_one();
+    scheduler.join();
+}
+
+JobId Renderer::submit(RenderJob request) {
+    if (!request.scene || request.width <= 0 || request.height <= 0) return 0;
+    auto job = std::make_unique<Job>();
+    const int samples = request.samples_per_pixel > 0 ? request.samples_per_pixel : request.scene->samples_per_pixel;
+    job->progress.samples_total = static_cast<uint32_t>(std::max(samples, 1));
+    job->progress.priority = request.priority;
+    job->request = std::move(request);
+    std::lock_guard<std::mutex> lock(mutex);
+    const JobId id = next_id++;
+    job->progress.id = id;
+    job_table.emplace(id, std::move(job));
+    scheduler_cv.notify_one();
+    return id;
+}
+
+bool Renderer::cancel(JobId id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = job_table.find(id);
+    if (it == job_table.end() || it->second->progress.finished()) return false;
+    it->second->cancel_requested = true;
+    if (running_id == id) pool.cancel_frame();
+    scheduler_cv.notify_one();
+    return true;
+}
+
+bool Renderer::set_priority(JobId id, int priority) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = job_table.find(id);
+    if (it == job_table.end() || it->second->progress.finished()) return false;
+    it->second->progress.priority = priority;
+    return true;
+}
+
+bool Renderer::progress(JobId id, JobProgress& result) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = job_table.find(id);
+    if (it == job_table.end()) return false;
+    result = it->second->progress;
+    return true;
+}
+
+std::vector<JobProgress> Renderer::jobs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<JobProgress> result;
+    result.reserve(job_table.size());
+    for (const auto& entry : job_table) result.push_back(entry.second->progress);
+    return result;
+}
+
+bool Renderer::wait(JobId id, JobProgress& result, FrameBuffer* image) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto settled = [&] {
+        auto it = job_table.find(id);
+        return it == job_table.end() || (it->second->progress.finished() && !it->second->reporting);
+    };
+    finished_cv.wait(lock, settled);
+    auto it = job_table.find(id);
+    if (it == job_table.end()) return false;
+    result = it->second->progress;
+    if (image) *image = std::move(it->second->target);
+    job_table.erase(it);
+    return true;
+}
+
+Renderer::Job* Renderer::next_job() {
+    Job* best = nullptr;
+    for (auto& entry : job_table) {
+        Job* job = entry.second.get();
+        if (job->progress.finished()) continue;
+        if (job->cancel_requested) return job; // Nothing to render, just its callbacks to run
+        if (!best || job->progress.priority > best->progress.priority ||
+            (job->progress.priority == best->progress.priority && job->last_turn < best->last_turn)) {
+            best = job;
+        }
+    }
+    return best;
+}
+
+void Renderer::run_scheduler() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        Job* job = nullptr;
+        scheduler_cv.wait(lock, [&] { return (job = next_job()) != nullptr || shutting_down; });
+        if (!job) break; // Shutting down, and every job has been reported
+        const JobId id = job->progress.id;
+        if (!job->cancel_requested) render_pass(lock, *job);
+        JobProgress& progress = job->progress;
+        if (job->failed) progress.state = JobState::Failed;
+        else if (job->cancel_requested) progress.state = JobState::Cancelled;
+        else if (progress.samples_done >= progress.samples_total) progress.state = JobState::Done;
+        else progress.state = JobState::Running;
+        report(lock, id);
+    }
+}
+
+void Renderer::render_pass(std::unique_lock<std::mutex>& lock, Job& job) {
+    const RenderJob& request = job.request;
+    JobProgress& progress = job.progress;
+    const JobId id = progress.id;
+    // The first pass is a single sample, which also measures what the next ones can afford.
+    const uint32_t remaining = progress.samples_total - progress.samples_done;
+    uint32_t samples = 1;
+    if (job.ms_per_sample > 0.0) {
+        samples = static_cast<uint32_t>(std::clamp(settings.pass_ms / job.ms_per_sample, 1.0, static_cast<double>(remaining)));
+    }
+    FrameInfo frame_info{ static_cast<long long>(progress.passes), request.settings };
+    RenderSettings& pass = frame_info.settings;
+    pass.samples_per_pixel = static_cast<int>(samples);
+    pass.accumulate = true;
+    pass.adaptive.enabled = false;
+    pass.temporal.enabled = false;
+    pass.denoise.enabled = request.settings.denoise.enabled && samples == remaining;
+    lock.unlock();
+
+    // Only this thread touches the target until the job is reported finished.
+    FrameBuffer& target = job.target;
+    auto fail = [&] {
+        log_message("Render job " + std::to_string(id) + ": out of memory for " + std::to_string(request.width) + "x" +
+            std::to_string(request.height) + "\n");
+        target = FrameBuffer();
+        lock.lock();
+        running_id = 0;
+        job.failed = true;
+    };
+    try {
+        if (target.width != request.width || target.height != request.height) target.resize(request.width, request.height, request.keep_hdr);
+        pool.submit_frame(frame_info, *request.scene, request.camera, target);
+    }
+    catch (const std::bad_alloc&) {
+        fail();
+        return;
+    }
+    lock.lock();
+    running_id = id;
+    if (job.cancel_requested) pool.cancel_frame(); // Arrived before running_id let cancel() do it
+    lock.unlock();
+    // submit_frame() sizes the post-process buffers, but the frame's last steps still run here.
+    FrameStats stats;
+    try {
+        stats = pool.wait_frame();
+    }
+    catch (const std::bad_alloc&) {
+        fail();
+        return;
+    }
+    lock.lock();
+    running_id = 0;
+
+    job.last_turn = ++turn;
+    progress.render_ms += stats.frame_ms;
+    progress.rays_traced += stats.rays_traced;
+    if (!stats.cancelled) {
+        progress.samples_done += samples;
+        progress.passes++;
+        job.ms_per_sample = stats.frame_ms / samples;
+    }
+}
+
+void Renderer::report(std::unique_lock<std::mutex>& lock, JobId id) {
+    Job& job = *job_table.at(id);
+    const JobProgress progress = job.progress;
+    job.reporting = true;
+    lock.unlock();
+    if (job.request.on_progress) job.request.on_progress(progress);
+    if (progress.finished() && job.request.on_finished) job.request.on_finished(progress, job.target);
+    lock.lock();
+    job.reporting = false;
+    if (progress.finished()) {
+        if (job.request.on_finished) job_table.erase(id);
+        finished_cv.notify_all();
+    }
+}
@@ -0,0 +1,129 @@
+#pragma once
+// Render service: one worker pool shared by any number of independent render jobs (scene, camera,
+// resolution, samples per pixel, priority), so a process can serve many preview and final-quality
+// requests without each one bringing its own threads. Jobs render progressively in passes, each an
+// accumulating frame over the whole pool sized to take about RendererSettings::pass_ms; between
+// passes a scheduler thread picks the next job: the highest priority first, and the one that waited
+// longest among equals. A new preview therefore starts within one pass of a long final render, and
+// jobs of the same priority share the pool in turns.
+//
+// Every job renders into its own FrameBuffer, and the Scene is shared (read-only) between the jobs
+// that use it, so nothing here is global and several Renderers may live side by side. Callbacks run
+// on the scheduler thread, between passes, without any lock held: they may call back into the
+// Renderer, but the pool idles while they run.
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Renderer.h"
+
+using JobId = uint64_t;
+
+enum class JobState {
+    Queued,    // No samples yet
+    Running,   // Some passes done; may be waiting for its next turn
+    Done,
+    Cancelled,
+    Failed     // Its buffers could not be allocated; the image is empty
+};
+
+const char* job_state_name(JobState state);
+
+struct JobProgress {
+    JobId id = 0;
+    JobState state = JobState::Queued;
+    int priority = 0;
+    uint32_t samples_done = 0;  // Per pixel
+    uint32_t samples_total = 0;
+    uint32_t passes = 0;
+    double render_ms = 0.0;     // Pool time spent on the job's passes
+    uint64_t rays_traced = 0;
+
+    bool finished() const { return state == JobState::Done || state == JobState::Cancelled || state == JobState::Failed; }
+    double fraction() const { return samples_total > 0 ? static_cast<double>(samples_done) / samples_total : 0.0; }
+};
+
+struct RenderJob {
+    std::shared_ptr<const Scene> scene; // Acceleration built; must not change while the job is queued or running
+    Camera camera;                      // Initialized for width / height
+    int width = 0;
+    int height = 0;
+    int samples_per_pixel = 0;          // 0 = the scene's
+    int priority = 0;                   // Higher runs first
+    // Everything but accumulation, temporal reuse and adaptive sampling, which the service decides
+    // (on, off, off). The denoiser only runs after the last pass, guided by that pass's samples.
+    RenderSettings settings;
+    bool keep_hdr = false;              // Size the result's hdr output too (see FrameBuffer::has_hdr)
+    // After every pass, and once more when the job finishes or is cancelled.
+    std::function<void(const JobProgress&)> on_progress;
+    // When the job is done, cancelled (the image then holds whatever passes finished) or failed. Jobs
+    // with this callback are dropped right after it; the others are kept for Renderer::wait().
+    std::function<void(const JobProgress&, const FrameBuffer&)> on_finished;
+};
+
+struct RendererSettings {
+    int threads = 0;        // 0 = default_thread_count()
+    double pass_ms = 50.0;  // Target length of one pass; also the longest a new job waits for the pool
+};
+
+class Renderer {
+public:
+    explicit Renderer(const RendererSettings& settings = RendererSettings());
+    // Cancels every job and stops the scheduler; the jobs' on_finished callbacks still run.
+    ~Renderer();
+
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+
+    // Queues the job and returns its id, or 0 when it has no scene or no pixels.
+    JobId submit(RenderJob job);
+    // A queued job is dropped before it starts, a running one stops within the pass in flight.
+    // False when the id is unknown or the job already finished.
+    bool cancel(JobId id);
+    bool set_priority(JobId id, int priority);
+    bool progress(JobId id, JobProgress& result) const;
+    // Jobs not yet dropped, in submission order.
+    std::vector<JobProgress> jobs() const;
+    // Blocks until the job finishes, then drops it and moves its image into `image` when given.
+    // False when the id is unknown (or its on_finished callback already dropped it).
+    bool wait(JobId id, JobProgress& result, FrameBuffer* image = nullptr);
+    int thread_count() const { return pool.thread_count(); }
+
+private:
+    struct Job {
+        RenderJob request;
+        JobProgress progress;
+        FrameBuffer target;
+        uint64_t last_turn = 0;     // Scheduler turn of its last pass; 0 = never ran
+        double ms_per_sample = 0.0; // Per sample per pixel, measured on the last pass
+        bool cancel_requested = false;
+        bool failed = false;
+        bool reporting = false;     // Callbacks running; wait() leaves the job alone until they return
+    };
+
+    void run_scheduler();
+    // Highest priority unfinished job, least recently run among equals; cancelled ones first.
+    Job* next_job();
+    // Renders one pass of the job; called and returns with the lock held. A job whose buffers do
+    // not fit in memory fails on its own instead of taking the scheduler thread down.
+    void render_pass(std::unique_lock<std::mutex>& lock, Job& job);
+    // Reports the job's state after a pass and drops it if its on_finished callback took it.
+    void report(std::unique_lock<std::mutex>& lock, JobId id);
+
+    RendererSettings settings;
+    RenderThreadPool pool;
+    mutable std::mutex mutex;
+    std::condition_variable scheduler_cv; // A job arrived or was cancelled, or shutdown
+    std::condition_variable finished_cv;  // A job finished or was dropped
+    std::map<JobId, std::unique_ptr<Job>> job_table; // Ordered by id, which is submission order
+    JobId next_id = 1;
+    JobId running_id = 0;  // Job whose pass is on the pool
+    uint64_t turn = 0;
+    bool shutting_down = false;
+
+    std::jthread scheduler; // Declared last so it stops before the state above is destroyed
+};
@@ -0,0 +1,532 @@
+#include "RenderServer.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "ImageIO.h"
+#include "Log.h"
+#include "SceneBinary.h"
+#include "Socket.h"
+
+namespace {
+
+using ClientId = uint64_t;
+const ClientId STDIN_CLIENT = 0;
+const size_t MAX_LINE = 1 << 16; // A connection sending longer lines is not speaking the protocol
+const int SHUTDOWN_FLUSH_MS = 1000; // What clients get to read their last replies after `shutdown`
+
+enum class CommandResult { Continue, Quit, Shutdown };
+
+std::vector<std::string> split_words(const std::string& line) {
+    std::istringstream stream(line);
+    std::vector<std::string> words;
+    std::string word;
+    while (stream >> word) words.push_back(word);
+    return words;
+}
+
+bool parse_camera(const std::string& value, Vec3& position, Vec3& target, double& fov) {
+    std::vector<double> numbers;
+    std::string_view rest(value);
+    while (!rest.empty() || numbers.empty()) {
+        const size_t comma = rest.find(',');
+        double number;
+        if (!scene_text::parse_number(rest.substr(0, comma), number)) return false;
+        numbers.push_back(number);
+        rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+    }
+    if (numbers.size() != 6 && numbers.size() != 7) return false;
+    position = Vec3(numbers[0], numbers[1], numbers[2]);
+    target = Vec3(numbers[3], numbers[4], numbers[5]);
+    if (numbers.size() == 7) fov = numbers[6];
+    return true;
+}
+
+std::string format_line(const char* pattern, auto... values) {
+    char buffer[512];
+    std::snprintf(buffer, sizeof(buffer), pattern, values...);
+    return buffer;
+}
+
+class RenderServer {
+public:
+    explicit RenderServer(const RenderServerSettings& settings_) : settings(settings_), renderer(settings_.renderer) {
+        loader = std::jthread([this] { run_loader(); });
+    }
+    ~RenderServer();
+
+    // Delivers a line to a client; set by the transport. Only called through emit(), one line at a time.
+    std::function<void(ClientId, const std::string&)> send;
+
+    // `scene` only queues the load: its reply comes from the loader thread once the scene is built.
+    CommandResult handle(ClientId client, const std::string& line);
+    // Loads on the calling thread. `file` is not checked: clients' paths go through resolve() first.
+    bool load_scene(const std::string& name, const std::string& file, std::string& reply);
+    // Cancels every job and drops the scene loads that have not started.
+    void cancel_all();
+    // A scene the client asked for is still loading; its later commands should wait for the reply.
+    bool loading(ClientId client) const;
+    // Every load and job has finished and reported back (the server's jobs all drop themselves).
+    bool idle() const;
+
+private:
+    struct SceneLoad {
+        ClientId client = 0;
+        std::string name;
+        std::string path;
+    };
+
+    void emit(ClientId client, const std::string& line) {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        send(client, line);
+    }
+    void render(ClientId client, const std::vector<std::string>& words);
+    // A client's file name inside settings.root; false for absolute paths and any "..".
+    bool resolve(const std::string& file, std::string& path) const;
+    // Parsing a scene and building its BVH can take seconds, so they run here rather than on the
+    // thread serving every connection. One load at a time, in the order they were asked for.
+    void run_loader();
+
+    RenderServerSettings settings;
+    mutable std::mutex scene_mutex; // Guards scenes, loads and shutting_down
+    std::condition_variable loader_cv;
+    std::map<std::string, std::shared_ptr<const Scene>> scenes;
+    std::deque<SceneLoad> loads; // The front one is loading; each is popped once its reply is out
+    bool shutting_down = false;
+    // Held across submit() and the "job <id>" reply, so the job's events cannot overtake it.
+    std::mutex send_mutex;
+    Renderer renderer; // Its destructor still runs the jobs' callbacks
+    std::jthread loader; // Declared last so it stops before the state above is destroyed
+};
+
+RenderServer::~RenderServer() {
+    {
+        std::lock_guard<std::mutex> lock(scene_mutex);
+        shutting_down = true;
+    }
+    loader_cv.notify_one();
+    loader.join();
+}
+
+bool RenderServer::load_scene(const std::string& name, const std::string& file, std::string& reply) {
+    auto scene = std::make_shared<Scene>();
+    try {
+        if (!load_scene_any(file, *scene)) {
+            reply = "error cannot load " + file;
+            return false;
+        }
+        build_acceleration(*scene, settings.use_bvh, settings.precision);
+    }
+    catch (const std::bad_alloc&) {
+        reply = "error out of memory loading " + file;
+        return false;
+    }
+    reply = format_line("ok scene %s %zu spheres", name.c_str(), scene->objects.size());
+    std::lock_guard<std::mutex> lock(scene_mutex);
+    scenes[name] = std::move(scene);
+    return true;
+}
+
+void RenderServer::run_loader() {
+    std::unique_lock<std::mutex> lock(scene_mutex);
+    while (true) {
+        loader_cv.wait(lock, [this] { return shutting_down || !loads.empty(); });
+        if (shutting_down) return;
+        const SceneLoad load = loads.front();
+        lock.unlock();
+        std::string reply;
+        load_scene(load.name, load.path, reply);
+        emit(load.client, reply);
+        lock.lock();
+        loads.pop_front();
+    }
+}
+
+void RenderServer::cancel_all() {
+    std::vector<SceneLoad> dropped;
+    {
+        std::lock_guard<std::mutex> lock(scene_mutex);
+        while (loads.size() > 1) {
+            dropped.push_back(std::move(loads.back()));
+            loads.pop_back();
+        }
+    }
+    for (const SceneLoad& load : dropped) emit(load.client, "error cancelled loading " + load.name);
+    for (const JobProgress& job : renderer.jobs()) renderer.cancel(job.id);
+}
+
+bool RenderServer::loading(ClientId client) const {
+    std::lock_guard<std::mutex> lock(scene_mutex);
+    for (const SceneLoad& load : loads) {
+        if (load.client == client) return true;
+    }
+    return false;
+}
+
+bool RenderServer::idle() const {
+    {
+        std::lock_guard<std::mutex> lock(scene_mutex);
+        if (!loads.empty()) return false;
+    }
+    return renderer.jobs().empty();
+}
+
+bool RenderServer::resolve(const std::string& file, std::string& path) const {
+    const std::filesystem::path relative(file);
+    if (file.empty() || relative.has_root_path()) return false;
+    for (const std::filesystem::path& part : relative) {
+        if (part == "..") return false;
+    }
+    path = settings.root.empty() ? file : (std::filesystem::path(settings.root) / relative).string();
+    return true;
+}
+
+CommandResult RenderServer::handle(ClientId client, const std::string& line) {
+    const std::vector<std::string> words = split_words(line);
+    if (words.empty()) return CommandResult::Continue;
+    const std::string& command = words[0];
+    JobId id = 0;
+    if (command == "scene") {
+        std::string path;
+        if (words.size() != 3) emit(client, "error usage: scene <name> <file>");
+        else if (!resolve(words[2], path)) emit(client, "error bad path " + words[2]);
+        else {
+            std::lock_guard<std::mutex> lock(scene_mutex);
+            loads.push_back(SceneLoad{client, words[1], path});
+            loader_cv.notify_one();
+        }
+    }
+    else if (command == "render") {
+        render(client, words);
+    }
+    else if (command == "cancel") {
+        if (words.size() != 2 || !scene_text::parse_number(words[1], id)) emit(client, "error usage: cancel <id>");
+        else emit(client, renderer.cancel(id) ? "ok" : "error no unfinished job " + words[1]);
+    }
+    else if (command == "priority") {
+        int priority = 0;
+        if (words.size() != 3 || !scene_text::parse_number(words[1], id) || !scene_text::parse_number(words[2], priority)) {
+            emit(client, "error usage: priority <id> <priority>");
+        }
+        else {
+            emit(client, renderer.set_priority(id, priority) ? "ok" : "error no unfinished job " + words[1]);
+        }
+    }
+    else if (command == "status") {
+        const std::vector<JobProgress> jobs = renderer.jobs();
+        for (const JobProgress& job : jobs) {
+            emit(client, format_line("job %llu %s priority %d %u/%u spp %.1f ms", static_cast<unsigned long long>(job.id),
+                job_state_name(job.state), job.priority, job.samples_done, job.samples_total, job.render_ms));
+        }
+        emit(client, format_line("ok %zu jobs", jobs.size()));
+    }
+    else if (command == "quit") {
+        emit(client, "ok");
+        return CommandResult::Quit;
+    }
+    else if (command == "shutdown") {
+        emit(client, "ok");
+        return CommandResult::Shutdown;
+    }
+    else {
+        emit(client, "error unknown command " + command);
+    }
+    return CommandResult::Continue;
+}
+
+void RenderServer::render(ClientId client, const std::vector<std::string>& words) {
+    RenderJob job;
+    if (words.size() >= 2) {
+        std::lock_guard<std::mutex> lock(scene_mutex);
+        auto scene = scenes.find(words[1]);
+        if (scene != scenes.end()) job.scene = scene->second;
+    }
+    if (!job.scene) {
+        emit(client, words.size() >= 2 ? "error unknown scene " + words[1] : "error usage: render <scene> [key=value...]");
+        return;
+    }
+    job.width = settings.width;
+    job.height = settings.height;
+    job.settings = settings.render;
+    Vec3 position = settings.camera_position;
+    Vec3 target = settings.camera_target;
+    double fov = settings.fov_degrees;
+    std::string output;      // As the client named it, for the events
+    std::string output_path; // Inside settings.root
+    for (size_t i = 2; i < words.size(); ++i) {
+        const size_t equals = words[i].find('=');
+        const std::string key = words[i].substr(0, equals);
+        const std::string value = equals == std::string::npos ? std::string() : words[i].substr(equals + 1);
+        bool valid = true;
+        if (key == "width") valid = scene_text::parse_number(value, job.width) && job.width > 0;
+        else if (key == "height") valid = scene_text::parse_number(value, job.height) && job.height > 0;
+        else if (key == "spp") {
+            valid = scene_text::parse_number(value, job.samples_per_pixel) && job.samples_per_pixel >= 0 &&
+                job.samples_per_pixel <= settings.max_spp;
+        }
+        else if (key == "priority") valid = scene_text::parse_number(value, job.priority);
+        else if (key == "seed") valid = scene_text::parse_number(value, job.settings.seed);
+        else if (key == "output") valid = resolve(value, output_path);
+        else if (key == "nee") {
+            valid = value == "on" || value == "off";
+            job.settings.next_event = value == "on";
+        }
+        else if (key == "denoise") {
+            job.settings.denoise.enabled = value != "off";
+            if (value != "on" && value != "off") {
+                valid = scene_text::parse_number(value, job.settings.denoise.passes) && job.settings.denoise.passes > 0;
+            }
+        }
+        else if (key == "integrator") {
+            valid = value == "recursive" || value == "wavefront";
+            job.settings.integrator = value == "wavefront" ? Integrator::Wavefront : Integrator::Recursive;
+        }
+        else if (key == "camera") valid = parse_camera(value, position, target, fov);
+        else {
+            emit(client, "error unknown key " + key);
+            return;
+        }
+        if (!valid) {
+            emit(client, "error bad value for " + key);
+            return;
+        }
+        if (key == "output") output = value;
+    }
+    if (static_cast<long long>(job.width) * job.height > settings.max_pixels) {
+        emit(client, format_line("error bad value for width: %dx%d is over the %lld pixel limit", job.width, job.height, settings.max_pixels));
+        return;
+    }
+    job.camera.position = position;
+    job.camera.look_at_target = target;
+    job.camera.world_up_vector = Vec3(0, 1, 0);
+    job.camera.fov_degrees = fov;
+    job.camera.initialize(static_cast<double>(job.width) / job.height);
+    job.keep_hdr = output.size() >= 4 && output.compare(output.size() - 4, 4, ".pfm") == 0;
+
+    job.on_progress = [this, client](const JobProgress& progress) {
+        if (progress.finished()) return; // on_finished has the last word
+        emit(client, format_line("progress %llu %u/%u", static_cast<unsigned long long>(progress.id), progress.samples_done,
+            progress.samples_total));
+    };
+    job.on_finished = [this, client, output, output_path](const JobProgress& progress, const FrameBuffer& image) {
+        const unsigned long long id = progress.id;
+        if (progress.state == JobState::Cancelled) {
+            emit(client, format_line("cancelled %llu", id));
+            return;
+        }
+        if (progress.state == JobState::Failed) {
+            emit(client, format_line("failed %llu out of memory", id));
+            return;
+        }
+        const std::string file = output.empty() ? format_line("job%llu.ppm", id) : output;
+        std::string path = output_path;
+        if (path.empty()) resolve(file, path);
+        if (write_image(path, image)) emit(client, format_line("done %llu %s %.1f ms", id, file.c_str(), progress.render_ms));
+        else emit(client, format_line("failed %llu %s", id, file.c_str()));
+    };
+    std::lock_guard<std::mutex> lock(send_mutex);
+    const JobId id = renderer.submit(std::move(job));
+    send(client, format_line("job %llu", static_cast<unsigned long long>(id)));
+}
+
+void wait_until_idle(const RenderServer& server) {
+    while (!server.idle()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+}
+
+// Commands from stdin, replies and events on stdout.
+void serve_stdin(RenderServer& server) {
+    server.send = [](ClientId, const std::string& line) {
+        std::fputs(line.c_str(), stdout);
+        std::fputc('\n', stdout);
+        std::fflush(stdout);
+    };
+    CommandResult result = CommandResult::Continue;
+    std::string line;
+    while (result == CommandResult::Continue && std::getline(std::cin, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        result = server.handle(STDIN_CLIENT, line);
+        // The next line may render the scene this one loads. Only stdin is waiting.
+        while (server.loading(STDIN_CLIENT)) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (result == CommandResult::Shutdown) server.cancel_all();
+    wait_until_idle(server);
+}
+
+struct Connection {
+    intptr_t socket = NO_SOCKET;
+    ClientId id = 0;
+    std::string name;
+    std::string input;  // Up to the next newline
+    std::string output; // Not yet sent
+    bool closing = false; // Said quit; closed once its output is out
+};
+
+// Reads what the connection has sent. False when it closed or failed.
+bool receive(Connection& connection) {
+    uint8_t buffer[4096];
+    while (true) {
+        const long received = recv_some(connection.socket, buffer, sizeof(buffer));
+        if (received == 0) return false;
+        if (received < 0) {
+            if (!would_block()) return false;
+            break;
+        }
+        connection.input.append(reinterpret_cast<const char*>(buffer), static_cast<size_t>(received));
+    }
+    return true;
+}
+
+// Runs the connection's complete lines. Those after a `scene` wait in the input until its reply is
+// out, so they see the scene it loads. False when the connection sent a line that is too long.
+bool run_lines(RenderServer& server, Connection& connection, bool& shutdown) {
+    size_t start = 0;
+    for (size_t end = connection.input.find('\n');
+        end != std::string::npos && !connection.closing && !shutdown && !server.loading(connection.id);
+        end = connection.input.find('\n', start)) {
+        std::string line = connection.input.substr(start, end - start);
+        start = end + 1;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        const CommandResult result = server.handle(connection.id, line);
+        if (result == CommandResult::Quit) connection.closing = true;
+        if (result == CommandResult::Shutdown) shutdown = true;
+    }
+    connection.input.erase(0, start);
+    if (connection.input.size() > MAX_LINE && connection.input.find('\n') == std::string::npos) {
+        log_message("Render server: dropping " + connection.name + ", line too long\n");
+        return false;
+    }
+    return true;
+}
+
+bool flush(Connection& connection) {
+    while (!connection.output.empty()) {
+        const long sent = send_some(connection.socket, reinterpret_cast<const uint8_t*>(connection.output.data()),
+            connection.output.size());
+        if (sent < 0) return would_block();
+        connection.output.erase(0, static_cast<size_t>(sent));
+    }
+    return true;
+}
+
+// Any number of connections, each with its own replies and job events. One thread runs the commands;
+// events from the scheduler and loader threads wait in an outbox until the next poll (at most 10 ms).
+bool serve_tcp(RenderServer& server, const std::string& address, int port) {
+    int bound_port = 0;
+    const intptr_t listener = open_listener(address, port, bound_port, "render server");
+    if (listener == NO_SOCKET) return false;
+    log_message("Render server listening on " + address + ":" + std::to_string(bound_port) + "\n");
+
+    std::mutex outbox_mutex;
+    std::vector<std::pair<ClientId, std::string>> outbox;
+    server.send = [&](ClientId client, const std::string& line) {
+        std::lock_guard<std::mutex> lock(outbox_mutex);
+        outbox.emplace_back(client, line + "\n");
+    };
+    std::vector<std::unique_ptr<Connection>> connections;
+    auto deliver = [&] {
+        std::vector<std::pair<ClientId, std::string>> lines;
+        {
+            std::lock_guard<std::mutex> lock(outbox_mutex);
+            lines.swap(outbox);
+        }
+        for (auto& [client, text] : lines) {
+            for (auto& connection : connections) {
+                if (connection->id == client) connection->output += text; // Gone: dropped
+            }
+        }
+    };
+
+    ClientId next_client = 1;
+    bool shutdown = false;
+    while (!shutdown) {
+        std::vector<PollEntry> entries(connections.size() + 1);
+        entries[0].fd = native(listener);
+        entries[0].events = POLLIN;
+        for (size_t i = 0; i < connections.size(); ++i) {
+            entries[i + 1].fd = native(connections[i]->socket);
+            // A connection waiting on a scene load is not read past a line's worth of commands.
+            const short read = connections[i]->input.size() <= MAX_LINE ? POLLIN : 0;
+            entries[i + 1].events = static_cast<short>(read | (connections[i]->output.empty() ? 0 : POLLOUT));
+        }
+        if (poll_sockets(entries.data(), entries.size(), 10) < 0) break;
+
+        std::vector<bool> alive(connections.size(), true);
+        for (size_t i = 0; i < connections.size() && !shutdown; ++i) {
+            const short events = entries[i + 1].revents;
+            if (events & (POLLERR | POLLNVAL)) alive[i] = false;
+            else if (events & (POLLIN | POLLHUP)) alive[i] = receive(*connections[i]);
+            // Also runs what was held back for a load that has since finished.
+            if (alive[i]) alive[i] = run_lines(server, *connections[i], shutdown);
+        }
+        deliver();
+        for (size_t i = 0; i < connections.size(); ++i) {
+            if (alive[i]) alive[i] = flush(*connections[i]);
+            if (alive[i] && connections[i]->closing && connections[i]->output.empty()) alive[i] = false;
+        }
+        for (size_t i = connections.size(); i > 0; --i) {
+            if (alive[i - 1]) continue;
+            close_socket(connections[i - 1]->socket);
+            connections.erase(connections.begin() + static_cast<std::ptrdiff_t>(i - 1));
+        }
+        if (entries[0].revents & POLLIN) {
+            std::string peer;
+            for (intptr_t s = accept_connection(listener, peer); s != NO_SOCKET; s = accept_connection(listener, peer)) {
+                set_nonblocking(s, true);
+                set_nodelay(s);
+                auto connection = std::make_unique<Connection>();
+                connection->socket = s;
+                connection->id = next_client++;
+                connection->name = peer;
+                connections.push_back(std::move(connection));
+            }
+        }
+    }
+
+    // Shutting down: the cancelled jobs still report, and whoever is connected hears about it, as
+    // far as SHUTDOWN_FLUSH_MS allows; a client that stopped reading loses the rest.
+    server.cancel_all();
+    wait_until_idle(server);
+    deliver();
+    const auto flush_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SHUTDOWN_FLUSH_MS);
+    while (!connections.empty()) {
+        for (size_t i = connections.size(); i > 0; --i) {
+            Connection& connection = *connections[i - 1];
+            if (flush(connection) && !connection.output.empty()) continue;
+            close_socket(connection.socket);
+            connections.erase(connections.begin() + static_cast<std::ptrdiff_t>(i - 1));
+        }
+        const long long left_ms = std::chrono::duration_cast<std::chrono::milliseconds>(flush_deadline - std::chrono::steady_clock::now()).count();
+        if (connections.empty() || left_ms <= 0) break;
+        std::vector<PollEntry> entries(connections.size());
+        for (size_t i = 0; i < connections.size(); ++i) {
+            entries[i].fd = native(connections[i]->socket);
+            entries[i].events = POLLOUT;
+        }
+        if (poll_sockets(entries.data(), entries.size(), static_cast<int>(left_ms)) < 0) break;
+    }
+    for (auto& connection : connections) close_socket(connection->socket);
+    close_socket(listener);
+    server.send = nullptr;
+    return true;
+}
+
+} // namespace
+
+bool run_render_server(const RenderServerSettings& settings) {
+    RenderServer server(settings);
+    if (!settings.default_scene.empty()) {
+        std::string reply;
+        if (!server.load_scene("default", settings.default_scene, reply)) log_message("Render server: " + reply + "\n");
+    }
+    if (settings.port < 0) {
+        serve_stdin(server);
+        return true;
+    }
+    return serve_tcp(server, settings.bind_address, settings.port);
+}
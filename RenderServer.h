@@ -0,0 +1,53 @@
+#pragma once
+// Line-based text protocol in front of the render service (RenderJobs.h), read from stdin (replies
+// on stdout) or from any number of TCP connections. Each command line gets one reply line, or
+// several for `status`; jobs report back to the connection that submitted them as they go.
+//
+//   scene <name> <file>           Load a scene (text or .rmsc) and build its BVH; an existing name is
+//                                 replaced, jobs already using the old scene keep it. Loads run in
+//                                 the background and reply when they finish; the connection's later
+//                                 commands wait for that reply, other connections do not
+//   render <scene> [key=value...] Queue a job; replies "job <id>". Keys: width, height, spp, priority,
+//                                 seed, output (.ppm or .pfm; default job<id>.ppm), nee=on|off,
+//                                 denoise=off|on|<passes>, integrator=recursive|wavefront,
+//                                 camera=px,py,pz,tx,ty,tz[,fov]
+//   cancel <id>
+//   priority <id> <priority>      Higher runs first; takes effect at the next pass
+//   status                        "job <id> <state> priority <p> <done>/<total> spp <ms> ms" per job
+//   quit                          Close the connection; on stdin, finish the queued jobs and exit
+//   shutdown                      Cancel every job and stop the server
+//
+// Files are relative to RenderServerSettings::root and may not leave it.
+//
+// Replies are "ok ...", "job <id>" or "error <message>". Events: "progress <id> <done>/<total>"
+// after every pass, then "done <id> <file> <ms> ms", "cancelled <id>", "failed <id> <file>" when
+// the image could not be written, or "failed <id> out of memory".
+#include <string>
+#include "RenderJobs.h"
+
+struct RenderServerSettings {
+    int port = -1;               // TCP port to listen on (0 = any free one); -1 = stdin and stdout
+    // Interface the port is opened on. Connections are not authenticated and may read scene files,
+    // write images and shut the server down, so the default only lets this machine in.
+    std::string bind_address = "127.0.0.1";
+    RendererSettings renderer;   // Threads and pass length of the shared pool
+    RenderSettings render;       // Defaults for every job; `render` keys override some
+    int width = 1920;            // Defaults for the `render` keys
+    int height = 1080;
+    // Largest jobs a client may ask for; bigger ones are refused rather than left to run out of memory.
+    long long max_pixels = 7680LL * 4320;
+    int max_spp = 65536;
+    Vec3 camera_position = Vec3(0, 1.0, 4.0);
+    Vec3 camera_target = Vec3(0, 0.5, 0);
+    double fov_degrees = 60.0;
+    bool use_bvh = true;         // How `scene` builds acceleration structures
+    Precision precision = Precision::Double;
+    std::string default_scene;   // Loaded as "default" before serving, when set
+    // Directory the files named in `scene` and `output=` are relative to ("" = the working
+    // directory). Absolute paths and ".." are refused, so clients cannot read or write outside it.
+    std::string root;
+};
+
+// Serves until `shutdown`, or on stdin until `quit` or the end of input and the last job. Returns
+// false when the port could not be opened.
+bool run_render_server(const RenderServerSettings& settings);
@@ -0,0 +1,965 @@
+#include "Renderer.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <cmath>
+#include <type_traits>
+#include "Sphere.h"
+#include "Resolution.h"
+
+namespace {
+
+bool adaptive_sampling_active(const FrameInfo& frame_info) {
+    return frame_info.settings.accumulate && frame_info.settings.adaptive.enabled;
+}
+
+} // namespace
+
+double sample_luminance(const Vec3& color) {
+    return 0.2126 * color.x + 0.7152 * color.y + 0.0722 * color.z;
+}
+
+uint32_t first_sample_index(const FrameInfo& frame_info, const FrameBuffer& target, size_t pixel_index) {
+    if (!frame_info.settings.accumulate || target.accumulated_samples == 0) return 0;
+    return adaptive_sampling_active(frame_info) ? target.sample_counts[pixel_index] : target.accumulated_samples;
+}
+
+bool survives_roulette(const RussianRoulette& roulette, int depth, Vec3& throughput, PixelSampler& sampler) {
+    if (!roulette.enabled) return true;
+    const double strength = std::max(throughput.x, std::max(throughput.y, throughput.z));
+    if (depth < roulette.min_depth || strength >= roulette.threshold) return true;
+    const double survival = strength / roulette.threshold;
+    if (sampler.next_1d() >= survival) return false;
+    throughput = throughput / survival;
+    return true;
+}
+
+// The first frame after a reset samples everything.
+bool skip_pixel(const FrameInfo& frame_info, const FrameBuffer& target, size_t pixel_index) {
+    return adaptive_sampling_active(frame_info) && target.accumulated_samples > 0 &&
+        pixel_converged(target, frame_info.settings.adaptive, pixel_index);
+}
+
+// When accumulating, the sums are added to the running sums and the mean over all frames so far
+// is displayed. Only the linear image is written; the pixels are resolved from it per tile.
+void store_pixel(FrameBuffer& target, const FrameInfo& frame_info, size_t pixel_index, const Vec3& sum, double lum_sq_sum, int samples) {
+    float* out = &target.hdr[pixel_index * 3];
+    if (frame_info.settings.accumulate) {
+        const bool fresh = target.accumulated_samples == 0;
+        float* running = &target.accum[pixel_index * 3];
+        if (fresh) {
+            running[0] = running[1] = running[2] = 0.0f;
+        }
+        running[0] += static_cast<float>(sum.x);
+        running[1] += static_cast<float>(sum.y);
+        running[2] += static_cast<float>(sum.z);
+        uint32_t count = target.accumulated_samples + samples;
+        if (adaptive_sampling_active(frame_info)) {
+            if (fresh) {
+                target.sample_counts[pixel_index] = 0;
+                target.accum_lum_sq[pixel_index] = 0.0f;
+            }
+            target.sample_counts[pixel_index] += samples;
+            target.accum_lum_sq[pixel_index] += static_cast<float>(lum_sq_sum);
+            count = target.sample_counts[pixel_index];
+        }
+        double inv_count = 1.0 / count;
+        out[0] = static_cast<float>(running[0] * inv_count);
+        out[1] = static_cast<float>(running[1] * inv_count);
+        out[2] = static_cast<float>(running[2] * inv_count);
+    }
+    else {
+        const Vec3 color = sum / static_cast<double>(samples);
+        out[0] = static_cast<float>(color.x);
+        out[1] = static_cast<float>(color.y);
+        out[2] = static_cast<float>(color.z);
+    }
+}
+
+void resolve_tile(const RenderSettings& settings, FrameBuffer& target, const RenderTile& tile) {
+    for (int y = tile.startY; y < tile.endY; ++y) {
+        const size_t row = static_cast<size_t>(y) * target.width + tile.startX;
+        resolve_pixels(settings.tonemap, target.hdr.data() + row * 3, target.pixels.data() + row, tile.endX - tile.startX);
+    }
+}
+
+void store_guides(FrameBuffer& target, size_t pixel_index, const GuideSums& sums, int samples) {
+    const size_t plane = static_cast<size_t>(target.width) * target.height;
+    const double inv_samples = 1.0 / samples;
+    target.albedo[pixel_index] = static_cast<float>(sums.albedo.x * inv_samples);
+    target.albedo[plane + pixel_index] = static_cast<float>(sums.albedo.y * inv_samples);
+    target.albedo[2 * plane + pixel_index] = static_cast<float>(sums.albedo.z * inv_samples);
+    target.normal[pixel_index] = static_cast<float>(sums.normal.x * inv_samples);
+    target.normal[plane + pixel_index] = static_cast<float>(sums.normal.y * inv_samples);
+    target.normal[2 * plane + pixel_index] = static_cast<float>(sums.normal.z * inv_samples);
+    target.depth[pixel_index] = static_cast<float>(sums.depth * inv_samples);
+}
+
+namespace {
+
+// trace_ray for a camera ray that also adds its first hit to the pixel's denoiser guides.
+template <typename T>
+Vec3 trace_camera_ray(TraceContext& ctx, const RayT<T>& ray, GuideSums& guides) {
+    const Scene& scene = ctx.scene;
+    if (scene.max_ray_depth <= 0) {
+        guides.add_miss(scene);
+        return trace_ray(ctx, ray, 0);
+    }
+    ctx.rays_traced++;
+    if constexpr (PROFILING_ENABLED) ctx.paths.rays[0]++;
+    SceneHit hit;
+    if (!intersect_scene(ctx, ray, T(0), hit)) {
+        if constexpr (PROFILING_ENABLED) ctx.paths.escaped++;
+        guides.add_miss(scene);
+        return scene.background_color;
+    }
+    guides.add_hit(scene, ray, hit);
+    return shade_hit(ctx, ray, hit, 0);
+}
+
+// Packet version of render_chunk: the tile is walked in block x block pixel blocks, and each
+// sample pass over a block traces the primary rays of all its unconverged pixels as one packet.
+template <typename T>
+void render_chunk_packets(const FrameInfo& frame_info, const Camera& camera, FrameBuffer& target,
+    const RenderTile& tile, TraceContext& ctx, int block) {
+    const int width = target.width;
+    const int height = target.height;
+    const int samples = frame_info.settings.frame_samples(ctx.scene);
+    const bool jitter = samples > 1 || frame_info.settings.accumulate; // Accumulated 1-spp frames still antialias
+    const RenderSettings& settings = frame_info.settings;
+    const bool want_guides = target.has_guides();
+    Vec3 accumulated[PACKET_MAX_RAYS];
+    GuideSums guides[PACKET_MAX_RAYS];
+    double accumulated_lum_sq[PACKET_MAX_RAYS];
+    int pixel_x[PACKET_MAX_RAYS];
+    int pixel_y[PACKET_MAX_RAYS];
+    uint32_t first_index[PACKET_MAX_RAYS];
+    PixelSampler samplers[PACKET_MAX_RAYS];
+    RayPacketSoAT<T> packet;
+
+    for (int by = tile.startY; by < tile.endY; by += block) {
+        const int block_h = std::min(block, tile.endY - by);
+        for (int bx = tile.startX; bx < tile.endX; bx += block) {
+            const int block_w = std::min(block, tile.endX - bx);
+            uint32_t ray_count = 0;
+            for (int y = by; y < by + block_h; ++y) {
+                for (int x = bx; x < bx + block_w; ++x) {
+                    const size_t pixel_index = static_cast<size_t>(y) * width + x;
+                    if (skip_pixel(frame_info, target, pixel_index)) continue;
+                    pixel_x[ray_count] = x;
+                    pixel_y[ray_count] = y;
+                    first_index[ray_count] = first_sample_index(frame_info, target, pixel_index);
+                    accumulated[ray_count] = Vec3(0.0, 0.0, 0.0);
+                    accumulated_lum_sq[ray_count] = 0.0;
+                    guides[ray_count] = GuideSums();
+                    ray_count++;
+                }
+            }
+            if (ray_count == 0) continue;
+            ctx.pixels_sampled += ray_count;
+            const uint32_t padded_count = (ray_count + PACKET_LANE_PADDING - 1) & ~(PACKET_LANE_PADDING - 1);
+            const PacketFrustum frustum = make_packet_frustum(camera,
+                static_cast<double>(bx) / width, static_cast<double>(by) / height,
+                static_cast<double>(bx + block_w) / width, static_cast<double>(by + block_h) / height);
+
+            for (int s = 0; s < samples; ++s) {
+                packet.origin[0] = static_cast<T>(camera.position.x);
+                packet.origin[1] = static_cast<T>(camera.position.y);
+                packet.origin[2] = static_cast<T>(camera.position.z);
+                packet.count = ray_count;
+                for (uint32_t r = 0; r < ray_count; ++r) {
+                    samplers[r] = PixelSampler(settings.sampler, settings.seed,
+                        static_cast<uint32_t>(pixel_y[r] * width + pixel_x[r]), first_index[r] + s);
+                    double dx, dy;
+                    samplers[r].next_2d(dx, dy);
+                    if (!jitter) dx = dy = 0.5;
+                    Vec3 dir = camera.get_ray((pixel_x[r] + dx) / width, (pixel_y[r] + dy) / height).direction;
+                    packet.dir_x[r] = static_cast<T>(dir.x);
+                    packet.dir_y[r] = static_cast<T>(dir.y);
+                    packet.dir_z[r] = static_cast<T>(dir.z);
+                    packet.t[r] = std::numeric_limits<T>::infinity();
+                    packet.hit_index[r] = T(-1);
+                }
+                for (uint32_t r = ray_count; r < padded_count; ++r) {
+                    packet.dir_x[r] = packet.dir_x[0];
+                    packet.dir_y[r] = packet.dir_y[0];
+                    packet.dir_z[r] = packet.dir_z[0];
+                    packet.t[r] = T(0); // Padding lane: nothing can be closer than 0
+                    packet.hit_index[r] = T(-1);
+                }
+
+                intersect_scene_packet(ctx, packet, frustum, T(0));
+                ctx.rays_traced += ray_count;
+                if constexpr (PROFILING_ENABLED) ctx.paths.rays[0] += ray_count;
+
+                for (uint32_t r = 0; r < ray_count; ++r) {
+                    Vec3 color = ctx.scene.background_color;
+                    if (packet.hit_index[r] >= T(0)) {
+                        SceneHit hit;
+                        hit.t = packet.t[r];
+                        hit.sphere_index = static_cast<uint32_t>(packet.hit_index[r]);
+                        RayT<T> primary_ray(Vec3T<T>(camera.position), Vec3T<T>(packet.dir_x[r], packet.dir_y[r], packet.dir_z[r]));
+                        if (want_guides) guides[r].add_hit(ctx.scene, primary_ray, hit);
+                        ctx.sampler = &samplers[r];
+                        color = shade_hit(ctx, primary_ray, hit, 0);
+                    }
+                    else {
+                        if (want_guides) guides[r].add_miss(ctx.scene);
+                        if constexpr (PROFILING_ENABLED) ctx.paths.escaped++;
+                    }
+                    double luminance = sample_luminance(color);
+                    accumulated[r] = accumulated[r] + color;
+                    accumulated_lum_sq[r] += luminance * luminance;
+                }
+            }
+
+            for (uint32_t r = 0; r < ray_count; ++r) {
+                const size_t pixel_index = static_cast<size_t>(pixel_y[r]) * width + pixel_x[r];
+                store_pixel(target, frame_info, pixel_index, accumulated[r], accumulated_lum_sq[r], samples);
+                if (want_guides) store_guides(target, pixel_index, guides[r], samples);
+            }
+        }
+    }
+}
+
+bool can_trace_packets(const Scene& scene) {
+    return scene.max_ray_depth > 0 && (!scene.bvh.empty() || !scene.sphere_soa.empty() || !scene.sphere_soa_f.empty());
+}
+
+template <typename T>
+void render_chunk_rays(const FrameInfo& frame_info, const Camera& camera, FrameBuffer& target,
+    const RenderTile& tile, TraceContext& ctx) {
+    const int width = target.width;
+    const int height = target.height;
+    const bool want_guides = target.has_guides();
+    for (int y = tile.startY; y < tile.endY; ++y) {
+        for (int x = tile.startX; x < tile.endX; ++x) {
+            const size_t pixel_index = static_cast<size_t>(y) * width + x;
+            if (skip_pixel(frame_info, target, pixel_index)) continue;
+            ctx.pixels_sampled++;
+            Vec3 accumulated_color(0.0, 0.0, 0.0);
+            double accumulated_lum_sq = 0.0;
+            GuideSums guides;
+            int samples = frame_info.settings.frame_samples(ctx.scene);
+            bool jitter = samples > 1 || frame_info.settings.accumulate;
+            const uint32_t first_index = first_sample_index(frame_info, target, pixel_index);
+
+            for (int s = 0; s < samples; ++s) {
+                PixelSampler sampler(frame_info.settings.sampler, frame_info.settings.seed,
+                    static_cast<uint32_t>(pixel_index), first_index + s);
+                ctx.sampler = &sampler;
+                double dx, dy;
+                sampler.next_2d(dx, dy);
+                if (!jitter) dx = dy = 0.5;
+                double u = (static_cast<double>(x) + dx) / width;
+                double v = (static_cast<double>(y) + dy) / height;
+                RayT<T> primary_ray(camera.get_ray(u, v));
+                Vec3 color = want_guides ? trace_camera_ray(ctx, primary_ray, guides) : trace_ray(ctx, primary_ray, 0);
+                double luminance = sample_luminance(color);
+                accumulated_color = accumulated_color + color;
+                accumulated_lum_sq += luminance * luminance;
+            }
+            store_pixel(target, frame_info, pixel_index, accumulated_color, accumulated_lum_sq, samples);
+            if (want_guides) store_guides(target, pixel_index, guides, samples);
+        }
+    }
+}
+
+template <typename T>
+void render_chunk_as(const FrameInfo& frame_info, const Camera& camera, FrameBuffer& target,
+    const RenderTile& tile, TraceContext& ctx) {
+    if (frame_info.settings.primary_rays != PrimaryRayMode::Single && can_trace_packets(ctx.scene)) {
+        int block = frame_info.settings.primary_rays == PrimaryRayMode::Packet4x4 ? 4 : 8;
+        render_chunk_packets<T>(frame_info, camera, target, tile, ctx, block);
+        return;
+    }
+    render_chunk_rays<T>(frame_info, camera, target, tile, ctx);
+}
+
+template <typename T>
+const SphereSoAT<T>& scene_sphere_store(const Scene& scene) {
+    if constexpr (std::is_same_v<T, float>) return scene.sphere_soa_f;
+    else return scene.sphere_soa;
+}
+
+} // namespace
+
+void render_chunk(const FrameInfo& frame_info, const Camera& camera, FrameBuffer& target,
+    const RenderTile& tile, TraceContext& ctx) {
+    const bool wavefront = frame_info.settings.integrator == Integrator::Wavefront;
+    if (ctx.scene.precision == Precision::Float) {
+        if (wavefront) render_chunk_wavefront<float>(frame_info, camera, target, tile, ctx);
+        else render_chunk_as<float>(frame_info, camera, target, tile, ctx);
+    }
+    else {
+        if (wavefront) render_chunk_wavefront<double>(frame_info, camera, target, tile, ctx);
+        else render_chunk_as<double>(frame_info, camera, target, tile, ctx);
+    }
+}
+
+template <typename T>
+bool intersect_scene(TraceContext& ctx, const RayT<T>& ray, T t_min, SceneHit& hit) {
+    const Scene& scene = ctx.scene;
+    if (!scene.bvh.empty()) {
+        return scene.bvh.intersect_closest(ray, t_min, std::numeric_limits<T>::infinity(), hit, ctx.traversal);
+    }
+    const SphereSoAT<T>& sphere_store = scene_sphere_store<T>(scene);
+    if (!sphere_store.empty()) {
+        T closest_t = std::numeric_limits<T>::infinity();
+        int32_t index = sphere_store.intersect_range(make_sphere_ray_query(ray), 0, sphere_store.count, t_min, closest_t);
+        ctx.traversal.primitive_tests += sphere_store.count;
+        if (index < 0) {
+            return false;
+        }
+        hit.t = closest_t;
+        hit.sphere_index = static_cast<uint32_t>(index);
+        return true;
+    }
+
+    // No acceleration structures built: plain double-precision test against Scene::objects.
+    const Ray ray_d(ray);
+    double closest_t = std::numeric_limits<double>::infinity();
+    bool found = false;
+    for (size_t i = 0; i < scene.objects.size(); ++i) {
+        double t;
+        if (scene.objects[i].hit_distance(ray_d, t_min, closest_t, t)) {
+            closest_t = t;
+            hit.sphere_index = static_cast<uint32_t>(i);
+            found = true;
+        }
+    }
+    ctx.traversal.primitive_tests += scene.objects.size();
+    if (found) {
+        hit.t = closest_t;
+    }
+    return found;
+}
+
+template <typename T>
+bool occluded(TraceContext& ctx, const RayT<T>& ray, T t_max) {
+    const Scene& scene = ctx.scene;
+    if (!scene.bvh.empty()) {
+        return scene.bvh.intersect_any(ray, T(0), t_max, ctx.traversal);
+    }
+    const SphereSoAT<T>& sphere_store = scene_sphere_store<T>(scene);
+    if (!sphere_store.empty()) {
+        T closest_t = t_max;
+        ctx.traversal.primitive_tests += sphere_store.count;
+        return sphere_store.intersect_range(make_sphere_ray_query(ray), 0, sphere_store.count, T(0), closest_t) >= 0;
+    }
+
+    const Ray ray_d(ray);
+    for (size_t i = 0; i < scene.objects.size(); ++i) {
+        double t;
+        if (scene.objects[i].hit_distance(ray_d, 0.0, static_cast<double>(t_max), t)) {
+            ctx.traversal.primitive_tests += i + 1;
+            return true;
+        }
+    }
+    ctx.traversal.primitive_tests += scene.objects.size();
+    return false;
+}
+
+template <typename T>
+Vec3 sample_direct_light(TraceContext& ctx, const Vec3T<T>& origin, const ReflectionLobe& lobe, const Vec3& throughput,
+    PixelSampler& sampler) {
+    const Scene& scene = ctx.scene;
+    double u1, u2;
+    sampler.next_2d(u1, u2);
+    LightSample light;
+    if (!sample_light(scene, Vec3(origin), u1, u2, light)) return Vec3(0.0, 0.0, 0.0);
+    // Directions the lobe never produces get no light from this surface; skip their shadow rays.
+    const double reflection_pdf = lobe_pdf(lobe, light.direction);
+    if (reflection_pdf <= 0.0) return Vec3(0.0, 0.0, 0.0);
+
+    // Stop short of the light itself by the margin a reflection ray leaving it would start at.
+    const Sphere& sphere = scene.objects[light.sphere];
+    const Vec3T<T> light_point(Vec3(origin) + light.direction * light.distance);
+    const T t_max = static_cast<T>(light.distance) - self_intersection_offset(light_point, static_cast<T>(sphere.radius));
+    ctx.rays_traced++;
+    if (t_max > T(0) && occluded(ctx, RayT<T>(origin, Vec3T<T>(light.direction)), t_max)) return Vec3(0.0, 0.0, 0.0);
+
+    const Vec3& emission = scene.material_of(light.sphere).emission_color;
+    const double weight = mis_weight(light.pdf, reflection_pdf) * reflection_pdf / light.pdf;
+    return Vec3(throughput.x * emission.x, throughput.y * emission.y, throughput.z * emission.z) * weight;
+}
+
+double emission_weight(const TraceContext& ctx, const Vec3& origin, const ReflectionLobe& lobe, const Vec3& direction, uint32_t sphere) {
+    if (lobe.roughness <= 0.0) return 1.0;
+    const double from_light = light_pdf(ctx.scene, origin, sphere);
+    if (from_light <= 0.0) return 1.0;
+    return mis_weight(lobe_pdf(lobe, direction), from_light);
+}
+
+template <typename T>
+bool intersect_scene_packet(TraceContext& ctx, RayPacketSoAT<T>& packet, const PacketFrustum& frustum, T t_min) {
+    const Scene& scene = ctx.scene;
+    if (!scene.bvh.empty()) {
+        scene.bvh.intersect_packet(packet, frustum, t_min, ctx.traversal);
+        return true;
+    }
+    const SphereSoAT<T>& sphere_store = scene_sphere_store<T>(scene);
+    if (!sphere_store.empty()) {
+        sphere_store.intersect_packet(packet, 0, sphere_store.count, t_min);
+        ctx.traversal.primitive_tests += static_cast<uint64_t>(sphere_store.count) * packet.count;
+        return true;
+    }
+    return false;
+}
+
+template <typename T>
+Vec3 trace_ray(TraceContext& ctx, const RayT<T>& ray, int depth) {
+    const Scene& scene = ctx.scene;
+    if (depth >= scene.max_ray_depth) {
+        if constexpr (PROFILING_ENABLED) ctx.paths.depth_limited++;
+        return Vec3(0.0, 0.0, 0.0);
+    }
+    ctx.rays_traced++;
+    if constexpr (PROFILING_ENABLED) ctx.paths.rays[PathStats::bucket(depth)]++;
+
+    // Camera rays start in free space and reflection rays above the surface they leave
+    // (see shade_hit), so no hit needs to be discarded for being too close.
+    SceneHit hit;
+    if (!intersect_scene(ctx, ray, T(0), hit)) {
+        if constexpr (PROFILING_ENABLED) ctx.paths.escaped++;
+        return scene.background_color;
+    }
+    return shade_hit(ctx, ray, hit, depth);
+}
+
+// Iterative form of the old trace_ray -> shade_hit recursion: each surface adds its own color
+// weighted by the path throughput (the product of the reflectivities before it), and the
+// reflection ray becomes the next iteration, so deep paths do not grow the stack. Glossy bounces
+// add a light sample as well, and the emission their reflection ray then finds is MIS-weighted.
+template <typename T>
+Vec3 shade_hit(TraceContext& ctx, const RayT<T>& primary_ray, const SceneHit& primary_hit, int depth) {
+    const Scene& scene = ctx.scene;
+    RayT<T> ray = primary_ray;
+    SceneHit hit = primary_hit;
+    Vec3 radiance(0.0, 0.0, 0.0);
+    Vec3 throughput(1.0, 1.0, 1.0);
+    ReflectionLobe lobe; // Of the glossy bounce whose ray found `hit`, when that bounce sampled the lights too
+    while (true) {
+        const Sphere& hit_sphere = scene.objects[hit.sphere_index];
+        const T radius = static_cast<T>(hit_sphere.radius);
+        Vec3T<T> hit_point = ray.origin + ray.direction * static_cast<T>(hit.t);
+        Vec3T<T> surface_normal = (hit_point - Vec3T<T>(hit_sphere.center)).normalize();
+
+        const Material& material = scene.material_of(hit.sphere_index);
+        Vec3 surface_color = material.emission_color;
+        if (lobe.roughness > 0.0) {
+            surface_color = surface_color * emission_weight(ctx, Vec3(ray.origin), lobe, Vec3(ray.direction), hit.sphere_index);
+        }
+        double base_color_contribution_factor = 1.0 - material.reflectivity;
+        if (base_color_contribution_factor > 1e-5) {
+            surface_color = surface_color + material.base_color * base_color_contribution_factor;
+        }
+        radiance = radiance + Vec3(throughput.x * surface_color.x, throughput.y * surface_color.y, throughput.z * surface_color.z);
+
+        if (material.reflectivity <= 1e-5) {
+            if constexpr (PROFILING_ENABLED) ctx.paths.absorbed++;
+            break;
+        }
+        if (depth + 1 >= scene.max_ray_depth) {
+            if constexpr (PROFILING_ENABLED) ctx.paths.depth_limited++;
+            break;
+        }
+        throughput = throughput * material.reflectivity;
+        if (!survives_roulette(ctx.roulette, depth + 1, throughput, *ctx.sampler)) {
+            if constexpr (PROFILING_ENABLED) ctx.paths.roulette++;
+            break;
+        }
+
+        Vec3T<T> incident_dir = ray.direction;
+        Vec3T<T> perfect_reflection_dir = incident_dir - surface_normal * (T(2) * Vec3T<T>::dot(incident_dir, surface_normal));
+        perfect_reflection_dir = perfect_reflection_dir.normalize();
+        Vec3T<T> scattered_reflection_dir;
+
+        if (material.roughness < 1e-5) {
+            scattered_reflection_dir = perfect_reflection_dir;
+        }
+        else {
+            const T roughness = static_cast<T>(material.roughness);
+            Vec3T<T> tangent, bitangent;
+            create_onb(surface_normal, tangent, bitangent);
+            double u1, u2;
+            ctx.sampler->next_2d(u1, u2);
+            Vec3T<T> sample_local_hemisphere = random_cosine_direction<T>(u1, u2);
+            Vec3T<T> random_world_dir = (tangent * sample_local_hemisphere.x +
+                bitangent * sample_local_hemisphere.y +
+                surface_normal * sample_local_hemisphere.z).normalize();
+            scattered_reflection_dir = (perfect_reflection_dir * (T(1) - roughness) +
+                random_world_dir * roughness).normalize();
+        }
+        ray = RayT<T>(hit_point + surface_normal * self_intersection_offset(hit_point, radius), scattered_reflection_dir);
+        lobe.roughness = 0.0;
+        if (ctx.next_event && material.roughness >= 1e-5) {
+            lobe = ReflectionLobe{ Vec3(surface_normal), Vec3(perfect_reflection_dir), material.roughness };
+            radiance = radiance + sample_direct_light(ctx, ray.origin, lobe, throughput, *ctx.sampler);
+        }
+        depth++;
+
+        ctx.rays_traced++;
+        if constexpr (PROFILING_ENABLED) ctx.paths.rays[PathStats::bucket(depth)]++;
+        if (!intersect_scene(ctx, ray, T(0), hit)) {
+            if constexpr (PROFILING_ENABLED) ctx.paths.escaped++;
+            radiance = radiance + Vec3(throughput.x * scene.background_color.x,
+                throughput.y * scene.background_color.y, throughput.z * scene.background_color.z);
+            break;
+        }
+    }
+    return radiance;
+}
+
+template bool intersect_scene<double>(TraceContext&, const RayT<double>&, double, SceneHit&);
+template bool intersect_scene<float>(TraceContext&, const RayT<float>&, float, SceneHit&);
+template bool occluded<double>(TraceContext&, const RayT<double>&, double);
+template bool occluded<float>(TraceContext&, const RayT<float>&, float);
+template Vec3 sample_direct_light<double>(TraceContext&, const Vec3T<double>&, const ReflectionLobe&, const Vec3&, PixelSampler&);
+template Vec3 sample_direct_light<float>(TraceContext&, const Vec3T<float>&, const ReflectionLobe&, const Vec3&, PixelSampler&);
+template bool intersect_scene_packet<double>(TraceContext&, RayPacketSoAT<double>&, const PacketFrustum&, double);
+template bool intersect_scene_packet<float>(TraceContext&, RayPacketSoAT<float>&, const PacketFrustum&, float);
+template Vec3 trace_ray<double>(TraceContext&, const RayT<double>&, int);
+template Vec3 trace_ray<float>(TraceContext&, const RayT<float>&, int);
+template Vec3 shade_hit<double>(TraceContext&, const RayT<double>&, const SceneHit&, int);
+template Vec3 shade_hit<float>(TraceContext&, const RayT<float>&, const SceneHit&, int);
+
+RenderThreadPool::RenderThreadPool(int thread_count_requested)
+    : num_threads(std::max(1, thread_count_requested)),
+    tile_queues(std::make_unique<WorkStealingDeque[]>(std::max(1, thread_count_requested))) {
+    threads.reserve(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(&RenderThreadPool::render_chunk_loop, this, i);
+    }
+}
+
+RenderThreadPool::~RenderThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(render_mutex);
+        shutdown_threads = true;
+    }
+    worker_start_cv.notify_all();
+    threads.clear(); // jthreads join on destruction
+}
+
+// Built aside and swapped in, so a failed allocation leaves the previous tiles and their area intact.
+void RenderThreadPool::build_tiles(const RenderTile& area, int tile_size) {
+    std::vector<RenderTile> built;
+    for (int y = area.startY; y < area.endY; y += tile_size) {
+        for (int x = area.startX; x < area.endX; x += tile_size) {
+            built.push_back(RenderTile{ x, y, std::min(x + tile_size, area.endX), std::min(y + tile_size, area.endY) });
+        }
+    }
+    tiles.swap(built);
+    tiles_area = area;
+    tiles_size = tile_size;
+}
+
+// Each worker gets a contiguous run of tiles (in scanline order, for cache locality between
+// neighbouring tiles). Runs are pushed back to front so the owner pops them in order while
+// thieves take from the far end.
+void RenderThreadPool::distribute_tiles() {
+    const uint32_t tile_count = static_cast<uint32_t>(tiles.size());
+    for (int i = 0; i < num_threads; ++i) {
+        uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(tile_count) * i / num_threads);
+        uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(tile_count) * (i + 1) / num_threads);
+        tile_queues[i].reset(std::max<uint32_t>(tile_count, 1));
+        for (uint32_t t = end; t > begin; --t) {
+            tile_queues[i].push(t - 1);
+        }
+    }
+}
+
+bool RenderThreadPool::next_tile(int thread_id, uint32_t& tile_index, bool& stolen) {
+    if (tile_queues[thread_id].pop(tile_index)) {
+        stolen = false;
+        return true;
+    }
+    // No tiles are added once a frame is running, so the frame is done for this worker as soon as
+    // one full sweep finds every deque empty. A lost race means work may remain: sweep again.
+    bool retry = true;
+    while (retry) {
+        retry = false;
+        for (int offset = 1; offset < num_threads; ++offset) {
+            int victim = (thread_id + offset) % num_threads;
+            WorkStealingDeque::StealResult result = tile_queues[victim].steal(tile_index);
+            if (result == WorkStealingDeque::StealResult::Success) {
+                stolen = true;
+                return true;
+            }
+            if (result == WorkStealingDeque::StealResult::Lost) retry = true;
+        }
+    }
+    return false;
+}
+
+void RenderThreadPool::submit_frame(const FrameInfo& frame_info, const Scene& scene, const Camera& camera, FrameBuffer& target,
+    const RenderTile* region) {
+    if (in_flight) wait_frame();
+    std::unique_lock<std::mutex> lock(render_mutex);
+    int tile_size = std::max(8, frame_info.settings.tile_size);
+    const RenderTile area = region ? *region : RenderTile{ 0, 0, target.width, target.height };
+    if (tiles_area.startX != area.startX || tiles_area.startY != area.startY || tiles_area.endX != area.endX ||
+        tiles_area.endY != area.endY || tiles_size != tile_size) {
+        build_tiles(area, tile_size);
+    }
+    distribute_tiles();
+    const size_t pixel_count = static_cast<size_t>(target.width) * target.height;
+    if (frame_info.settings.accumulate && target.accum.size() != pixel_count * 3) {
+        target.accum.assign(pixel_count * 3, 0.0f);
+        target.accumulated_samples = 0;
+    }
+    if (adaptive_sampling_active(frame_info) && target.sample_counts.size() != pixel_count) {
+        target.sample_counts.assign(pixel_count, 0);
+        target.accum_lum_sq.assign(pixel_count, 0.0f);
+        target.accumulated_samples = 0; // Sums without per-pixel counts cannot be continued adaptively
+    }
+    if (target.hdr.size() != pixel_count * 3) {
+        target.hdr.assign(pixel_count * 3, 0.0f);
+    }
+    if (frame_info.settings.wants_guides() && target.depth.size() != pixel_count) {
+        target.albedo.assign(pixel_count * 3, 0.0f);
+        target.normal.assign(pixel_count * 3, 0.0f);
+        target.depth.assign(pixel_count, DENOISE_MISS_DEPTH);
+        // Adaptive sampling would skip converged pixels and leave their guides empty, and temporal
+        // reuse restarts its running mean along with them. Plain accumulation keeps its samples:
+        // every pixel gets its guides this frame.
+        if (adaptive_sampling_active(frame_info) || frame_info.settings.temporal.enabled) target.accumulated_samples = 0;
+    }
+    else if (!frame_info.settings.wants_guides() && target.has_guides()) {
+        target.albedo.clear();
+        target.normal.clear();
+        target.depth.clear();
+    }
+    if (!frame_info.settings.temporal.enabled) target.temporal.clear();
+    // What post_process() writes into is sized here too, so running out of memory throws to the
+    // caller before the frame starts rather than out of wait_frame() after it rendered.
+    if (frame_info.settings.wants_guides() && !region) {
+        post_planes.resize(pixel_count * 6);
+        if (frame_info.settings.temporal.enabled) {
+            TemporalHistory& history = target.temporal;
+            history.prior.resize(pixel_count * 3);
+            history.prior_weight.resize(pixel_count);
+            history.resolved.resize(pixel_count * 3);
+            history.resolved_weight.resize(pixel_count);
+            history.normal.reserve(pixel_count * 3);
+            history.depth.reserve(pixel_count);
+        }
+    }
+    current_frame_info = frame_info;
+    current_scene = &scene;
+    current_camera = camera;
+    current_target = &target;
+    current_has_region = region != nullptr;
+    current_resolve_tiles = !frame_info.settings.wants_guides() || current_has_region;
+    frame_stats = FrameStats();
+    frame_stats.workers.resize(num_threads);
+    worker_finish_times.resize(num_threads);
+    tiles_remaining.store(static_cast<uint32_t>(tiles.size()), std::memory_order_relaxed);
+    tiles_complete.store(tiles.empty(), std::memory_order_relaxed);
+    frame_cancelled.store(false, std::memory_order_relaxed);
+    frame_start_time = std::chrono::steady_clock::now();
+    tiles_end_time = frame_start_time;
+    in_flight = true;
+    publish();
+}
+
+FrameStats RenderThreadPool::wait_frame() {
+    if (!in_flight) return FrameStats();
+    in_flight = false;
+    tiles_complete.wait(false, std::memory_order_acquire);
+    // Every tile is done; the workers still sweep the empty deques once before reporting their
+    // counters, which has to finish before the deques are refilled.
+    wait_for_workers();
+    std::unique_lock<std::mutex> lock(render_mutex);
+    const FrameInfo& frame_info = current_frame_info;
+    const Scene& scene = *current_scene;
+    FrameBuffer& target = *current_target;
+
+    const auto tiles_end = tiles_end_time;
+    const double tiles_ms = std::chrono::duration<double, std::milli>(tiles_end - frame_start_time).count();
+    for (int i = 0; i < num_threads; ++i) {
+        WorkerFrameStats& worker = frame_stats.workers[i];
+        worker.idle_ms = std::max(0.0, tiles_ms - worker.busy_ms);
+        worker.barrier_ms = std::max(0.0, std::chrono::duration<double, std::milli>(tiles_end - worker_finish_times[i]).count());
+        if constexpr (PROFILING_ENABLED) {
+            const uint64_t finished_ns = std::min(profile_time_ns(worker_finish_times[i]), profile_time_ns(tiles_end));
+            frame_stats.events.push_back(ProfileEvent{ finished_ns, profile_time_ns(tiles_end) - finished_ns,
+                ProfilePhase::BarrierWait, static_cast<uint16_t>(i + 1), 0 });
+        }
+    }
+    frame_stats.cancelled = frame_cancelled.load(std::memory_order_relaxed);
+    if (frame_info.settings.accumulate && !frame_stats.cancelled) {
+        target.accumulated_samples += frame_info.settings.frame_samples(scene);
+    }
+    if (frame_info.settings.wants_guides() && !current_has_region && !frame_stats.cancelled) {
+        post_process(lock, frame_info, scene, current_camera, target);
+    }
+    const auto frame_end = std::chrono::steady_clock::now();
+    frame_stats.frame_ms = std::chrono::duration<double, std::milli>(frame_end - frame_start_time).count();
+    if constexpr (PROFILING_ENABLED) {
+        const uint64_t start_ns = profile_time_ns(frame_start_time);
+        frame_stats.events.push_back(ProfileEvent{ start_ns, profile_time_ns(frame_end) - start_ns, ProfilePhase::RenderFrame, 0, 0 });
+    }
+    return frame_stats;
+}
+
+void RenderThreadPool::publish() {
+    workers_done_count.store(0, std::memory_order_relaxed);
+    target_frame_id++;
+    worker_start_cv.notify_all();
+}
+
+void RenderThreadPool::wait_for_workers() {
+    for (int done = workers_done_count.load(std::memory_order_acquire); done != num_threads;
+        done = workers_done_count.load(std::memory_order_acquire)) {
+        workers_done_count.wait(done, std::memory_order_acquire);
+    }
+}
+
+void RenderThreadPool::dispatch(std::unique_lock<std::mutex>& lock) {
+    publish();
+    lock.unlock();
+    wait_for_workers();
+    lock.lock();
+}
+
+void RenderThreadPool::run_tasks(std::unique_lock<std::mutex>& lock, int count, const std::function<void(int)>& task) {
+    current_task = &task;
+    task_count = count;
+    next_task.store(0, std::memory_order_relaxed);
+    dispatch(lock);
+    current_task = nullptr;
+}
+
+// Both passes start from the frame's linear output: the running mean when accumulating (hdr may
+// still hold the last post-processed result for pixels adaptive sampling skipped), otherwise
+// target.hdr. Each step is one job over bands of rows, since a step reads rows that other workers
+// write in the step before; the last one writes its rows back to hdr and resolves them.
+void RenderThreadPool::post_process(std::unique_lock<std::mutex>& lock, const FrameInfo& frame_info, const Scene& scene,
+    const Camera& camera, FrameBuffer& target) {
+    const RenderSettings& settings = frame_info.settings;
+    const int width = target.width;
+    const int height = target.height;
+    const size_t plane = static_cast<size_t>(width) * height;
+    post_planes.resize(plane * 6);
+    float* frame_color = post_planes.data();
+    float* const buffers[2] = { post_planes.data(), post_planes.data() + plane * 3 };
+    const int BAND_ROWS = 8;
+    const int bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+    auto band_end = [&](int band) { return std::min(height, (band + 1) * BAND_ROWS); };
+    auto resolve_rows = [&](int band) {
+        const size_t first = static_cast<size_t>(band) * BAND_ROWS * width;
+        resolve_pixels(settings.tonemap, target.hdr.data() + first * 3, target.pixels.data() + first,
+            static_cast<size_t>(band_end(band) - band * BAND_ROWS) * width);
+    };
+    auto record = [&](ProfilePhase phase, std::chrono::steady_clock::time_point start, double& ms) {
+        const auto end = std::chrono::steady_clock::now();
+        ms = std::chrono::duration<double, std::milli>(end - start).count();
+        if constexpr (PROFILING_ENABLED) {
+            const uint64_t start_ns = profile_time_ns(start);
+            frame_stats.events.push_back(ProfileEvent{ start_ns, profile_time_ns(end) - start_ns, phase, 0, 0 });
+        }
+    };
+
+    const auto temporal_start = std::chrono::steady_clock::now();
+    const bool accumulated = settings.accumulate;
+    const bool per_pixel_counts = adaptive_sampling_active(frame_info);
+    run_tasks(lock, bands, [&](int band) {
+        if (!accumulated) {
+            interleaved_to_planes(target.hdr.data(), frame_color, width, height, band * BAND_ROWS, band_end(band));
+            return;
+        }
+        for (size_t i = static_cast<size_t>(band) * BAND_ROWS * width; i < static_cast<size_t>(band_end(band)) * width; ++i) {
+            const float inv_count = 1.0f / (per_pixel_counts ? target.sample_counts[i] : target.accumulated_samples);
+            frame_color[i] = target.accum[i * 3 + 0] * inv_count;
+            frame_color[plane + i] = target.accum[i * 3 + 1] * inv_count;
+            frame_color[2 * plane + i] = target.accum[i * 3 + 2] * inv_count;
+        }
+        });
+
+    const float* src = frame_color;
+    if (settings.temporal.enabled) {
+        TemporalHistory& history = target.temporal;
+        // The prior is only reused by frames that continue a running mean, which a resize restarts.
+        history.prior.resize(plane * 3);
+        history.prior_weight.resize(plane);
+        history.resolved.resize(plane * 3);
+        history.resolved_weight.resize(plane);
+        const uint32_t frame_samples = settings.frame_samples(scene);
+        // A running mean restarts when it does not accumulate or was just reset (camera moved).
+        const bool restarted = !accumulated || target.accumulated_samples <= frame_samples;
+        const TemporalFrame frame{ width, height, &camera, frame_color, target.normal.data(), target.depth.data(),
+            per_pixel_counts ? target.sample_counts.data() : nullptr, accumulated ? target.accumulated_samples : frame_samples, restarted };
+        run_tasks(lock, bands, [&](int band) {
+            temporal_resolve(frame, settings.temporal, history, band * BAND_ROWS, band_end(band));
+            if (!settings.denoise.enabled) {
+                planes_to_interleaved(history.resolved.data(), target.hdr.data(), width, height, band * BAND_ROWS, band_end(band));
+                resolve_rows(band);
+            }
+            });
+        std::swap(history.color, history.resolved);
+        std::swap(history.weight, history.resolved_weight);
+        history.normal = target.normal;
+        history.depth = target.depth;
+        history.camera = camera;
+        history.width = width;
+        history.height = height;
+        history.valid = true;
+        src = history.color.data();
+        record(ProfilePhase::Temporal, temporal_start, frame_stats.temporal_ms);
+    }
+
+    if (settings.denoise.enabled) {
+        const auto denoise_start = std::chrono::steady_clock::now();
+        const DenoiseImage image{ width, height, target.albedo.data(), target.normal.data(), target.depth.data() };
+        const int passes = std::max(1, settings.denoise.passes);
+        for (int pass = 0; pass < passes; ++pass) {
+            const bool last = pass + 1 == passes;
+            float* dst = src == buffers[0] ? buffers[1] : buffers[0];
+            run_tasks(lock, bands, [&](int band) {
+                denoise_pass(image, settings.denoise, pass, src, dst, band * BAND_ROWS, band_end(band));
+                if (last) {
+                    planes_to_interleaved(dst, target.hdr.data(), width, height, band * BAND_ROWS, band_end(band));
+                    resolve_rows(band);
+                }
+                });
+            src = dst;
+        }
+        record(ProfilePhase::Denoise, denoise_start, frame_stats.denoise_ms);
+    }
+}
+
+void RenderThreadPool::upscale(const FrameBuffer& source, FrameBuffer& output) {
+    if (in_flight) wait_frame();
+    std::unique_lock<std::mutex> lock(render_mutex);
+    const bool with_hdr = source.has_hdr() && output.has_hdr();
+    const int BAND_ROWS = 16;
+    run_tasks(lock, (output.height + BAND_ROWS - 1) / BAND_ROWS, [&](int band) {
+        const int row_begin = band * BAND_ROWS;
+        const int row_end = std::min(output.height, row_begin + BAND_ROWS);
+        upscale_bilinear(source.pixels.data(), source.width, source.height, output.pixels.data(), output.width, output.height, row_begin, row_end);
+        if (with_hdr) {
+            upscale_bilinear(source.hdr.data(), source.width, source.height, output.hdr.data(), output.width, output.height, row_begin, row_end);
+        }
+        });
+}
+
+void RenderThreadPool::parallel_for(int count, const std::function<void(int)>& task) {
+    if (count <= 0) return;
+    if (in_flight) wait_frame();
+    std::unique_lock<std::mutex> lock(render_mutex);
+    run_tasks(lock, count, task);
+}
+
+void RenderThreadPool::render_chunk_loop(int thread_id) {
+    long long worker_last_completed_frame_id = -1;
+    std::vector<ProfileEvent> events; // This worker's events of the current frame; keeps its capacity
+    while (true) {
+        FrameInfo local_frame_info;
+        long long current_frame_to_render;
+        const Scene* scene;
+        Camera camera;
+        FrameBuffer* target;
+        bool resolve_tiles;
+        const std::function<void(int)>* task;
+        std::chrono::steady_clock::time_point published;
+        {
+            std::unique_lock<std::mutex> lock(render_mutex);
+            worker_start_cv.wait(lock, [&] {
+                return target_frame_id > worker_last_completed_frame_id || shutdown_threads;
+                });
+            if (shutdown_threads) {
+                break;
+            }
+            current_frame_to_render = target_frame_id;
+            local_frame_info = current_frame_info;
+            scene = current_scene;
+            camera = current_camera;
+            target = current_target;
+            resolve_tiles = current_resolve_tiles;
+            task = current_task;
+            published = frame_start_time;
+        }
+
+        if (task) {
+            for (int index = next_task.fetch_add(1, std::memory_order_relaxed); index < task_count;
+                index = next_task.fetch_add(1, std::memory_order_relaxed)) {
+                (*task)(index);
+            }
+            worker_last_completed_frame_id = current_frame_to_render;
+            if (workers_done_count.fetch_add(1, std::memory_order_acq_rel) + 1 == num_threads) {
+                workers_done_count.notify_one();
+            }
+            continue;
+        }
+
+        TraceContext ctx(*scene);
+        ctx.roulette = local_frame_info.settings.roulette;
+        ctx.next_event = local_frame_info.settings.next_event && !scene->lights.empty();
+        WorkerFrameStats worker_stats;
+        const uint16_t profile_thread = static_cast<uint16_t>(thread_id + 1);
+        const auto woken = std::chrono::steady_clock::now();
+        worker_stats.wake_ms = std::chrono::duration<double, std::milli>(woken - published).count();
+        events.clear();
+        if constexpr (PROFILING_ENABLED) {
+            const uint64_t published_ns = profile_time_ns(published);
+            events.push_back(ProfileEvent{ published_ns, profile_time_ns(woken) - published_ns, ProfilePhase::WorkerWake, profile_thread, 0 });
+        }
+        uint32_t tile_index;
+        bool stolen;
+        while (next_tile(thread_id, tile_index, stolen)) {
+            auto tile_start = std::chrono::steady_clock::now();
+            if (!frame_cancelled.load(std::memory_order_relaxed)) {
+                render_chunk(local_frame_info, camera, *target, tiles[tile_index], ctx);
+                if (resolve_tiles) resolve_tile(local_frame_info.settings, *target, tiles[tile_index]);
+            }
+            auto tile_end = std::chrono::steady_clock::now();
+            if (tiles_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                tiles_end_time = tile_end;
+                tiles_complete.store(true, std::memory_order_release);
+                tiles_complete.notify_one();
+            }
+            worker_stats.busy_ms += std::chrono::duration<double, std::milli>(tile_end - tile_start).count();
+            worker_stats.tiles_rendered++;
+            if (stolen) worker_stats.tiles_stolen++;
+            if constexpr (PROFILING_ENABLED) {
+                const uint64_t start_ns = profile_time_ns(tile_start);
+                events.push_back(ProfileEvent{ start_ns, profile_time_ns(tile_end) - start_ns, ProfilePhase::RenderTile, profile_thread, tile_index });
+            }
+        }
+
+        worker_last_completed_frame_id = current_frame_to_render;
+        {
+            std::lock_guard<std::mutex> lock(render_mutex);
+            frame_stats.rays_traced += ctx.rays_traced;
+            frame_stats.pixels_sampled += ctx.pixels_sampled;
+            frame_stats.traversal += ctx.traversal;
+            frame_stats.wavefront += ctx.wavefront;
+            frame_stats.paths += ctx.paths;
+            frame_stats.workers[thread_id] = worker_stats;
+            frame_stats.events.insert(frame_stats.events.end(), events.begin(), events.end());
+            worker_finish_times[thread_id] = std::chrono::steady_clock::now();
+        }
+        if (workers_done_count.fetch_add(1, std::memory_order_acq_rel) + 1 == num_threads) {
+            workers_done_count.notify_one();
+        }
+    }
+}
+
+bool pixel_converged(const FrameBuffer& target, const AdaptiveSampling& adaptive, size_t pixel_index) {
+    const uint32_t count = target.sample_counts[pixel_index];
+    if (count >= adaptive.max_samples) return true;
+    if (count < std::max<uint32_t>(adaptive.min_samples, 2)) return false;
+    const float* sum = &target.accum[pixel_index * 3];
+    double mean = sample_luminance(Vec3(sum[0], sum[1], sum[2])) / count;
+    double variance = std::max(0.0, (target.accum_lum_sq[pixel_index] - count * mean * mean) / (count - 1));
+    double standard_error = std::sqrt(variance / count);
+    const double DARK_LUMINANCE_FLOOR = 0.1;
+    return standard_error <= adaptive.target_error * std::max(mean, DARK_LUMINANCE_FLOOR);
+}
+
+int default_thread_count() {
+    unsigned int hw = std::thread::hardware_concurrency();
+    return hw > 0 ? static_cast<int>(hw) : 4;
+}
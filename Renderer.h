@@ -0,0 +1,392 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include "Vec3.h"
+#include "Ray.h"
+#include "Camera.h"
+#include "SceneLoader.h"
+#include "BVH.h"
+#include "RayPacket.h"
+#include "WorkStealingDeque.h"
+#include "Sampler.h"
+#include "Profile.h"
+#include "Denoise.h"
+#include "Temporal.h"
+#include "Tonemap.h"
+
+// How primary rays are traced. Packet modes trace square pixel blocks together (SIMD lanes across
+// rays, frustum-culled BVH traversal); reflection bounces are always traced one ray at a time.
+// The packet kernels can place a hit a rounding error away from where a single ray finds it, which
+// only shows once light sampling makes shading depend on exact positions.
+enum class PrimaryRayMode {
+    Single,
+    Packet4x4,
+    Packet8x8
+};
+
+// How each pixel sample's bounce chain is traced. Recursive follows one sample depth-first
+// (trace_ray, then shade_hit loops over its bounces). Wavefront advances a whole batch of samples one bounce
+// at a time: intersect every ray of the wave, bin the hits by how they shade, shade each bin in one
+// pass and queue the continuation rays as the next wave (see Wavefront.cpp). Both give the same image
+// (with light sampling on, against Recursive with PrimaryRayMode::Single).
+enum class Integrator {
+    Recursive,
+    Wavefront
+};
+
+// Progressive adaptive sampling. Each accumulating frame gives every unconverged pixel another
+// samples_per_pixel samples; a pixel is converged once the standard error of its mean luminance
+// drops below target_error relative to that mean (dark pixels are judged against a floor
+// luminance so near-black noise does not hold them up) or it reaches max_samples.
+struct AdaptiveSampling {
+    bool enabled = false;        // Only takes effect together with RenderSettings::accumulate
+    uint32_t min_samples = 16;   // Variance estimates below this are too unreliable to stop on
+    uint32_t max_samples = 4096;
+    double target_error = 0.02;
+};
+
+// Russian roulette on path continuation. From min_depth on, a path whose throughput (product of
+// the reflectivities so far) has dropped below `threshold` continues with probability
+// throughput / threshold and is reweighted by its inverse when it does, so the image stays
+// unbiased while dim paths stop long before max_ray_depth. Bright paths are never cut: this
+// renderer's mirror chains are nearly noise-free, and rouletting them (threshold 1, the textbook
+// form) costs more in variance than it saves in rays. Off by default: on the benchmark scenes it
+// is neutral at equal noise at best (and about 13% worse on the mirror scene), so it is an opt-in
+// for scenes where long dim paths dominate.
+struct RussianRoulette {
+    bool enabled = false;
+    int min_depth = 3;       // Bounce depth of the first continuation that may be cut
+    double threshold = 0.1;
+};
+
+struct RenderSettings {
+    PrimaryRayMode primary_rays = PrimaryRayMode::Packet8x8;
+    int tile_size = 32; // Edge of the square tiles the scheduler hands out; a multiple of 8 keeps packets whole
+    int samples_per_pixel = 0; // Samples each pixel gets this frame; 0 = the scene's
+    bool accumulate = false; // Add this frame's samples to the target's running sums and display their mean
+    Integrator integrator = Integrator::Recursive;
+    SamplerType sampler = SamplerType::Sobol;
+    uint32_t seed = 0; // Same seed, same image: sampling never depends on threads or tile order
+    RussianRoulette roulette;
+    bool next_event = true; // Sample the scene's lights at glossy bounces (see Lights.h); off leaves emitters to the reflection rays
+    AdaptiveSampling adaptive;
+    TemporalSettings temporal; // Reuse of earlier frames after camera motion; runs before the denoiser
+    DenoiseSettings denoise; // Post-pass on the worker pool; the pixels (and hdr) show the filtered image
+    ToneMapSettings tonemap; // How the linear image is resolved into the pixels
+
+    bool wants_guides() const { return temporal.enabled || denoise.enabled; }
+    int frame_samples(const Scene& scene) const {
+        const int samples = samples_per_pixel > 0 ? samples_per_pixel : scene.samples_per_pixel;
+        return samples > 0 ? samples : 1;
+    }
+};
+
+struct FrameInfo {
+    long long frameNumber;
+    RenderSettings settings;
+};
+
+// Render target. The render stage writes `hdr` (linear RGB floats), which render_frame sizes
+// whenever it is missing; resolving it (see Tonemap.h) writes `pixels` (0xAARRGGBB, top-down rows).
+// has_hdr() says whether the caller asked for the linear image as an output too, with
+// resize(..., true): .pfm files and distributed frames copy it only then.
+// With RenderSettings::accumulate, `accum` holds per-pixel sums of every sample since the last
+// reset_accumulation(), and both outputs show their mean, so a static view keeps converging.
+struct FrameBuffer {
+    int width = 0;
+    int height = 0;
+    std::vector<uint32_t> pixels;
+    std::vector<float> hdr;
+    bool hdr_output = false;
+    std::vector<float> accum;          // Linear RGB sums; sized on the first accumulating frame
+    uint32_t accumulated_samples = 0;  // Samples per pixel already in accum (the most any pixel has with adaptive sampling)
+    std::vector<uint32_t> sample_counts; // Adaptive sampling: samples actually taken per pixel
+    std::vector<float> accum_lum_sq;     // Adaptive sampling: per-pixel sum of squared sample luminance
+    // Guides of the camera rays' first hits, averaged over the frame's samples; sized by render_frame
+    // while RenderSettings::wants_guides(). Planar, see DenoiseImage. Misses store the background as
+    // albedo, a zero normal and DENOISE_MISS_DEPTH.
+    std::vector<float> albedo;  // 3 planes
+    std::vector<float> normal;  // 3 planes
+    std::vector<float> depth;   // Distance along the camera ray
+    TemporalHistory temporal;   // Kept by resize(), so a new resolution still reprojects the old frames
+
+    void resize(int new_width, int new_height, bool with_hdr) {
+        width = new_width;
+        height = new_height;
+        pixels.assign(static_cast<size_t>(width) * height, 0);
+        hdr.assign(with_hdr ? static_cast<size_t>(width) * height * 3 : 0, 0.0f);
+        hdr_output = with_hdr;
+        accum.clear();
+        accumulated_samples = 0;
+        sample_counts.clear();
+        accum_lum_sq.clear();
+        albedo.clear();
+        normal.clear();
+        depth.clear();
+    }
+    bool has_hdr() const { return hdr_output; }
+    bool has_guides() const { return !depth.empty(); }
+    // Call when the camera or the scene changes; the next accumulating frame starts from scratch.
+    void reset_accumulation() { accumulated_samples = 0; }
+    // Call when the scene changes: the next frame does not reuse earlier ones even with temporal
+    // reprojection on. Camera motion alone needs only reset_accumulation().
+    void reset_history() { temporal.valid = false; }
+};
+
+// Rectangle of pixels [startX, endX) x [startY, endY), the unit of work handed to render_chunk.
+struct RenderTile {
+    int startX;
+    int startY;
+    int endX;
+    int endY;
+};
+
+// How full the wavefront integrator's waves were. A wave starts with one path per pixel sample of
+// its batch; paths that miss, hit a non-reflective surface or run out of depth drop out, so later
+// bounces run with fewer rays than the batch has slots.
+struct WavefrontStats {
+    static constexpr int DEPTH_BUCKETS = 16; // Deeper bounces are counted in the last bucket
+    enum Bin { Miss, Terminal, Mirror, Glossy, BIN_COUNT };
+
+    uint64_t waves = 0;
+    uint64_t rays[DEPTH_BUCKETS] = {};  // Rays traced per bounce depth
+    uint64_t slots[DEPTH_BUCKETS] = {}; // Batch sizes of the waves run at that depth
+    uint64_t binned[BIN_COUNT] = {};    // Hits shaded per bin
+
+    WavefrontStats& operator+=(const WavefrontStats& other) {
+        waves += other.waves;
+        for (int d = 0; d < DEPTH_BUCKETS; ++d) {
+            rays[d] += other.rays[d];
+            slots[d] += other.slots[d];
+        }
+        for (int b = 0; b < BIN_COUNT; ++b) binned[b] += other.binned[b];
+        return *this;
+    }
+};
+
+// Per-thread state handed down through trace_ray. `sampler` belongs to the pixel sample being
+// traced; the render loops point it at that sample's PixelSampler before tracing it.
+struct TraceContext {
+    explicit TraceContext(const Scene& scene_) : scene(scene_) {}
+
+    const Scene& scene;
+    PixelSampler* sampler = nullptr;
+    RussianRoulette roulette; // The frame's settings
+    bool next_event = true;   // RenderSettings::next_event and the scene has lights
+    uint64_t rays_traced = 0;
+    uint64_t pixels_sampled = 0;
+    TraversalStats traversal;
+    WavefrontStats wavefront;
+    PathStats paths; // Only counted with RM_PROFILING
+};
+
+// Load-balance numbers for one worker over one frame.
+struct WorkerFrameStats {
+    double busy_ms = 0.0;  // Inside render_chunk
+    double idle_ms = 0.0;  // Rest of the frame: scheduling, stealing, waiting for the slowest worker
+    double wake_ms = 0.0;  // From render_frame publishing the frame until this worker started on it
+    double barrier_ms = 0.0; // From this worker's last tile until the frame was done
+    uint32_t tiles_rendered = 0;
+    uint32_t tiles_stolen = 0;
+};
+
+// Totals for one rendered frame, summed over all workers.
+struct FrameStats {
+    uint64_t rays_traced = 0;
+    uint64_t pixels_sampled = 0; // Pixels that received samples (all of them unless adaptive sampling skipped some)
+    TraversalStats traversal;
+    WavefrontStats wavefront;
+    PathStats paths;
+    double frame_ms = 0.0;   // Including the temporal and denoise passes
+    bool cancelled = false;  // RenderThreadPool::cancel_frame() stopped the frame before all of its tiles ran
+    double temporal_ms = 0.0;
+    double denoise_ms = 0.0;
+    std::vector<WorkerFrameStats> workers;
+    // With RM_PROFILING: the frame's RenderFrame span on the calling thread plus every worker's
+    // wake-up, tiles and barrier wait, in no particular order.
+    std::vector<ProfileEvent> events;
+};
+
+// The tracing functions below exist for T = double and T = float; T must match Scene::precision,
+// which render_chunk dispatches on. Shading and colors are always double.
+
+// Closest hit against the scene: BVH when one has been built, otherwise every sphere
+// (through the SIMD store if build_acceleration() has filled it).
+template <typename T>
+bool intersect_scene(TraceContext& ctx, const RayT<T>& ray, T t_min, SceneHit& hit);
+// Shadow ray: whether anything is hit with t in (0, t_max). Stops at the first occluder found.
+template <typename T>
+bool occluded(TraceContext& ctx, const RayT<T>& ray, T t_max);
+
+// Closest hits for a primary-ray packet (BVH or brute-force SIMD store); see BVH::intersect_packet.
+// Returns false when the scene has no SIMD-ready geometry and the caller must trace rays singly.
+template <typename T>
+bool intersect_scene_packet(TraceContext& ctx, RayPacketSoAT<T>& packet, const PacketFrustum& frustum, T t_min);
+
+template <typename T>
+Vec3 trace_ray(TraceContext& ctx, const RayT<T>& ray, int depth);
+// Shading for a hit already found by intersect_scene, following the path's reflections in a loop
+// until it escapes, is absorbed, loses at Russian roulette or reaches max_ray_depth.
+template <typename T>
+Vec3 shade_hit(TraceContext& ctx, const RayT<T>& ray, const SceneHit& hit, int depth);
+void render_chunk(const FrameInfo& frame_info, const Camera& camera, FrameBuffer& target,
+    const RenderTile& tile, TraceContext& ctx);
+// Integrator::Wavefront version of render_chunk (Wavefront.cpp).
+template <typename T>
+void render_chunk_wavefront(const FrameInfo& frame_info, const Camera& camera, FrameBuffer& target,
+    const RenderTile& tile, TraceContext& ctx);
+
+// Pixel bookkeeping shared by the integrators.
+// Russian roulette for a path about to continue to bounce `depth` with `throughput` (already
+// including the reflectivity of the surface it leaves). Returns false when the path stops there;
+// otherwise throughput has been reweighted for survival. Draws from the sampler only when it applies.
+bool survives_roulette(const RussianRoulette& roulette, int depth, Vec3& throughput, PixelSampler& sampler);
+// Next-event estimate at a glossy bounce whose reflection ray leaves `origin` through `lobe` with
+// `throughput` (after roulette): one light sample and its shadow ray, MIS-weighted against the
+// reflection ray. Draws one pair from the sampler.
+template <typename T>
+Vec3 sample_direct_light(TraceContext& ctx, const Vec3T<T>& origin, const ReflectionLobe& lobe, const Vec3& throughput,
+    PixelSampler& sampler);
+// MIS weight of emission that a reflection ray from `origin` through `lobe` found on `sphere`.
+double emission_weight(const TraceContext& ctx, const Vec3& origin, const ReflectionLobe& lobe, const Vec3& direction, uint32_t sphere);
+double sample_luminance(const Vec3& color);
+// Sequence index of this frame's first sample for the pixel: the samples it already has when
+// accumulating, so progressive frames continue the sampler's sequence; 0 otherwise.
+uint32_t first_sample_index(const FrameInfo& frame_info, const FrameBuffer& target, size_t pixel_index);
+// True when adaptive sampling has already settled this pixel and the frame should leave it alone.
+bool skip_pixel(const FrameInfo& frame_info, const FrameBuffer& target, size_t pixel_index);
+// Per-pixel sums of the denoiser guides over a frame's samples.
+struct GuideSums {
+    Vec3 albedo;
+    Vec3 normal;
+    double depth = 0.0;
+
+    void add_miss(const Scene& scene) {
+        albedo = albedo + scene.background_color;
+        depth += DENOISE_MISS_DEPTH;
+    }
+    // `ray` must have a unit direction, as camera rays do.
+    template <typename T>
+    void add_hit(const Scene& scene, const RayT<T>& ray, const SceneHit& hit) {
+        const Sphere& sphere = scene.objects[hit.sphere_index];
+        const Vec3 point = Vec3(ray.origin) + Vec3(ray.direction) * hit.t;
+        albedo = albedo + scene.material_of(hit.sphere_index).base_color;
+        normal = normal + (point - sphere.center) / sphere.radius;
+        depth += hit.t;
+    }
+};
+void store_guides(FrameBuffer& target, size_t pixel_index, const GuideSums& sums, int samples);
+// Writes one pixel of the linear image from this frame's `samples` samples (sum of colors and of
+// squared luminances), folding them into the accumulation buffers when the frame accumulates.
+void store_pixel(FrameBuffer& target, const FrameInfo& frame_info, size_t pixel_index, const Vec3& sum, double lum_sq_sum, int samples);
+// Resolves the tile's linear pixels into target.pixels.
+void resolve_tile(const RenderSettings& settings, FrameBuffer& target, const RenderTile& tile);
+
+// Fixed pool of render workers. Each frame is cut into small tiles; every worker starts with a
+// contiguous run of tiles in its own lock-free deque and steals from the others once that runs
+// dry, so expensive regions get spread over all threads. submit_frame() wakes the workers and
+// returns; each finished tile counts down an atomic, and wait_frame() sleeps on it until the last
+// one is done. A frame loop can present the previous image and prepare the next frame's camera
+// and scene in between, which render_frame() (both in one call) leaves the workers idle for.
+class RenderThreadPool {
+public:
+    explicit RenderThreadPool(int num_threads);
+    ~RenderThreadPool();
+
+    RenderThreadPool(const RenderThreadPool&) = delete;
+    RenderThreadPool& operator=(const RenderThreadPool&) = delete;
+
+    // Starts the frame and returns. The camera is copied; the scene and the target must be left
+    // alone until wait_frame(), and only one frame may be in flight. With a region, only the pixels
+    // inside it are rendered (a distributed job, see Distributed.h); such frames must not
+    // accumulate, and the temporal and denoise passes are skipped.
+    void submit_frame(const FrameInfo& frame_info, const Scene& scene, const Camera& camera, FrameBuffer& target,
+        const RenderTile* region = nullptr);
+    // Blocks until the submitted frame's tiles are done, runs the temporal and denoise passes and
+    // returns the frame's totals.
+    FrameStats wait_frame();
+    bool frame_in_flight() const { return in_flight; }
+    // Stops the frame in flight from starting any more tiles; callable from any thread, and a no-op
+    // when no frame is in flight. wait_frame() then returns once the tiles already started are done,
+    // with FrameStats::cancelled set. The target is left half rendered: such a frame skips the
+    // temporal and denoise passes and is not counted in accumulated_samples, but the tiles it did
+    // render are in accum, so reset_accumulation() before accumulating into the target again.
+    void cancel_frame() { frame_cancelled.store(true, std::memory_order_relaxed); }
+    FrameStats render_frame(const FrameInfo& frame_info, const Scene& scene, const Camera& camera, FrameBuffer& target,
+        const RenderTile* region = nullptr) {
+        submit_frame(frame_info, scene, camera, target, region);
+        return wait_frame();
+    }
+    // Bilinear resampling of source's pixels (and hdr, when both have one) to output's size, over
+    // the workers; for dynamic resolution, where source is the smaller render target. Not while a
+    // frame is in flight.
+    void upscale(const FrameBuffer& source, FrameBuffer& output);
+    // Runs task(index) for index in [0, count) on the workers and returns when all are done; for
+    // work between frames such as refitting the BVH of an animated scene (a ParallelFor).
+    void parallel_for(int count, const std::function<void(int)>& task);
+    int thread_count() const { return num_threads; }
+
+private:
+    void render_chunk_loop(int thread_id);
+    // Wakes the workers on the published frame or job; under render_mutex.
+    void publish();
+    // Sleeps until every worker has reported back on the last publish(); without render_mutex.
+    void wait_for_workers();
+    // publish() and wait_for_workers(), releasing the lock in between.
+    void dispatch(std::unique_lock<std::mutex>& lock);
+    // Runs task(index) for index in [0, task_count) spread over the workers; under render_mutex.
+    void run_tasks(std::unique_lock<std::mutex>& lock, int task_count, const std::function<void(int)>& task);
+    // The passes after the tiles; writes the frame's outputs when any of them ran.
+    void post_process(std::unique_lock<std::mutex>& lock, const FrameInfo& frame_info, const Scene& scene,
+        const Camera& camera, FrameBuffer& target);
+    void build_tiles(const RenderTile& area, int tile_size);
+    void distribute_tiles();
+    bool next_tile(int thread_id, uint32_t& tile_index, bool& stolen);
+
+    int num_threads;
+    std::vector<RenderTile> tiles;
+    RenderTile tiles_area = { 0, 0, -1, -1 };
+    int tiles_size = -1;
+    std::unique_ptr<WorkStealingDeque[]> tile_queues; // One per worker
+
+    // Frame parameters, published under render_mutex before target_frame_id is bumped.
+    FrameInfo current_frame_info{ -1, RenderSettings() };
+    const Scene* current_scene = nullptr;
+    Camera current_camera;
+    FrameBuffer* current_target = nullptr;
+    bool current_has_region = false;
+    bool current_resolve_tiles = false; // Workers resolve each tile; otherwise post_process resolves the frame
+    bool in_flight = false; // Submitted and not yet waited for; only touched by the submitting thread
+    const std::function<void(int)>* current_task = nullptr; // Set while run_tasks runs instead of tiles
+    int task_count = 0;
+    std::atomic<int> next_task = 0;
+    std::vector<float> post_planes; // Two 3-plane color images: the frame's mean, then the denoise ping-pong
+
+    std::mutex render_mutex;
+    std::condition_variable worker_start_cv;
+    long long target_frame_id = -1; // Bumped for every dispatch: a frame's tiles or a run_tasks job
+    std::atomic<int> workers_done_count = 0;    // Workers that reported back on the last dispatch; notified on the last
+    std::atomic<uint32_t> tiles_remaining = 0;  // Of the frame in flight, counted down per finished tile
+    std::atomic<bool> tiles_complete = false;   // Set and notified by the worker that finished the last tile
+    std::atomic<bool> frame_cancelled = false;  // Set by cancel_frame(); workers then count tiles down without rendering them
+    std::chrono::steady_clock::time_point tiles_end_time; // Written by that worker before setting tiles_complete
+    std::chrono::steady_clock::time_point frame_start_time;
+    std::vector<std::chrono::steady_clock::time_point> worker_finish_times; // Guarded by render_mutex
+    FrameStats frame_stats; // Guarded by render_mutex
+    bool shutdown_threads = false;
+
+    std::vector<std::jthread> threads; // Declared last so workers are joined before the state above is destroyed
+};
+
+// True when adaptive sampling would skip this pixel on the next accumulating frame.
+bool pixel_converged(const FrameBuffer& target, const AdaptiveSampling& adaptive, size_t pixel_index);
+
+// Picks a worker count when the user did not ask for one.
+int default_thread_count();
@@ -0,0 +1,144 @@
+#include "Resolution.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+RenderScale DynamicResolution::next(int output_width, int output_height, int scene_spp) {
+    const int max_spp = std::max(1, scene_spp);
+    auto size_at = [&](double scale, int spp) {
+        return RenderScale{ std::min(output_width, std::max(8, static_cast<int>(std::lround(output_width * scale)))),
+            std::min(output_height, std::max(8, static_cast<int>(std::lround(output_height * scale)))), spp };
+    };
+    auto samples = [](const RenderScale& size) { return static_cast<double>(size.width) * size.height * size.spp; };
+
+    int spp = current_spp > 0 ? std::min(current_spp, max_spp) : max_spp;
+    if (settings.enabled && sample_cost_ms > 0.0) {
+        const double predicted_ms = sample_cost_ms * samples(size_at(current_scale, spp));
+        if (predicted_ms > settings.target_ms || predicted_ms < HEADROOM_LOW * settings.target_ms) {
+            const double budget = settings.target_ms * HEADROOM / sample_cost_ms; // Pixel samples
+            const double output_samples = static_cast<double>(output_width) * output_height * max_spp;
+            const double desired = std::sqrt(budget / output_samples);
+            if (desired >= settings.min_scale) {
+                current_scale = desired >= settings.max_scale ? settings.max_scale
+                    : std::max(settings.min_scale, std::floor(desired / SCALE_STEP) * SCALE_STEP);
+                spp = max_spp;
+            }
+            else {
+                current_scale = settings.min_scale;
+                const double pixels = samples(size_at(current_scale, 1));
+                spp = std::clamp(static_cast<int>(budget / pixels), std::min(settings.min_spp, max_spp), max_spp);
+            }
+            current_spp = spp < max_spp ? spp : 0;
+        }
+    }
+    else if (!settings.enabled) {
+        current_scale = settings.max_scale;
+        current_spp = 0;
+        spp = max_spp;
+    }
+    last = size_at(current_scale, spp);
+    return last;
+}
+
+void DynamicResolution::update(double frame_ms, uint64_t pixels_sampled) {
+    if (pixels_sampled == 0 || last.spp <= 0) return;
+    const double cost = frame_ms / (static_cast<double>(pixels_sampled) * last.spp);
+    sample_cost_ms = sample_cost_ms > 0.0 ? 0.5 * (sample_cost_ms + cost) : cost;
+}
+
+namespace {
+
+// Source coordinate of each destination column or row: the tap before it and the 8-bit weight of
+// the tap after it.
+struct Taps {
+    std::vector<int> index;
+    std::vector<int> weight;
+};
+
+Taps make_taps(int src_size, int dst_size, int begin, int end) {
+    Taps taps;
+    taps.index.resize(end - begin);
+    taps.weight.resize(end - begin);
+    const double ratio = static_cast<double>(src_size) / dst_size;
+    for (int d = begin; d < end; ++d) {
+        const double s = std::clamp((d + 0.5) * ratio - 0.5, 0.0, static_cast<double>(src_size - 1));
+        const int i = std::min(static_cast<int>(s), std::max(0, src_size - 2));
+        taps.index[d - begin] = i;
+        taps.weight[d - begin] = static_cast<int>(std::lround((s - i) * 256.0));
+    }
+    return taps;
+}
+
+// Blends two 0xAARRGGBB pixels by an 8-bit weight (0 = a, 256 = b). Red and blue, then alpha and
+// green, share a 32-bit multiply: each lane's product stays below 2^16.
+uint32_t blend(uint32_t a, uint32_t b, uint32_t weight) {
+    const uint32_t MASK = 0x00FF00FFu;
+    const uint32_t rb = (((a & MASK) * (256 - weight) + (b & MASK) * weight) >> 8) & MASK;
+    const uint32_t ag = ((((a >> 8) & MASK) * (256 - weight) + ((b >> 8) & MASK) * weight) >> 8) & MASK;
+    return rb | (ag << 8);
+}
+
+} // namespace
+
+void upscale_bilinear(const uint32_t* src, int src_width, int src_height, uint32_t* dst, int dst_width, int dst_height,
+    int row_begin, int row_end) {
+    const Taps columns = make_taps(src_width, dst_width, 0, dst_width);
+    const Taps rows = make_taps(src_height, dst_height, row_begin, row_end);
+    const int next_column = src_width > 1 ? 1 : 0;
+    // Each source row is stretched to the output width once and kept while the output rows between
+    // it and the next one are blended, which is a plain loop over both.
+    std::vector<uint32_t> upper(dst_width), lower(dst_width);
+    int upper_row = -1, lower_row = -1;
+    auto stretch = [&](int row, std::vector<uint32_t>& out) {
+        const uint32_t* line = src + static_cast<size_t>(row) * src_width;
+        for (int x = 0; x < dst_width; ++x) {
+            out[x] = blend(line[columns.index[x]], line[columns.index[x] + next_column], columns.weight[x]);
+        }
+    };
+    for (int y = row_begin; y < row_end; ++y) {
+        const int top = rows.index[y - row_begin];
+        const int bottom = std::min(top + 1, src_height - 1);
+        if (top != upper_row) {
+            if (top == lower_row) {
+                std::swap(upper, lower);
+                std::swap(upper_row, lower_row);
+            }
+            else {
+                stretch(top, upper);
+                upper_row = top;
+            }
+        }
+        if (bottom != lower_row) {
+            stretch(bottom, lower);
+            lower_row = bottom;
+        }
+        const uint32_t wy = rows.weight[y - row_begin];
+        uint32_t* out = dst + static_cast<size_t>(y) * dst_width;
+        for (int x = 0; x < dst_width; ++x) {
+            out[x] = blend(upper[x], lower[x], wy);
+        }
+    }
+}
+
+void upscale_bilinear(const float* src, int src_width, int src_height, float* dst, int dst_width, int dst_height,
+    int row_begin, int row_end) {
+    const Taps columns = make_taps(src_width, dst_width, 0, dst_width);
+    const Taps rows = make_taps(src_height, dst_height, row_begin, row_end);
+    const int next_column = src_width > 1 ? 3 : 0;
+    const size_t next_row = src_height > 1 ? static_cast<size_t>(src_width) * 3 : 0;
+    for (int y = row_begin; y < row_end; ++y) {
+        const float* top = src + static_cast<size_t>(rows.index[y - row_begin]) * src_width * 3;
+        const float* bottom = top + next_row;
+        const float wy = rows.weight[y - row_begin] / 256.0f;
+        float* out = dst + static_cast<size_t>(y) * dst_width * 3;
+        for (int x = 0; x < dst_width; ++x) {
+            const size_t sx = static_cast<size_t>(columns.index[x]) * 3;
+            const float wx = columns.weight[x] / 256.0f;
+            for (int c = 0; c < 3; ++c) {
+                const float upper = top[sx + c] + (top[sx + next_column + c] - top[sx + c]) * wx;
+                const float lower = bottom[sx + c] + (bottom[sx + next_column + c] - bottom[sx + c]) * wx;
+                out[x * 3 + c] = upper + (lower - upper) * wy;
+            }
+        }
+    }
+}
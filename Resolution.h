@@ -0,0 +1,59 @@
+#pragma once
+// Dynamic resolution: the frame loop renders into a target smaller than its output, sized each
+// frame to hold a frame time, and upscales the result (RenderThreadPool::upscale). The controller
+// models a frame's time as proportional to the pixel samples it renders, learns that cost from the
+// frames it has seen, and picks the largest render size that fits the target at the scene's spp;
+// only when the smallest size is still too slow does it give up samples per pixel.
+#include <cstdint>
+
+struct DynamicResolutionSettings {
+    bool enabled = false;     // Otherwise every frame renders at max_scale
+    double target_ms = 33.3;  // Frame time to hold
+    double min_scale = 0.25;  // Smallest render width and height, as a fraction of the output's
+    double max_scale = 1.0;
+    int min_spp = 1;          // Fewest samples per pixel once the render size bottoms out
+};
+
+// Render size and samples per pixel for one frame.
+struct RenderScale {
+    int width;
+    int height;
+    int spp;
+};
+
+class DynamicResolution {
+public:
+    explicit DynamicResolution(const DynamicResolutionSettings& settings_ = DynamicResolutionSettings())
+        : settings(settings_), current_scale(settings_.max_scale) {}
+
+    // What to render the next frame of an output_width x output_height image at, for a scene asking
+    // for scene_spp samples per pixel. Keeps the last choice unless the predicted frame time
+    // leaves the band between HEADROOM_LOW and 1 times the target, so noise in the frame times does
+    // not resize the target (and restart accumulation) every frame.
+    RenderScale next(int output_width, int output_height, int scene_spp);
+    // Time of the frame rendered at the last next() result, which took samples in pixels_sampled
+    // of its pixels (fewer than all of them once adaptive sampling skips converged ones). The cost
+    // is learned per pixel sample taken, but predictions assume every pixel is sampled, as they
+    // are again after a resize.
+    void update(double frame_ms, uint64_t pixels_sampled);
+
+    double scale() const { return current_scale; }
+
+private:
+    static constexpr double SCALE_STEP = 1.0 / 32.0; // Scales are multiples of this
+    static constexpr double HEADROOM = 0.9;          // Resizes aim for this share of the target
+    static constexpr double HEADROOM_LOW = 0.7;      // Grows only below this share of the target
+
+    DynamicResolutionSettings settings;
+    double current_scale;
+    int current_spp = 0;        // 0 = the scene's
+    double sample_cost_ms = 0.0; // Smoothed ms per pixel sample; 0 until a frame was timed
+    RenderScale last = { 0, 0, 0 };
+};
+
+// Bilinear resampling of rows [row_begin, row_end) of a dst_width x dst_height image from a
+// src_width x src_height one, pixel centers aligned; 0xAARRGGBB pixels or interleaved linear RGB.
+void upscale_bilinear(const uint32_t* src, int src_width, int src_height, uint32_t* dst, int dst_width, int dst_height,
+    int row_begin, int row_end);
+void upscale_bilinear(const float* src, int src_width, int src_height, float* dst, int dst_width, int dst_height,
+    int row_begin, int row_end);
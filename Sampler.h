@@ -0,0 +1,172 @@
+#pragma once
+// Random numbers for the integrators. Every value a pixel sample consumes is a pure function of
+// (seed, pixel, sample index, dimension), so an image does not depend on the thread count, the
+// tile size, the order tiles are stolen in or the integrator. The sample index keeps counting
+// across accumulated frames, so progressive rendering continues one sequence instead of
+// restarting it every frame.
+#include <cstdint>
+#include <string>
+
+// Random: independent PCG32 stream per pixel sample.
+// Sobol: Owen-scrambled, shuffled 2D Sobol points per pair of dimensions (Burley, "Practical
+// Hash-based Owen Scrambling", 2020). Each pixel's samples stratify in every pair, so it converges
+// faster than independent sampling at the same spp; pixels are decorrelated by hashing.
+enum class SamplerType {
+    Random,
+    Sobol
+};
+
+inline const char* sampler_name(SamplerType type) {
+    return type == SamplerType::Sobol ? "sobol" : "random";
+}
+
+inline bool parse_sampler(const std::string& name, SamplerType& type) {
+    if (name == "random") type = SamplerType::Random;
+    else if (name == "sobol") type = SamplerType::Sobol;
+    else return false;
+    return true;
+}
+
+// PCG32 (O'Neill, pcg-random.org): 64-bit LCG with a permuted 32-bit output. 16 bytes of state
+// instead of mt19937's 2.5 KB, and every (seed, stream) pair is a separate sequence, which is what
+// lets each pixel sample own one.
+class Pcg32 {
+public:
+    Pcg32() = default;
+    Pcg32(uint64_t seed, uint64_t stream) : state(0), increment((stream << 1) | 1) {
+        next_u32();
+        state += seed;
+        next_u32();
+    }
+
+    uint32_t next_u32() {
+        uint64_t old_state = state;
+        state = old_state * 6364136223846793005ULL + increment;
+        uint32_t xorshifted = static_cast<uint32_t>(((old_state >> 18) ^ old_state) >> 27);
+        uint32_t rotation = static_cast<uint32_t>(old_state >> 59);
+        return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+    }
+
+private:
+    uint64_t state = 0;
+    uint64_t increment = 1;
+};
+
+// 32-bit integer hash (lowbias32, Wellons) and a seed combiner built on it.
+inline uint32_t hash_u32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t value) {
+    return hash_u32(seed ^ (value + 0x9e3779b9U + (seed << 6) + (seed >> 2)));
+}
+
+// [0, 1) from the top bits of a 32-bit value; never rounds up to 1.
+inline double unit_double(uint32_t bits) {
+    return bits * (1.0 / 4294967296.0);
+}
+
+namespace sobol_detail {
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+    x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fU) | ((x & 0x0f0f0f0fU) << 4);
+    x = ((x >> 8) & 0x00ff00ffU) | ((x & 0x00ff00ffU) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// First two Sobol dimensions: van der Corput (bit reversal), and the Pascal-matrix dimension whose
+// direction numbers follow v[k+1] = v[k] ^ (v[k] >> 1). Higher dimensions are made by pairing these.
+// Dimension 1 is linear over XOR, so it is evaluated a byte at a time from precomputed tables
+// rather than with a data-dependent loop over all 32 index bits.
+struct SobolDimension1Tables {
+    uint32_t byte_table[4][256];
+};
+
+constexpr SobolDimension1Tables make_sobol_dimension1_tables() {
+    SobolDimension1Tables tables{};
+    uint32_t direction[32] = {};
+    direction[0] = 1U << 31;
+    for (int bit = 1; bit < 32; ++bit) direction[bit] = direction[bit - 1] ^ (direction[bit - 1] >> 1);
+    for (int byte = 0; byte < 4; ++byte) {
+        for (uint32_t value = 0; value < 256; ++value) {
+            uint32_t result = 0;
+            for (int bit = 0; bit < 8; ++bit) {
+                if (value & (1U << bit)) result ^= direction[byte * 8 + bit];
+            }
+            tables.byte_table[byte][value] = result;
+        }
+    }
+    return tables;
+}
+
+inline constexpr SobolDimension1Tables SOBOL_DIMENSION1 = make_sobol_dimension1_tables();
+
+inline uint32_t sobol_dimension1(uint32_t index) {
+    return SOBOL_DIMENSION1.byte_table[0][index & 0xff] ^ SOBOL_DIMENSION1.byte_table[1][(index >> 8) & 0xff] ^
+        SOBOL_DIMENSION1.byte_table[2][(index >> 16) & 0xff] ^ SOBOL_DIMENSION1.byte_table[3][index >> 24];
+}
+
+// Hash-based Owen scrambling: a Laine-Karras style permutation applied to the bit-reversed value
+// scrambles every binary digit conditioned on the ones above it.
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x ^= x * 0x3d20adeaU;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526c56U;
+    x ^= x * 0x53a22864U;
+    return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+} // namespace sobol_detail
+
+// The random numbers of one pixel sample, handed out two dimensions at a time in a fixed order
+// (camera jitter first, then per bounce a roulette draw if it applies, a pair for glossy scattering
+// and, with light sampling, a pair for the light sample). Small enough to travel with a path.
+class PixelSampler {
+public:
+    PixelSampler() = default;
+    PixelSampler(SamplerType type_, uint32_t seed, uint32_t pixel_index, uint32_t sample_index)
+        : type(type_), pixel_seed(hash_combine(seed, pixel_index)), index(sample_index),
+        rng(pixel_seed, sample_index) {
+    }
+
+    // Next single dimension; uses up a pair so later draws keep their place in the sequence.
+    double next_1d() {
+        double u, v;
+        next_2d(u, v);
+        return u;
+    }
+
+    // Next pair of dimensions, each in [0, 1).
+    void next_2d(double& u, double& v) {
+        if (type == SamplerType::Random) {
+            u = unit_double(rng.next_u32());
+            v = unit_double(rng.next_u32());
+            return;
+        }
+        using namespace sobol_detail;
+        const uint32_t dimension_seed = hash_combine(pixel_seed, dimension++);
+        const uint32_t shuffled = nested_uniform_scramble(index, hash_combine(dimension_seed, 0));
+        // Dimension 0 is a bit reversal, which cancels against the scramble's leading reversal.
+        u = unit_double(reverse_bits(laine_karras_permutation(shuffled, hash_combine(dimension_seed, 1))));
+        v = unit_double(nested_uniform_scramble(sobol_dimension1(shuffled), hash_combine(dimension_seed, 2)));
+    }
+
+private:
+    SamplerType type = SamplerType::Random;
+    uint32_t pixel_seed = 0;
+    uint32_t index = 0;
+    uint32_t dimension = 0;
+    Pcg32 rng;
+};
@@ -0,0 +1,117 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+// Per-element scene storage that either owns a std::vector or views memory someone else keeps alive,
+// such as the tables of a mapped .rmsc file (read_binary_scene). Reads go through one pointer either
+// way, so rendering does not care which it is. The first write to a view copies it into owned storage;
+// writes are spelled out (edit, mutable_data, push_back...) and there is no non-const operator[], so a
+// read that happens to go through a non-const Scene never copies a mapped table by accident.
+template <typename T>
+class SceneArray {
+    static_assert(std::is_trivially_copyable_v<T>, "views are plain memory");
+
+public:
+    SceneArray() = default;
+    SceneArray(const SceneArray& other) : owned(other.owned), owner(other.owner) { point_at(other); }
+    SceneArray(SceneArray&& other) noexcept : owned(std::move(other.owned)), owner(std::move(other.owner)) {
+        point_at(other);
+        other.reset();
+    }
+    SceneArray& operator=(const SceneArray& other) {
+        if (this != &other) {
+            owned = other.owned;
+            owner = other.owner;
+            point_at(other);
+        }
+        return *this;
+    }
+    SceneArray& operator=(SceneArray&& other) noexcept {
+        if (this != &other) {
+            owned = std::move(other.owned);
+            owner = std::move(other.owner);
+            point_at(other);
+            other.reset();
+        }
+        return *this;
+    }
+
+    // Views `count` elements at `data`, which `keep_alive` owns. Drops any owned elements.
+    void view(std::shared_ptr<const void> keep_alive, const T* data, size_t count) {
+        owned = std::vector<T>();
+        owner = std::move(keep_alive);
+        elements = data;
+        element_count = count;
+    }
+    bool is_view() const { return owner != nullptr; }
+
+    size_t size() const { return element_count; }
+    bool empty() const { return element_count == 0; }
+    const T* data() const { return elements; }
+    const T* begin() const { return elements; }
+    const T* end() const { return elements + element_count; }
+    const T& operator[](size_t index) const { return elements[index]; }
+    const T& back() const { return elements[element_count - 1]; }
+    operator std::span<const T>() const { return std::span<const T>(elements, element_count); }
+
+    T* mutable_data() {
+        detach();
+        return owned.data();
+    }
+    T& edit(size_t index) { return mutable_data()[index]; }
+    void push_back(const T& value) {
+        detach();
+        owned.push_back(value);
+        sync();
+    }
+    void reserve(size_t capacity) {
+        detach();
+        owned.reserve(capacity);
+        sync();
+    }
+    void assign(const T* first, const T* last) {
+        owner.reset();
+        owned.assign(first, last);
+        sync();
+    }
+    void clear() {
+        owner.reset();
+        owned.clear();
+        sync();
+    }
+
+private:
+    void detach() {
+        if (!owner) return;
+        owned.assign(elements, elements + element_count);
+        owner.reset();
+        sync();
+    }
+    void sync() {
+        elements = owned.data();
+        element_count = owned.size();
+    }
+    // After copying or moving `other`'s members in: a view keeps its pointer, owned storage uses ours.
+    void point_at(const SceneArray& other) {
+        if (owner) {
+            elements = other.elements;
+            element_count = other.element_count;
+        }
+        else {
+            sync();
+        }
+    }
+    void reset() {
+        owned.clear();
+        owner.reset();
+        sync();
+    }
+
+    std::vector<T> owned;
+    std::shared_ptr<const void> owner; // Keeps a view's memory alive; null when the elements are owned
+    const T* elements = nullptr;       // owned.data() or the view
+    size_t element_count = 0;
+};
@@ -0,0 +1,371 @@
+#include "SceneBinary.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const std::string& path) {
+    close();
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(handle);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(handle);
+        return false;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        CloseHandle(handle);
+        return false;
+    }
+    file_handle = handle;
+    mapping_handle = mapping;
+    mapped_data = static_cast<const uint8_t*>(view);
+    mapped_size = static_cast<size_t>(file_size.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // The mapping keeps the file alive
+    if (view == MAP_FAILED) return false;
+    posix_madvise(view, static_cast<size_t>(info.st_size), POSIX_MADV_SEQUENTIAL);
+    mapped_data = static_cast<const uint8_t*>(view);
+    mapped_size = static_cast<size_t>(info.st_size);
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+    if (!mapped_data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(mapped_data);
+    CloseHandle(mapping_handle);
+    CloseHandle(file_handle);
+    mapping_handle = nullptr;
+    file_handle = nullptr;
+#else
+    munmap(const_cast<uint8_t*>(mapped_data), mapped_size);
+#endif
+    mapped_data = nullptr;
+    mapped_size = 0;
+}
+
+namespace {
+
+bool range_fits(uint64_t offset, uint64_t count, uint64_t element_size, size_t file_size) {
+    if (offset > file_size) return false;
+    return count <= (file_size - offset) / element_size;
+}
+
+uint64_t align_up(uint64_t offset, uint64_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+bool MappedScene::open(const std::string& path) {
+    if (!file.open(path)) {
+        log_message("Error: Could not map scene file: " + path + "\n");
+        return false;
+    }
+    bytes = file.data();
+    byte_count = file.size();
+    return validate(path);
+}
+
+bool MappedScene::open(const uint8_t* data, size_t size, const std::string& name) {
+    file.close();
+    bytes = data;
+    byte_count = size;
+    if (reinterpret_cast<uintptr_t>(data) % alignof(PackedMaterial) != 0) {
+        log_message("Error: " + name + " is not aligned for reading in place\n");
+        bytes = nullptr;
+        byte_count = 0;
+        return false;
+    }
+    return validate(name);
+}
+
+bool MappedScene::validate(const std::string& name) {
+    auto fail = [&](const char* reason) {
+        log_message("Error: " + name + " is not a valid binary scene (" + reason + ")\n");
+        file.close();
+        bytes = nullptr;
+        byte_count = 0;
+        return false;
+    };
+    file_header = SceneFileHeader();
+    if (byte_count < SCENE_BINARY_V1_HEADER_SIZE) return fail("truncated header");
+    std::memcpy(&file_header, bytes, SCENE_BINARY_V1_HEADER_SIZE);
+    SceneFileHeader& h = file_header;
+    if (std::memcmp(h.magic, SCENE_BINARY_MAGIC, sizeof(h.magic)) != 0) return fail("bad magic");
+    // Older headers are prefixes of the current one; the fields they lack stay 0.
+    uint32_t header_size = 0;
+    if (h.version == 1 && h.header_size == SCENE_BINARY_V1_HEADER_SIZE) header_size = SCENE_BINARY_V1_HEADER_SIZE;
+    else if (h.version == 2 && h.header_size == SCENE_BINARY_V2_HEADER_SIZE) header_size = SCENE_BINARY_V2_HEADER_SIZE;
+    else if (h.version == SCENE_BINARY_VERSION && h.header_size == sizeof(SceneFileHeader)) header_size = sizeof(SceneFileHeader);
+    else return fail("unsupported version");
+    if (byte_count < header_size) return fail("truncated header");
+    std::memcpy(&file_header, bytes, header_size);
+
+    const bool in_place = in_memory_layout();
+    if (h.materials_offset % alignof(Material) != 0 || h.spheres_offset % alignof(Sphere) != 0 ||
+        h.tracks_offset % alignof(PackedTrack) != 0 || h.keys_offset % alignof(PackedKeyframe) != 0 ||
+        (in_place && (h.sphere_materials_offset % alignof(MaterialIndex) != 0 || h.material_ids_offset % alignof(PackedMaterialId) != 0))) {
+        return fail("misaligned tables");
+    }
+    if (!range_fits(h.materials_offset, h.material_count, in_place ? sizeof(Material) : sizeof(PackedMaterial), byte_count) ||
+        !range_fits(h.spheres_offset, h.sphere_count, in_place ? sizeof(Sphere) : sizeof(PackedSphere), byte_count) ||
+        !range_fits(h.strings_offset, h.strings_size, 1, byte_count) ||
+        !range_fits(h.tracks_offset, h.track_count, sizeof(PackedTrack), byte_count) ||
+        !range_fits(h.keys_offset, h.key_count, sizeof(PackedKeyframe), byte_count) ||
+        (in_place && (!range_fits(h.sphere_materials_offset, h.sphere_count, sizeof(MaterialIndex), byte_count) ||
+            !range_fits(h.material_ids_offset, h.material_count, sizeof(PackedMaterialId), byte_count)))) {
+        return fail("table out of bounds");
+    }
+    for (uint32_t i = 0; i < h.material_count; ++i) {
+        const uint64_t end = in_place ? static_cast<uint64_t>(material_ids()[i].offset) + material_ids()[i].length :
+            static_cast<uint64_t>(packed_materials()[i].id_offset) + packed_materials()[i].id_length;
+        if (end > h.strings_size) return fail("material id out of bounds");
+    }
+    // What Scene::add_material / add_sphere would have ensured for tables that are used as they are.
+    if (in_place) {
+        for (uint32_t i = 0; i < h.material_count; ++i) {
+            const Material& material = material_table()[i];
+            if (!(material.reflectivity >= 0.0 && material.reflectivity <= 1.0 && material.roughness >= 0.0 && material.roughness <= 1.0)) {
+                return fail("material parameters out of range");
+            }
+        }
+    }
+    for (uint32_t i = 0; i < h.sphere_count; ++i) {
+        const MaterialIndex material = in_place ? sphere_materials()[i] : packed_spheres()[i].material_index;
+        if (material >= h.material_count) return fail("sphere references a missing material");
+    }
+    // Poses are looked up by binary search over ascending times, and tracks by ascending sphere.
+    const PackedTrack* track_table = tracks();
+    const PackedKeyframe* key_table = keys();
+    for (uint32_t i = 0; i < h.track_count; ++i) {
+        const PackedTrack& track = track_table[i];
+        if (track.sphere >= h.sphere_count || (i > 0 && track.sphere <= track_table[i - 1].sphere)) return fail("track out of order");
+        if (static_cast<uint64_t>(track.first_key) + track.key_count > h.key_count) return fail("keyframes out of bounds");
+        for (uint32_t k = 0; k < track.key_count; ++k) {
+            const double time = key_table[track.first_key + k].time;
+            if (!(time > (k > 0 ? key_table[track.first_key + k - 1].time : 0.0))) return fail("keyframe times out of order");
+        }
+    }
+    return true;
+}
+
+std::string_view MappedScene::material_id(uint32_t index) const {
+    const char* strings = reinterpret_cast<const char*>(bytes + header().strings_offset);
+    if (in_memory_layout()) return std::string_view(strings + material_ids()[index].offset, material_ids()[index].length);
+    const PackedMaterial& material = packed_materials()[index];
+    return std::string_view(strings + material.id_offset, material.id_length);
+}
+
+bool is_binary_scene_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(SCENE_BINARY_MAGIC)] = {};
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, SCENE_BINARY_MAGIC, sizeof(magic)) == 0;
+}
+
+namespace {
+
+// With an `owner` keeping `mapped` alive, version 3 tables are viewed in place; otherwise copied.
+void fill_scene(const MappedScene& mapped, std::shared_ptr<const void> owner, Scene& scene) {
+    const SceneFileHeader& header = mapped.header();
+    scene.max_ray_depth = header.max_ray_depth;
+    scene.samples_per_pixel = header.samples_per_pixel;
+    scene.background_color = Vec3(header.background_color[0], header.background_color[1], header.background_color[2]);
+
+    // The file's material table maps one to one onto Scene::materials, so sphere indices carry over.
+    const uint32_t material_count = mapped.material_count();
+    const uint32_t sphere_count = mapped.sphere_count();
+    scene.material_ids.clear();
+    scene.material_ids.reserve(material_count);
+    for (uint32_t i = 0; i < material_count; ++i) scene.material_ids.emplace_back(mapped.material_id(i));
+
+    if (mapped.in_memory_layout() && owner) {
+        scene.materials.view(owner, mapped.material_table(), material_count);
+        scene.objects.view(owner, mapped.sphere_table(), sphere_count);
+        scene.object_materials.view(std::move(owner), mapped.sphere_materials(), sphere_count);
+    }
+    else if (mapped.in_memory_layout()) {
+        scene.materials.assign(mapped.material_table(), mapped.material_table() + material_count);
+        scene.objects.assign(mapped.sphere_table(), mapped.sphere_table() + sphere_count);
+        scene.object_materials.assign(mapped.sphere_materials(), mapped.sphere_materials() + sphere_count);
+    }
+    else {
+        const PackedMaterial* packed_materials = mapped.packed_materials();
+        scene.materials.clear();
+        scene.materials.reserve(material_count);
+        for (uint32_t i = 0; i < material_count; ++i) {
+            const PackedMaterial& m = packed_materials[i];
+            scene.materials.push_back(Material(Vec3(m.base_color[0], m.base_color[1], m.base_color[2]), m.reflectivity, m.roughness,
+                Vec3(m.emission_color[0], m.emission_color[1], m.emission_color[2])));
+        }
+        const PackedSphere* packed_spheres = mapped.packed_spheres();
+        scene.objects.clear();
+        scene.object_materials.clear();
+        scene.objects.reserve(sphere_count);
+        scene.object_materials.reserve(sphere_count);
+        for (uint32_t i = 0; i < sphere_count; ++i) {
+            const PackedSphere& s = packed_spheres[i];
+            scene.add_sphere(Sphere(Vec3(s.center[0], s.center[1], s.center[2]), s.radius), s.material_index);
+        }
+    }
+
+    scene.animation.clear();
+    scene.animation.tracks.reserve(mapped.track_count());
+    for (uint32_t i = 0; i < mapped.track_count(); ++i) {
+        const PackedTrack& t = mapped.tracks()[i];
+        SphereTrack track;
+        track.sphere = t.sphere;
+        track.first_key = t.first_key;
+        track.key_count = t.key_count;
+        track.rest = scene.objects[t.sphere];
+        track.velocity = Vec3(t.velocity[0], t.velocity[1], t.velocity[2]);
+        scene.animation.tracks.push_back(track);
+    }
+    scene.animation.keys.reserve(mapped.key_count());
+    for (uint32_t i = 0; i < mapped.key_count(); ++i) {
+        const PackedKeyframe& k = mapped.keys()[i];
+        scene.animation.keys.push_back(SphereKeyframe{ k.time, Vec3(k.center[0], k.center[1], k.center[2]), k.radius });
+    }
+}
+
+} // namespace
+
+bool read_binary_scene(const std::string& path, Scene& scene, bool in_place) {
+    auto mapped = std::make_shared<MappedScene>();
+    if (!mapped->open(path)) return false;
+    const MappedScene& tables = *mapped;
+    fill_scene(tables, in_place ? std::move(mapped) : nullptr, scene);
+    return true;
+}
+
+bool decode_binary_scene(const uint8_t* data, size_t size, Scene& scene, const std::string& name) {
+    MappedScene mapped;
+    if (!mapped.open(data, size, name)) return false;
+    fill_scene(mapped, nullptr, scene);
+    return true;
+}
+
+std::vector<uint64_t> encode_binary_scene(const Scene& scene, size_t& size) {
+    SceneFileHeader header = {};
+    std::memcpy(header.magic, SCENE_BINARY_MAGIC, sizeof(header.magic));
+    header.version = SCENE_BINARY_VERSION;
+    header.header_size = sizeof(SceneFileHeader);
+    header.max_ray_depth = scene.max_ray_depth;
+    header.samples_per_pixel = scene.samples_per_pixel;
+    header.background_color[0] = scene.background_color.x;
+    header.background_color[1] = scene.background_color.y;
+    header.background_color[2] = scene.background_color.z;
+
+    std::vector<PackedMaterialId> material_ids(scene.materials.size());
+    std::string strings;
+    for (size_t i = 0; i < scene.materials.size(); ++i) {
+        const std::string& id = scene.material_ids[i];
+        material_ids[i] = PackedMaterialId{ static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(id.size()) };
+        strings += id;
+    }
+
+    // Animated spheres are stored at rest, whatever time the scene was last posed at.
+    std::vector<Sphere> spheres(scene.objects.begin(), scene.objects.end());
+    std::vector<PackedTrack> tracks(scene.animation.tracks.size());
+    for (size_t i = 0; i < tracks.size(); ++i) {
+        const SphereTrack& track = scene.animation.tracks[i];
+        spheres[track.sphere] = track.rest;
+        tracks[i] = PackedTrack{ track.sphere, track.first_key, track.key_count, 0, { track.velocity.x, track.velocity.y, track.velocity.z } };
+    }
+    std::vector<PackedKeyframe> keys(scene.animation.keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const SphereKeyframe& key = scene.animation.keys[i];
+        keys[i] = PackedKeyframe{ key.time, { key.center.x, key.center.y, key.center.z }, key.radius };
+    }
+
+    header.material_count = static_cast<uint32_t>(scene.materials.size());
+    header.sphere_count = static_cast<uint32_t>(spheres.size());
+    header.track_count = static_cast<uint32_t>(tracks.size());
+    header.key_count = static_cast<uint32_t>(keys.size());
+    header.materials_offset = sizeof(SceneFileHeader);
+    header.spheres_offset = header.materials_offset + scene.materials.size() * sizeof(Material);
+    header.sphere_materials_offset = header.spheres_offset + spheres.size() * sizeof(Sphere);
+    header.material_ids_offset = align_up(header.sphere_materials_offset + spheres.size() * sizeof(MaterialIndex), alignof(PackedMaterialId));
+    header.strings_offset = header.material_ids_offset + material_ids.size() * sizeof(PackedMaterialId);
+    header.strings_size = strings.size();
+    header.tracks_offset = align_up(header.strings_offset + strings.size(), alignof(PackedTrack));
+    header.keys_offset = header.tracks_offset + tracks.size() * sizeof(PackedTrack);
+
+    size = static_cast<size_t>(header.keys_offset + keys.size() * sizeof(PackedKeyframe));
+    std::vector<uint64_t> buffer((size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    uint8_t* out = reinterpret_cast<uint8_t*>(buffer.data());
+    std::memcpy(out, &header, sizeof(header));
+    if (!scene.materials.empty()) std::memcpy(out + header.materials_offset, scene.materials.data(), scene.materials.size() * sizeof(Material));
+    if (!spheres.empty()) std::memcpy(out + header.spheres_offset, spheres.data(), spheres.size() * sizeof(Sphere));
+    if (!spheres.empty()) std::memcpy(out + header.sphere_materials_offset, scene.object_materials.data(), spheres.size() * sizeof(MaterialIndex));
+    if (!material_ids.empty()) std::memcpy(out + header.material_ids_offset, material_ids.data(), material_ids.size() * sizeof(PackedMaterialId));
+    if (!strings.empty()) std::memcpy(out + header.strings_offset, strings.data(), strings.size());
+    if (!tracks.empty()) std::memcpy(out + header.tracks_offset, tracks.data(), tracks.size() * sizeof(PackedTrack));
+    if (!keys.empty()) std::memcpy(out + header.keys_offset, keys.data(), keys.size() * sizeof(PackedKeyframe));
+    return buffer;
+}
+
+bool write_binary_scene(const std::string& path, const Scene& scene) {
+    size_t size = 0;
+    const std::vector<uint64_t> buffer = encode_binary_scene(scene, size);
+    // Truncating a file that a scene reads in place would fault (SIGBUS) or change its validated
+    // tables; renaming leaves the old file to whoever still maps it.
+    const std::string temporary = path + ".tmp";
+    std::error_code error;
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            log_message("Error: Could not open " + temporary + " for writing\n");
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(size));
+        file.close();
+        if (!file) {
+            log_message("Error: Failed writing " + temporary + "\n");
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        log_message("Error: Could not replace " + path + " (" + error.message() + ")\n");
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+bool load_scene_any(const std::string& path, Scene& scene, bool in_place) {
+    if (is_binary_scene_file(path)) return read_binary_scene(path, scene, in_place);
+    return parse_scene_file(path, scene);
+}
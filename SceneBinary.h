@@ -0,0 +1,180 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "SceneLoader.h"
+
+// Binary scene format (.rmsc). Everything is fixed-size, little-endian and 8-byte aligned so a
+// mapped file can be read in place. Since version 3 the material, sphere and sphere material tables
+// are stored exactly as Scene holds them in memory, and a loaded Scene points straight at them:
+//
+//   SceneFileHeader
+//   Material[material_count]
+//   Sphere[sphere_count]                 (animated spheres at their time-0 pose)
+//   MaterialIndex[sphere_count]          (into the material table)
+//   PackedMaterialId[material_count]
+//   material id characters
+//   PackedTrack[track_count]
+//   PackedKeyframe[key_count]
+//
+// Versions 1 and 2 store PackedMaterial / PackedSphere tables (which carry the ids and material
+// indices) instead of the first four arrays and are copied on load; version 1 has no animation and
+// ends its header before track_count.
+const char SCENE_BINARY_MAGIC[8] = { 'R', 'M', 'S', 'C', 'E', 'N', 'E', '\0' };
+const uint32_t SCENE_BINARY_VERSION = 3;
+const uint32_t SCENE_BINARY_V1_HEADER_SIZE = 88;
+const uint32_t SCENE_BINARY_V2_HEADER_SIZE = 112;
+const char* const SCENE_BINARY_EXTENSION = ".rmsc";
+
+struct SceneFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;   // sizeof(SceneFileHeader) when written; lets readers reject mismatches
+    int32_t max_ray_depth;
+    int32_t samples_per_pixel;
+    double background_color[3];
+    uint32_t material_count;
+    uint32_t sphere_count;
+    uint64_t materials_offset;
+    uint64_t spheres_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint32_t track_count;
+    uint32_t key_count;
+    uint64_t tracks_offset;
+    uint64_t keys_offset;
+    uint64_t sphere_materials_offset; // Version 3
+    uint64_t material_ids_offset;
+};
+
+// Version 3; where each material's id lies in the string block.
+struct PackedMaterialId {
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Versions 1 and 2.
+struct PackedMaterial {
+    double base_color[3];
+    double reflectivity;
+    double roughness;
+    double emission_color[3];
+    uint32_t id_offset;     // Into the string block
+    uint32_t id_length;
+};
+
+// Versions 1 and 2.
+struct PackedSphere {
+    double center[3];
+    double radius;
+    uint32_t material_index; // Into the material table
+    uint32_t reserved;
+};
+
+// See SphereTrack / SphereKeyframe.
+struct PackedTrack {
+    uint32_t sphere;
+    uint32_t first_key;
+    uint32_t key_count;
+    uint32_t reserved;
+    double velocity[3];
+};
+
+struct PackedKeyframe {
+    double time;
+    double center[3];
+    double radius;
+};
+
+static_assert(sizeof(SceneFileHeader) == 128, "SceneFileHeader layout is part of the file format");
+static_assert(sizeof(Material) == 64 && sizeof(Sphere) == 32 && sizeof(MaterialIndex) == 4 && sizeof(PackedMaterialId) == 8,
+    "Material, Sphere and MaterialIndex layouts are part of the file format");
+static_assert(sizeof(PackedMaterial) == 72, "PackedMaterial layout is part of the file format");
+static_assert(sizeof(PackedSphere) == 40, "PackedSphere layout is part of the file format");
+static_assert(sizeof(PackedTrack) == 40 && sizeof(PackedKeyframe) == 40, "PackedTrack and PackedKeyframe layouts are part of the file format");
+
+// Read-only memory mapping of a whole file (mmap / MapViewOfFile).
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    const uint8_t* data() const { return mapped_data; }
+    size_t size() const { return mapped_size; }
+
+private:
+    const uint8_t* mapped_data = nullptr;
+    size_t mapped_size = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
+
+// A validated .rmsc file mapped into memory. The arrays point straight into the mapping, so
+// opening a scene costs one mmap plus a pass over its indices; read_binary_scene keeps it alive for as long
+// as the Scene's tables view it.
+class MappedScene {
+public:
+    bool open(const std::string& path);
+    // Validates a scene that is already in memory (received over the network); `data` must be
+    // 8-byte aligned and outlive the MappedScene. `name` is for error messages.
+    bool open(const uint8_t* data, size_t size, const std::string& name);
+
+    // A copy, as older headers are shorter; the fields they lack read as 0.
+    const SceneFileHeader& header() const { return file_header; }
+    // Version 3: the tables in their in-memory layout.
+    bool in_memory_layout() const { return header().version >= 3; }
+    const Material* material_table() const { return reinterpret_cast<const Material*>(bytes + header().materials_offset); }
+    const Sphere* sphere_table() const { return reinterpret_cast<const Sphere*>(bytes + header().spheres_offset); }
+    const MaterialIndex* sphere_materials() const { return reinterpret_cast<const MaterialIndex*>(bytes + header().sphere_materials_offset); }
+    // Versions 1 and 2.
+    const PackedMaterial* packed_materials() const { return reinterpret_cast<const PackedMaterial*>(bytes + header().materials_offset); }
+    const PackedSphere* packed_spheres() const { return reinterpret_cast<const PackedSphere*>(bytes + header().spheres_offset); }
+    const PackedTrack* tracks() const { return reinterpret_cast<const PackedTrack*>(bytes + header().tracks_offset); }
+    const PackedKeyframe* keys() const { return reinterpret_cast<const PackedKeyframe*>(bytes + header().keys_offset); }
+    uint32_t material_count() const { return header().material_count; }
+    uint32_t sphere_count() const { return header().sphere_count; }
+    uint32_t track_count() const { return header().track_count; }
+    uint32_t key_count() const { return header().key_count; }
+    std::string_view material_id(uint32_t index) const;
+
+private:
+    bool validate(const std::string& name);
+    const PackedMaterialId* material_ids() const { return reinterpret_cast<const PackedMaterialId*>(bytes + header().material_ids_offset); }
+
+    MappedFile file;
+    const uint8_t* bytes = nullptr; // file.data() or the caller's buffer
+    size_t byte_count = 0;
+    SceneFileHeader file_header = {};
+};
+
+// True when `path` starts with the .rmsc magic.
+bool is_binary_scene_file(const std::string& path);
+
+// Fills `scene` (settings, materials, objects, animation) from a .rmsc file. Returns false on I/O or
+// format errors. With `in_place`, the materials, objects and object_materials of a version 3 file
+// are views of the mapping (see SceneArray), so loading allocates nothing per sphere; only the
+// material ids and the animation are copied. The file must then not be truncated or rewritten in
+// place while the scene lives (write_binary_scene replaces files, which is safe). Without, the
+// tables are copied out.
+bool read_binary_scene(const std::string& path, Scene& scene, bool in_place = true);
+// Writes settings, materials, objects and animation of `scene` as .rmsc, to a temporary file that
+// is then renamed over `path`, so scenes still mapping the old file keep its old contents.
+bool write_binary_scene(const std::string& path, const Scene& scene);
+
+// The same in memory: the .rmsc bytes of `scene`, and `scene` filled from them. The buffer is
+// 8-byte aligned for the MappedScene it is read through, and copied from, so it may be reused.
+std::vector<uint64_t> encode_binary_scene(const Scene& scene, size_t& size);
+bool decode_binary_scene(const uint8_t* data, size_t size, Scene& scene, const std::string& name);
+
+// Text or binary, picked from the file's magic; `in_place` as for read_binary_scene.
+bool load_scene_any(const std::string& path, Scene& scene, bool in_place = true);
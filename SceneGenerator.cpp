@@ -0,0 +1,172 @@
+#include "SceneGenerator.h"
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include "Sampler.h"
+
+namespace {
+
+constexpr double CELL_SIZE = 0.5;
+constexpr double MIN_RADIUS = 0.06;
+constexpr double MAX_RADIUS = 0.2;       // Below CELL_SIZE / 2, so neighbours cannot touch
+constexpr double GROUND_RADIUS = 1000.0;
+
+enum class MaterialKind { Diffuse, Mirror, Glossy, Emissive };
+
+uint32_t grid_cells(uint32_t sphere_count) {
+    return static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(std::max<uint32_t>(sphere_count, 1)))));
+}
+
+// Palette entry k gets the kind whose share of the cumulative weights covers (k + 0.5) / count,
+// so every kind ends up with its proportional number of entries.
+MaterialKind material_kind(const SceneGeneratorSettings& settings, uint32_t k) {
+    const double weights[4] = { settings.diffuse_weight, settings.mirror_weight, settings.glossy_weight, settings.emissive_weight };
+    double total = 0.0;
+    for (double w : weights) total += std::max(0.0, w);
+    if (total <= 0.0) return MaterialKind::Diffuse;
+    const double position = (k + 0.5) / settings.material_count * total;
+    double cumulative = 0.0;
+    for (int kind = 0; kind < 4; ++kind) {
+        cumulative += std::max(0.0, weights[kind]);
+        if (position < cumulative) return static_cast<MaterialKind>(kind);
+    }
+    return MaterialKind::Diffuse;
+}
+
+class Uniform {
+public:
+    explicit Uniform(uint32_t seed) : rng(seed, 0x5ce7e) {}
+    double operator()(double lo = 0.0, double hi = 1.0) { return lo + (hi - lo) * unit_double(rng.next_u32()); }
+
+private:
+    Pcg32 rng;
+};
+
+void append_number(std::string& out, double value) {
+    char buffer[32];
+    std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value); // Shortest exact form
+    out.append(buffer, result.ptr);
+}
+
+} // namespace
+
+double generated_scene_extent(const SceneGeneratorSettings& settings) {
+    return grid_cells(settings.sphere_count) * CELL_SIZE;
+}
+
+Scene generate_scene(const SceneGeneratorSettings& settings) {
+    Scene scene;
+    scene.max_ray_depth = settings.max_ray_depth;
+    scene.samples_per_pixel = settings.samples_per_pixel;
+    scene.background_color = Vec3(0.5, 0.6, 0.75);
+    Uniform uniform(settings.seed);
+    Uniform motion(settings.seed ^ 0x6d6f7665u); // Its own stream: animating does not move the layout
+
+    const MaterialIndex ground = scene.add_material("ground", Material(Vec3(0.55, 0.55, 0.5), 0.15, 0.4));
+    const uint32_t palette_size = std::max<uint32_t>(settings.material_count, 1);
+    for (uint32_t k = 0; k < palette_size; ++k) {
+        Vec3 color(uniform(0.1, 0.95), uniform(0.1, 0.95), uniform(0.1, 0.95));
+        switch (material_kind(settings, k)) {
+        case MaterialKind::Diffuse:
+            scene.add_material("diffuse" + std::to_string(k), Material(color));
+            break;
+        case MaterialKind::Mirror:
+            scene.add_material("mirror" + std::to_string(k), Material(color, 0.9, 0.0));
+            break;
+        case MaterialKind::Glossy:
+            scene.add_material("glossy" + std::to_string(k), Material(color, 0.6, settings.roughness));
+            break;
+        case MaterialKind::Emissive:
+            scene.add_material("emissive" + std::to_string(k), Material(color, 0.0, 0.0, color * uniform(2.0, 4.0)));
+            break;
+        }
+    }
+
+    scene.objects.reserve(settings.sphere_count + 1);
+    scene.object_materials.reserve(settings.sphere_count + 1);
+    scene.add_sphere(Sphere(Vec3(0.0, -GROUND_RADIUS, 0.0), GROUND_RADIUS), ground);
+    const uint32_t cells = grid_cells(settings.sphere_count);
+    const double half_extent = cells * CELL_SIZE * 0.5;
+    for (uint32_t i = 0; i < settings.sphere_count; ++i) {
+        const double radius = uniform(MIN_RADIUS, MAX_RADIUS);
+        const double slack = CELL_SIZE * 0.5 - radius;
+        const double x = -half_extent + ((i % cells) + 0.5) * CELL_SIZE + uniform(-slack, slack);
+        const double z = -half_extent + ((i / cells) + 0.5) * CELL_SIZE + uniform(-slack, slack);
+        // Resting on the ground sphere, which curves away from the origin.
+        const double ground_y = std::sqrt(GROUND_RADIUS * GROUND_RADIUS - x * x - z * z) - GROUND_RADIUS;
+        const MaterialIndex material = 1 + std::min(palette_size - 1, static_cast<uint32_t>(uniform() * palette_size));
+        scene.add_sphere(Sphere(Vec3(x, ground_y + radius, z), radius), material);
+        if (settings.animated_fraction > 0.0 && motion() < settings.animated_fraction) {
+            const double angle = motion(0.0, 2.0 * M_PI);
+            const double speed = motion(0.5, 1.0) * settings.speed;
+            SphereTrack track;
+            track.sphere = static_cast<uint32_t>(scene.objects.size() - 1);
+            track.rest = scene.objects.back();
+            track.velocity = Vec3(std::cos(angle) * speed, 0.0, std::sin(angle) * speed);
+            scene.animation.tracks.push_back(track);
+        }
+    }
+    return scene;
+}
+
+bool write_scene_file(const std::string& path, const Scene& scene) {
+    std::string text;
+    text.reserve(64 + scene.materials.size() * 96 + scene.objects.size() * 80);
+    auto field = [&](double value) {
+        text += ';';
+        append_number(text, value);
+    };
+    text += std::to_string(scene.max_ray_depth) + ';' + std::to_string(scene.samples_per_pixel);
+    field(scene.background_color.x);
+    field(scene.background_color.y);
+    field(scene.background_color.z);
+    text += '\n';
+    for (size_t i = 0; i < scene.materials.size(); ++i) {
+        const Material& m = scene.materials[i];
+        text += "M;" + scene.material_ids[i];
+        field(m.base_color.x);
+        field(m.base_color.y);
+        field(m.base_color.z);
+        field(m.reflectivity);
+        field(m.roughness);
+        field(m.emission_color.x);
+        field(m.emission_color.y);
+        field(m.emission_color.z);
+        text += '\n';
+    }
+    const std::vector<SphereTrack>& tracks = scene.animation.tracks;
+    size_t next_track = 0;
+    for (size_t i = 0; i < scene.objects.size(); ++i) {
+        const SphereTrack* track = next_track < tracks.size() && tracks[next_track].sphere == i ? &tracks[next_track++] : nullptr;
+        const Sphere& s = track ? track->rest : scene.objects[i];
+        text += "S;" + scene.material_id_of(i);
+        field(s.center.x);
+        field(s.center.y);
+        field(s.center.z);
+        field(s.radius);
+        if (track && track->key_count == 0) {
+            field(track->velocity.x);
+            field(track->velocity.y);
+            field(track->velocity.z);
+        }
+        text += '\n';
+        for (uint32_t k = 0; track && k < track->key_count; ++k) {
+            const SphereKeyframe& key = scene.animation.keys[track->first_key + k];
+            text += 'K';
+            field(key.time);
+            field(key.center.x);
+            field(key.center.y);
+            field(key.center.z);
+            field(key.radius);
+            text += '\n';
+        }
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        log_message("Error: cannot write " + path + "\n");
+        return false;
+    }
+    file.write(text.data(), static_cast<std::streamsize>(text.size()));
+    return static_cast<bool>(file);
+}
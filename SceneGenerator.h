@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "SceneLoader.h"
+
+// Procedural test scenes for benchmarking. Spheres rest on a large ground sphere, one per cell of
+// a square grid (jittered inside the cell, so they never overlap), with materials drawn from a
+// palette by the given mix. The same settings always give the same scene.
+struct SceneGeneratorSettings {
+    uint32_t sphere_count = 20000;  // Not counting the ground
+    uint32_t material_count = 16;   // Palette size; kinds are assigned round-robin by the mix weights
+    // Relative weights of the material kinds in the palette.
+    double diffuse_weight = 0.5;
+    double mirror_weight = 0.2;
+    double glossy_weight = 0.25;
+    double emissive_weight = 0.05;
+    double roughness = 0.2;         // Of the glossy materials
+    double animated_fraction = 0.0; // Share of the spheres that drift across the ground at a constant velocity
+    double speed = 0.5;             // Their top speed, in scene units per second
+    int max_ray_depth = 6;
+    int samples_per_pixel = 1;
+    uint32_t seed = 1;
+};
+
+// Edge length of the square the generated spheres cover, centred on the origin.
+double generated_scene_extent(const SceneGeneratorSettings& settings);
+
+// Fills settings, materials and objects of a new scene; acceleration structures are not built.
+Scene generate_scene(const SceneGeneratorSettings& settings);
+
+// Writes `scene` in the scene.txt format (parse_scene_file reads it back exactly), animated spheres
+// at rest with their velocities and keyframes. All materials come first, so a sphere whose
+// material ID was redefined gets that ID's last definition.
+bool write_scene_file(const std::string& path, const Scene& scene);
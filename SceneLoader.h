@@ -3,7 +3,20 @@
 #include <sstream>
 #include <vector>
 #include <string>
+#include <map>
 #include <iostream>
+#include <string_view>
+#include <charconv>
+#include <algorithm>
+#include <functional>
+#include "Vec3.h"
+#include "Material.h"
+#include "Sphere.h"
+#include "BVH.h"
+#include "Animation.h"
+#include "Lights.h"
+#include "Log.h"
+#include "SceneArray.h"
 
 struct Scene {
     // Global Rendering Settings
@@ -11,19 +24,85 @@ struct Scene {
     int samples_per_pixel;
     Vec3 background_color;
 
-    // Scene Content
-    std::map<std::string, Material> materials; // Materials stored by ID
-    std::vector<Sphere> objects;               // Scene objects (spheres)
-    // std::vector<Light> lights; // If you add lights back
+    // Scene Content. Rendering reads objects (hot: every shaded hit) and, once per shaded hit,
+    // object_materials and materials; the string IDs are only for loading, saving and diffing.
+    // A binary scene's tables are read in place from the mapped file (see SceneArray).
+    SceneArray<Material> materials;            // Flat material table, indexed by MaterialIndex
+    std::vector<std::string> material_ids;     // Scene-file ID of each material table entry
+    SceneArray<Sphere> objects;                // Sphere geometry
+    SceneArray<MaterialIndex> object_materials; // Material of each object, parallel to objects
+    SceneAnimation animation;                  // Moving objects; objects holds their pose at the last animate_scene()
+    BVH bvh;                                   // Built over objects by build_acceleration(); empty = brute force
+    SphereSoA sphere_soa;                      // SIMD copy of objects for the brute-force path
+    SphereSoAF sphere_soa_f;                   // Same in single precision (Precision::Float)
+    Precision precision = Precision::Double;   // What the acceleration structures were built for; set by build_acceleration()
+    LightList lights;                          // Emissive objects, for light sampling; built with the acceleration structures
 
     // Camera (Optional: can be part of Scene or handled separately)
     // CameraData camera_settings; // You might define a CameraData struct
 
     // Default constructor
     Scene() : max_ray_depth(5), samples_per_pixel(1), background_color(0.2, 0.2, 0.2) {}
+
+    // Appends a table entry. Redefining an ID adds a new entry rather than overwriting the old one,
+    // so spheres defined before the redefinition keep the material they were given.
+    MaterialIndex add_material(std::string id, const Material& material) {
+        materials.push_back(material);
+        material_ids.push_back(std::move(id));
+        return static_cast<MaterialIndex>(materials.size() - 1);
+    }
+    void add_sphere(const Sphere& sphere, MaterialIndex material) {
+        objects.push_back(sphere);
+        object_materials.push_back(material);
+    }
+    const Material& material_of(size_t object_index) const { return materials[object_materials[object_index]]; }
+    const std::string& material_id_of(size_t object_index) const { return material_ids[object_materials[object_index]]; }
+};
+
+// Bytes per sphere held by the render-time scene data, split by how rendering touches them.
+struct SceneFootprint {
+    size_t spheres = 0;
+    double geometry_per_sphere = 0.0;     // Scene::objects
+    double material_refs_per_sphere = 0.0; // Scene::object_materials
+    double acceleration_per_sphere = 0.0; // BVH (nodes, indices, leaf geometry) or SIMD store
+    size_t material_table_bytes = 0;      // Scene::materials, shared by all spheres
 };
 
-std::vector<std::string> split_string(const std::string& s, char delimiter) {
+inline SceneFootprint scene_footprint(const Scene& scene) {
+    SceneFootprint footprint;
+    footprint.spheres = scene.objects.size();
+    footprint.material_table_bytes = scene.materials.size() * sizeof(Material);
+    if (footprint.spheres == 0) return footprint;
+    const double n = static_cast<double>(footprint.spheres);
+    footprint.geometry_per_sphere = sizeof(Sphere);
+    footprint.material_refs_per_sphere = sizeof(MaterialIndex);
+    footprint.acceleration_per_sphere = (scene.bvh.memory_bytes() + scene.sphere_soa.memory_bytes() + scene.sphere_soa_f.memory_bytes()) / n;
+    return footprint;
+}
+
+// (Re)builds the intersection structures and the light list over the current objects. Call after
+// loading or editing Scene::objects. Without a BVH every ray is tested against all spheres with the SIMD kernel.
+// Float kernels index spheres through float lanes, so larger scenes fall back to double.
+inline void build_acceleration(Scene& scene, bool use_bvh = true, Precision precision = Precision::Double) {
+    if (precision == Precision::Float && scene.objects.size() >= FLOAT_KERNEL_MAX_SPHERES) {
+        log_message("Warning: " + std::to_string(scene.objects.size()) + " spheres is too many for float precision, tracing in double\n");
+        precision = Precision::Double;
+    }
+    scene.precision = precision;
+    scene.sphere_soa.clear();
+    scene.sphere_soa_f.clear();
+    if (use_bvh) {
+        scene.bvh.build(scene.objects, precision);
+    }
+    else {
+        scene.bvh.clear();
+        if (precision == Precision::Float) scene.sphere_soa_f.build(scene.objects);
+        else scene.sphere_soa.build(scene.objects);
+    }
+    build_light_list(scene);
+}
+
+inline std::vector<std::string> split_string(const std::string& s, char delimiter) {
     std::vector<std::string> tokens;
     std::string token;
     std::istringstream tokenStream(s);
@@ -33,95 +112,221 @@ std::vector<std::string> split_string(const std::string& s, char delimiter) {
     return tokens;
 }   
 
-Scene load_scene_from_file(const std::string& filename) { // Renamed for clarity
-    Scene loaded_scene; // Create a Scene object to populate
+namespace scene_text {
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+inline std::string_view trim(std::string_view s) {
+    while (!s.empty() && is_space(s.front())) s.remove_prefix(1);
+    while (!s.empty() && is_space(s.back())) s.remove_suffix(1);
+    return s;
+}
+
+// Like std::stod / std::stoi: leading whitespace and '+' are skipped and the longest numeric
+// prefix is used, so trailing comments such as "0 # note" keep parsing the way they always have.
+template <typename T>
+bool parse_number(std::string_view token, T& value) {
+    token = trim(token);
+    if (!token.empty() && token.front() == '+') token.remove_prefix(1);
+    std::from_chars_result result = std::from_chars(token.data(), token.data() + token.size(), value);
+    return result.ec == std::errc();
+}
+
+} // namespace scene_text
+
+// Parses `filename` into `loaded_scene` (settings, materials, objects, animation; acceleration
+// structures are left untouched). Returns false if the file could not be opened or had critical errors.
+// Spheres may carry a velocity after their radius (S;material;x;y;z;r;vx;vy;vz), or be followed by
+// keyframes, K;time;x;y;z[;r], with increasing times after 0; the S line is the pose at time 0.
+// The file is read in one go and tokenized with string_views and std::from_chars, so there are no
+// per-line or per-token allocations.
+inline bool parse_scene_file(const std::string& filename, Scene& loaded_scene) {
+    using scene_text::parse_number;
     bool success = true; // Flag to track parsing success
 
-    std::ifstream file(filename);
+    std::ifstream file(filename, std::ios::binary);
     if (!file.is_open()) {
-        OutputDebugStringA(("Error: Could not open scene file: " + filename + "\n").c_str());
-        // Return a default (or empty) scene on failure, or throw an exception
-        return Scene(); // Returns a default-constructed scene
+        log_message("Error: Could not open scene file: " + filename + "\n");
+        return false;
     }
+    std::string contents;
+    file.seekg(0, std::ios::end);
+    contents.resize(static_cast<size_t>(std::max<std::streamoff>(0, file.tellg())));
+    file.seekg(0, std::ios::beg);
+    file.read(contents.data(), static_cast<std::streamsize>(contents.size()));
+    file.close();
 
-    std::string line;
+    // One reservation up front instead of log2(n) regrowths of a multi-million sphere vector.
+    size_t sphere_lines = 0;
+    for (size_t pos = contents.find("\nS"); pos != std::string::npos; pos = contents.find("\nS", pos + 2)) sphere_lines++;
+    loaded_scene.objects.reserve(sphere_lines + 1);
+    loaded_scene.object_materials.reserve(sphere_lines + 1);
+
+    const size_t MAX_TOKENS = 16;
+    std::string_view tokens[MAX_TOKENS];
+    std::string_view remaining(contents);
     int line_number = 0;
     bool globals_loaded = false;
+    // Load-time side table from material ID to the table entry it currently names.
+    std::map<std::string, MaterialIndex, std::less<>> material_lookup;
+    for (MaterialIndex i = 0; i < loaded_scene.material_ids.size(); ++i) material_lookup[loaded_scene.material_ids[i]] = i;
+    auto last_material = material_lookup.end(); // Consecutive spheres usually share a material
+    bool last_sphere_added = false; // Keyframes attach to the sphere just before them
 
-    while (std::getline(file, line)) {
+    while (!remaining.empty()) {
+        size_t line_end = remaining.find('\n');
+        std::string_view line = scene_text::trim(remaining.substr(0, line_end));
+        remaining.remove_prefix(line_end == std::string_view::npos ? remaining.size() : line_end + 1);
         line_number++;
-        line.erase(0, line.find_first_not_of(" \t\n\r\f\v"));
-        line.erase(line.find_last_not_of(" \t\n\r\f\v") + 1);
 
         if (line.empty() || line[0] == '#') continue;
 
-        std::vector<std::string> tokens = split_string(line, ';');
-        if (tokens.empty()) continue;
+        size_t token_count = 0;
+        while (token_count < MAX_TOKENS && !line.empty()) { // A trailing ';' adds no empty token
+            size_t separator = line.find(';');
+            tokens[token_count++] = line.substr(0, separator);
+            if (separator == std::string_view::npos) break;
+            line.remove_prefix(separator + 1);
+        }
 
-        try {
-            if (!globals_loaded) {
-                if (tokens.size() < 5) {
-                    OutputDebugStringA(("Error: Insufficient global settings on line " + std::to_string(line_number) + "\n").c_str());
-                    success = false; break; // Stop parsing on critical error
-                }
-                loaded_scene.max_ray_depth = std::stoi(tokens[0]);
-                loaded_scene.samples_per_pixel = std::stoi(tokens[1]);
-                loaded_scene.background_color.x = std::stod(tokens[2]);
-                loaded_scene.background_color.y = std::stod(tokens[3]);
-                loaded_scene.background_color.z = std::stod(tokens[4]);
-                globals_loaded = true;
-                continue;
-            }
+        bool numbers_ok = true;
+        auto number = [&](size_t index, auto& value) {
+            if (!parse_number(tokens[index], value)) numbers_ok = false;
+        };
 
-            char type = tokens[0][0];
-            if (type == 'M') {
-                if (tokens.size() < 7) { /* ... error handling ... */ continue; }
-                std::string id = tokens[1];
-                Vec3 color(std::stod(tokens[2]), std::stod(tokens[3]), std::stod(tokens[4]));
-                double reflectivity = std::stod(tokens[5]);
-                double roughness = std::stod(tokens[6]);
-                Vec3 emission(0, 0, 0);
-                if (tokens.size() >= 10) {
-                    emission.x = std::stod(tokens[7]);
-                    emission.y = std::stod(tokens[8]);
-                    emission.z = std::stod(tokens[9]);
+        char type = tokens[0].empty() ? '\0' : tokens[0][0];
+        if (!globals_loaded) {
+            if (token_count < 5) {
+                log_message("Error: Insufficient global settings on line " + std::to_string(line_number) + "\n");
+                success = false; break; // Stop parsing on critical error
+            }
+            number(0, loaded_scene.max_ray_depth);
+            number(1, loaded_scene.samples_per_pixel);
+            number(2, loaded_scene.background_color.x);
+            number(3, loaded_scene.background_color.y);
+            number(4, loaded_scene.background_color.z);
+            globals_loaded = true;
+        }
+        else if (type == 'M') {
+            if (token_count < 7) continue;
+            Vec3 color;
+            double reflectivity = 0.0;
+            double roughness = 0.0;
+            Vec3 emission(0, 0, 0);
+            number(2, color.x);
+            number(3, color.y);
+            number(4, color.z);
+            number(5, reflectivity);
+            number(6, roughness);
+            if (token_count >= 10) {
+                number(7, emission.x);
+                number(8, emission.y);
+                number(9, emission.z);
+            }
+            if (numbers_ok) {
+                std::string id(tokens[1]);
+                material_lookup.insert_or_assign(id, loaded_scene.add_material(id, Material(color, reflectivity, roughness, emission)));
+                last_material = material_lookup.end();
+            }
+        }
+        else if (type == 'S') {
+            last_sphere_added = false;
+            if (token_count < 6) continue;
+            Vec3 center;
+            double radius = 0.0;
+            Vec3 velocity;
+            number(2, center.x);
+            number(3, center.y);
+            number(4, center.z);
+            number(5, radius);
+            if (token_count >= 9) {
+                number(6, velocity.x);
+                number(7, velocity.y);
+                number(8, velocity.z);
+            }
+            if (numbers_ok) {
+                std::string_view mat_id_ref = tokens[1];
+                if (last_material == material_lookup.end() || last_material->first != mat_id_ref) {
+                    last_material = material_lookup.find(mat_id_ref);
+                }
+                if (last_material != material_lookup.end()) {
+                    loaded_scene.add_sphere(Sphere(center, radius), last_material->second);
+                    last_sphere_added = true;
+                    if (velocity.x != 0.0 || velocity.y != 0.0 || velocity.z != 0.0) {
+                        SphereTrack track;
+                        track.sphere = static_cast<uint32_t>(loaded_scene.objects.size() - 1);
+                        track.rest = loaded_scene.objects.back();
+                        track.velocity = velocity;
+                        loaded_scene.animation.tracks.push_back(track);
+                    }
+                }
+                else {
+                    log_message("Error: Material ID '" + std::string(mat_id_ref) + "' not found for sphere on line " + std::to_string(line_number) + "\n");
                 }
-                loaded_scene.materials[id] = Material(id, color, reflectivity, roughness, emission);
             }
-            else if (type == 'S') {
-                if (tokens.size() < 6) { /* ... error handling ... */ continue; }
-                std::string mat_id_ref = tokens[1];
-                Vec3 center(std::stod(tokens[2]), std::stod(tokens[3]), std::stod(tokens[4]));
-                double radius = std::stod(tokens[5]);
-
-                auto it = loaded_scene.materials.find(mat_id_ref);
-                if (it != loaded_scene.materials.end()) {
-                    loaded_scene.objects.emplace_back(Sphere(center, radius, it->second /* a copy of the material */));
+        }
+        else if (type == 'K') {
+            if (token_count < 5) continue;
+            SphereKeyframe key;
+            number(1, key.time);
+            number(2, key.center.x);
+            number(3, key.center.y);
+            number(4, key.center.z);
+            if (numbers_ok && last_sphere_added) {
+                const uint32_t sphere = static_cast<uint32_t>(loaded_scene.objects.size() - 1);
+                std::vector<SphereTrack>& tracks = loaded_scene.animation.tracks;
+                std::vector<SphereKeyframe>& keys = loaded_scene.animation.keys;
+                const bool has_track = !tracks.empty() && tracks.back().sphere == sphere;
+                const bool has_keys = has_track && tracks.back().key_count > 0;
+                key.radius = has_keys ? keys.back().radius : loaded_scene.objects.back().radius;
+                if (token_count >= 6) number(5, key.radius);
+                if (has_track && !has_keys) {
+                    log_message("Error: Keyframe for a sphere with a velocity on line " + std::to_string(line_number) + "\n");
+                }
+                else if (key.time <= (has_keys ? keys.back().time : 0.0)) {
+                    log_message("Error: Keyframe time not after the previous one on line " + std::to_string(line_number) + "\n");
                 }
                 else {
-                    OutputDebugStringA(("Error: Material ID '" + mat_id_ref + "' not found for sphere on line " + std::to_string(line_number) + "\n").c_str());
-                    // Optionally set success = false; or skip this sphere
+                    if (!has_track) {
+                        SphereTrack track;
+                        track.sphere = sphere;
+                        track.first_key = static_cast<uint32_t>(keys.size());
+                        track.rest = loaded_scene.objects.back();
+                        tracks.push_back(track);
+                    }
+                    keys.push_back(key);
+                    tracks.back().key_count++;
                 }
             }
-            else {
-                OutputDebugStringA(("Warning: Unknown object type '" + std::string(1, type) + "' on line " + std::to_string(line_number) + "\n").c_str());
+            else if (numbers_ok) {
+                log_message("Error: Keyframe without a sphere before it on line " + std::to_string(line_number) + "\n");
             }
         }
-        catch (const std::exception& e) { // Catch std::exception for broader coverage
-            OutputDebugStringA(("Error parsing line " + std::to_string(line_number) + ": " + e.what() + "\n").c_str());
+        else {
+            log_message("Warning: Unknown object type '" + std::string(1, type) + "' on line " + std::to_string(line_number) + "\n");
+        }
+
+        if (!numbers_ok) {
+            log_message("Error parsing line " + std::to_string(line_number) + ": invalid number\n");
             success = false; // Potentially stop parsing or just log and continue
         }
     }
-    file.close();
 
     if (!globals_loaded && line_number > 0 && success) { // only an error if parsing was otherwise ok
-        OutputDebugStringA("Error: Global settings not found or no valid lines in scene file.\n");
+        log_message("Error: Global settings not found or no valid lines in scene file.\n");
         success = false;
     }
 
-    if (!success) {
+    return success;
+}
+
+inline Scene load_scene_from_file(const std::string& filename) { // Renamed for clarity
+    Scene loaded_scene; // Create a Scene object to populate
+    if (!parse_scene_file(filename, loaded_scene)) {
         // If critical errors occurred, you might want to return a clearly invalid/default scene
-        OutputDebugStringA("Scene loading finished with errors. Returning default scene.\n");
+        log_message("Scene loading finished with errors. Returning default scene.\n");
         return Scene(); // Return default scene
     }
     return loaded_scene;
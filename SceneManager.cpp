@@ -0,0 +1,214 @@
+#include "SceneManager.h"
+#include "SceneBinary.h"
+#include <chrono>
+#include <map>
+#include <string_view>
+#include <system_error>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace {
+
+bool same_vec(const Vec3& a, const Vec3& b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+bool same_material(const Material& a, const Material& b) {
+    return same_vec(a.base_color, b.base_color) && a.reflectivity == b.reflectivity &&
+        a.roughness == b.roughness && same_vec(a.emission_color, b.emission_color);
+}
+
+// The material each ID finally names (a redefinition wins, as it does for later spheres).
+std::map<std::string_view, const Material*> materials_by_id(const Scene& scene) {
+    std::map<std::string_view, const Material*> by_id;
+    for (size_t i = 0; i < scene.materials.size(); ++i) by_id[scene.material_ids[i]] = &scene.materials[i];
+    return by_id;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+SceneManager::SceneManager(const std::string& path, bool use_bvh_, Precision precision_)
+    : file_path(path), use_bvh(use_bvh_), precision(precision_) {
+    std::filesystem::path fs_path(path);
+    file_name = fs_path.filename().string();
+#ifdef __linux__
+    std::string directory = fs_path.has_parent_path() ? fs_path.parent_path().string() : std::string(".");
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd >= 0 && inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        log_message("Warning: cannot watch " + directory + ", falling back to polling the file's modification time\n");
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+#endif
+    build_acceleration(current, use_bvh, precision);
+    file_changed(); // Prime the modification time / drain the watch before the initial load
+    reload();
+}
+
+SceneManager::~SceneManager() {
+#ifdef __linux__
+    if (inotify_fd >= 0) close(inotify_fd);
+#endif
+}
+
+bool SceneManager::file_changed() {
+#ifdef __linux__
+    if (inotify_fd >= 0) {
+        bool changed = false;
+        alignas(inotify_event) char buffer[4096];
+        while (true) {
+            ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+            if (length <= 0) break; // EAGAIN: no more queued events
+            for (char* p = buffer; p < buffer + length;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+                if ((event->mask & IN_Q_OVERFLOW) || (event->len > 0 && file_name == event->name)) {
+                    changed = true;
+                }
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+        return changed;
+    }
+#endif
+    std::error_code ec;
+    std::filesystem::file_time_type write_time = std::filesystem::last_write_time(file_path, ec);
+    if (ec) return false;
+    std::uintmax_t size = std::filesystem::file_size(file_path, ec);
+    if (ec) return false;
+    if (write_time == last_write_time && size == last_file_size) return false;
+    last_write_time = write_time;
+    last_file_size = size;
+    return true;
+}
+
+SceneUpdate SceneManager::poll() {
+    if (!prepare()) return SceneUpdate();
+    return apply_pending();
+}
+
+SceneUpdate SceneManager::reload() {
+    if (!parse_pending()) return SceneUpdate();
+    return apply_pending();
+}
+
+bool SceneManager::prepare() {
+    if (has_pending) return true;
+    return file_changed() && parse_pending();
+}
+
+bool SceneManager::parse_pending() {
+    auto parse_start = std::chrono::steady_clock::now();
+    pending = Scene();
+    // Copied rather than mapped: this file is expected to change under us, and a writer that
+    // rewrites it in place would pull a mapped scene's tables away mid-frame.
+    if (!load_scene_any(file_path, pending, false)) {
+        log_message("Scene reload failed, keeping the previous scene\n");
+        has_pending = false;
+        return false;
+    }
+    pending_parse_ms = elapsed_ms(parse_start);
+    has_pending = true;
+    return true;
+}
+
+SceneUpdate SceneManager::apply_pending() {
+    auto apply_start = std::chrono::steady_clock::now();
+    SceneUpdate update = apply(pending);
+    update.parse_ms = pending_parse_ms;
+    update.apply_ms = elapsed_ms(apply_start);
+    pending = Scene();
+    has_pending = false;
+    if (update.scene_changed()) {
+        scene_version++;
+    }
+    return update;
+}
+
+AnimationUpdate SceneManager::animate(double time, const ParallelFor& parallel, const AnimationSettings& settings) {
+    if (current.animation.empty() || time == current.animation.time) return AnimationUpdate();
+    return animate_scene(current, time, settings, parallel);
+}
+
+SceneUpdate SceneManager::apply(Scene& fresh) {
+    SceneUpdate update;
+    update.reloaded = true;
+
+    if (fresh.max_ray_depth != current.max_ray_depth || fresh.samples_per_pixel != current.samples_per_pixel ||
+        !same_vec(fresh.background_color, current.background_color)) {
+        current.max_ray_depth = fresh.max_ray_depth;
+        current.samples_per_pixel = fresh.samples_per_pixel;
+        current.background_color = fresh.background_color;
+        update.settings_changed = true;
+    }
+
+    const auto current_by_id = materials_by_id(current);
+    const auto fresh_by_id = materials_by_id(fresh);
+    for (const auto& [id, material] : fresh_by_id) {
+        auto it = current_by_id.find(id);
+        if (it == current_by_id.end() || !same_material(*it->second, *material)) update.materials_changed++;
+    }
+    for (const auto& [id, material] : current_by_id) {
+        if (fresh_by_id.find(id) == fresh_by_id.end()) update.materials_changed++;
+    }
+
+    // Spheres are matched by their position in the file. Edits in place keep the acceleration
+    // structures' layout; inserting or deleting a line shifts everything after it, so that is
+    // treated as a new sphere set, and so is any edit to the animation (which holds the animated
+    // spheres' rest poses). Otherwise animated spheres keep their current pose.
+    std::vector<uint32_t> moved;
+    update.animation_changed = !same_animation(fresh.animation, current.animation);
+    if (fresh.objects.size() != current.objects.size() || update.animation_changed) {
+        update.topology_changed = fresh.objects.size() != current.objects.size();
+        const double time = current.animation.time;
+        current.objects = std::move(fresh.objects);
+        current.animation = std::move(fresh.animation);
+        pose_scene(current, time);
+    }
+    else {
+        const std::vector<SphereTrack>& tracks = current.animation.tracks;
+        size_t next_track = 0;
+        for (size_t i = 0; i < current.objects.size(); ++i) {
+            const Sphere& sphere = current.objects[i];
+            const Sphere& edited = fresh.objects[i];
+            const bool animated = next_track < tracks.size() && tracks[next_track].sphere == i;
+            if (animated) next_track++;
+            bool geometry_changed = !animated && (!same_vec(sphere.center, edited.center) || sphere.radius != edited.radius);
+            if (geometry_changed) {
+                current.objects.edit(i) = edited;
+                moved.push_back(static_cast<uint32_t>(i));
+            }
+            bool restyled = current.material_id_of(i) != fresh.material_id_of(i) ||
+                !same_material(current.material_of(i), fresh.material_of(i));
+            if (restyled && !geometry_changed) update.spheres_restyled++;
+        }
+    }
+    // The material tables are small and indices may have shifted, so they are always taken over whole.
+    current.materials = std::move(fresh.materials);
+    current.material_ids = std::move(fresh.material_ids);
+    current.object_materials = std::move(fresh.object_materials);
+    update.spheres_moved = static_cast<uint32_t>(moved.size());
+
+    // Materials are looked up through Scene::object_materials at shading time, so only geometry edits
+    // touch the acceleration structures. The brute-force SIMD store is indexed like objects and
+    // can be patched; the BVH has to be rebuilt.
+    if (update.topology_changed || update.animation_changed || (use_bvh && !moved.empty())) {
+        build_acceleration(current, use_bvh, precision);
+        update.acceleration_rebuilt = true;
+    }
+    else {
+        for (uint32_t index : moved) {
+            if (current.precision == Precision::Float) current.sphere_soa_f.update(index, current.objects[index]);
+            else current.sphere_soa.update(index, current.objects[index]);
+        }
+        build_light_list(current); // Emission may have been restyled, or a light resized
+    }
+    return update;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+#include "SceneLoader.h"
+
+// What the last SceneManager::poll() changed.
+struct SceneUpdate {
+    bool reloaded = false;             // The file changed on disk and was parsed successfully
+    bool settings_changed = false;     // Ray depth, samples per pixel or background
+    uint32_t materials_changed = 0;    // Materials added, removed or edited in the material table
+    uint32_t spheres_moved = 0;        // Center or radius edited in place
+    uint32_t spheres_restyled = 0;     // Only the material edited in place
+    bool topology_changed = false;     // Spheres added or removed
+    bool animation_changed = false;    // Velocities or keyframes edited, added or removed
+    bool acceleration_rebuilt = false; // BVH / SIMD store rebuilt from scratch
+    double parse_ms = 0.0;
+    double apply_ms = 0.0;
+
+    bool scene_changed() const {
+        return settings_changed || materials_changed > 0 || spheres_moved > 0 || spheres_restyled > 0 || topology_changed ||
+            animation_changed;
+    }
+};
+
+// Owns the live scene and keeps it in sync with its file. poll() is meant to be called once per
+// frame: it costs one inotify read (Linux) or one stat() when nothing changed. When the file did
+// change it is re-parsed and diffed against the current scene, and only the edited parts are
+// applied: settings are patched in place, the (small) material tables are swapped, moved spheres
+// are patched into the SIMD store, and the BVH is rebuilt only when geometry actually changed.
+// A file that fails to parse (e.g. caught half-written by an editor) leaves the current scene
+// untouched.
+class SceneManager {
+public:
+    explicit SceneManager(const std::string& path, bool use_bvh = true, Precision precision = Precision::Double);
+    ~SceneManager();
+
+    SceneManager(const SceneManager&) = delete;
+    SceneManager& operator=(const SceneManager&) = delete;
+
+    // Must not run while a frame is rendering the scene.
+    SceneUpdate poll();
+    // Re-parses and diffs regardless of change notifications.
+    SceneUpdate reload();
+    // The part of poll() that leaves the current scene alone, so a pipelined frame loop can run it
+    // while a frame renders: checks the file and parses it if it changed. The next poll() applies
+    // the parsed scene instead of reading the file again. True when a parsed scene is waiting.
+    bool prepare();
+    // Poses the animated spheres `time` seconds in and refits the acceleration structures to them
+    // (animate_scene); nothing to do when the scene has no animation or the time has not changed.
+    // Reloads keep the scene at this time. Must not run while a frame is rendering the scene.
+    AnimationUpdate animate(double time, const ParallelFor& parallel = nullptr,
+        const AnimationSettings& settings = AnimationSettings());
+    double animation_time() const { return current.animation.time; }
+
+    const Scene& scene() const { return current; }
+    // For settings overrides (e.g. a command-line spp); the next reload diffs against the tweaked values.
+    Scene& scene() { return current; }
+    // Bumped every time poll()/reload() changes the scene; lets callers drop cached results.
+    uint64_t version() const { return scene_version; }
+    const std::string& path() const { return file_path; }
+
+private:
+    bool file_changed();
+    // Parses the file into `pending`; false (keeping the current scene) when that fails.
+    bool parse_pending();
+    SceneUpdate apply_pending();
+    SceneUpdate apply(Scene& fresh);
+
+    std::string file_path;
+    std::string file_name; // file_path without its directory, matched against inotify events
+    bool use_bvh;
+    Precision precision; // Requested; Scene::precision holds what was actually built
+    Scene current;
+    uint64_t scene_version = 0; // Not bumped by animate(): the scene file's content is what it names
+    Scene pending;               // Parsed by prepare(), applied by the next poll()
+    bool has_pending = false;
+    double pending_parse_ms = 0.0;
+
+    // Change detection: inotify on the file's directory where available (editors often replace the
+    // file by rename, which a watch on the file itself would miss), modification time otherwise.
+    int inotify_fd = -1;
+    std::filesystem::file_time_type last_write_time{};
+    std::uintmax_t last_file_size = 0;
+};
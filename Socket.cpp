@@ -0,0 +1,127 @@
+#include "Socket.h"
+#include <algorithm>
+#include "Log.h"
+
+bool sockets_ready() {
+#ifdef _WIN32
+    static const bool started = [] {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    if (!started) log_message("Error: WSAStartup failed\n");
+    return started;
+#else
+    static const bool ignored = [] {
+        signal(SIGPIPE, SIG_IGN);
+        return true;
+    }();
+    return ignored;
+#endif
+}
+
+void set_nonblocking(intptr_t s, bool nonblocking) {
+#ifdef _WIN32
+    u_long mode = nonblocking ? 1 : 0;
+    ioctlsocket(native(s), FIONBIO, &mode);
+#else
+    const int flags = fcntl(native(s), F_GETFL, 0);
+    fcntl(native(s), F_SETFL, nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+#endif
+}
+
+void set_nodelay(intptr_t s) {
+    int on = 1;
+    setsockopt(native(s), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+}
+
+long send_some(intptr_t s, const uint8_t* data, size_t size) {
+    const int chunk = static_cast<int>(std::min<size_t>(size, 1 << 30));
+    return static_cast<long>(::send(native(s), reinterpret_cast<const char*>(data), chunk, 0));
+}
+
+long recv_some(intptr_t s, uint8_t* data, size_t size) {
+    const int chunk = static_cast<int>(std::min<size_t>(size, 1 << 30));
+    return static_cast<long>(::recv(native(s), reinterpret_cast<char*>(data), chunk, 0));
+}
+
+bool send_all(intptr_t s, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        const long sent = send_some(s, data, size);
+        if (sent <= 0) return false;
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+bool recv_all(intptr_t s, uint8_t* data, size_t size) {
+    while (size > 0) {
+        const long received = recv_some(s, data, size);
+        if (received <= 0) return false;
+        data += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+intptr_t open_listener(const std::string& host, int port, int& bound_port, const char* who) {
+    if (!sockets_ready()) return NO_SOCKET;
+    intptr_t listener = NO_SOCKET;
+    auto fail = [&](const char* what) {
+        log_message(std::string("Error: ") + who + " " + what + " failed on " + host + ":" + std::to_string(port) + "\n");
+        if (listener != NO_SOCKET) close_socket(listener);
+        return NO_SOCKET;
+    };
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) return fail("inet_pton()");
+    listener = static_cast<intptr_t>(::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+    if (listener == NO_SOCKET) return fail("socket()");
+    int on = 1;
+    setsockopt(native(listener), SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+    if (::bind(native(listener), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) return fail("bind()");
+    if (::listen(native(listener), 64) != 0) return fail("listen()");
+    socklen_t length = sizeof(address);
+    if (getsockname(native(listener), reinterpret_cast<sockaddr*>(&address), &length) != 0) return fail("getsockname()");
+    bound_port = ntohs(address.sin_port);
+    set_nonblocking(listener, true);
+    return listener;
+}
+
+intptr_t accept_connection(intptr_t listener, std::string& peer) {
+    sockaddr_in address = {};
+    socklen_t length = sizeof(address);
+    const intptr_t s = static_cast<intptr_t>(::accept(native(listener), reinterpret_cast<sockaddr*>(&address), &length));
+    if (s == NO_SOCKET) return NO_SOCKET; // Would block, or a connection that died before it was accepted
+    char host[INET_ADDRSTRLEN] = "?";
+    inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+    peer = std::string(host) + ":" + std::to_string(ntohs(address.sin_port));
+    return s;
+}
+
+intptr_t connect_to(const std::string& host, int port) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* results = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &results) != 0) return NO_SOCKET;
+    intptr_t s = NO_SOCKET;
+    for (addrinfo* a = results; a && s == NO_SOCKET; a = a->ai_next) {
+        s = static_cast<intptr_t>(::socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+        if (s == NO_SOCKET) continue;
+        if (::connect(native(s), a->ai_addr, static_cast<socklen_t>(a->ai_addrlen)) != 0) {
+            close_socket(s);
+            s = NO_SOCKET;
+        }
+    }
+    freeaddrinfo(results);
+    return s;
+}
+
+bool has_input(intptr_t s) {
+    PollEntry entry = {};
+    entry.fd = native(s);
+    entry.events = POLLIN;
+    return poll_sockets(&entry, 1, 0) > 0;
+}
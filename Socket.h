@@ -0,0 +1,67 @@
+#pragma once
+// Thin portable layer over BSD sockets and Winsock for the TCP parts of the renderer (distributed
+// rendering, the job server). Only included by .cpp files: it pulls in the platform headers.
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Socket handles travel as intptr_t (SOCKET is pointer-sized on Windows), -1 when closed.
+const intptr_t NO_SOCKET = -1;
+
+#ifdef _WIN32
+using PollEntry = WSAPOLLFD;
+inline SOCKET native(intptr_t s) { return static_cast<SOCKET>(s); }
+inline int poll_sockets(PollEntry* entries, size_t count, int timeout_ms) { return WSAPoll(entries, static_cast<ULONG>(count), timeout_ms); }
+inline bool would_block() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+inline void close_socket(intptr_t s) { closesocket(native(s)); }
+#else
+using PollEntry = pollfd;
+inline int native(intptr_t s) { return static_cast<int>(s); }
+inline int poll_sockets(PollEntry* entries, size_t count, int timeout_ms) { return ::poll(entries, static_cast<nfds_t>(count), timeout_ms); }
+inline bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+inline void close_socket(intptr_t s) { ::close(native(s)); }
+#endif
+
+// WSAStartup on Windows; elsewhere a dead peer must fail send() instead of raising SIGPIPE.
+bool sockets_ready();
+void set_nonblocking(intptr_t s, bool nonblocking);
+// Small messages that are waited on; Nagle would hold them back.
+void set_nodelay(intptr_t s);
+
+// Bytes sent or received, 0 when the peer closed (recv only), -1 on errors including would-block.
+long send_some(intptr_t s, const uint8_t* data, size_t size);
+long recv_some(intptr_t s, uint8_t* data, size_t size);
+// Blocking; false when the connection fails or closes first.
+bool send_all(intptr_t s, const uint8_t* data, size_t size);
+bool recv_all(intptr_t s, uint8_t* data, size_t size);
+
+// Nonblocking listening socket on the IPv4 `address` ("127.0.0.1": this machine only, "0.0.0.0":
+// every interface); port 0 picks a free one, which goes to bound_port. Logs (naming
+// `who`) and returns NO_SOCKET on failure.
+intptr_t open_listener(const std::string& address, int port, int& bound_port, const char* who);
+// Next pending connection on a nonblocking listener, NO_SOCKET when there is none; `peer` gets
+// its host:port.
+intptr_t accept_connection(intptr_t listener, std::string& peer);
+// Blocking connect; NO_SOCKET when no address of the host accepts.
+intptr_t connect_to(const std::string& host, int port);
+// Whether a read would not block.
+bool has_input(intptr_t s);
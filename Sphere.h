@@ -4,8 +4,12 @@
 #include "Ray.h"
 #include <cstdint> // For uint32_t
 #include <algorithm> // For std::clamp
-#include "Material.h"
-#include <random>    // For random number generation
+#include <string>
+#include <limits>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 
 struct SphereData { // Using a temporary struct for loading
     Vec3 center;
@@ -17,109 +21,89 @@ struct SphereData { // Using a temporary struct for loading
     }
 };
 
-// Helper function to generate a random unit vector in a hemisphere around a normal
-// This is a simple cosine-weighted hemisphere sampling.
-// A more uniform random point in a sphere, then normalized and checked if in hemisphere,
-// could also work for a very basic approach.
-inline Vec3 random_in_hemisphere(const Vec3& normal, std::mt19937& rng) {
-    std::uniform_real_distribution<double> dist01(0.0, 1.0);
-    while (true) {
-        // Generate a random point in a unit cube
-        double x = dist01(rng) * 2.0 - 1.0;
-        double y = dist01(rng) * 2.0 - 1.0;
-        double z = dist01(rng) * 2.0 - 1.0;
-        Vec3 p(x, y, z);
-        if (p.length_squared() >= 1.0) continue; // Reject points outside unit sphere
-        p = p.normalize();
-        if (Vec3::dot(p, normal) > 0.0) { // Ensure it's in the hemisphere defined by the normal
-            return p;
-        }
-        // Optional: could also return -p if it's in the other hemisphere,
-        // but for reflection, we want it in the normal's hemisphere.
-        // This simple rejection sampling works but isn't the most efficient for perfect cosine weighting.
-    }
+// Hemisphere directions are built from two uniforms in [0, 1) by inverting their CDFs instead of a
+// rejection loop, so every call costs the same and consumes exactly the sampler dimensions it is given.
+
+// Uniform over the hemisphere around `normal`: a uniform point on the sphere, mirrored into it.
+inline Vec3 random_in_hemisphere(const Vec3& normal, double u1, double u2) {
+    double z = 1.0 - 2.0 * u1;
+    double r = std::sqrt(std::max(0.0, 1.0 - z * z));
+    double phi = 2.0 * M_PI * u2;
+    Vec3 p(r * std::cos(phi), r * std::sin(phi), z);
+    return Vec3::dot(p, normal) >= 0.0 ? p : p * -1.0;
 }
-// A more common (and often better for BRDFs) cosine-weighted hemisphere sampling:
-inline Vec3 random_cosine_direction(std::mt19937& rng) {
-    std::uniform_real_distribution<double> dist01(0.0, 1.0);
-    double r1 = dist01(rng);
-    double r2 = dist01(rng);
-    double z = std::sqrt(1.0 - r2);
-    double phi = 2.0 * M_PI * r1;
-    double x = std::cos(phi) * std::sqrt(r2);
-    double y = std::sin(phi) * std::sqrt(r2);
-    return Vec3(x, y, z);
+
+// Cosine-weighted hemisphere sampling around +z (the usual choice for BRDFs).
+template <typename T = double>
+Vec3T<T> random_cosine_direction(double u1, double u2) {
+    T r1 = static_cast<T>(u1);
+    T r2 = static_cast<T>(u2);
+    T z = std::sqrt(T(1) - r2);
+    T phi = T(2.0 * M_PI) * r1;
+    T x = std::cos(phi) * std::sqrt(r2);
+    T y = std::sin(phi) * std::sqrt(r2);
+    return Vec3T<T>(x, y, z);
 }
 
 // Function to create an orthonormal basis (ONB) from a normal vector
-inline void create_onb(const Vec3& normal, Vec3& tangent, Vec3& bitangent) {
+template <typename T>
+void create_onb(const Vec3T<T>& normal, Vec3T<T>& tangent, Vec3T<T>& bitangent) {
     if (std::abs(normal.x) > std::abs(normal.y)) {
-        tangent = Vec3(-normal.z, 0, normal.x) / std::sqrt(normal.x * normal.x + normal.z * normal.z);
+        tangent = Vec3T<T>(-normal.z, 0, normal.x) / std::sqrt(normal.x * normal.x + normal.z * normal.z);
     }
     else {
-        tangent = Vec3(0, normal.z, -normal.y) / std::sqrt(normal.y * normal.y + normal.z * normal.z);
+        tangent = Vec3T<T>(0, normal.z, -normal.y) / std::sqrt(normal.y * normal.y + normal.z * normal.z);
     }
-    bitangent = Vec3::cross(normal, tangent);
+    bitangent = Vec3T<T>::cross(normal, tangent);
 }
 
-struct Sphere {
-    Vec3 center;
-    double radius;
-    Material material;
+// Scene::objects is always SphereT<double>; the single-precision path only converts the geometry
+// it intersects (see SphereSoAT), so this template is mostly for code shared between the two.
+// Geometry only (32 bytes in double): the material index is kept apart in Scene::object_materials,
+// since only shading reads it.
+template <typename T>
+struct SphereT {
+    Vec3T<T> center;
+    T radius;
 
-    Sphere(const Vec3& c, double r, const Material& mat)
-        : center(c), radius(r), material(mat) {
+    SphereT(const Vec3T<T>& c, T r)
+        : center(c), radius(r) {
     }
 
-    bool intersect(const Ray& ray, double& t_out, Vec3& hit_point_out, Vec3& normal_at_hit_out) const {
-        Vec3 oc = ray.origin - center; // Vector from sphere center to ray origin
-
-        // These coefficients are for the quadratic equation: a*t^2 + b*t + c = 0
-        // where t is the distance along the ray.
-        // a = ray.direction . ray.direction (dot product)
-        // b = 2 * (ray.origin - sphere.center) . ray.direction
-        // c = (ray.origin - sphere.center) . (ray.origin - sphere.center) - sphere.radius^2
-
-        double a = Vec3::dot(ray.direction, ray.direction); // Should be 1.0 if ray.direction is normalized,
-        // but calculating it makes it robust even if not.
-        double b = 2.0 * Vec3::dot(oc, ray.direction);
-        double c = Vec3::dot(oc, oc) - radius * radius;
-
-        double discriminant = b * b - 4.0 * a * c;
-
-        if (discriminant < 0.0) {
-            return false; // No real roots, so the ray misses the sphere
+    // Distance-only test used by the acceleration structures: nearest root in (t_min, t_max).
+    // Hit point and normal are left to the caller so they are only computed for the final hit.
+    bool hit_distance(const RayT<T>& ray, T t_min, T t_max, T& t_out) const {
+        Vec3T<T> oc = ray.origin - center;
+        T a = Vec3T<T>::dot(ray.direction, ray.direction);
+        T half_b = Vec3T<T>::dot(oc, ray.direction);
+        T c = Vec3T<T>::dot(oc, oc) - radius * radius;
+        T discriminant = half_b * half_b - a * c;
+        if (discriminant < T(0)) {
+            return false;
         }
-        else {
-            // Calculate the two potential intersection distances (t values)
-            double sqrt_discriminant = std::sqrt(discriminant);
-            double t0 = (-b - sqrt_discriminant) / (2.0 * a);
-            double t1 = (-b + sqrt_discriminant) / (2.0 * a);
-
-            // We need the smallest positive t value, as that's the closest intersection
-            // in front of the ray's origin.
-            // Using a small epsilon (t_min) to avoid self-intersections or hits that are too close.
-            const double intersection_t_min = 1e-4; // Minimum distance for a valid hit
-
-            double t_hit = -1.0; // Sentinel for no valid hit found yet
-
-            if (t0 > intersection_t_min) { // If t0 is a valid hit in front
-                t_hit = t0;
-            }
-            // If t0 was not valid or t1 is closer (and also valid)
-            if (t1 > intersection_t_min && (t_hit < 0.0 || t1 < t_hit)) {
-                t_hit = t1;
+        T sqrt_discriminant = std::sqrt(discriminant);
+        T t_hit = (-half_b - sqrt_discriminant) / a;
+        if (t_hit <= t_min || t_hit >= t_max) {
+            t_hit = (-half_b + sqrt_discriminant) / a;
+            if (t_hit <= t_min || t_hit >= t_max) {
+                return false;
             }
+        }
+        t_out = t_hit;
+        return true;
+    }
 
-            if (t_hit > 0.0) { // If a valid t_hit was found
-                t_out = t_hit;
-                hit_point_out = ray.origin + ray.direction * t_hit;
-                normal_at_hit_out = (hit_point_out - center).normalize();
-                return true;
-            }
-            else {
-                return false; // Both intersections are behind or too close to the origin
-            }
+    // Full hit record for the nearest root past t_min. Rays leaving a surface are expected to start at
+    // an offset origin (self_intersection_offset), so t_min can stay at 0.
+    bool intersect(const RayT<T>& ray, T& t_out, Vec3T<T>& hit_point_out, Vec3T<T>& normal_at_hit_out, T t_min = T(0)) const {
+        if (!hit_distance(ray, t_min, std::numeric_limits<T>::infinity(), t_out)) {
+            return false; // No real roots, or both intersections are behind the origin
         }
+        hit_point_out = ray.origin + ray.direction * t_out;
+        normal_at_hit_out = (hit_point_out - center).normalize();
+        return true;
     }
-};
\ No newline at end of file
+};
+
+using Sphere = SphereT<double>;
+static_assert(sizeof(Sphere) == 32, "Sphere should stay four doubles of geometry");
\ No newline at end of file
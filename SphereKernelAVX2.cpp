@@ -0,0 +1,83 @@
+// AVX2/FMA sphere kernels: one ray against 4 spheres (8 in float) per iteration.
+// Built with AVX2 code generation (see CMakeLists.txt); only called after a runtime CPU check.
+#include "SphereKernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#include "SphereKernelImpl.h"
+
+namespace {
+
+struct Avx2Double {
+    using Scalar = double;
+    using Vec = __m256d;
+    using Mask = __m256d;
+    static constexpr int LANES = 4;
+    static Vec set1(double v) { return _mm256_set1_pd(v); }
+    static Vec zero() { return _mm256_setzero_pd(); }
+    static Vec load(const double* p) { return _mm256_load_pd(p); }
+    static Vec loadu(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, Vec v) { _mm256_store_pd(p, v); }
+    static Vec add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm256_sub_pd(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm256_fmadd_pd(a, b, c); }
+    static Vec fmsub(Vec a, Vec b, Vec c) { return _mm256_fmsub_pd(a, b, c); }
+    static Vec sqrt(Vec a) { return _mm256_sqrt_pd(a); }
+    static Vec max(Vec a, Vec b) { return _mm256_max_pd(a, b); }
+    static Mask cmp_ge(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+    static Mask cmp_gt(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+    static Mask cmp_lt(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static Mask mask_and(Mask a, Mask b) { return _mm256_and_pd(a, b); }
+    static bool any(Mask m) { return _mm256_movemask_pd(m) != 0; }
+    static Vec select(Mask m, Vec if_true, Vec if_false) { return _mm256_blendv_pd(if_false, if_true, m); }
+    static Vec lane_offsets() { return _mm256_set_pd(3.0, 2.0, 1.0, 0.0); }
+};
+
+struct Avx2Float {
+    using Scalar = float;
+    using Vec = __m256;
+    using Mask = __m256;
+    static constexpr int LANES = 8;
+    static Vec set1(float v) { return _mm256_set1_ps(v); }
+    static Vec zero() { return _mm256_setzero_ps(); }
+    static Vec load(const float* p) { return _mm256_load_ps(p); }
+    static Vec loadu(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, Vec v) { _mm256_store_ps(p, v); }
+    static Vec add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm256_fmadd_ps(a, b, c); }
+    static Vec fmsub(Vec a, Vec b, Vec c) { return _mm256_fmsub_ps(a, b, c); }
+    static Vec sqrt(Vec a) { return _mm256_sqrt_ps(a); }
+    static Vec max(Vec a, Vec b) { return _mm256_max_ps(a, b); }
+    static Mask cmp_ge(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static Mask cmp_gt(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static Mask cmp_lt(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static Mask mask_and(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+    static bool any(Mask m) { return _mm256_movemask_ps(m) != 0; }
+    static Vec select(Mask m, Vec if_true, Vec if_false) { return _mm256_blendv_ps(if_false, if_true, m); }
+    static Vec lane_offsets() { return _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f); }
+};
+
+} // namespace
+
+int32_t intersect_spheres_avx2(const SphereSoAViewT<double>& spheres, const SphereRayQueryT<double>& ray,
+    uint32_t begin, uint32_t end, double t_min, double* t_max) {
+    return intersect_range_kernel<Avx2Double>(spheres, ray, begin, end, t_min, t_max);
+}
+
+int32_t intersect_spheres_avx2(const SphereSoAViewT<float>& spheres, const SphereRayQueryT<float>& ray,
+    uint32_t begin, uint32_t end, float t_min, float* t_max) {
+    return intersect_range_kernel<Avx2Float>(spheres, ray, begin, end, t_min, t_max);
+}
+
+void intersect_packet_avx2(const SphereSoAViewT<double>& spheres, uint32_t begin, uint32_t end, double t_min, RayPacketSoAT<double>& packet) {
+    intersect_packet_kernel<Avx2Double>(spheres, begin, end, t_min, packet);
+}
+
+void intersect_packet_avx2(const SphereSoAViewT<float>& spheres, uint32_t begin, uint32_t end, float t_min, RayPacketSoAT<float>& packet) {
+    intersect_packet_kernel<Avx2Float>(spheres, begin, end, t_min, packet);
+}
+
+#endif
@@ -0,0 +1,85 @@
+// AVX-512F sphere kernels: one ray against 8 spheres (16 in float) per iteration, with mask
+// registers replacing the blends of the AVX2 version. Only called after a runtime CPU check.
+#include "SphereKernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#include "SphereKernelImpl.h"
+
+namespace {
+
+struct Avx512Double {
+    using Scalar = double;
+    using Vec = __m512d;
+    using Mask = __mmask8;
+    static constexpr int LANES = 8;
+    static Vec set1(double v) { return _mm512_set1_pd(v); }
+    static Vec zero() { return _mm512_setzero_pd(); }
+    static Vec load(const double* p) { return _mm512_load_pd(p); }
+    static Vec loadu(const double* p) { return _mm512_loadu_pd(p); }
+    static void store(double* p, Vec v) { _mm512_store_pd(p, v); }
+    static Vec add(Vec a, Vec b) { return _mm512_add_pd(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm512_sub_pd(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm512_mul_pd(a, b); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm512_fmadd_pd(a, b, c); }
+    static Vec fmsub(Vec a, Vec b, Vec c) { return _mm512_fmsub_pd(a, b, c); }
+    static Vec sqrt(Vec a) { return _mm512_sqrt_pd(a); }
+    static Vec max(Vec a, Vec b) { return _mm512_max_pd(a, b); }
+    static Mask cmp_ge(Vec a, Vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ); }
+    static Mask cmp_gt(Vec a, Vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+    static Mask cmp_lt(Vec a, Vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    static Mask mask_and(Mask a, Mask b) { return static_cast<Mask>(a & b); }
+    static bool any(Mask m) { return m != 0; }
+    static Vec select(Mask m, Vec if_true, Vec if_false) { return _mm512_mask_blend_pd(m, if_false, if_true); }
+    static Vec lane_offsets() { return _mm512_set_pd(7.0, 6.0, 5.0, 4.0, 3.0, 2.0, 1.0, 0.0); }
+};
+
+struct Avx512Float {
+    using Scalar = float;
+    using Vec = __m512;
+    using Mask = __mmask16;
+    static constexpr int LANES = 16;
+    static Vec set1(float v) { return _mm512_set1_ps(v); }
+    static Vec zero() { return _mm512_setzero_ps(); }
+    static Vec load(const float* p) { return _mm512_load_ps(p); }
+    static Vec loadu(const float* p) { return _mm512_loadu_ps(p); }
+    static void store(float* p, Vec v) { _mm512_store_ps(p, v); }
+    static Vec add(Vec a, Vec b) { return _mm512_add_ps(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm512_sub_ps(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm512_mul_ps(a, b); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm512_fmadd_ps(a, b, c); }
+    static Vec fmsub(Vec a, Vec b, Vec c) { return _mm512_fmsub_ps(a, b, c); }
+    static Vec sqrt(Vec a) { return _mm512_sqrt_ps(a); }
+    static Vec max(Vec a, Vec b) { return _mm512_max_ps(a, b); }
+    static Mask cmp_ge(Vec a, Vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+    static Mask cmp_gt(Vec a, Vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    static Mask cmp_lt(Vec a, Vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static Mask mask_and(Mask a, Mask b) { return static_cast<Mask>(a & b); }
+    static bool any(Mask m) { return m != 0; }
+    static Vec select(Mask m, Vec if_true, Vec if_false) { return _mm512_mask_blend_ps(m, if_false, if_true); }
+    static Vec lane_offsets() {
+        return _mm512_set_ps(15.0f, 14.0f, 13.0f, 12.0f, 11.0f, 10.0f, 9.0f, 8.0f, 7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+    }
+};
+
+} // namespace
+
+int32_t intersect_spheres_avx512(const SphereSoAViewT<double>& spheres, const SphereRayQueryT<double>& ray,
+    uint32_t begin, uint32_t end, double t_min, double* t_max) {
+    return intersect_range_kernel<Avx512Double>(spheres, ray, begin, end, t_min, t_max);
+}
+
+int32_t intersect_spheres_avx512(const SphereSoAViewT<float>& spheres, const SphereRayQueryT<float>& ray,
+    uint32_t begin, uint32_t end, float t_min, float* t_max) {
+    return intersect_range_kernel<Avx512Float>(spheres, ray, begin, end, t_min, t_max);
+}
+
+void intersect_packet_avx512(const SphereSoAViewT<double>& spheres, uint32_t begin, uint32_t end, double t_min, RayPacketSoAT<double>& packet) {
+    intersect_packet_kernel<Avx512Double>(spheres, begin, end, t_min, packet);
+}
+
+void intersect_packet_avx512(const SphereSoAViewT<float>& spheres, uint32_t begin, uint32_t end, float t_min, RayPacketSoAT<float>& packet) {
+    intersect_packet_kernel<Avx512Float>(spheres, begin, end, t_min, packet);
+}
+
+#endif
@@ -0,0 +1,119 @@
+#pragma once
+// Range and packet kernels written once against a small vector-traits interface (V). Each kernel
+// translation unit defines traits for its ISA (double and float flavours) and instantiates these.
+// Only include from the kernel files: everything here is compiled with that file's ISA flags, so
+// it must stay free of library calls that the linker could merge with baseline code.
+#include "SphereKernels.h"
+
+namespace {
+
+// Traits interface used below:
+//   Scalar, Vec, Mask, LANES
+//   set1, zero, load (64-byte aligned), loadu, store, add, sub, mul, fmadd (a*b+c), fmsub (a*b-c),
+//   sqrt, max, cmp_ge / cmp_gt / cmp_lt -> Mask, mask_and, any, select(mask, if_true, if_false),
+//   lane_offsets (0, 1, ..., LANES-1)
+
+template <typename V>
+int32_t intersect_range_kernel(const SphereSoAViewT<typename V::Scalar>& spheres, const SphereRayQueryT<typename V::Scalar>& ray,
+    uint32_t begin, uint32_t end, typename V::Scalar t_min, typename V::Scalar* t_max) {
+    using S = typename V::Scalar;
+    using Vec = typename V::Vec;
+    using Mask = typename V::Mask;
+    const Vec ox = V::set1(ray.origin[0]);
+    const Vec oy = V::set1(ray.origin[1]);
+    const Vec oz = V::set1(ray.origin[2]);
+    const Vec dx = V::set1(ray.direction[0]);
+    const Vec dy = V::set1(ray.direction[1]);
+    const Vec dz = V::set1(ray.direction[2]);
+    const Vec a = V::set1(ray.dir_dot_dir);
+    const Vec inv_a = V::set1(ray.inv_dir_dot_dir);
+    const Vec tmin = V::set1(t_min);
+    const Vec zero = V::zero();
+    const Vec end_index = V::set1(static_cast<S>(end));
+    const Vec step = V::set1(static_cast<S>(V::LANES));
+
+    Vec best_t = V::set1(*t_max);
+    Vec best_index = V::set1(S(-1));
+    Vec index = V::add(V::set1(static_cast<S>(begin)), V::lane_offsets());
+
+    for (uint32_t i = begin; i < end; i += V::LANES) {
+        Vec ocx = V::sub(ox, V::loadu(spheres.center_x + i));
+        Vec ocy = V::sub(oy, V::loadu(spheres.center_y + i));
+        Vec ocz = V::sub(oz, V::loadu(spheres.center_z + i));
+        Vec half_b = V::fmadd(ocz, dz, V::fmadd(ocy, dy, V::mul(ocx, dx)));
+        Vec oc_sq = V::fmadd(ocz, ocz, V::fmadd(ocy, ocy, V::mul(ocx, ocx)));
+        Vec c = V::sub(oc_sq, V::loadu(spheres.radius_sq + i));
+        Vec discriminant = V::fmsub(half_b, half_b, V::mul(a, c));
+        Mask has_roots = V::mask_and(V::cmp_ge(discriminant, zero), V::cmp_lt(index, end_index));
+        if (!V::any(has_roots)) {
+            index = V::add(index, step); // Common case: the ray misses every sphere of the batch
+            continue;
+        }
+        Vec sqrt_disc = V::sqrt(V::max(discriminant, zero));
+        Vec neg_b = V::sub(zero, half_b);
+        Vec t0 = V::mul(V::sub(neg_b, sqrt_disc), inv_a);
+        Vec t1 = V::mul(V::add(neg_b, sqrt_disc), inv_a);
+        Mask use_t0 = V::mask_and(V::cmp_gt(t0, tmin), V::cmp_lt(t0, best_t));
+        Vec t = V::select(use_t0, t0, t1);
+        Mask valid = V::mask_and(has_roots, V::mask_and(V::cmp_gt(t, tmin), V::cmp_lt(t, best_t)));
+        best_t = V::select(valid, t, best_t);
+        best_index = V::select(valid, index, best_index);
+        index = V::add(index, step);
+    }
+
+    alignas(64) S lane_t[V::LANES];
+    alignas(64) S lane_index[V::LANES];
+    V::store(lane_t, best_t);
+    V::store(lane_index, best_index);
+    int32_t result = -1;
+    S result_t = *t_max;
+    for (int lane = 0; lane < V::LANES; ++lane) {
+        if (lane_index[lane] >= S(0) && (lane_t[lane] < result_t || (lane_t[lane] == result_t && lane_index[lane] < result))) {
+            result_t = lane_t[lane];
+            result = static_cast<int32_t>(lane_index[lane]);
+        }
+    }
+    *t_max = result_t;
+    return result;
+}
+
+// Packet variant: lanes run across rays of the packet, the sphere loop is scalar. Rays share the
+// origin, so oc and c are computed once per sphere; directions are unit length (a = 1).
+template <typename V>
+void intersect_packet_kernel(const SphereSoAViewT<typename V::Scalar>& spheres, uint32_t begin, uint32_t end,
+    typename V::Scalar t_min, RayPacketSoAT<typename V::Scalar>& packet) {
+    using S = typename V::Scalar;
+    using Vec = typename V::Vec;
+    using Mask = typename V::Mask;
+    const uint32_t lanes = (packet.count + V::LANES - 1) & ~static_cast<uint32_t>(V::LANES - 1);
+    const Vec tmin = V::set1(t_min);
+    const Vec zero = V::zero();
+    for (uint32_t i = begin; i < end; ++i) {
+        S ocx_s = packet.origin[0] - spheres.center_x[i];
+        S ocy_s = packet.origin[1] - spheres.center_y[i];
+        S ocz_s = packet.origin[2] - spheres.center_z[i];
+        const Vec ocx = V::set1(ocx_s);
+        const Vec ocy = V::set1(ocy_s);
+        const Vec ocz = V::set1(ocz_s);
+        const Vec c = V::set1(ocx_s * ocx_s + ocy_s * ocy_s + ocz_s * ocz_s - spheres.radius_sq[i]);
+        const Vec sphere_index = V::set1(static_cast<S>(i));
+        for (uint32_t r = 0; r < lanes; r += V::LANES) {
+            Vec half_b = V::fmadd(ocz, V::load(packet.dir_z + r), V::fmadd(ocy, V::load(packet.dir_y + r), V::mul(ocx, V::load(packet.dir_x + r))));
+            Vec discriminant = V::fmsub(half_b, half_b, c);
+            Mask has_roots = V::cmp_ge(discriminant, zero);
+            if (!V::any(has_roots)) continue;
+            Vec sqrt_disc = V::sqrt(V::max(discriminant, zero));
+            Vec neg_b = V::sub(zero, half_b);
+            Vec t0 = V::sub(neg_b, sqrt_disc);
+            Vec t1 = V::add(neg_b, sqrt_disc);
+            Vec best_t = V::load(packet.t + r);
+            Mask use_t0 = V::mask_and(V::cmp_gt(t0, tmin), V::cmp_lt(t0, best_t));
+            Vec t = V::select(use_t0, t0, t1);
+            Mask valid = V::mask_and(has_roots, V::mask_and(V::cmp_gt(t, tmin), V::cmp_lt(t, best_t)));
+            V::store(packet.t + r, V::select(valid, t, best_t));
+            V::store(packet.hit_index + r, V::select(valid, sphere_index, V::load(packet.hit_index + r)));
+        }
+    }
+}
+
+} // namespace
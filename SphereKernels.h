@@ -0,0 +1,91 @@
+#pragma once
+// Plain-data interface between the sphere store and the per-ISA intersection kernels.
+// The kernel translation units are compiled with ISA-specific flags, so this header (and those
+// files) must not pull in anything with inline functions that could be shared with baseline code.
+// Every structure comes in a double and a float flavour (T); float kernels run twice the lanes.
+#include <cstdint>
+
+// Pointers into a SphereSoAT. Every array holds SPHERE_SOA_PADDING extra entries past the last
+// sphere (radius_sq = -1, never hit) so kernels can load full vectors at the end of a range.
+template <typename T>
+struct SphereSoAViewT {
+    const T* center_x;
+    const T* center_y;
+    const T* center_z;
+    const T* radius_sq;
+};
+
+constexpr uint32_t SPHERE_SOA_PADDING = 16; // Widest vector: 16 floats (AVX-512)
+
+// Float kernels carry sphere indices in float lanes, which are exact up to 2^24.
+constexpr uint32_t FLOAT_KERNEL_MAX_SPHERES = 1u << 24;
+
+template <typename T>
+struct SphereRayQueryT {
+    T origin[3];
+    T direction[3];
+    T dir_dot_dir;     // |direction|^2, 1 for normalized rays
+    T inv_dir_dot_dir;
+};
+
+// Closest sphere in [begin, end) whose nearest root lies in (t_min, *t_max).
+// Returns the store index and narrows *t_max on a hit, returns -1 otherwise.
+template <typename T>
+using SphereRangeKernelT = int32_t (*)(const SphereSoAViewT<T>& spheres, const SphereRayQueryT<T>& ray,
+    uint32_t begin, uint32_t end, T t_min, T* t_max);
+
+// Up to 8x8 primary rays that share one origin (pinhole camera), stored lane-per-ray.
+// Directions must be normalized. Lanes past `count` up to the next multiple of PACKET_LANE_PADDING
+// are padding: their t is 0 so no root can ever beat it.
+constexpr uint32_t PACKET_MAX_RAYS = 64;
+constexpr uint32_t PACKET_LANE_PADDING = 16;
+
+template <typename T>
+struct RayPacketSoAT {
+    T origin[3];
+    alignas(64) T dir_x[PACKET_MAX_RAYS];
+    alignas(64) T dir_y[PACKET_MAX_RAYS];
+    alignas(64) T dir_z[PACKET_MAX_RAYS];
+    alignas(64) T t[PACKET_MAX_RAYS];          // Closest hit so far (starts at t_max)
+    alignas(64) T hit_index[PACKET_MAX_RAYS];  // Store index of that hit, -1 for none
+    uint32_t count;
+};
+
+// Tests every ray of the packet against spheres [begin, end), narrowing t/hit_index per ray.
+template <typename T>
+using PacketRangeKernelT = void (*)(const SphereSoAViewT<T>& spheres, uint32_t begin, uint32_t end,
+    T t_min, RayPacketSoAT<T>& packet);
+
+using SphereSoAView = SphereSoAViewT<double>;
+using SphereRayQuery = SphereRayQueryT<double>;
+using RayPacketSoA = RayPacketSoAT<double>;
+using SphereRangeKernel = SphereRangeKernelT<double>;
+using PacketRangeKernel = PacketRangeKernelT<double>;
+
+int32_t intersect_spheres_scalar(const SphereSoAViewT<double>& spheres, const SphereRayQueryT<double>& ray,
+    uint32_t begin, uint32_t end, double t_min, double* t_max);
+int32_t intersect_spheres_sse2(const SphereSoAViewT<double>& spheres, const SphereRayQueryT<double>& ray,
+    uint32_t begin, uint32_t end, double t_min, double* t_max);
+int32_t intersect_spheres_avx2(const SphereSoAViewT<double>& spheres, const SphereRayQueryT<double>& ray,
+    uint32_t begin, uint32_t end, double t_min, double* t_max);
+int32_t intersect_spheres_avx512(const SphereSoAViewT<double>& spheres, const SphereRayQueryT<double>& ray,
+    uint32_t begin, uint32_t end, double t_min, double* t_max);
+
+int32_t intersect_spheres_scalar(const SphereSoAViewT<float>& spheres, const SphereRayQueryT<float>& ray,
+    uint32_t begin, uint32_t end, float t_min, float* t_max);
+int32_t intersect_spheres_sse2(const SphereSoAViewT<float>& spheres, const SphereRayQueryT<float>& ray,
+    uint32_t begin, uint32_t end, float t_min, float* t_max);
+int32_t intersect_spheres_avx2(const SphereSoAViewT<float>& spheres, const SphereRayQueryT<float>& ray,
+    uint32_t begin, uint32_t end, float t_min, float* t_max);
+int32_t intersect_spheres_avx512(const SphereSoAViewT<float>& spheres, const SphereRayQueryT<float>& ray,
+    uint32_t begin, uint32_t end, float t_min, float* t_max);
+
+void intersect_packet_scalar(const SphereSoAViewT<double>& spheres, uint32_t begin, uint32_t end, double t_min, RayPacketSoAT<double>& packet);
+void intersect_packet_sse2(const SphereSoAViewT<double>& spheres, uint32_t begin, uint32_t end, double t_min, RayPacketSoAT<double>& packet);
+void intersect_packet_avx2(const SphereSoAViewT<double>& spheres, uint32_t begin, uint32_t end, double t_min, RayPacketSoAT<double>& packet);
+void intersect_packet_avx512(const SphereSoAViewT<double>& spheres, uint32_t begin, uint32_t end, double t_min, RayPacketSoAT<double>& packet);
+
+void intersect_packet_scalar(const SphereSoAViewT<float>& spheres, uint32_t begin, uint32_t end, float t_min, RayPacketSoAT<float>& packet);
+void intersect_packet_sse2(const SphereSoAViewT<float>& spheres, uint32_t begin, uint32_t end, float t_min, RayPacketSoAT<float>& packet);
+void intersect_packet_avx2(const SphereSoAViewT<float>& spheres, uint32_t begin, uint32_t end, float t_min, RayPacketSoAT<float>& packet);
+void intersect_packet_avx512(const SphereSoAViewT<float>& spheres, uint32_t begin, uint32_t end, float t_min, RayPacketSoAT<float>& packet);
@@ -0,0 +1,345 @@
+#include "SphereSoA.h"
+#include <cmath>
+#include <string>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RMRT_X86_64 1
+#include <emmintrin.h>
+#include "SphereKernelImpl.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+namespace {
+
+template <typename T>
+SphereRangeKernelT<T> kernel_for(SimdIsa isa) {
+    switch (isa) {
+#ifdef RMRT_X86_64
+    case SimdIsa::SSE2: return intersect_spheres_sse2;
+    case SimdIsa::AVX2: return intersect_spheres_avx2;
+    case SimdIsa::AVX512: return intersect_spheres_avx512;
+#endif
+    default: return intersect_spheres_scalar;
+    }
+}
+
+template <typename T>
+PacketRangeKernelT<T> packet_kernel_for(SimdIsa isa) {
+    switch (isa) {
+#ifdef RMRT_X86_64
+    case SimdIsa::SSE2: return intersect_packet_sse2;
+    case SimdIsa::AVX2: return intersect_packet_avx2;
+    case SimdIsa::AVX512: return intersect_packet_avx512;
+#endif
+    default: return intersect_packet_scalar;
+    }
+}
+
+SimdIsa g_active_isa = detect_best_simd_isa();
+SphereRangeKernelT<double> g_active_kernel = kernel_for<double>(g_active_isa);
+PacketRangeKernelT<double> g_active_packet_kernel = packet_kernel_for<double>(g_active_isa);
+SphereRangeKernelT<float> g_active_kernel_f = kernel_for<float>(g_active_isa);
+PacketRangeKernelT<float> g_active_packet_kernel_f = packet_kernel_for<float>(g_active_isa);
+
+template <typename T>
+SphereRangeKernelT<T> active_kernel() {
+    if constexpr (std::is_same_v<T, float>) return g_active_kernel_f;
+    else return g_active_kernel;
+}
+
+template <typename T>
+PacketRangeKernelT<T> active_packet_kernel() {
+    if constexpr (std::is_same_v<T, float>) return g_active_packet_kernel_f;
+    else return g_active_packet_kernel;
+}
+
+// Same math as Sphere::hit_distance, reading the SoA arrays.
+template <typename T>
+int32_t scalar_range_kernel(const SphereSoAViewT<T>& spheres, const SphereRayQueryT<T>& ray,
+    uint32_t begin, uint32_t end, T t_min, T* t_max) {
+    int32_t best_index = -1;
+    T best_t = *t_max;
+    for (uint32_t i = begin; i < end; ++i) {
+        T ocx = ray.origin[0] - spheres.center_x[i];
+        T ocy = ray.origin[1] - spheres.center_y[i];
+        T ocz = ray.origin[2] - spheres.center_z[i];
+        T half_b = ocx * ray.direction[0] + ocy * ray.direction[1] + ocz * ray.direction[2];
+        T c = ocx * ocx + ocy * ocy + ocz * ocz - spheres.radius_sq[i];
+        T discriminant = half_b * half_b - ray.dir_dot_dir * c;
+        if (discriminant < T(0)) continue;
+        T sqrt_discriminant = std::sqrt(discriminant);
+        T t = (-half_b - sqrt_discriminant) * ray.inv_dir_dot_dir;
+        if (t <= t_min || t >= best_t) {
+            t = (-half_b + sqrt_discriminant) * ray.inv_dir_dot_dir;
+            if (t <= t_min || t >= best_t) continue;
+        }
+        best_t = t;
+        best_index = static_cast<int32_t>(i);
+    }
+    *t_max = best_t;
+    return best_index;
+}
+
+// Packet rays share the origin, so oc and c are computed once per sphere; directions are unit length (a = 1).
+template <typename T>
+void scalar_packet_kernel(const SphereSoAViewT<T>& spheres, uint32_t begin, uint32_t end, T t_min, RayPacketSoAT<T>& packet) {
+    for (uint32_t i = begin; i < end; ++i) {
+        T ocx = packet.origin[0] - spheres.center_x[i];
+        T ocy = packet.origin[1] - spheres.center_y[i];
+        T ocz = packet.origin[2] - spheres.center_z[i];
+        T c = ocx * ocx + ocy * ocy + ocz * ocz - spheres.radius_sq[i];
+        for (uint32_t r = 0; r < packet.count; ++r) {
+            T half_b = ocx * packet.dir_x[r] + ocy * packet.dir_y[r] + ocz * packet.dir_z[r];
+            T discriminant = half_b * half_b - c;
+            if (discriminant < T(0)) continue;
+            T sqrt_discriminant = std::sqrt(discriminant);
+            T t = -half_b - sqrt_discriminant;
+            if (t <= t_min || t >= packet.t[r]) {
+                t = -half_b + sqrt_discriminant;
+                if (t <= t_min || t >= packet.t[r]) continue;
+            }
+            packet.t[r] = t;
+            packet.hit_index[r] = static_cast<T>(i);
+        }
+    }
+}
+
+#ifdef RMRT_X86_64
+// SSE2 is part of the x86-64 baseline, so these need no special compile flags. There is no FMA
+// at this level: fmadd/fmsub are a separate multiply and add.
+struct Sse2Double {
+    using Scalar = double;
+    using Vec = __m128d;
+    using Mask = __m128d;
+    static constexpr int LANES = 2;
+    static Vec set1(double v) { return _mm_set1_pd(v); }
+    static Vec zero() { return _mm_setzero_pd(); }
+    static Vec load(const double* p) { return _mm_load_pd(p); }
+    static Vec loadu(const double* p) { return _mm_loadu_pd(p); }
+    static void store(double* p, Vec v) { _mm_store_pd(p, v); }
+    static Vec add(Vec a, Vec b) { return _mm_add_pd(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm_sub_pd(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm_mul_pd(a, b); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static Vec fmsub(Vec a, Vec b, Vec c) { return _mm_sub_pd(_mm_mul_pd(a, b), c); }
+    static Vec sqrt(Vec a) { return _mm_sqrt_pd(a); }
+    static Vec max(Vec a, Vec b) { return _mm_max_pd(a, b); }
+    static Mask cmp_ge(Vec a, Vec b) { return _mm_cmpge_pd(a, b); }
+    static Mask cmp_gt(Vec a, Vec b) { return _mm_cmpgt_pd(a, b); }
+    static Mask cmp_lt(Vec a, Vec b) { return _mm_cmplt_pd(a, b); }
+    static Mask mask_and(Mask a, Mask b) { return _mm_and_pd(a, b); }
+    static bool any(Mask m) { return _mm_movemask_pd(m) != 0; }
+    static Vec select(Mask m, Vec if_true, Vec if_false) { return _mm_or_pd(_mm_and_pd(m, if_true), _mm_andnot_pd(m, if_false)); }
+    static Vec lane_offsets() { return _mm_set_pd(1.0, 0.0); }
+};
+
+struct Sse2Float {
+    using Scalar = float;
+    using Vec = __m128;
+    using Mask = __m128;
+    static constexpr int LANES = 4;
+    static Vec set1(float v) { return _mm_set1_ps(v); }
+    static Vec zero() { return _mm_setzero_ps(); }
+    static Vec load(const float* p) { return _mm_load_ps(p); }
+    static Vec loadu(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, Vec v) { _mm_store_ps(p, v); }
+    static Vec add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm_sub_ps(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static Vec fmsub(Vec a, Vec b, Vec c) { return _mm_sub_ps(_mm_mul_ps(a, b), c); }
+    static Vec sqrt(Vec a) { return _mm_sqrt_ps(a); }
+    static Vec max(Vec a, Vec b) { return _mm_max_ps(a, b); }
+    static Mask cmp_ge(Vec a, Vec b) { return _mm_cmpge_ps(a, b); }
+    static Mask cmp_gt(Vec a, Vec b) { return _mm_cmpgt_ps(a, b); }
+    static Mask cmp_lt(Vec a, Vec b) { return _mm_cmplt_ps(a, b); }
+    static Mask mask_and(Mask a, Mask b) { return _mm_and_ps(a, b); }
+    static bool any(Mask m) { return _mm_movemask_ps(m) != 0; }
+    static Vec select(Mask m, Vec if_true, Vec if_false) { return _mm_or_ps(_mm_and_ps(m, if_true), _mm_andnot_ps(m, if_false)); }
+    static Vec lane_offsets() { return _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f); }
+};
+#endif
+
+#if defined(RMRT_X86_64) && defined(_MSC_VER)
+bool os_saves_ymm_state() {
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    return osxsave && (_xgetbv(0) & 0x6) == 0x6;
+}
+bool os_saves_zmm_state() {
+    return os_saves_ymm_state() && (_xgetbv(0) & 0xE6) == 0xE6;
+}
+#endif
+
+} // namespace
+
+const char* simd_isa_name(SimdIsa isa) {
+    switch (isa) {
+    case SimdIsa::SSE2: return "sse2";
+    case SimdIsa::AVX2: return "avx2";
+    case SimdIsa::AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+bool parse_simd_isa(const std::string& name, SimdIsa& isa_out) {
+    if (name == "auto") { isa_out = detect_best_simd_isa(); return true; }
+    if (name == "scalar") { isa_out = SimdIsa::Scalar; return true; }
+    if (name == "sse2") { isa_out = SimdIsa::SSE2; return true; }
+    if (name == "avx2") { isa_out = SimdIsa::AVX2; return true; }
+    if (name == "avx512") { isa_out = SimdIsa::AVX512; return true; }
+    return false;
+}
+
+const char* precision_name(Precision precision) {
+    return precision == Precision::Float ? "float" : "double";
+}
+
+bool parse_precision(const std::string& name, Precision& precision_out) {
+    if (name == "double") { precision_out = Precision::Double; return true; }
+    if (name == "float") { precision_out = Precision::Float; return true; }
+    return false;
+}
+
+bool simd_isa_supported(SimdIsa isa) {
+    switch (isa) {
+    case SimdIsa::Scalar:
+        return true;
+#ifdef RMRT_X86_64
+    case SimdIsa::SSE2:
+        return true; // Baseline on x86-64
+#if defined(_MSC_VER)
+    case SimdIsa::AVX2: {
+        int info[4];
+        __cpuidex(info, 7, 0);
+        bool avx2 = (info[1] & (1 << 5)) != 0;
+        __cpuid(info, 1);
+        bool fma = (info[2] & (1 << 12)) != 0;
+        return avx2 && fma && os_saves_ymm_state();
+    }
+    case SimdIsa::AVX512: {
+        int info[4];
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 16)) != 0 && os_saves_zmm_state();
+    }
+#else
+    case SimdIsa::AVX2:
+        __builtin_cpu_init(); // May run from a static initializer, before libgcc has probed the CPU
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case SimdIsa::AVX512:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512f");
+#endif
+#endif
+    default:
+        return false;
+    }
+}
+
+SimdIsa detect_best_simd_isa() {
+    if (simd_isa_supported(SimdIsa::AVX512)) return SimdIsa::AVX512;
+    if (simd_isa_supported(SimdIsa::AVX2)) return SimdIsa::AVX2;
+    if (simd_isa_supported(SimdIsa::SSE2)) return SimdIsa::SSE2;
+    return SimdIsa::Scalar;
+}
+
+SimdIsa active_simd_isa() {
+    return g_active_isa;
+}
+
+bool set_active_simd_isa(SimdIsa isa) {
+    if (!simd_isa_supported(isa)) {
+        return false;
+    }
+    g_active_isa = isa;
+    g_active_kernel = kernel_for<double>(isa);
+    g_active_packet_kernel = packet_kernel_for<double>(isa);
+    g_active_kernel_f = kernel_for<float>(isa);
+    g_active_packet_kernel_f = packet_kernel_for<float>(isa);
+    return true;
+}
+
+template <typename T>
+void SphereSoAT<T>::clear() {
+    center_x.clear();
+    center_y.clear();
+    center_z.clear();
+    radius_sq.clear();
+    count = 0;
+}
+
+template <typename T>
+void SphereSoAT<T>::build(std::span<const Sphere> spheres, const std::vector<uint32_t>* order) {
+    count = static_cast<uint32_t>(order ? order->size() : spheres.size());
+    size_t padded = static_cast<size_t>(count) + SPHERE_SOA_PADDING;
+    center_x.assign(padded, T(0));
+    center_y.assign(padded, T(0));
+    center_z.assign(padded, T(0));
+    radius_sq.assign(padded, T(-1)); // Padding lanes can never produce a real root
+    for (uint32_t i = 0; i < count; ++i) {
+        update(i, spheres[order ? (*order)[i] : i]);
+    }
+}
+
+template <typename T>
+void SphereSoAT<T>::update(uint32_t index, const Sphere& sphere) {
+    center_x[index] = static_cast<T>(sphere.center.x);
+    center_y[index] = static_cast<T>(sphere.center.y);
+    center_z[index] = static_cast<T>(sphere.center.z);
+    radius_sq[index] = static_cast<T>(sphere.radius * sphere.radius);
+}
+
+template <typename T>
+int32_t SphereSoAT<T>::intersect_range(const SphereRayQueryT<T>& query, uint32_t begin, uint32_t end, T t_min, T& t_max) const {
+    return active_kernel<T>()(view(), query, begin, end, t_min, &t_max);
+}
+
+template <typename T>
+void SphereSoAT<T>::intersect_packet(RayPacketSoAT<T>& packet, uint32_t begin, uint32_t end, T t_min) const {
+    active_packet_kernel<T>()(view(), begin, end, t_min, packet);
+}
+
+template struct SphereSoAT<double>;
+template struct SphereSoAT<float>;
+
+int32_t intersect_spheres_scalar(const SphereSoAViewT<double>& spheres, const SphereRayQueryT<double>& ray,
+    uint32_t begin, uint32_t end, double t_min, double* t_max) {
+    return scalar_range_kernel(spheres, ray, begin, end, t_min, t_max);
+}
+
+int32_t intersect_spheres_scalar(const SphereSoAViewT<float>& spheres, const SphereRayQueryT<float>& ray,
+    uint32_t begin, uint32_t end, float t_min, float* t_max) {
+    return scalar_range_kernel(spheres, ray, begin, end, t_min, t_max);
+}
+
+void intersect_packet_scalar(const SphereSoAViewT<double>& spheres, uint32_t begin, uint32_t end, double t_min, RayPacketSoAT<double>& packet) {
+    scalar_packet_kernel(spheres, begin, end, t_min, packet);
+}
+
+void intersect_packet_scalar(const SphereSoAViewT<float>& spheres, uint32_t begin, uint32_t end, float t_min, RayPacketSoAT<float>& packet) {
+    scalar_packet_kernel(spheres, begin, end, t_min, packet);
+}
+
+#ifdef RMRT_X86_64
+int32_t intersect_spheres_sse2(const SphereSoAViewT<double>& spheres, const SphereRayQueryT<double>& ray,
+    uint32_t begin, uint32_t end, double t_min, double* t_max) {
+    return intersect_range_kernel<Sse2Double>(spheres, ray, begin, end, t_min, t_max);
+}
+
+int32_t intersect_spheres_sse2(const SphereSoAViewT<float>& spheres, const SphereRayQueryT<float>& ray,
+    uint32_t begin, uint32_t end, float t_min, float* t_max) {
+    return intersect_range_kernel<Sse2Float>(spheres, ray, begin, end, t_min, t_max);
+}
+
+void intersect_packet_sse2(const SphereSoAViewT<double>& spheres, uint32_t begin, uint32_t end, double t_min, RayPacketSoAT<double>& packet) {
+    intersect_packet_kernel<Sse2Double>(spheres, begin, end, t_min, packet);
+}
+
+void intersect_packet_sse2(const SphereSoAViewT<float>& spheres, uint32_t begin, uint32_t end, float t_min, RayPacketSoAT<float>& packet) {
+    intersect_packet_kernel<Sse2Float>(spheres, begin, end, t_min, packet);
+}
+#endif
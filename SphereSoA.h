@@ -0,0 +1,80 @@
+#pragma once
+#include <vector>
+#include <span>
+#include <cstdint>
+#include <string>
+#include "AlignedAllocator.h"
+#include "SphereKernels.h"
+#include "Sphere.h"
+#include "Ray.h"
+
+enum class SimdIsa {
+    Scalar,
+    SSE2,   // 2 spheres per instruction (4 in float)
+    AVX2,   // 4 spheres per instruction (8 in float)
+    AVX512  // 8 spheres per instruction (16 in float)
+};
+
+const char* simd_isa_name(SimdIsa isa);
+bool parse_simd_isa(const std::string& name, SimdIsa& isa_out);
+// Widest ISA both compiled in and supported by the running CPU.
+SimdIsa detect_best_simd_isa();
+bool simd_isa_supported(SimdIsa isa);
+
+// Scalar type used for intersection. Shading, colors and the scene description stay double;
+// Float traces rays, BVH nodes and sphere geometry in single precision, which doubles the SIMD
+// width of every kernel and halves the memory they stream.
+enum class Precision {
+    Double,
+    Float
+};
+
+const char* precision_name(Precision precision);
+bool parse_precision(const std::string& name, Precision& precision_out);
+
+// Kernels used by every SphereSoAT query. Defaults to detect_best_simd_isa(); set_active_simd_isa
+// is meant for benchmarking and must be called before rendering starts.
+SimdIsa active_simd_isa();
+bool set_active_simd_isa(SimdIsa isa);
+
+// Structure-of-arrays copy of sphere geometry (center x/y/z and radius^2 in separate
+// cache-line aligned arrays) for the vectorized intersection kernels.
+template <typename T>
+struct SphereSoAT {
+    AlignedVector<T> center_x;
+    AlignedVector<T> center_y;
+    AlignedVector<T> center_z;
+    AlignedVector<T> radius_sq;
+    uint32_t count = 0;
+
+    // Copies spheres in the given order (e.g. BVH leaf order); identity order when `order` is null.
+    void build(std::span<const Sphere> spheres, const std::vector<uint32_t>* order = nullptr);
+    // Overwrites one entry in place (same index as passed to build) after a sphere was edited.
+    void update(uint32_t index, const Sphere& sphere);
+    void clear();
+    bool empty() const { return count == 0; }
+    size_t memory_bytes() const { return (center_x.capacity() + center_y.capacity() + center_z.capacity() + radius_sq.capacity()) * sizeof(T); }
+    SphereSoAViewT<T> view() const { return SphereSoAViewT<T>{ center_x.data(), center_y.data(), center_z.data(), radius_sq.data() }; }
+
+    // Closest hit among entries [begin, end); see SphereRangeKernelT.
+    int32_t intersect_range(const SphereRayQueryT<T>& query, uint32_t begin, uint32_t end, T t_min, T& t_max) const;
+    // Same for a whole primary-ray packet, SIMD lanes running across rays; see PacketRangeKernelT.
+    void intersect_packet(RayPacketSoAT<T>& packet, uint32_t begin, uint32_t end, T t_min) const;
+};
+
+using SphereSoA = SphereSoAT<double>;
+using SphereSoAF = SphereSoAT<float>;
+
+template <typename T>
+SphereRayQueryT<T> make_sphere_ray_query(const RayT<T>& ray) {
+    SphereRayQueryT<T> query;
+    query.origin[0] = ray.origin.x;
+    query.origin[1] = ray.origin.y;
+    query.origin[2] = ray.origin.z;
+    query.direction[0] = ray.direction.x;
+    query.direction[1] = ray.direction.y;
+    query.direction[2] = ray.direction.z;
+    query.dir_dot_dir = Vec3T<T>::dot(ray.direction, ray.direction);
+    query.inv_dir_dot_dir = T(1) / query.dir_dot_dir;
+    return query;
+}
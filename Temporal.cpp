@@ -0,0 +1,158 @@
+#include "Temporal.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Maps pixels of the current view into the history camera's image. Pixel (x, y) looks along
+// d = base + step_x * (x + 0.5) + step_y * (y + 0.5), the unnormalized direction of Camera::get_ray,
+// and its first hit is origin + d * depth / |d|; all four vectors are in the history camera's
+// (right, up, forward) frame, so projecting the hit is a divide by its forward component.
+struct ViewMapping {
+    Vec3 origin;
+    Vec3 base;
+    Vec3 step_x;
+    Vec3 step_y;
+    double scale_x, scale_y; // Pixels per unit of right / forward and up / forward in the history image
+    double center_x, center_y;
+};
+
+ViewMapping make_mapping(const Camera& current, int width, int height, const Camera& history, int history_width, int history_height) {
+    auto to_history = [&](const Vec3& v) {
+        return Vec3(Vec3::dot(v, history.right_direction), Vec3::dot(v, history.up_direction), Vec3::dot(v, history.forward_direction));
+    };
+    const Vec3 corner = current.forward_direction * current.image_plane_dist
+        - current.right_direction * (current.image_plane_w * 0.5) + current.up_direction * (current.image_plane_h * 0.5);
+    ViewMapping mapping;
+    mapping.origin = to_history(current.position - history.position);
+    mapping.base = to_history(corner);
+    mapping.step_x = to_history(current.right_direction * (current.image_plane_w / width));
+    mapping.step_y = to_history(current.up_direction * (-current.image_plane_h / height));
+    mapping.scale_x = history.image_plane_dist / history.image_plane_w * history_width;
+    mapping.scale_y = -history.image_plane_dist / history.image_plane_h * history_height;
+    mapping.center_x = history_width * 0.5;
+    mapping.center_y = history_height * 0.5;
+    return mapping;
+}
+
+struct Prior {
+    Vec3 color;
+    double weight = 0.0;
+};
+
+// Bilinear fetch of the history around the pixel's first hit, over the taps that pass the depth
+// and normal tests; taps that fail take their share of the weight with them.
+Prior reproject(const TemporalFrame& frame, const TemporalSettings& settings, const TemporalHistory& history,
+    const ViewMapping& mapping, int x, int y) {
+    const size_t plane = static_cast<size_t>(frame.width) * frame.height;
+    const size_t i = static_cast<size_t>(y) * frame.width + x;
+    const Vec3 direction = mapping.base + mapping.step_x * (x + 0.5) + mapping.step_y * (y + 0.5);
+    // Misses sit at DENOISE_MISS_DEPTH, far enough that only the rotation moves them.
+    const Vec3 point = mapping.origin + direction * (frame.depth[i] / direction.length());
+    Prior prior;
+    if (point.z <= 1e-9) return prior; // Behind the history camera
+    const double inv_forward = 1.0 / point.z;
+    const double px = point.x * inv_forward * mapping.scale_x + mapping.center_x;
+    const double py = point.y * inv_forward * mapping.scale_y + mapping.center_y;
+    const double distance = point.length();
+
+    const Vec3 normal(frame.normal[i], frame.normal[plane + i], frame.normal[2 * plane + i]);
+    const double min_cos_sq = settings.normal_threshold * settings.normal_threshold * Vec3::dot(normal, normal);
+    const size_t history_plane = static_cast<size_t>(history.width) * history.height;
+    const double fx = px - 0.5, fy = py - 0.5;
+    if (!(fx > -1.0 && fy > -1.0 && fx < history.width && fy < history.height)) return prior; // No tap in the image
+    const int x0 = static_cast<int>(fx + 1.0) - 1, y0 = static_cast<int>(fy + 1.0) - 1; // floor, as fx, fy > -1
+    const double ax = fx - x0, ay = fy - y0;
+    double coverage = 0.0;
+    for (int ty = 0; ty < 2; ++ty) {
+        for (int tx = 0; tx < 2; ++tx) {
+            const int hx = x0 + tx, hy = y0 + ty;
+            if (hx < 0 || hy < 0 || hx >= history.width || hy >= history.height) continue;
+            const size_t h = static_cast<size_t>(hy) * history.width + hx;
+            if (std::abs(history.depth[h] - distance) > settings.depth_tolerance * distance) continue;
+            // Cosine test on the averaged normals, squared to keep the square roots out of the tap
+            // loop; pixels without a hit have a zero normal and pass.
+            const Vec3 history_normal(history.normal[h], history.normal[history_plane + h], history.normal[2 * history_plane + h]);
+            const double cosine = Vec3::dot(normal, history_normal);
+            if (cosine < 0.0 || cosine * cosine < min_cos_sq * Vec3::dot(history_normal, history_normal)) continue;
+            const double w = (tx ? ax : 1.0 - ax) * (ty ? ay : 1.0 - ay);
+            prior.color = prior.color + Vec3(history.color[h], history.color[history_plane + h], history.color[2 * history_plane + h]) * w;
+            prior.weight += history.weight[h] * w;
+            coverage += w;
+        }
+    }
+    if (coverage < 1e-3) return Prior();
+    prior.color = prior.color / coverage;
+    return prior;
+}
+
+// Sums of the frame's colors and squared colors down each column of the up to three rows around
+// row y, so the 3x3 neighbourhoods of the row take three columns each. Returns the row count.
+int column_sums(const TemporalFrame& frame, int y, std::vector<Vec3>& sums, std::vector<Vec3>& sums_sq) {
+    const size_t plane = static_cast<size_t>(frame.width) * frame.height;
+    sums.assign(frame.width, Vec3());
+    sums_sq.assign(frame.width, Vec3());
+    const int first = std::max(0, y - 1), last = std::min(frame.height - 1, y + 1);
+    for (int ny = first; ny <= last; ++ny) {
+        for (int x = 0; x < frame.width; ++x) {
+            const size_t n = static_cast<size_t>(ny) * frame.width + x;
+            const Vec3 c(frame.color[n], frame.color[plane + n], frame.color[2 * plane + n]);
+            sums[x] = sums[x] + c;
+            sums_sq[x] = sums_sq[x] + Vec3(c.x * c.x, c.y * c.y, c.z * c.z);
+        }
+    }
+    return last - first + 1;
+}
+
+// Limits the prior to the mean +- clamp_sigma standard deviations of the frame's colors in the 3x3
+// block around the pixel.
+Vec3 clamp_to_neighbourhood(const TemporalSettings& settings, const std::vector<Vec3>& sums, const std::vector<Vec3>& sums_sq,
+    int rows, int x, const Vec3& color) {
+    const int first = std::max(0, x - 1), last = std::min(static_cast<int>(sums.size()) - 1, x + 1);
+    Vec3 sum, sum_sq;
+    for (int nx = first; nx <= last; ++nx) {
+        sum = sum + sums[nx];
+        sum_sq = sum_sq + sums_sq[nx];
+    }
+    const double inv_count = 1.0 / (rows * (last - first + 1));
+    auto clamp_channel = [&](double value, double s, double s_sq) {
+        const double mean = s * inv_count;
+        const double spread = settings.clamp_sigma * std::sqrt(std::max(0.0, s_sq * inv_count - mean * mean));
+        return std::clamp(value, mean - spread, mean + spread);
+    };
+    return Vec3(clamp_channel(color.x, sum.x, sum_sq.x), clamp_channel(color.y, sum.y, sum_sq.y),
+        clamp_channel(color.z, sum.z, sum_sq.z));
+}
+
+} // namespace
+
+void temporal_resolve(const TemporalFrame& frame, const TemporalSettings& settings, TemporalHistory& history,
+    int row_begin, int row_end) {
+    const size_t plane = static_cast<size_t>(frame.width) * frame.height;
+    const bool reprojects = frame.restarted && history.valid;
+    const ViewMapping mapping = make_mapping(*frame.camera, frame.width, frame.height, history.camera, history.width, history.height);
+    std::vector<Vec3> sums, sums_sq;
+    for (int y = row_begin; y < row_end; ++y) {
+        const int rows = reprojects ? column_sums(frame, y, sums, sums_sq) : 0;
+        for (int x = 0; x < frame.width; ++x) {
+            const size_t i = static_cast<size_t>(y) * frame.width + x;
+            if (frame.restarted) {
+                Prior prior;
+                if (reprojects) prior = reproject(frame, settings, history, mapping, x, y);
+                if (prior.weight > 0.0) prior.color = clamp_to_neighbourhood(settings, sums, sums_sq, rows, x, prior.color);
+                history.prior[i] = static_cast<float>(prior.color.x);
+                history.prior[plane + i] = static_cast<float>(prior.color.y);
+                history.prior[2 * plane + i] = static_cast<float>(prior.color.z);
+                history.prior_weight[i] = static_cast<float>(std::min<double>(prior.weight, settings.max_history));
+            }
+            const float samples = static_cast<float>(frame.sample_counts ? frame.sample_counts[i] : frame.samples);
+            const float prior_weight = history.prior_weight[i];
+            const float total = samples + prior_weight;
+            for (int c = 0; c < 3; ++c) {
+                const size_t p = c * plane + i;
+                history.resolved[p] = total > 0.0f ? (frame.color[p] * samples + history.prior[p] * prior_weight) / total : frame.color[p];
+            }
+            history.resolved_weight[i] = std::min(total, settings.max_history);
+        }
+    }
+}
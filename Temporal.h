@@ -0,0 +1,65 @@
+#pragma once
+// Temporal reuse of earlier frames across camera motion. When a frame starts a new running mean
+// (the camera moved, so accumulation was reset, or the frame does not accumulate), the previous
+// output is reprojected into the new view through each pixel's first-hit position and kept as a
+// prior that the new samples are blended with until they outweigh it. History taps whose depth or
+// normal disagree with the new first hit are disocclusions and dropped; what survives is clamped to
+// the spread of the new samples around the pixel, so shading that moves differently from the
+// geometry (reflections, highlights) cannot leave a trail. The renderer runs it over bands of rows
+// on its worker pool, before the denoiser (RenderThreadPool::render_frame).
+#include <cstdint>
+#include <vector>
+#include "Camera.h"
+
+struct TemporalSettings {
+    bool enabled = false;
+    float max_history = 16.0f;     // Most samples' worth of weight the reprojected history may carry
+    float depth_tolerance = 0.05f; // Largest depth mismatch of a history tap, relative to the new depth
+    float normal_threshold = 0.9f; // Smallest cosine between the new and the history normal
+    float clamp_sigma = 1.5f;      // History is clamped to the new 3x3 neighbourhood's mean +- this many std devs
+};
+
+// Per-target state, kept in FrameBuffer::temporal. Color planes as in DenoiseImage. The history
+// keeps its own size, so a target that changes resolution (dynamic resolution) still reprojects it.
+struct TemporalHistory {
+    bool valid = false;          // color/weight/normal/depth hold a width x height frame seen from `camera`
+    Camera camera;
+    int width = 0;
+    int height = 0;
+    std::vector<float> color;    // 3 planes: the last resolved frame
+    std::vector<float> weight;   // Samples' worth behind each pixel of color, at most max_history
+    std::vector<float> normal;   // 3 planes: that frame's first-hit guides
+    std::vector<float> depth;
+    std::vector<float> prior;    // 3 planes, at the target's size: history reprojected into the current running mean's view
+    std::vector<float> prior_weight;
+    std::vector<float> resolved; // 3 planes at the target's size, written by the current frame and swapped into color
+    std::vector<float> resolved_weight;
+
+    void clear() {
+        valid = false;
+        width = height = 0;
+        for (std::vector<float>* plane : { &color, &weight, &normal, &depth, &prior, &prior_weight, &resolved, &resolved_weight }) {
+            plane->clear();
+        }
+    }
+};
+
+// The frame being resolved. `color` is this view's running mean of `samples` samples per pixel, or
+// of sample_counts[i] samples where sample_counts is not null (adaptive sampling).
+struct TemporalFrame {
+    int width;
+    int height;
+    const Camera* camera;
+    const float* color;         // 3 planes
+    const float* normal;        // 3 planes
+    const float* depth;
+    const uint32_t* sample_counts;
+    uint32_t samples;
+    bool restarted;             // The running mean starts with this frame: reproject a new prior
+};
+
+// Rows [row_begin, row_end): reprojects the prior when the frame restarted, then writes the blend
+// of prior and running mean to history.resolved / resolved_weight. Reads any row of the history
+// and of the frame's color.
+void temporal_resolve(const TemporalFrame& frame, const TemporalSettings& settings, TemporalHistory& history,
+    int row_begin, int row_end);
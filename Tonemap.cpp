@@ -0,0 +1,111 @@
+#include "Tonemap.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RMRT_X86_64 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// The tone curve's output in [0, 1] indexes the encode tables directly. 2^14 entries keep the
+// sRGB curve's steep start to a tenth of an 8-bit step, and both tables together fit in L1.
+constexpr int LUT_SIZE = 1 << 14;
+constexpr float LUT_SCALE = static_cast<float>(LUT_SIZE - 1);
+// Larger inputs all map to 1 anyway; capping them keeps the ACES fit's squares finite for inf.
+constexpr float MAX_INPUT = 1e6f;
+
+struct EncodeTables {
+    uint8_t srgb[LUT_SIZE];
+    uint8_t linear[LUT_SIZE];
+
+    EncodeTables() {
+        for (int i = 0; i < LUT_SIZE; ++i) {
+            const double v = i / static_cast<double>(LUT_SIZE - 1);
+            const double encoded = v <= 0.0031308 ? 12.92 * v : 1.055 * std::pow(v, 1.0 / 2.4) - 0.055;
+            srgb[i] = static_cast<uint8_t>(encoded * 255.0 + 0.5);
+            linear[i] = static_cast<uint8_t>(v * 255.0 + 0.5);
+        }
+    }
+};
+
+const EncodeTables& encode_tables() {
+    static const EncodeTables tables;
+    return tables;
+}
+
+// Exposed value to the curve's [0, 1]. NaN (and negative) input ends up at 0.
+inline float tone_scalar(float x, float scale, ToneCurve curve) {
+    x *= scale;
+    x = x > 0.0f ? x : 0.0f;
+    x = x < MAX_INPUT ? x : MAX_INPUT;
+    if (curve == ToneCurve::Aces) x = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+    return x < 1.0f ? x : 1.0f;
+}
+
+inline uint32_t pack(const uint8_t* table, int r, int g, int b) {
+    return 0xFF000000u | (static_cast<uint32_t>(table[r]) << 16) | (static_cast<uint32_t>(table[g]) << 8) | table[b];
+}
+
+inline uint32_t resolve_scalar(const uint8_t* table, const float* rgb, float scale, ToneCurve curve) {
+    return pack(table, static_cast<int>(tone_scalar(rgb[0], scale, curve) * LUT_SCALE + 0.5f),
+        static_cast<int>(tone_scalar(rgb[1], scale, curve) * LUT_SCALE + 0.5f),
+        static_cast<int>(tone_scalar(rgb[2], scale, curve) * LUT_SCALE + 0.5f));
+}
+
+#ifdef RMRT_X86_64
+// Same arithmetic as tone_scalar, four channels at a time. The curve works on each channel alone,
+// so the interleaved floats need no shuffling: three loads cover four pixels.
+inline __m128 tone_sse2(__m128 x, __m128 scale, ToneCurve curve) {
+    x = _mm_mul_ps(x, scale);
+    x = _mm_max_ps(x, _mm_setzero_ps()); // Returns the second operand for NaN
+    x = _mm_min_ps(x, _mm_set1_ps(MAX_INPUT));
+    if (curve == ToneCurve::Aces) {
+        const __m128 numerator = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f)));
+        const __m128 denominator = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x), _mm_set1_ps(0.59f))),
+            _mm_set1_ps(0.14f));
+        x = _mm_div_ps(numerator, denominator);
+    }
+    return _mm_min_ps(x, _mm_set1_ps(1.0f));
+}
+
+inline __m128i lut_index_sse2(__m128 v) {
+    return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(LUT_SCALE)), _mm_set1_ps(0.5f)));
+}
+#endif
+
+} // namespace
+
+void resolve_pixels(const ToneMapSettings& settings, const float* rgb, uint32_t* pixels, size_t count) {
+    const EncodeTables& tables = encode_tables();
+    const uint8_t* table = settings.srgb ? tables.srgb : tables.linear;
+    const float scale = std::exp2(settings.exposure);
+    const ToneCurve curve = settings.curve;
+    size_t i = 0;
+#ifdef RMRT_X86_64
+    // Scalar up to the first 16-byte aligned pixel, then four pixels per streaming store.
+    for (; i < count && (reinterpret_cast<uintptr_t>(pixels + i) & 15) != 0; ++i) {
+        pixels[i] = resolve_scalar(table, rgb + i * 3, scale, curve);
+    }
+    if (i + 4 <= count) {
+        const __m128 scale4 = _mm_set1_ps(scale);
+        alignas(16) int32_t index[12];
+        for (; i + 4 <= count; i += 4) {
+            const float* src = rgb + i * 3;
+            _mm_store_si128(reinterpret_cast<__m128i*>(index + 0), lut_index_sse2(tone_sse2(_mm_loadu_ps(src + 0), scale4, curve)));
+            _mm_store_si128(reinterpret_cast<__m128i*>(index + 4), lut_index_sse2(tone_sse2(_mm_loadu_ps(src + 4), scale4, curve)));
+            _mm_store_si128(reinterpret_cast<__m128i*>(index + 8), lut_index_sse2(tone_sse2(_mm_loadu_ps(src + 8), scale4, curve)));
+            const __m128i packed = _mm_setr_epi32(static_cast<int>(pack(table, index[0], index[1], index[2])),
+                static_cast<int>(pack(table, index[3], index[4], index[5])), static_cast<int>(pack(table, index[6], index[7], index[8])),
+                static_cast<int>(pack(table, index[9], index[10], index[11])));
+            _mm_stream_si128(reinterpret_cast<__m128i*>(pixels + i), packed);
+        }
+        // Streaming stores are weakly ordered; fence them before whoever waits for this resolve
+        // (tile completion, the end of a post-process step) reads the pixels.
+        _mm_sfence();
+    }
+#endif
+    for (; i < count; ++i) {
+        pixels[i] = resolve_scalar(table, rgb + i * 3, scale, curve);
+    }
+}
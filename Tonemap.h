@@ -0,0 +1,24 @@
+#pragma once
+// Resolve: turns the linear float image the render stage writes (FrameBuffer::hdr) into the 8-bit
+// pixels that are displayed and saved. Per channel: scale by the exposure, map through the tone
+// curve into [0, 1], and encode with the sRGB transfer curve through a lookup table. The renderer
+// resolves each tile as soon as it is rendered, or the post-processed image rows at the end of the
+// temporal and denoise passes; either way the render stage itself never touches the pixels.
+#include <cstddef>
+#include <cstdint>
+
+enum class ToneCurve {
+    Clamp, // Clips at 1, as the renderer always did
+    Aces   // Filmic: Narkowicz's fit of the ACES RRT + ODT, rolls highlights off instead of clipping
+};
+
+struct ToneMapSettings {
+    ToneCurve curve = ToneCurve::Aces;
+    float exposure = 0.0f; // Stops; the image is scaled by 2^exposure before the curve
+    bool srgb = true;      // sRGB transfer curve; off stores the curve's output as is (linear 8-bit)
+};
+
+// Resolves `count` pixels: rgb (interleaved linear floats) to pixels (0xAARRGGBB). Full 16-byte
+// groups of the output are written with streaming stores, which bypass the cache: the pixels are
+// not read again until the frame is presented.
+void resolve_pixels(const ToneMapSettings& settings, const float* rgb, uint32_t* pixels, size_t count);
@@ -1,33 +1,42 @@
 #pragma once
+#include <cmath>
 
-struct Vec3 {
-    double x, y, z;
+// 3-component vector over a scalar type. The scene description and shading work in double
+// (Vec3); the single-precision render path traces with Vec3f.
+template <typename T>
+struct Vec3T {
+    T x, y, z;
 
-    Vec3(double x_ = 0.0, double y_ = 0.0, double z_ = 0.0) : x(x_), y(y_), z(z_) {}
+    Vec3T(T x_ = T(0), T y_ = T(0), T z_ = T(0)) : x(x_), y(y_), z(z_) {}
+    template <typename U>
+    explicit Vec3T(const Vec3T<U>& other) : x(static_cast<T>(other.x)), y(static_cast<T>(other.y)), z(static_cast<T>(other.z)) {}
 
-    Vec3 operator+(const Vec3& other) const { return Vec3(x + other.x, y + other.y, z + other.z); }
-    Vec3 operator-(const Vec3& other) const { return Vec3(x - other.x, y - other.y, z - other.z); }
-    Vec3 operator*(double scalar) const { return Vec3(x * scalar, y * scalar, z * scalar); }
-    Vec3 operator/(double scalar) const { return Vec3(x / scalar, y / scalar, z / scalar); }
+    Vec3T operator+(const Vec3T& other) const { return Vec3T(x + other.x, y + other.y, z + other.z); }
+    Vec3T operator-(const Vec3T& other) const { return Vec3T(x - other.x, y - other.y, z - other.z); }
+    Vec3T operator*(T scalar) const { return Vec3T(x * scalar, y * scalar, z * scalar); }
+    Vec3T operator/(T scalar) const { return Vec3T(x / scalar, y / scalar, z / scalar); }
 
-    double length_squared() const { return x * x + y * y + z * z; }
-    double length() const { return std::sqrt(length_squared()); }
+    T length_squared() const { return x * x + y * y + z * z; }
+    T length() const { return std::sqrt(length_squared()); }
 
-    Vec3 normalize() const {
-        double l = length();
-        if (l > 1e-8) { // Avoid division by zero
-            return Vec3(x / l, y / l, z / l);
+    Vec3T normalize() const {
+        T l = length();
+        if (l > T(1e-8)) { // Avoid division by zero
+            return Vec3T(x / l, y / l, z / l);
         }
-        return Vec3(0, 0, 0); // Or handle error
+        return Vec3T(0, 0, 0); // Or handle error
     }
 
-    static double dot(const Vec3& a, const Vec3& b) {
+    static T dot(const Vec3T& a, const Vec3T& b) {
         return a.x * b.x + a.y * b.y + a.z * b.z;
     }
 
-    static Vec3 cross(const Vec3& a, const Vec3& b) {
-        return Vec3(a.y * b.z - a.z * b.y,
+    static Vec3T cross(const Vec3T& a, const Vec3T& b) {
+        return Vec3T(a.y * b.z - a.z * b.y,
             a.z * b.x - a.x * b.z,
             a.x * b.y - a.y * b.x);
     }
-};
\ No newline at end of file
+};
+
+using Vec3 = Vec3T<double>;
+using Vec3f = Vec3T<float>;
@@ -0,0 +1,252 @@
+// Wavefront integrator: the samples of a tile advance one bounce at a time instead of one
+// sample at a time. Each wave is intersected in bulk, its hits are binned by how they shade
+// (miss / no reflection / mirror / glossy) with a counting sort, each bin is shaded in one tight
+// loop, and the reflection rays it spawns form the next wave.
+//
+// Shading is the same as shade_hit's bounce loop: a path carries the product of the reflectivities
+// along its chain (throughput), every surface adds emission + base color weighted by that
+// throughput, and a miss adds the background. A continuation is not spawned when its depth would
+// reach max_ray_depth or the path loses at Russian roulette (survives_roulette, as in shade_hit).
+// Glossy hits also sample a light (sample_direct_light) right after spawning their continuation;
+// its shadow ray is traced there, inside the glossy bin's pass.
+#include "Renderer.h"
+#include <algorithm>
+#include <limits>
+#include "Sphere.h"
+
+namespace {
+
+// Paths per batch. A tile's pixel samples are processed in batches of at most this many, which
+// bounds the queues for high sample counts while keeping waves long enough to amortize the passes.
+constexpr size_t WAVEFRONT_BATCH_PATHS = 4096;
+
+template <typename T>
+struct WavePath {
+    RayT<T> ray;
+    Vec3 throughput;
+    ReflectionLobe lobe; // Of the glossy bounce that spawned the ray when it sampled the lights (MIS weight of what it finds)
+    uint32_t sample; // Index into the batch's per-sample radiance
+    PixelSampler sampler; // Continues where the path's previous bounce left off
+};
+
+template <typename T>
+struct WaveQueues {
+    std::vector<WavePath<T>> current;
+    std::vector<WavePath<T>> next;
+    std::vector<SceneHit> hits;
+    std::vector<uint8_t> bin_of;            // WavefrontStats::Bin per ray of the current wave
+    std::vector<uint32_t> sorted;           // Ray indices of the current wave grouped by bin
+    std::vector<Vec3> radiance;             // Per sample of the batch
+    std::vector<uint32_t> pixels;           // Unconverged pixels of the tile
+    std::vector<GuideSums> guides;          // Per pixel of the batch, when the target has denoiser guides
+};
+
+template <typename T>
+WaveQueues<T>& wave_queues() {
+    thread_local WaveQueues<T> queues; // Reused across tiles and frames by each render worker
+    return queues;
+}
+
+inline int depth_bucket(int depth) {
+    return std::min(depth, WavefrontStats::DEPTH_BUCKETS - 1);
+}
+
+// Emission (times its MIS weight) plus the non-reflected share of the base color, as in shade_hit.
+inline Vec3 surface_color(const Material& material, double emission_weight) {
+    Vec3 color = material.emission_color;
+    if (emission_weight != 1.0) color = color * emission_weight;
+    double base_color_contribution_factor = 1.0 - material.reflectivity;
+    if (base_color_contribution_factor > 1e-5) {
+        color = color + material.base_color * base_color_contribution_factor;
+    }
+    return color;
+}
+
+// Same reflection as shade_hit: mirror direction, perturbed by the material roughness for glossy
+// hits, whose lobe goes to `lobe`.
+template <typename T>
+RayT<T> reflect_path(TraceContext& ctx, const RayT<T>& ray, const SceneHit& hit, bool glossy, PixelSampler& sampler,
+    ReflectionLobe& lobe) {
+    const Sphere& sphere = ctx.scene.objects[hit.sphere_index];
+    const T radius = static_cast<T>(sphere.radius);
+    Vec3T<T> hit_point = ray.origin + ray.direction * static_cast<T>(hit.t);
+    Vec3T<T> surface_normal = (hit_point - Vec3T<T>(sphere.center)).normalize();
+    Vec3T<T> reflection_dir = ray.direction - surface_normal * (T(2) * Vec3T<T>::dot(ray.direction, surface_normal));
+    reflection_dir = reflection_dir.normalize();
+    if (glossy) {
+        const T roughness = static_cast<T>(ctx.scene.material_of(hit.sphere_index).roughness);
+        Vec3T<T> tangent, bitangent;
+        create_onb(surface_normal, tangent, bitangent);
+        double u1, u2;
+        sampler.next_2d(u1, u2);
+        Vec3T<T> sample_local_hemisphere = random_cosine_direction<T>(u1, u2);
+        Vec3T<T> random_world_dir = (tangent * sample_local_hemisphere.x +
+            bitangent * sample_local_hemisphere.y +
+            surface_normal * sample_local_hemisphere.z).normalize();
+        lobe = ReflectionLobe{ Vec3(surface_normal), Vec3(reflection_dir), ctx.scene.material_of(hit.sphere_index).roughness };
+        reflection_dir = (reflection_dir * (T(1) - roughness) + random_world_dir * roughness).normalize();
+    }
+    return RayT<T>(hit_point + surface_normal * self_intersection_offset(hit_point, radius), reflection_dir);
+}
+
+// Runs the paths in queues.current to completion, adding their light to queues.radiance. With
+// `guide_samples` (the samples per pixel) the first wave's hits also go into queues.guides.
+template <typename T>
+void run_waves(TraceContext& ctx, WaveQueues<T>& queues, size_t batch_paths, int guide_samples) {
+    const Scene& scene = ctx.scene;
+    if constexpr (PROFILING_ENABLED) {
+        if (scene.max_ray_depth <= 0) ctx.paths.depth_limited += queues.current.size();
+    }
+    for (int depth = 0; !queues.current.empty() && depth < scene.max_ray_depth; ++depth) {
+        const size_t ray_count = queues.current.size();
+        ctx.rays_traced += ray_count;
+        ctx.wavefront.waves++;
+        ctx.wavefront.rays[depth_bucket(depth)] += ray_count;
+        ctx.wavefront.slots[depth_bucket(depth)] += batch_paths;
+        if constexpr (PROFILING_ENABLED) ctx.paths.rays[PathStats::bucket(depth)] += ray_count;
+
+        // Intersect the whole wave.
+        queues.hits.resize(ray_count);
+        queues.bin_of.resize(ray_count);
+        uint32_t bin_counts[WavefrontStats::BIN_COUNT] = {};
+        const bool can_continue = depth + 1 < scene.max_ray_depth;
+        for (size_t i = 0; i < ray_count; ++i) {
+            uint8_t bin = WavefrontStats::Miss;
+            const bool hit = intersect_scene(ctx, queues.current[i].ray, T(0), queues.hits[i]);
+            if (depth == 0 && guide_samples > 0) {
+                GuideSums& guides = queues.guides[queues.current[i].sample / guide_samples];
+                if (hit) guides.add_hit(scene, queues.current[i].ray, queues.hits[i]);
+                else guides.add_miss(scene);
+            }
+            if (hit) {
+                const Material& material = scene.material_of(queues.hits[i].sphere_index);
+                if (!can_continue || material.reflectivity <= 1e-5) {
+                    bin = WavefrontStats::Terminal;
+                    if constexpr (PROFILING_ENABLED) {
+                        if (material.reflectivity <= 1e-5) ctx.paths.absorbed++;
+                        else ctx.paths.depth_limited++;
+                    }
+                }
+                else if (material.roughness < 1e-5) bin = WavefrontStats::Mirror;
+                else bin = WavefrontStats::Glossy;
+            }
+            queues.bin_of[i] = bin;
+            bin_counts[bin]++;
+        }
+
+        // Counting sort by bin, stable within a bin so neighbouring pixels stay together.
+        uint32_t bin_start[WavefrontStats::BIN_COUNT + 1] = {};
+        for (int b = 0; b < WavefrontStats::BIN_COUNT; ++b) {
+            bin_start[b + 1] = bin_start[b] + bin_counts[b];
+            ctx.wavefront.binned[b] += bin_counts[b];
+        }
+        if constexpr (PROFILING_ENABLED) ctx.paths.escaped += bin_counts[WavefrontStats::Miss];
+        uint32_t fill[WavefrontStats::BIN_COUNT];
+        std::copy(bin_start, bin_start + WavefrontStats::BIN_COUNT, fill);
+        queues.sorted.resize(ray_count);
+        for (size_t i = 0; i < ray_count; ++i) {
+            queues.sorted[fill[queues.bin_of[i]]++] = static_cast<uint32_t>(i);
+        }
+
+        // Shade bin by bin.
+        queues.next.clear();
+        for (uint32_t k = bin_start[WavefrontStats::Miss]; k < bin_start[WavefrontStats::Miss + 1]; ++k) {
+            const WavePath<T>& path = queues.current[queues.sorted[k]];
+            Vec3& radiance = queues.radiance[path.sample];
+            radiance = radiance + Vec3(path.throughput.x * scene.background_color.x,
+                path.throughput.y * scene.background_color.y, path.throughput.z * scene.background_color.z);
+        }
+        for (uint32_t k = bin_start[WavefrontStats::Terminal]; k < bin_start[WavefrontStats::BIN_COUNT]; ++k) {
+            const uint32_t i = queues.sorted[k];
+            WavePath<T>& path = queues.current[i];
+            const Material& material = scene.material_of(queues.hits[i].sphere_index);
+            const double weight = path.lobe.roughness > 0.0 ?
+                emission_weight(ctx, Vec3(path.ray.origin), path.lobe, Vec3(path.ray.direction), queues.hits[i].sphere_index) : 1.0;
+            const Vec3 color = surface_color(material, weight);
+            Vec3& radiance = queues.radiance[path.sample];
+            radiance = radiance + Vec3(path.throughput.x * color.x, path.throughput.y * color.y, path.throughput.z * color.z);
+            if (k < bin_start[WavefrontStats::Mirror]) continue; // Terminal: nothing reflected
+            Vec3 throughput = path.throughput * material.reflectivity;
+            if (!survives_roulette(ctx.roulette, depth + 1, throughput, path.sampler)) {
+                if constexpr (PROFILING_ENABLED) ctx.paths.roulette++;
+                continue;
+            }
+            const bool glossy = k >= bin_start[WavefrontStats::Glossy];
+            ReflectionLobe lobe;
+            RayT<T> reflected = reflect_path(ctx, path.ray, queues.hits[i], glossy, path.sampler, lobe);
+            if (glossy && ctx.next_event) {
+                radiance = radiance + sample_direct_light(ctx, reflected.origin, lobe, throughput, path.sampler);
+            }
+            else lobe.roughness = 0.0;
+            queues.next.push_back(WavePath<T>{ reflected, throughput, lobe, path.sample, path.sampler });
+        }
+        std::swap(queues.current, queues.next);
+    }
+    queues.current.clear();
+}
+
+} // namespace
+
+template <typename T>
+void render_chunk_wavefront(const FrameInfo& frame_info, const Camera& camera, FrameBuffer& target,
+    const RenderTile& tile, TraceContext& ctx) {
+    const int width = target.width;
+    const int height = target.height;
+    const int samples = frame_info.settings.frame_samples(ctx.scene);
+    const bool jitter = samples > 1 || frame_info.settings.accumulate;
+    const RenderSettings& settings = frame_info.settings;
+    const bool want_guides = target.has_guides();
+    WaveQueues<T>& queues = wave_queues<T>();
+
+    queues.pixels.clear();
+    for (int y = tile.startY; y < tile.endY; ++y) {
+        for (int x = tile.startX; x < tile.endX; ++x) {
+            const size_t pixel_index = static_cast<size_t>(y) * width + x;
+            if (!skip_pixel(frame_info, target, pixel_index)) queues.pixels.push_back(static_cast<uint32_t>(pixel_index));
+        }
+    }
+    ctx.pixels_sampled += queues.pixels.size();
+
+    const size_t pixels_per_batch = std::max<size_t>(1, WAVEFRONT_BATCH_PATHS / samples);
+    for (size_t batch_begin = 0; batch_begin < queues.pixels.size(); batch_begin += pixels_per_batch) {
+        const size_t batch_end = std::min(queues.pixels.size(), batch_begin + pixels_per_batch);
+        const size_t batch_paths = (batch_end - batch_begin) * samples;
+
+        // Primary wave: every sample of every pixel in the batch, jittered as in render_chunk.
+        queues.radiance.assign(batch_paths, Vec3(0.0, 0.0, 0.0));
+        if (want_guides) queues.guides.assign(batch_end - batch_begin, GuideSums());
+        queues.current.clear();
+        for (size_t p = batch_begin; p < batch_end; ++p) {
+            const int x = static_cast<int>(queues.pixels[p] % width);
+            const int y = static_cast<int>(queues.pixels[p] / width);
+            const uint32_t first_index = first_sample_index(frame_info, target, queues.pixels[p]);
+            for (int s = 0; s < samples; ++s) {
+                PixelSampler sampler(settings.sampler, settings.seed, queues.pixels[p], first_index + s);
+                double dx, dy;
+                sampler.next_2d(dx, dy);
+                if (!jitter) dx = dy = 0.5;
+                Ray primary_ray = camera.get_ray((static_cast<double>(x) + dx) / width, (static_cast<double>(y) + dy) / height);
+                queues.current.push_back(WavePath<T>{ RayT<T>(primary_ray), Vec3(1.0, 1.0, 1.0), ReflectionLobe(),
+                    static_cast<uint32_t>((p - batch_begin) * samples + s), sampler });
+            }
+        }
+
+        run_waves(ctx, queues, batch_paths, want_guides ? samples : 0);
+
+        for (size_t p = batch_begin; p < batch_end; ++p) {
+            Vec3 sum(0.0, 0.0, 0.0);
+            double lum_sq_sum = 0.0;
+            for (int s = 0; s < samples; ++s) {
+                const Vec3& color = queues.radiance[(p - batch_begin) * samples + s];
+                double luminance = sample_luminance(color);
+                sum = sum + color;
+                lum_sq_sum += luminance * luminance;
+            }
+            store_pixel(target, frame_info, queues.pixels[p], sum, lum_sq_sum, samples);
+            if (want_guides) store_guides(target, queues.pixels[p], queues.guides[p - batch_begin], samples);
+        }
+    }
+}
+
+template void render_chunk_wavefront<double>(const FrameInfo&, const Camera&, FrameBuffer&, const RenderTile&, TraceContext&);
+template void render_chunk_wavefront<float>(const FrameInfo&, const Camera&, FrameBuffer&, const RenderTile&, TraceContext&);
@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Lock-free Chase-Lev work-stealing deque (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013) with a
+// fixed power-of-two capacity. The owning thread pushes and pops at the bottom; any other thread
+// may steal from the top. The render pool fills every deque before a frame starts and never grows
+// them while workers run, so there is no buffer reallocation to worry about.
+class WorkStealingDeque {
+public:
+    enum class StealResult {
+        Success,
+        Empty,
+        Lost // Another thread won the race for the same item; the deque may still hold work
+    };
+
+    void reset(uint32_t min_capacity) {
+        uint32_t capacity = 1;
+        while (capacity < min_capacity) capacity <<= 1;
+        if (capacity != buffer_size) {
+            buffer = std::make_unique<std::atomic<uint32_t>[]>(capacity);
+            buffer_size = capacity;
+        }
+        mask = capacity - 1;
+        top.store(0, std::memory_order_relaxed);
+        bottom.store(0, std::memory_order_relaxed);
+    }
+
+    // Owner only (or any thread while no one else is touching the deque, e.g. between frames).
+    void push(uint32_t item) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        buffer[b & mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only. Returns false when the deque is empty.
+    bool pop(uint32_t& item) {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = buffer[b & mask].load(std::memory_order_relaxed);
+        if (t == b) {
+            // Last item: race any thief for it through top.
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread.
+    StealResult steal(uint32_t& item) {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return StealResult::Empty;
+        }
+        item = buffer[t & mask].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return StealResult::Lost;
+        }
+        return StealResult::Success;
+    }
+
+private:
+    // Owner and thieves hammer different ends; keep the indices on separate cache lines.
+    alignas(64) std::atomic<int64_t> top{ 0 };
+    alignas(64) std::atomic<int64_t> bottom{ 0 };
+    alignas(64) std::unique_ptr<std::atomic<uint32_t>[]> buffer;
+    uint32_t buffer_size = 0;
+    uint32_t mask = 0;
+};
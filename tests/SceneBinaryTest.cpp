@@ -0,0 +1,61 @@
+// Rewrites a .rmsc file while scenes loaded from it are still in use: a scene reading the file in
+// place must keep seeing its old tables, and SceneManager must not depend on the file at all.
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include "SceneBinary.h"
+#include "SceneManager.h"
+
+static int failures = 0;
+
+static void check(bool condition, const char* what) {
+    if (condition) return;
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+}
+
+static Scene make_scene(int spheres, double offset) {
+    Scene scene;
+    const MaterialIndex grey = scene.add_material("grey", Material(Vec3(0.5, 0.5, 0.5), 0.25, 0.5));
+    for (int i = 0; i < spheres; ++i) scene.add_sphere(Sphere(Vec3(i + offset, 0.0, -2.0 * i), 0.5 + 0.001 * i), grey);
+    return scene;
+}
+
+static bool same_spheres(const Scene& scene, const std::vector<Sphere>& expected) {
+    if (scene.objects.size() != expected.size()) return false;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        const Sphere& sphere = scene.objects[i];
+        if (sphere.center.x != expected[i].center.x || sphere.center.z != expected[i].center.z || sphere.radius != expected[i].radius) return false;
+    }
+    return true;
+}
+
+int main() {
+    const std::string path = (std::filesystem::temp_directory_path() / "rm-scene-binary-test.rmsc").string();
+    const Scene large = make_scene(100000, 0.0);
+    const std::vector<Sphere> large_spheres(large.objects.begin(), large.objects.end());
+    check(write_binary_scene(path, large), "writing the first scene");
+
+    // Replaced through write_binary_scene while a scene maps the file: the old tables stay.
+    Scene mapped;
+    check(read_binary_scene(path, mapped), "reading the first scene");
+    check(mapped.objects.is_view(), "a version 3 scene is read in place");
+    check(write_binary_scene(path, make_scene(10, 7.0)), "replacing the scene file");
+    check(same_spheres(mapped, large_spheres), "a mapped scene keeps its tables after the file is replaced");
+    Scene replaced;
+    check(read_binary_scene(path, replaced) && replaced.objects.size() == 10, "the replacement is what a new load sees");
+
+    // Truncated and rewritten in place, as an editor or another tool might: the managed scene is a copy.
+    check(write_binary_scene(path, large), "writing the first scene again");
+    {
+        SceneManager manager(path, false);
+        check(!manager.scene().objects.is_view(), "SceneManager copies the tables");
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << "truncated";
+        check(same_spheres(manager.scene(), large_spheres), "SceneManager's scene survives the file being truncated");
+    }
+
+    std::filesystem::remove(path);
+    if (failures == 0) std::printf("SceneBinaryTest: all checks passed\n");
+    return failures == 0 ? 0 : 1;
+}